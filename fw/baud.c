@@ -0,0 +1,131 @@
+#include <xc.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "can.h"
+
+#include "baud.h"
+
+#define FOSC 12000000ul // MCP2515 clock
+#define POLL_CYCLES 1200u // PIC instruction cycles between polls: 100us
+#define POLLS_PER_MS 10u
+
+// Most common rates first
+static const BaudTiming presets[BAUD_NPRESETS] = {
+	{{CAN_TIMING_500K}},
+	{{CAN_TIMING_250K}},
+	{{CAN_TIMING_125K}},
+	{{CAN_TIMING_100K}},
+	{{CAN_TIMING_50K}},
+	{{CAN_TIMING_20K}},
+	{{CAN_TIMING_10K}},
+};
+
+// Polls since baudDetect started
+static U16 polls;
+
+static bool
+eq(const BaudTiming *a, const BaudTiming *b) {
+	return a->cnf[0u] == b->cnf[0u] && a->cnf[1u] == b->cnf[1u] && a->cnf[2u] == b->cnf[2u];
+}
+
+// Listen at a timing until it proves right or wrong, or time runs out.
+// Returns OK if BAUD_FRAMES frames were received without error.
+static Status
+listen(const BaudTiming *timing) {
+	U16 n;
+	U8 flags, frames;
+
+	canSetMode(CAN_MODE_CONFIG);
+	canSetBitTiming(timing->cnf[0u], timing->cnf[1u], timing->cnf[2u]);
+	canSetMode(CAN_MODE_LISTEN_ONLY);
+	canClearIntFlags(0xFF);
+
+	frames = 0u;
+	for (n = 0u; n < BAUD_WINDOW_MS*POLLS_PER_MS; n++) {
+		_delay(POLL_CYCLES);
+		polls++;
+		flags = canIntFlags();
+		if (flags & CAN_INTF_MERR) {
+			return FAIL; // wrong rate
+		}
+		flags &= CAN_INTF_RX0 | CAN_INTF_RX1;
+		if (flags) {
+			frames += (flags == (CAN_INTF_RX0 | CAN_INTF_RX1)) ? 2u : 1u;
+			if (frames >= BAUD_FRAMES) {
+				return OK;
+			}
+			canClearIntFlags(flags); // discard the frames
+		}
+	}
+	return FAIL; // silent
+}
+
+// Listen at a timing and record the outcome.
+static void
+attempt(const BaudTiming *timing, BaudResult *result) {
+	result->tries++;
+	if (listen(timing) == OK) {
+		result->timing = *timing;
+		result->locked = true;
+	}
+}
+
+void
+baudDetect(const BaudTiming *first, BaudResult *result) {
+	U8 pass, k;
+
+	polls = 0u;
+	result->timing = *first;
+	result->locked = false;
+	result->tries = 0u;
+	for (pass = 0u; pass < BAUD_PASSES && !result->locked; pass++) {
+		attempt(first, result);
+		for (k = 0u; k < BAUD_NPRESETS && !result->locked; k++) {
+			if (!eq(&presets[k], first)) {
+				attempt(&presets[k], result);
+			}
+		}
+	}
+	result->waitMs = polls / POLLS_PER_MS; // the SPI traffic is not counted
+
+	canSetMode(CAN_MODE_CONFIG);
+	canSetBitTiming(result->timing.cnf[0u], result->timing.cnf[1u], result->timing.cnf[2u]);
+	canClearIntFlags(0xFF);
+}
+
+// Length of a bit in time quanta
+static U8
+bitTq(const BaudTiming *timing) {
+	U8 prseg, phseg1, phseg2;
+
+	prseg = (timing->cnf[1u] & 0x07) + 1u;
+	phseg1 = ((timing->cnf[1u] >> 3u) & 0x07) + 1u;
+	phseg2 = (timing->cnf[2u] & 0x07) + 1u;
+	return 1u + prseg + phseg1 + phseg2; // sync segment is 1 TQ
+}
+
+bool
+baudValid(const BaudTiming *timing) {
+	U8 sjw, prseg, phseg1, phseg2;
+
+	sjw = (timing->cnf[0u] >> 6u) + 1u;
+	prseg = (timing->cnf[1u] & 0x07) + 1u;
+	phseg1 = ((timing->cnf[1u] >> 3u) & 0x07) + 1u;
+	phseg2 = (timing->cnf[2u] & 0x07) + 1u;
+
+	return (timing->cnf[1u] & 0x80) // BTLMODE: PHSEG2 set by CNF3
+		&& (timing->cnf[2u] & 0x38) == 0u // unimplemented bits
+		&& phseg2 >= 2u && phseg2 >= sjw
+		&& prseg + phseg1 >= phseg2;
+}
+
+U16
+baudKbps(const BaudTiming *timing) {
+	U32 div;
+
+	div = 2ul * ((timing->cnf[0u] & 0x3F) + 1u) * bitTq(timing) * 1000ul;
+	return (U16)((FOSC + div/2u) / div);
+}
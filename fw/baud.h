@@ -0,0 +1,59 @@
+/* Bit-rate detection.
+ *
+ * The bus's bit rate isn't known at power-up. baudDetect listens to the
+ * bus in Listen-only mode, so that it never disturbs it, at one timing
+ * after another: first the one given, typically the last one found,
+ * then the CAN_TIMING_x presets from the fastest. A timing is dropped
+ * as soon as the MCP2515 sees a message error, and locked onto once it
+ * has received BAUD_FRAMES frames without one.
+ *
+ * Each timing is given at most BAUD_WINDOW_MS, and the timings are
+ * tried at most BAUD_PASSES times, so the search gives up on a silent
+ * bus after about BAUD_MAX_MS.
+ *
+ * The receive masks must be clear, as after canInit(), so that every
+ * frame is received.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "can.h"
+ * #include "baud.h"
+ */
+
+enum {
+	BAUD_NPRESETS = 7, // CAN_TIMING_10K..CAN_TIMING_500K
+	BAUD_FRAMES = 2, // error-free frames needed to lock
+	BAUD_WINDOW_MS = 100, // time given to each timing
+	BAUD_PASSES = 2,
+	BAUD_MAX_MS = BAUD_PASSES*(BAUD_NPRESETS+1)*BAUD_WINDOW_MS,
+};
+
+// Bit timing
+typedef struct {
+	U8 cnf[3u]; // CNF1, CNF2, CNF3
+} BaudTiming;
+
+typedef struct {
+	BaudTiming timing; // the one locked onto, else the first one
+	bool locked; // frames were received at this timing
+	U8 tries; // timings listened to
+	U16 waitMs; // time waited between polls: less than the time taken
+} BaudResult;
+
+// Find the bit timing of the frames on the bus, trying the given valid
+// timing first, and falling back to it if none is found.
+// Leaves the MCP2515 in Config mode with the result's timing set.
+void baudDetect(const BaudTiming *first, BaudResult *result);
+
+// Check that a timing can be programmed into the MCP2515.
+// An erased timing (all 0xFF) is invalid.
+bool baudValid(const BaudTiming *timing);
+
+// Bit rate of a valid timing in kbps, rounded.
+U16 baudKbps(const BaudTiming *timing);
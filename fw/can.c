@@ -8,13 +8,19 @@
 #include "spi.h"
 
 #include "can.h"
+#include "txq.h"
 
 // Oscillator startup timeout
 #define STARTUP_TIME 128u
 
+// Time given to pending frames to be sent before the bit timing is
+// changed: 200 polls of 100us, enough for a frame at 10kbps.
+#define RETIME_POLLS 200u
+#define RETIME_POLL_CYCLES 1200u
+
 enum {
-	TX_RETRIES = 32u,
-	RETRY_DELAY = 1024ul,
+	NTXB = 3u, // transmit buffers
+	TXB_STRIDE = 0x10, // distance between transmit buffers' registers
 };
 
 // Register addresses
@@ -27,6 +33,7 @@ typedef enum {
 	REG_RXB1CTRL = 0x70, // receive buffer 1 control
 	REG_CANINTE = 0x2B, // CAN interrupt enable
 	REG_CANINTF = 0x2C, // CAN interrupt flags
+	REG_EFLG = 0x2D, // error flags
 
 	// Bit timing
 	REG_CNF1 = 0x2A,
@@ -109,9 +116,30 @@ typedef enum {
 
 // Masks
 enum {
+	// CANCTRL
+	ABAT = 0x10, // abort all pending transmissions
+
 	// TXBnCTRL
 	TXREQ = 0x08,
-	TXERR = 0x10,
+
+	// CANINTE, CANINTF
+	RX0I = 0x01,
+	RX1I = 0x02,
+	TX0I = 0x04,
+	TX1I = 0x08,
+	TX2I = 0x10,
+	ERRI = 0x20,
+
+	// EFLG
+	RX0OVR = 0x40,
+	RX1OVR = 0x80,
+
+	// RXB0CTRL
+	BUKT = 0x04, // rollover to RXB1
+
+	// READ STATUS instruction: TXnREQ at bit 2n+2, TXnIF at bit 2n+3
+	STATUS_TXREQ = 0x04,
+	STATUS_TXIF = 0x08,
 
 	// SIDL registers
 	SRR = 0x10, // standard frame remote transmit request bit
@@ -140,6 +168,17 @@ typedef enum {
 	RXB1 = 1,
 } RxBuf;
 
+// Frames waiting for a transmit buffer
+static TxQ txq;
+
+// Transmit buffers holding a frame not yet seen sent: bit n is TXBn
+static U8 txPending;
+static U8 txPrio[NTXB]; // priority of each pending frame
+static U8 txbTxp[NTXB]; // TXP bits of each buffer
+
+static U8 intEnabled; // CANINTE
+static CanRxStats rxStats;
+
 // Send RESET instruction.
 static void
 reset(void) {
@@ -161,6 +200,18 @@ read(Reg addr) {
 	return data;
 }
 
+// Read consecutive registers in one transaction.
+static void
+readRegs(Reg addr, U8 *data, U8 n) {
+	CAN_CS = 0;
+	(void)spiTx(CMD_READ);
+	(void)spiTx((U8)addr);
+	while (n--) {
+		*data++ = spiTx(0x00);
+	}
+	CAN_CS = 1;
+}
+
 // Write to a register.
 static void
 write(Reg addr, U8 data) {
@@ -171,6 +222,18 @@ write(Reg addr, U8 data) {
 	CAN_CS = 1;
 }
 
+// Write consecutive registers in one transaction.
+static void
+writeRegs(Reg addr, const U8 *data, U8 n) {
+	CAN_CS = 0;
+	(void)spiTx(CMD_WRITE);
+	(void)spiTx((U8)addr);
+	while (n--) {
+		(void)spiTx(*data++);
+	}
+	CAN_CS = 1;
+}
+
 U8
 canRxStatus(void) {
 	U8 status;
@@ -195,6 +258,8 @@ bitModify(Reg addr, U8 mask, U8 data) {
 
 void
 canInit(void) {
+	U8 k;
+
 	// Configure chip-select pin
 	CAN_CS_TRIS = OUT;
 	CAN_CS = 1;
@@ -208,8 +273,16 @@ canInit(void) {
 	canSetMode(CAN_MODE_CONFIG);
 	bitModify(REG_CANCTRL, 0x1F, 0x00); // disable one-shot mode and CLKOUT pin
 	write(REG_BFPCTRL, 0x00); // disable RXnBF interrupt pins
-	write(REG_RXB0CTRL, 0x00); // use filters, disable rollover
+	write(REG_RXB0CTRL, BUKT); // use filters, roll over to RXB1 when full
 	write(REG_RXB1CTRL, 0x00); // use filters
+
+	txqInit(&txq);
+	txPending = 0u;
+	intEnabled = 0u;
+	rxStats = (CanRxStats){0};
+	for (k = 0u; k < NTXB; k++) {
+		txbTxp[k] = 0u; // after reset
+	}
 }
 
 void
@@ -226,18 +299,27 @@ canSetMode(CanMode mode) {
 
 void
 canSetBitTiming(U8 cnf1, U8 cnf2, U8 cnf3) {
-	write(REG_CNF1, cnf1);
-	write(REG_CNF2, cnf2);
-	write(REG_CNF3, cnf3);
+	U8 cnf[3u];
+
+	cnf[0u] = cnf3; // CNF3..CNF1 are at ascending addresses
+	cnf[1u] = cnf2;
+	cnf[2u] = cnf1;
+	writeRegs(REG_CNF3, cnf, sizeof(cnf));
 }
 
 void
 canIE(bool enable) {
 	if (enable) {
-		write(REG_CANINTF, 0x00); // clear interrupt flags
-		write(REG_CANINTE, 0x03); // enable RX-buffer-full interrupts
+		// CANINTE, then CANINTF
+		U8 regs[2u] = {
+			RX0I | RX1I | TX0I | TX1I | TX2I | ERRI, // RX buffer full, TX buffer empty, error
+			0x00, // clear interrupt flags
+		};
+		writeRegs(REG_CANINTE, regs, sizeof(regs));
+		intEnabled = regs[0u];
 	} else {
 		write(REG_CANINTE, 0x00); // disable interrupts
+		intEnabled = 0u;
 	}
 }
 
@@ -296,92 +378,282 @@ canReadRxb1(CanFrame *frame) {
 	readRxbn(1u, frame);
 }
 
-// Write an ID to a set of {xSIDH, xSIDL, xEID8, xEID0} registers,
-// e.g., RXMnSIDH etc.
+// Unpack an ID into the values of a set of
+// {xSIDH, xSIDL, xEID8, xEID0} registers.
 static void
-writeId(const CanId *id, Reg sidh, Reg sidl, Reg eid8, Reg eid0) {
+idRegs(const CanId *id, U8 regs[4u]) {
 	if (id->isExt) { // extended
-		write(eid0, id->eid & 0xFF); // id[7:0]
-		write(eid8, (id->eid >> 8u) & 0xFF); // id[15:8]
-		write(sidl, ((id->eid >> 13u) & 0xE0) | IDE | ((id->eid >> 16u) & 0x03)); // id[20:18], IDE, id[17:16]
-		write(sidh, (id->eid >> 21u) & 0xFF); // id[28:21]
+		regs[0u] = (id->eid >> 21u) & 0xFF; // id[28:21]
+		regs[1u] = ((id->eid >> 13u) & 0xE0) | IDE | ((id->eid >> 16u) & 0x03); // id[20:18], IDE, id[17:16]
+		regs[2u] = (id->eid >> 8u) & 0xFF; // id[15:8]
+		regs[3u] = id->eid & 0xFF; // id[7:0]
 	} else { // standard
-		write(sidh, (id->sid >> 3u) & 0xFF);
-		write(sidl, (id->sid << 5u) & 0xE0);
-		write(eid8, 0u);
-		write(eid0, 0u);
+		regs[0u] = (id->sid >> 3u) & 0xFF;
+		regs[1u] = (id->sid << 5u) & 0xE0;
+		regs[2u] = 0u;
+		regs[3u] = 0u;
 	}
 }
 
-Status
-canTx(const CanFrame *frame) {
-	U8 k, ctrl;
+// Write an ID to a set of {xSIDH, xSIDL, xEID8, xEID0} registers,
+// e.g., RXMnSIDH etc.
+static void
+writeId(const CanId *id, Reg sidh) {
+	U8 regs[4u];
+
+	idRegs(id, regs);
+	writeRegs(sidh, regs, sizeof(regs));
+}
+
+// Read the status bits with the READ STATUS instruction.
+static U8
+readStatus(void) {
+	U8 status;
+
+	CAN_CS = 0;
+	(void)spiTx(CMD_READ_STATUS);
+	status = spiTx(0x00);
+	CAN_CS = 1;
+	return status;
+}
 
-	// Set ID, DLC, and RTR
-	writeId(&frame->id, REG_TXB0SIDH, REG_TXB0SIDL, REG_TXB0EID8, REG_TXB0EID0);
-	write(REG_TXB0DLC, (frame->dlc & 0x0F) | ((frame->rtr) ? RTR : 0));
+// Choose an idle transmit buffer for a frame of the given priority.
+// Of pending buffers with equal priority, the MCP2515 sends the highest
+// numbered first, so the frame must go below those to keep its place.
+// Returns NTXB if there is none.
+static U8
+idleTxb(U8 prio) {
+	U8 n, limit;
 
-	// Copy data to registers
-	for (k = 0u; k < frame->dlc; k++) {
-		write(REG_TXB0DM+k, frame->data[k]);
+	for (limit = 0u; limit < NTXB; limit++) {
+		if ((txPending & (1u << limit)) && txPrio[limit] == prio) {
+			break;
+		}
+	}
+	for (n = limit; n-- > 0u;) {
+		if (!(txPending & (1u << n))) {
+			return n;
+		}
+	}
+	return NTXB;
+}
+
+// Load a frame into transmit buffer n and request its transmission.
+static void
+loadTxb(U8 n, const TxqEntry *e) {
+	U8 id[4u], k;
+
+	// Priority, if the buffer's TXP bits differ
+	if (txbTxp[n] != e->prio) {
+		write(REG_TXB0CTRL + n*TXB_STRIDE, e->prio & 0x03);
+		txbTxp[n] = e->prio;
 	}
 
+	// ID, DLC and RTR, and data, starting at TXBnSIDH
+	idRegs(&e->frame.id, id);
+	CAN_CS = 0;
+	(void)spiTx(CMD_LOAD_TX | (U8)(n << 1u));
+	for (k = 0u; k < sizeof(id); k++) {
+		(void)spiTx(id[k]);
+	}
+	(void)spiTx((e->frame.dlc & 0x0F) | ((e->frame.rtr) ? RTR : 0));
+	for (k = 0u; k < e->frame.dlc; k++) {
+		(void)spiTx(e->frame.data[k]);
+	}
+	CAN_CS = 1;
+
 	// Send
-	bitModify(REG_TXB0CTRL, TXREQ, TXREQ);
-	k = 0u;
-	do {
-		if (k > 0u) {
-			_delay(RETRY_DELAY);
+	CAN_CS = 0;
+	(void)spiTx(CMD_RTS | (U8)(1u << n));
+	CAN_CS = 1;
+
+	txPending |= 1u << n;
+	txPrio[n] = e->prio;
+}
+
+// Load queued frames into idle transmit buffers.
+static void
+refill(void) {
+	const TxqEntry *e;
+	U8 n;
+
+	while ((e = txqFront(&txq)) != 0) {
+		n = idleTxb(e->prio);
+		if (n >= NTXB) {
+			break;
+		}
+		loadTxb(n, e);
+		txqPop(&txq);
+	}
+}
+
+void
+canTxService(void) {
+	U8 status, flags, n;
+
+	if (txPending == 0u && txqFront(&txq) == 0) {
+		return; // no TX interrupt can be pending
+	}
+
+	// Retire sent frames and clear their interrupt flags,
+	// so that the INT pin can fall again.
+	status = readStatus();
+	flags = 0u;
+	for (n = 0u; n < NTXB; n++) {
+		if (!(status & (STATUS_TXREQ << 2u*n))) {
+			txPending &= ~(1u << n);
 		}
-		ctrl = read(REG_TXB0CTRL);
-		if (ctrl & TXERR) {
-			// Error
-			bitModify(REG_TXB0CTRL, TXREQ, 0); // cancel  transmission
-			return FAIL;
+		if (status & (STATUS_TXIF << 2u*n)) {
+			flags |= TX0I << n;
 		}
-	} while ((ctrl & TXREQ) && (++k <= TX_RETRIES)); // transmission in progress
+	}
+	if (flags) {
+		bitModify(REG_CANINTF, flags, 0x00);
+	}
+
+	refill();
+}
+
+Status
+canTx(const CanFrame *frame, CanPrio prio) {
+	Status status;
+
+	// Buffers sent without an interrupt are retired by canTxService()
+	if (txq.len >= TXQ_LEN) {
+		canTxService(); // make room
+	}
+	status = txqPush(&txq, frame, prio);
+	refill(); // load it now if a buffer is idle
+	if (txqFront(&txq) != 0) {
+		canTxService();
+	}
+	return status;
+}
+
+Status
+canConfigBegin(CanMode *mode) {
+	Status status;
+	U8 n;
+
+	*mode = read(REG_CANSTAT) >> 5u;
+
+	// Let frames already queued go out first
+	for (n = 0u; n < RETIME_POLLS && (txPending != 0u || txqFront(&txq) != 0); n++) {
+		_delay(RETIME_POLL_CYCLES);
+		canTxService();
+	}
+	status = OK;
+	if (txPending != 0u || txqFront(&txq) != 0) {
+		// Unacknowledged: abort them, or Config mode is never entered
+		bitModify(REG_CANCTRL, ABAT, ABAT);
+		while (txqFront(&txq) != 0) {
+			txqPop(&txq);
+		}
+		txPending = 0u;
+		status = FAIL;
+	}
 
-	return (k <= TX_RETRIES) ? OK : FAIL;
+	canSetMode(CAN_MODE_CONFIG);
+	return status;
+}
+
+void
+canConfigEnd(CanMode mode) {
+	bitModify(REG_CANCTRL, ABAT, 0x00);
+	canClearIntFlags(TX0I | TX1I | TX2I);
+	canSetMode(mode);
+}
+
+Status
+canRetime(U8 cnf1, U8 cnf2, U8 cnf3) {
+	CanMode mode;
+	Status status;
+
+	status = canConfigBegin(&mode); // frames go out at the old rate
+	canSetBitTiming(cnf1, cnf2, cnf3);
+	canConfigEnd(mode);
+	return status;
+}
+
+U8
+canIntFlags(void) {
+	return read(REG_CANINTF);
+}
+
+void
+canClearIntFlags(U8 flags) {
+	bitModify(REG_CANINTF, flags, 0x00);
+}
+
+bool
+canErrService(void) {
+	U8 regs[2u]; // CANINTF, EFLG
+
+	readRegs(REG_CANINTF, regs, sizeof(regs));
+	if ((regs[1u] & RX0OVR) && rxStats.rx0Overflows < 0xFFFF) { // saturate
+		rxStats.rx0Overflows++;
+	}
+	if ((regs[1u] & RX1OVR) && rxStats.rx1Overflows < 0xFFFF) {
+		rxStats.rx1Overflows++;
+	}
+	if (regs[1u] & (RX0OVR | RX1OVR)) {
+		bitModify(REG_EFLG, RX0OVR | RX1OVR, 0x00);
+	}
+	if (regs[0u] & ERRI) {
+		bitModify(REG_CANINTF, ERRI, 0x00);
+	}
+	return (regs[0u] & intEnabled & ~ERRI) != 0u;
+}
+
+void
+canGetRxStats(CanRxStats *stats) {
+	*stats = rxStats;
+}
+
+void
+canGetTxStats(CanTxStats *stats) {
+	stats->drops = txq.drops;
+	stats->peak = txq.peak;
 }
 
 void
 canSetMask0(const CanId *mask) {
-	writeId(mask, REG_RXM0SIDH, REG_RXM0SIDL, REG_RXM0EID8, REG_RXM0EID0);
+	writeId(mask, REG_RXM0SIDH);
 }
 
 void
 canSetMask1(const CanId *mask) {
-	writeId(mask, REG_RXM1SIDH, REG_RXM1SIDL, REG_RXM1EID8, REG_RXM1EID0);
+	writeId(mask, REG_RXM1SIDH);
 }
 
 void
 canSetFilter0(const CanId *filter) {
-	writeId(filter, REG_RXF0SIDH, REG_RXF0SIDL, REG_RXF0EID8, REG_RXF0EID0);
+	writeId(filter, REG_RXF0SIDH);
 }
 
 void
 canSetFilter1(const CanId *filter) {
-	writeId(filter, REG_RXF1SIDH, REG_RXF1SIDL, REG_RXF1EID8, REG_RXF1EID0);
+	writeId(filter, REG_RXF1SIDH);
 }
 
 void
 canSetFilter2(const CanId *filter) {
-	writeId(filter, REG_RXF2SIDH, REG_RXF2SIDL, REG_RXF2EID8, REG_RXF2EID0);
+	writeId(filter, REG_RXF2SIDH);
 }
 
 void
 canSetFilter3(const CanId *filter) {
-	writeId(filter, REG_RXF3SIDH, REG_RXF3SIDL, REG_RXF3EID8, REG_RXF3EID0);
+	writeId(filter, REG_RXF3SIDH);
 }
 
 void
 canSetFilter4(const CanId *filter) {
-	writeId(filter, REG_RXF4SIDH, REG_RXF4SIDL, REG_RXF4EID8, REG_RXF4EID0);
+	writeId(filter, REG_RXF4SIDH);
 }
 
 void
 canSetFilter5(const CanId *filter) {
-	writeId(filter, REG_RXF5SIDH, REG_RXF5SIDL, REG_RXF5EID8, REG_RXF5EID0);
+	writeId(filter, REG_RXF5SIDH);
 }
 
 bool
@@ -38,6 +38,22 @@ typedef enum {
 	CAN_MODE_CONFIG = 0x4,
 } CanMode;
 
+// Interrupt flags (CANINTF)
+enum {
+	CAN_INTF_RX0 = 0x01, // RXB0 full
+	CAN_INTF_RX1 = 0x02, // RXB1 full
+	CAN_INTF_MERR = 0x80, // error while receiving or sending a frame
+};
+
+// Transmit priorities (TXP bits).
+// Of the frames waiting in the MCP2515, the highest priority is sent first.
+typedef enum {
+	CAN_PRIO_LOW = 0x0,
+	CAN_PRIO_MEDIUM_LOW = 0x1,
+	CAN_PRIO_MEDIUM_HIGH = 0x2,
+	CAN_PRIO_HIGH = 0x3,
+} CanPrio;
+
 // CAN identifier
 typedef struct {
 	bool isExt; // is extended
@@ -55,8 +71,21 @@ typedef struct {
 	U8 data[8];
 } CanFrame;
 
+// Receive statistics
+typedef struct {
+	U16 rx0Overflows; // frames lost because RXB0 was full (RX0OVR)
+	U16 rx1Overflows; // frames lost because RXB1 was full (RX1OVR)
+} CanRxStats;
+
+// Transmit statistics
+typedef struct {
+	U16 drops; // frames dropped because the transmit queue was full
+	U8 peak; // maximum number of frames queued at once
+} CanTxStats;
+
 // Initialize the MCP2515.
 // Initial mode is Config.
+// Frames that find RXB0 full roll over into RXB1.
 void canInit(void);
 
 // Set the operating mode of the MCP2515.
@@ -67,9 +96,34 @@ void canSetMode(CanMode mode);
 // The MCP2515 must be in Config mode.
 void canSetBitTiming(U8 cnf1, U8 cnf2, U8 cnf3);
 
-// Enable/disable RX-buffer-full interrupts on the MCP2515's INT pin.
+// Enter Config mode while running, e.g. to change the filters.
+// Frames waiting to be sent get 20ms to go out; any left then are
+// aborted and FAIL is returned. Stores the current mode in *mode.
+Status canConfigBegin(CanMode *mode);
+
+// Leave Config mode entered by canConfigBegin(), back to mode.
+void canConfigEnd(CanMode mode);
+
+// Change the bit timing while running, as with canSetBitTiming().
+// Frames waiting to be sent get 20ms to go out at the old rate;
+// any left then are aborted and FAIL is returned. Returns to the
+// current mode afterwards.
+Status canRetime(U8 cnf1, U8 cnf2, U8 cnf3);
+
+// Enable/disable RX-buffer-full, TX-buffer-empty and error interrupts on
+// the MCP2515's INT pin.
+// INT stays asserted while any of them is pending, so an interrupt on
+// its falling edge must read both RX buffers, call canTxService(), and
+// repeat until canErrService() reports nothing pending.
 void canIE(bool enable);
 
+// Read the interrupt flags (CANINTF), enabled or not.
+U8 canIntFlags(void);
+
+// Clear interrupt flags. Clearing CAN_INTF_RXn frees the receive buffer
+// without reading it.
+void canClearIntFlags(U8 flags);
+
 // Read RX status with RX STATUS instruction.
 U8 canRxStatus(void);
 
@@ -79,8 +133,26 @@ void canReadRxb0(CanFrame *frame);
 // Read the frame in RXB1.
 void canReadRxb1(CanFrame *frame);
 
-// Transmit a frame to the CAN bus
-Status canTx(const CanFrame *frame);
+// Queue a frame for transmission and return without waiting.
+// Queued frames are loaded into TXB0--TXB2 as they become idle: highest
+// priority first, and in order within a priority.
+// Returns FAIL, and counts a drop, if the queue is full.
+// Must not be interrupted by other users of the MCP2515.
+Status canTx(const CanFrame *frame, CanPrio prio);
+
+// Retire sent frames and refill the transmit buffers from the queue.
+// Clears the TX interrupt flags.
+void canTxService(void);
+
+// Count and clear receive overflows and the error interrupt.
+// Returns true if another enabled interrupt is still pending.
+bool canErrService(void);
+
+// Get the receive overflow counts.
+void canGetRxStats(CanRxStats *stats);
+
+// Get the transmit queue's statistics.
+void canGetTxStats(CanTxStats *stats);
 
 // Set the message acceptance mask of RXB0.
 // The MCP2515 must be in Config mode.
@@ -20,43 +20,28 @@ typedef enum {
 	CONFB = 0xF000, // DAC B
 } Conf;
 
-void
-dacInit(void) {
-	DAC1_CS_TRIS = OUT;
-	DAC2_CS_TRIS = OUT;
-	DAC1_CS = 1;
-	DAC2_CS = 1;
-
-	U16 level = 0u;
-	dacSet1a(level);
-	dacSet1b(level);
-	dacSet2a(level);
-	dacSet2b(level);
-}
+static U16 staged[DAC_NCHAN];
+static U16 written[DAC_NCHAN];
+static U8 dirty; // bit n: staged[n] != written[n]
 
 static void
-set(U8 dacNum, Conf conf, U16 mv) {
-	U16 level;
-
-	mv = min(mv, VREF_MV); // clamp to 5V
-
-	// D = 2^10 * Vout / Vref / (1000mV/V)
-	level = (U16)((U32)mv * (1u<<10u) / VREF_MV);
+write(DacChan ch, U16 code) {
+	U16 cmd;
 
-	level <<= 2u; // D0 at bit 2
-	level = ((U16)conf & 0xF000) | (level & 0x0FFF); // set config bits
+	cmd = ((ch & 1u) ? CONFB : CONFA) | (code << 2u); // D0 at bit 2
 
-	if (dacNum == 1u) {
+	// CS setup time is less than an instruction cycle
+	if (ch < DAC_2A) {
 		DAC1_CS = 0;
 	} else {
 		DAC2_CS = 0;
 	}
-	_delay(1);
 
-	(void)spiTx((level>>8u) & 0xFF); // MSB
-	(void)spiTx((level>>0u) & 0xFF); // LSB
+	(void)spiTx((cmd>>8u) & 0xFF); // MSB
+	(void)spiTx((cmd>>0u) & 0xFF); // LSB
 
-	if (dacNum == 1u) {
+	// The output changes as CS rises
+	if (ch < DAC_2A) {
 		DAC1_CS = 1;
 	} else {
 		DAC2_CS = 1;
@@ -64,20 +49,55 @@ set(U8 dacNum, Conf conf, U16 mv) {
 }
 
 void
-dacSet1a(U16 mv) {
-	set(1u, CONFA, mv);
+dacInit(void) {
+	U8 ch;
+
+	DAC1_CS_TRIS = OUT;
+	DAC2_CS_TRIS = OUT;
+	DAC1_CS = 1;
+	DAC2_CS = 1;
+
+	for (ch = 0u; ch < DAC_NCHAN; ch++) {
+		staged[ch] = 0u;
+	}
+	dirty = (1u << DAC_NCHAN) - 1u; // outputs unknown
+	(void)dacCommit();
 }
 
-void
-dacSet1b(U16 mv) {
-	set(1u, CONFB, mv);
+U16
+dacCode(U16 mv) {
+	U32 code;
+
+	// D = 2^10 * Vout / Vref / (1000mV/V)
+	code = (U32)mv * (1u<<10u) / VREF_MV;
+	return (U16)min(code, DAC_MAX_CODE);
 }
 
 void
-dacSet2a(U16 mv) {
-	set(2u, CONFA, mv);
+dacStage(DacChan ch, U16 code) {
+	if (ch >= DAC_NCHAN) {
+		return;
+	}
+	code = min(code, DAC_MAX_CODE);
+	staged[ch] = code;
+	if (code != written[ch]) {
+		dirty |= 1u << ch;
+	} else {
+		dirty &= ~(1u << ch);
+	}
 }
-void
-dacSet2b(U16 mv) {
-	set(2u, CONFB, mv);
+
+U8
+dacCommit(void) {
+	U8 ch, n;
+
+	n = 0u;
+	for (ch = 0u; dirty != 0u; ch++, dirty >>= 1u) {
+		if (dirty & 1u) {
+			write(ch, staged[ch]);
+			written[ch] = staged[ch];
+			n++;
+		}
+	}
+	return n;
 }
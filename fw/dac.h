@@ -1,4 +1,10 @@
 /* Microchip MCP4912 10-bit DAC
+ *
+ * The four analog outputs are set in batches: dacStage() records a
+ * channel's new code, and dacCommit() writes the channels whose code
+ * changed, back to back. ~LDAC is tied low on the board, so each DAC
+ * latches its output at the end of its write; a batch of four moves the
+ * outputs within a few tens of microseconds of each other.
  *
  * Device: PIC16F1459
  * Compiler: XC8 v3.00
@@ -17,20 +23,28 @@
 #define DAC2_CS_TRIS TRISB5
 #define DAC2_CS RB5
 
-void dacInit(void);
+enum {
+	DAC_MAX_CODE = 1023,
+};
+
+typedef enum {
+	DAC_1A = 0, // DAC1 VOUTA
+	DAC_1B, // DAC1 VOUTB
+	DAC_2A, // DAC2 VOUTA
+	DAC_2B, // DAC2 VOUTB
 
-// Set DAC1 VOUTA.
-// Mv is the desired voltage in millivolts.
-void dacSet1a(U16 mv);
+	DAC_NCHAN,
+} DacChan;
+
+// Set all outputs to 0V.
+void dacInit(void);
 
-// Set DAC1 VOUTB.
-// Mv is the desired voltage in millivolts.
-void dacSet1b(U16 mv);
+// Convert a voltage in millivolts to a code, clamped to DAC_MAX_CODE.
+U16 dacCode(U16 mv);
 
-// Set DAC2 VOUTA.
-// Mv is the desired voltage in millivolts.
-void dacSet2a(U16 mv);
+// Stage a channel's code, clamped to DAC_MAX_CODE, for the next commit.
+void dacStage(DacChan ch, U16 code);
 
-// Set DAC2 VOUTB.
-// Mv is the desired voltage in millivolts.
-void dacSet2b(U16 mv);
+// Write the staged codes that differ from the outputs.
+// Returns the number of channels written.
+U8 dacCommit(void);
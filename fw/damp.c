@@ -0,0 +1,86 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#include "damp.h"
+
+static bool
+isOff(const Damp *d) {
+	return (d->shift == 0u || d->shift > DAMP_MAX_SHIFT) && d->slew == DAMP_SLEW_OFF;
+}
+
+void
+dampInit(Damp *d) {
+	d->shift = 0u;
+	d->slew = DAMP_SLEW_OFF;
+	d->target = 0u;
+	d->acc = 0ul;
+	d->settled = true;
+}
+
+void
+dampConfig(Damp *d, U8 shift, U16 slew) {
+	d->shift = shift;
+	d->slew = slew;
+}
+
+bool
+dampSet(Damp *d, U16 target) {
+	d->target = target;
+	if (isOff(d)) {
+		d->acc = (U32)target << 16u;
+		d->settled = true;
+		return true;
+	}
+	d->settled = (dampOut(d) == target);
+	return false;
+}
+
+bool
+dampStep(Damp *d, U16 *out) {
+	U32 goal, delta;
+	U16 prev, next;
+
+	if (d->settled) {
+		return false;
+	}
+	goal = (U32)d->target << 16u;
+	prev = dampOut(d);
+
+	// IIR: acc += (goal - acc) / 2^shift, snapping to the goal once the
+	// step vanishes. The sign is kept apart to shift unsigned values.
+	if (d->shift == 0u || d->shift > DAMP_MAX_SHIFT) {
+		d->acc = goal;
+	} else if (goal > d->acc) {
+		delta = (goal - d->acc) >> d->shift;
+		d->acc = (delta == 0ul) ? goal : d->acc + delta;
+	} else {
+		delta = (d->acc - goal) >> d->shift;
+		d->acc = (delta == 0ul) ? goal : d->acc - delta;
+	}
+	next = dampOut(d);
+
+	// Slew limit
+	if (d->slew != DAMP_SLEW_OFF) {
+		if (next > prev && next - prev > d->slew) {
+			next = prev + d->slew;
+			d->acc = (U32)next << 16u;
+		} else if (next < prev && prev - next > d->slew) {
+			next = prev - d->slew;
+			d->acc = (U32)next << 16u;
+		}
+	}
+
+	d->settled = (d->acc == goal);
+	if (next == prev) {
+		return false;
+	}
+	*out = next;
+	return true;
+}
+
+U16
+dampOut(const Damp *d) {
+	return (d->acc + 0x8000ul) >> 16u; // acc <= 0xFFFF0000
+}
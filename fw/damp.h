@@ -0,0 +1,56 @@
+/* Damping of a gauge's output value.
+ *
+ * Values looked up from noisy signals step the gauge from one to the
+ * next, making the needle twitch. A damper sits between the table
+ * lookup and the output: the looked-up value becomes its target, and
+ * each tick of DAMP_TICK_HZ moves the output towards it through
+ *  - a first-order IIR filter that covers 1/2^shift of the distance
+ *    left (a time constant of about 2^shift ticks), then
+ *  - a slew limiter that moves it by at most slew per tick.
+ * Either stage may be turned off; with both off, the target is output
+ * at once. Everything is integer arithmetic on a 16.16 fixed-point
+ * accumulator, and a damper that has reached its target does no work.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "damp.h"
+ */
+
+enum {
+	DAMP_TICK_HZ = 183, // every fourth scheduler tick: 12MHz / 64 / 256 / 4
+	DAMP_MAX_SHIFT = 15, // larger shifts turn the IIR off, as does 0
+	DAMP_SLEW_OFF = 0, // no slew limit
+};
+
+typedef struct {
+	// Settings
+	U8 shift; // IIR: 1-DAMP_MAX_SHIFT, or off
+	U16 slew; // most output change per tick, or DAMP_SLEW_OFF
+
+	U16 target; // value looked up
+	U32 acc; // value output, with 16 bits of fraction
+	bool settled; // output == target
+} Damp;
+
+// Output 0 with both stages off.
+void dampInit(Damp *d);
+
+// Set the stages. The output carries on from where it is.
+void dampConfig(Damp *d, U8 shift, U16 slew);
+
+// Set the target. Returns true if it is to be output at once,
+// i.e. damping is off.
+bool dampSet(Damp *d, U16 target);
+
+// Move the output one tick towards the target.
+// Returns true if it changed, with the new output in out.
+bool dampStep(Damp *d, U16 *out);
+
+// Get the value output: acc, rounded.
+U16 dampOut(const Damp *d);
@@ -0,0 +1,90 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "can.h"
+
+#include "dispatch.h"
+
+#define STD_FLAG 0x80000000 // keeps standard IDs apart from extended ones
+
+static U32
+key(const CanId *id) {
+	if (id->isExt) {
+		return id->eid & 0x1FFFFFFF;
+	}
+	return STD_FLAG | (id->sid & 0x7FF);
+}
+
+// Home slot of a key: the XOR of its nibbles.
+// Bytes are XORed first, so it is a handful of instructions on the PIC.
+static U8
+hash(U32 k) {
+	U8 h;
+
+	h = (U8)k ^ (U8)(k >> 8u) ^ (U8)(k >> 16u) ^ (U8)(k >> 24u);
+	return (h ^ (h >> 4u)) & (DISP_SLOTS-1u);
+}
+
+void
+dispInit(Dispatch *d) {
+	U8 i;
+
+	for (i = 0u; i < DISP_SLOTS; i++) {
+		d->slots[i].sigs = 0u;
+	}
+	d->maxProbe = 0u;
+}
+
+Status
+dispAdd(Dispatch *d, const CanId *id, U8 sig) {
+	U32 k;
+	U8 i, n;
+
+	if (sig >= DISP_MAX_SIGS) {
+		return FAIL;
+	}
+
+	k = key(id);
+	i = hash(k);
+	for (n = 0u; n < DISP_SLOTS; n++) {
+		if (d->slots[i].sigs == 0u) { // new ID
+			d->slots[i].key = k;
+			break;
+		}
+		if (d->slots[i].key == k) { // another signal in the same message
+			break;
+		}
+		i = (i+1u) & (DISP_SLOTS-1u);
+	}
+	if (n >= DISP_SLOTS) {
+		return FAIL; // full
+	}
+
+	d->slots[i].sigs |= (DispSet)(1u << sig);
+	if (n > d->maxProbe) {
+		d->maxProbe = n;
+	}
+	return OK;
+}
+
+DispSet
+dispLookup(const Dispatch *d, const CanId *id) {
+	const DispSlot *slot;
+	U32 k;
+	U8 i, n;
+
+	k = key(id);
+	i = hash(k);
+	for (n = 0u; n <= d->maxProbe; n++) {
+		slot = &d->slots[i];
+		if (slot->sigs == 0u) {
+			return 0u; // empty slot: unknown ID
+		}
+		if (slot->key == k) {
+			return slot->sigs;
+		}
+		i = (i+1u) & (DISP_SLOTS-1u);
+	}
+	return 0u;
+}
@@ -0,0 +1,50 @@
+/* Dispatch table: which signals a CAN ID carries.
+ *
+ * A small open-addressed hash table maps each configured ID to the set
+ * of signals in that message. There are two slots for each signal, so
+ * the table is at most half full and never fills up. Unknown IDs often
+ * hit an empty slot on the first probe, and no lookup probes more slots
+ * than the longest insertion did.
+ *
+ * The table is rebuilt whenever the signal formats change.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "can.h"
+ * #include "dispatch.h"
+ */
+
+enum {
+	DISP_MAX_SIGS = 8, // signals that fit in a DispSet
+	DISP_SLOTS = 2*DISP_MAX_SIGS, // at most half full -- a power of 2, at most 16
+};
+
+// Set of signals: bit k is signal k
+typedef U8 DispSet;
+
+typedef struct {
+	U32 key; // ID; bit 31 marks standard IDs
+	DispSet sigs; // empty if the slot is unused
+} DispSlot;
+
+typedef struct {
+	DispSlot slots[DISP_SLOTS];
+	U8 maxProbe; // slots past the home slot that a lookup may visit
+} Dispatch;
+
+// Empty the table.
+void dispInit(Dispatch *d);
+
+// Add a signal to the set of an ID.
+// Returns FAIL if the table is full or sig >= DISP_MAX_SIGS.
+Status dispAdd(Dispatch *d, const CanId *id, U8 sig);
+
+// Get the set of signals carried by an ID.
+// Returns the empty set if the ID is unknown.
+DispSet dispLookup(const Dispatch *d, const CanId *id);
@@ -36,6 +36,23 @@ enum {
 	STATUS_BP1 = 0x8, // block protection 1
 };
 
+// Page waiting to be written
+typedef struct {
+	EepromAddr page; // address of the page's first byte
+	U8 data[PAGE_SIZE];
+	U16 dirty; // bit k: data[k] is to be written
+	bool writing; // write cycle started
+} WbPage;
+
+// Pages in order of first write. Only the oldest can be writing.
+static WbPage wb[EEPROM_WB_PAGES];
+static U8 wbHead; // free-running index of the next free page
+static U8 wbTail; // free-running index of the oldest page
+
+// A write cycle has been started and not yet seen to finish.
+// Until one is, reads skip the status register.
+static bool busy;
+
 static U8
 readStatus(void) {
 	U8 status;
@@ -69,19 +86,29 @@ eepromInit(void) {
 	EEPROM_CS = 1;
 
 	writeDisable();
+	wbHead = wbTail = 0u;
+	busy = true; // a cycle may have been started before a reset
+}
+
+// Check whether a write cycle is in progress.
+// Only reads the status register if one has been started.
+static bool
+isBusy(void) {
+	if (busy) {
+		busy = readStatus() & STATUS_WIP;
+	}
+	return busy;
 }
 
 // Wait for pending write to finish
 static Status
 waitForWrite(void) {
-	U8 status, k;
+	U8 k;
 
-	status = readStatus();
-	for (k = 0u; (status & STATUS_WIP) && (k < BAILOUT); k++) {
+	for (k = 0u; isBusy() && (k < BAILOUT); k++) {
 		_delay(WRITE_DELAY);
-		status = readStatus();
 	}
-	return (k < BAILOUT) ? OK : FAIL;
+	return busy ? FAIL : OK;
 }
 
 static void
@@ -90,63 +117,178 @@ spiTxAddr(U16 addr) {
 	(void)spiTx((addr>>0u) & 0xFF); // LSB
 }
 
-static bool
-isPageStart(U16 addr) {
-	return (addr % PAGE_SIZE) == 0;
+// Read a range of the EEPROM. It must not be busy.
+static void
+readRaw(U16 addr, U8 *data, U8 size) {
+	EEPROM_CS = 0;
+	(void)spiTx(CMD_READ);
+	spiTxAddr(addr);
+	while (size--) {
+		*data = spiTx(0x00);
+		data++;
+	}
+	EEPROM_CS = 1;
 }
 
-Status
-eepromWrite(U16 addr, U8 *data, U8 size) {
+// Start the write cycle of a buffered page. The EEPROM must not be busy.
+// One cycle writes everything from the first dirty byte to the last;
+// clean bytes between them are read first and rewritten unchanged.
+static Status
+startWrite(WbPage *p) {
+	U8 gap[PAGE_SIZE];
+	U8 first, last, k;
 	Status status;
 
-	// Wait for pending write to finish
-	status = waitForWrite();
-	if (status != OK) {
-		return FAIL; // timed out
+	for (first = 0u; !(p->dirty & (1u << first)); first++) {}
+	for (last = PAGE_SIZE-1u; !(p->dirty & (1u << last)); last--) {}
+	for (k = first; k <= last && (p->dirty & (1u << k)); k++) {}
+	if (k <= last) { // gap
+		readRaw(p->page + first, gap, last-first+1u);
+		for (k = first; k <= last; k++) {
+			if (!(p->dirty & (1u << k))) {
+				p->data[k] = gap[k-first];
+			}
+		}
 	}
 
-	// Set write-enable
 	status = writeEnable();
 	if (status != OK) {
 		return FAIL;
 	}
-
-	// Write
 	EEPROM_CS = 0;
 	(void)spiTx(CMD_WRITE);
-	spiTxAddr(addr);
-	while (size--) {
-		(void)spiTx(*data);
-		data++;
-		addr++;
-
-		// Check if write crosses page boundary
-		if (isPageStart(addr) && size) {
-			// Write current page to memory
-			EEPROM_CS = 1;
-			status = waitForWrite();
-			if (status != OK) {
-				return FAIL; // timed out
-			}
-			status = writeEnable();
-			if (status != OK) {
-				return FAIL;
-			}
-			EEPROM_CS = 0;
+	spiTxAddr(p->page + first);
+	for (k = first; k <= last; k++) {
+		(void)spiTx(p->data[k]);
+	}
+	EEPROM_CS = 1;
+
+	p->writing = true;
+	busy = true;
+	return OK;
+}
+
+void
+eepromPoll(void) {
+	WbPage *p;
+
+	if (wbHead == wbTail) {
+		return; // nothing to write
+	}
+	if (isBusy()) {
+		return; // the oldest page's cycle, or one started before a reset
+	}
+	p = &wb[wbTail % EEPROM_WB_PAGES];
+	if (p->writing) {
+		wbTail++;
+		if (wbHead == wbTail) {
+			return;
+		}
+		p = &wb[wbTail % EEPROM_WB_PAGES];
+	}
+	(void)startWrite(p); // only fails if the EEPROM doesn't respond: retried
+}
+
+Status
+eepromFlush(void) {
+	U8 k;
 
-			// Start next page
-			(void)spiTx(CMD_WRITE);
-			spiTxAddr(addr);
+	for (k = 0u; wbHead != wbTail; k++) {
+		if (k >= EEPROM_WB_PAGES*BAILOUT || waitForWrite() != OK) {
+			return FAIL; // timed out
 		}
+		eepromPoll();
+	}
+	return waitForWrite();
+}
+
+// Get the buffer to write bytes of a page into: a buffered page that has
+// not started writing, else a free one. If none is free, wait for the
+// oldest to be written.
+static WbPage *
+bufferFor(EepromAddr page) {
+	WbPage *p;
+	U8 i, k;
+
+	for (i = wbTail; i != wbHead; i++) {
+		p = &wb[i % EEPROM_WB_PAGES];
+		if (!p->writing && p->page == page) {
+			return p; // coalesce
+		}
+	}
+
+	for (k = 0u; (U8)(wbHead - wbTail) >= EEPROM_WB_PAGES; k++) {
+		if (k >= BAILOUT || waitForWrite() != OK) {
+			return 0; // timed out
+		}
+		eepromPoll();
+	}
+
+	p = &wb[wbHead % EEPROM_WB_PAGES];
+	p->page = page;
+	p->dirty = 0u;
+	p->writing = false;
+	wbHead++;
+	return p;
+}
+
+Status
+eepromWrite(U16 addr, U8 *data, U8 size) {
+	WbPage *p;
+	U8 k;
+
+	while (size) {
+		p = bufferFor(addr & ~(PAGE_SIZE-1u));
+		if (!p) {
+			return FAIL;
+		}
+
+		// Copy up to the end of the page
+		k = addr % PAGE_SIZE;
+		do {
+			p->data[k] = *data;
+			p->dirty |= 1u << k;
+			data++;
+			addr++;
+			size--;
+			k++;
+		} while (size && k < PAGE_SIZE);
 	}
-	EEPROM_CS = 1;
 
 	return OK;
 }
 
+// Get the newest buffered value of a byte.
+static bool
+buffered(U16 addr, U8 *val) {
+	const WbPage *p;
+	U8 i, k;
+
+	k = addr % PAGE_SIZE;
+	for (i = wbHead; i != wbTail;) {
+		p = &wb[--i % EEPROM_WB_PAGES];
+		if (p->page == addr-k && (p->dirty & (1u << k))) {
+			*val = p->data[k];
+			return true;
+		}
+	}
+	return false;
+}
+
 Status
 eepromRead(U16 addr, U8 *data, U8 size) {
 	Status status;
+	U8 k;
+
+	// Skip the EEPROM if every byte is buffered
+	for (k = 0u; k < size; k++) {
+		if (!buffered(addr+k, &data[k])) {
+			break;
+		}
+	}
+	if (k == size) {
+		return OK;
+	}
 
 	// Wait for pending write to finish
 	status = waitForWrite();
@@ -154,15 +296,11 @@ eepromRead(U16 addr, U8 *data, U8 size) {
 		return FAIL; // timed out
 	}
 
-	// Read
-	EEPROM_CS = 0;
-	(void)spiTx(CMD_READ);
-	spiTxAddr(addr);
-	while (size--) {
-		*data = spiTx(0x00);
-		data++;
+	// Read, then replace bytes that have not been written yet
+	readRaw(addr, data, size);
+	for (k = 0u; k < size; k++) {
+		(void)buffered(addr+k, &data[k]);
 	}
-	EEPROM_CS = 1;
 
 	return OK;
 }
@@ -1,4 +1,13 @@
 /* Microchip 25LC160C 2KiB EEPROM
+ *
+ * Writes are buffered and written behind: eepromWrite() copies the bytes
+ * into a page buffer and returns, and eepromPoll(), called from the main
+ * loop, starts each page's write cycle once the previous one is done.
+ * Bytes written to a page before its cycle starts are coalesced into a
+ * single cycle. Reads see buffered bytes.
+ *
+ * The driver remembers whether a write cycle may be in progress, so
+ * reads only poll the status register while one is.
  *
  * Device: PIC16F1459
  * Compiler: XC8 v3.00
@@ -15,8 +24,26 @@
 #define EEPROM_CS_TRIS TRISC5
 #define EEPROM_CS RC5
 
+enum {
+	EEPROM_WB_PAGES = 2, // pages buffered for writing -- must be a power of 2
+};
+
 typedef U16 EepromAddr;
 
 void eepromInit(void);
+
+// Buffer data to be written.
+// Only waits if every page buffer is full: for one write cycle.
+// Returns FAIL if the EEPROM stays busy.
 Status eepromWrite(EepromAddr addr, U8 data[], U8 size);
+
+// Read data, including buffered bytes not yet written.
+// Waits for the current write cycle unless every byte is buffered.
 Status eepromRead(EepromAddr addr, U8 data[], U8 size);
+
+// Advance the write-behind buffer without waiting:
+// retire a finished write cycle and start the next one.
+void eepromPoll(void);
+
+// Write all buffered pages and wait for them to finish.
+Status eepromFlush(void);
@@ -0,0 +1,83 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#include "errlog.h"
+
+static void
+count(U16 *n) {
+	if (*n < 0xFFFF) {
+		(*n)++;
+	}
+}
+
+void
+errLogInit(ErrLog *l) {
+	U8 k;
+
+	for (k = 0u; k < ERRLOG_SLOTS; k++) {
+		l->slots[k].code = ERRLOG_NONE;
+		l->slots[k].count = 0u;
+	}
+	l->total = 0u;
+	l->lost = 0u;
+	l->last = ERRLOG_NONE;
+	l->fresh = false;
+	l->wait = 0u;
+}
+
+void
+errLogRecord(ErrLog *l, U16 code) {
+	ErrSlot *empty;
+	U8 k;
+
+	count(&l->total);
+	l->last = code;
+	l->fresh = true;
+
+	empty = 0;
+	for (k = 0u; k < ERRLOG_SLOTS; k++) {
+		if (l->slots[k].code == code) {
+			count(&l->slots[k].count);
+			return;
+		}
+		if (empty == 0 && l->slots[k].code == ERRLOG_NONE) {
+			empty = &l->slots[k];
+		}
+	}
+	if (empty == 0) {
+		count(&l->lost);
+		return;
+	}
+	empty->code = code;
+	empty->count = 1u;
+}
+
+void
+errLogTick(ErrLog *l) {
+	if (l->wait > 0u) {
+		l->wait--;
+	}
+}
+
+bool
+errLogDue(ErrLog *l) {
+	if (!l->fresh || l->wait > 0u) {
+		return false;
+	}
+	l->fresh = false;
+	l->wait = ERRLOG_PERIOD;
+	return true;
+}
+
+bool
+errLogTake(ErrLog *l, U8 k, ErrSlot *slot) {
+	if (k >= ERRLOG_SLOTS) {
+		return false;
+	}
+	*slot = l->slots[k];
+	l->slots[k].code = ERRLOG_NONE;
+	l->slots[k].count = 0u;
+	return true;
+}
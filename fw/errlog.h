@@ -0,0 +1,57 @@
+/* Error log.
+ *
+ * Errors found while handling frames are counted rather than reported
+ * one frame each, so that a misbehaving calibration tool can't flood
+ * the transmit queue. Each error code (typically a line number) gets a
+ * saturating counter in one of ERRLOG_SLOTS slots; codes that find no
+ * free slot are counted as lost. The main loop ticks the log and sends
+ * a summary when errLogDue() says so: at most once per ERRLOG_PERIOD
+ * ticks, and only if there were new errors.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "errlog.h"
+ */
+
+enum {
+	ERRLOG_SLOTS = 6,
+	ERRLOG_PERIOD = 732, // ticks between summaries: 1s of SCHED_TICK_HZ
+	ERRLOG_NONE = 0, // code of an empty slot
+};
+
+typedef struct {
+	U16 code;
+	U16 count; // saturating
+} ErrSlot;
+
+typedef struct {
+	ErrSlot slots[ERRLOG_SLOTS];
+	U16 total; // all errors, saturating
+	U16 lost; // errors whose code found no free slot, saturating
+	U16 last; // code of the latest error
+	bool fresh; // errors since the last summary
+	U16 wait; // ticks until a summary may be sent
+} ErrLog;
+
+// Clear the counters.
+void errLogInit(ErrLog *l);
+
+// Count an error.
+void errLogRecord(ErrLog *l, U16 code);
+
+// Count one tick.
+void errLogTick(ErrLog *l);
+
+// Check whether a summary should be sent now.
+// If so, the next one is held off for ERRLOG_PERIOD ticks.
+bool errLogDue(ErrLog *l);
+
+// Take slot k's code and count, and empty it.
+// Returns false if k is out of range.
+bool errLogTake(ErrLog *l, U8 k, ErrSlot *slot);
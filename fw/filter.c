@@ -0,0 +1,219 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "can.h"
+
+#include "filter.h"
+
+#define ID_BITS 0x1FFFFFFF // all 29 bits
+#define SID_BITS 0x1FFC0000 // bits 28:18: standard ID
+#define SID_SHIFT 18u
+
+// ID as stored in a set of MCP2515 ID registers.
+static U32
+regId(const CanId *id) {
+	if (id->isExt) {
+		return id->eid & ID_BITS;
+	}
+	return ((U32)(id->sid & 0x7FF)) << SID_SHIFT;
+}
+
+static CanId
+mkId(bool isExt, U32 reg) {
+	CanId id;
+
+	id.isExt = isExt;
+	if (isExt) {
+		id.eid = reg & ID_BITS;
+	} else {
+		id.sid = (U16)(reg >> SID_SHIFT) & 0x7FF;
+	}
+	return id;
+}
+
+static U8
+popcount(U32 x) {
+	U8 n;
+
+	for (n = 0u; x; x &= x-1u) {
+		n++;
+	}
+	return n;
+}
+
+// Advance to the next partition of n items into at most FILT_N groups.
+// A partition is a restricted growth string: a[0] = 0, and each a[i] is
+// at most one more than the greatest group before it.
+// Returns false after the last partition.
+static bool
+nextPartition(U8 a[], U8 n) {
+	U8 i, k, max;
+
+	for (i = n; i-- > 1u;) {
+		max = 0u;
+		for (k = 0u; k < i; k++) {
+			if (a[k] > max) {
+				max = a[k];
+			}
+		}
+		if (a[i] <= max && a[i] < FILT_N-1u) {
+			a[i]++;
+			for (k = i+1u; k < n; k++) {
+				a[k] = 0u;
+			}
+			return true;
+		}
+	}
+	return false;
+}
+
+// The ID at index k of an array with the given stride.
+static const CanId *
+idAt(const CanId *ids, U8 stride, U8 k) {
+	return (const CanId *)((const U8 *)ids + (U16)k*stride);
+}
+
+// Compute the mask of a partition: the bits on which every group agrees.
+// Item i of the partition is the ID at index idx[i].
+// Returns false if a group mixes standard and extended IDs.
+static bool
+partitionMask(const CanId *ids, U8 stride, const U8 idx[], const U8 a[], U8 n, U32 *mask, U8 *groups) {
+	const CanId *id, *first;
+	U8 firsts[FILT_N]; // item that opened each group
+	U32 diff;
+	bool anyStd;
+	U8 i, g;
+
+	diff = 0ul;
+	anyStd = false;
+	*groups = 0u;
+	for (i = 0u; i < n; i++) {
+		g = a[i];
+		id = idAt(ids, stride, idx[i]);
+		anyStd |= !id->isExt;
+		if (g == *groups) { // first member
+			firsts[g] = i;
+			(*groups)++;
+			continue;
+		}
+		first = idAt(ids, stride, idx[firsts[g]]);
+		if (first->isExt != id->isExt) {
+			return false;
+		}
+		diff |= regId(id) ^ regId(first);
+	}
+
+	*mask = ~diff & ID_BITS;
+	if (anyStd) {
+		*mask &= SID_BITS;
+	}
+	return true;
+}
+
+// Cover that accepts every frame.
+static void
+acceptAll(FiltCover *cover) {
+	U8 k;
+
+	cover->mask = mkId(false, 0ul);
+	cover->filters[0u] = mkId(true, 0ul);
+	cover->filters[1u] = mkId(false, 0ul);
+	for (k = 2u; k < FILT_N; k++) {
+		cover->filters[k] = cover->filters[0u];
+	}
+	cover->groups = 2u;
+}
+
+Status
+filtCover(const CanId *ids, U8 stride, const U8 sel[], U8 n, FiltCover *cover) {
+	const CanId *id, *other;
+	U32 mask, bestMask, accepted, bestAccepted;
+	bool anyStd;
+	U8 idx[FILT_MAX_IDS], a[FILT_MAX_IDS], best[FILT_MAX_IDS];
+	U8 m, i, k, groups, bestGroups;
+
+	// Unique IDs, by index: they are read in place, not copied
+	m = 0u;
+	for (i = 0u; i < n; i++) {
+		id = idAt(ids, stride, sel[i]);
+		for (k = 0u; k < m; k++) {
+			other = idAt(ids, stride, idx[k]);
+			if (other->isExt == id->isExt && regId(other) == regId(id)) {
+				break;
+			}
+		}
+		if (k < m) {
+			continue; // duplicate
+		}
+		if (m >= FILT_MAX_IDS) {
+			acceptAll(cover);
+			return FAIL;
+		}
+		idx[m++] = sel[i];
+	}
+
+	if (m == 0u) {
+		cover->mask = mkId(true, ID_BITS);
+		for (k = 0u; k < FILT_N; k++) {
+			cover->filters[k] = mkId(true, 0ul);
+		}
+		cover->groups = 1u;
+		return OK;
+	}
+
+	// Try every partition into at most FILT_N groups.
+	// Keep the one that accepts the fewest IDs: groups * 2^(29 - mask bits).
+	for (i = 0u; i < m; i++) {
+		a[i] = 0u;
+	}
+	bestAccepted = 0ul;
+	bestGroups = 0u;
+	bestMask = 0ul;
+	do {
+		if (partitionMask(ids, stride, idx, a, m, &mask, &groups)) {
+			accepted = (U32)groups << (29u - popcount(mask));
+			if (bestGroups == 0u || accepted < bestAccepted
+				|| (accepted == bestAccepted && groups < bestGroups)) {
+				bestAccepted = accepted;
+				bestGroups = groups;
+				bestMask = mask;
+				for (i = 0u; i < m; i++) {
+					best[i] = a[i];
+				}
+			}
+		}
+	} while (nextPartition(a, m));
+
+	// One filter per group: any member's ID.
+	// The partition with all standard IDs in one group and all extended
+	// IDs in another is always valid, so a best one was found.
+	anyStd = false;
+	for (i = 0u; i < m; i++) {
+		id = idAt(ids, stride, idx[i]);
+		cover->filters[best[i]] = mkId(id->isExt, regId(id));
+		anyStd |= !id->isExt;
+	}
+	for (k = bestGroups; k < FILT_N; k++) {
+		cover->filters[k] = cover->filters[0u];
+	}
+	cover->mask = mkId(!anyStd, bestMask);
+	cover->groups = bestGroups;
+	return OK;
+}
+
+bool
+filtAccepts(const FiltCover *cover, const CanId *id) {
+	U32 key, mask;
+	U8 k;
+
+	key = regId(id);
+	mask = regId(&cover->mask);
+	for (k = 0u; k < FILT_N; k++) {
+		if (cover->filters[k].isExt == id->isExt
+			&& ((key ^ regId(&cover->filters[k])) & mask) == 0ul) {
+			return true;
+		}
+	}
+	return false;
+}
@@ -0,0 +1,52 @@
+/* Acceptance filter cover for the MCP2515's receive buffer 1.
+ *
+ * RXB1 has one mask (RXM1) shared by four filters (RXF2--RXF5). A frame
+ * is accepted if, for any filter, its ID matches the filter in every bit
+ * set in the mask. Filters match either standard or extended frames.
+ *
+ * Given the IDs of the configured signals, filtCover finds the mask and
+ * filters that accept all of them and as few other IDs as possible:
+ * the IDs are split into at most four groups, each covered by one
+ * filter, choosing the split that accepts the fewest IDs. Frames that
+ * get through are still checked in software.
+ *
+ * IDs are compared as 29-bit values: standard IDs occupy bits 28:18,
+ * like in the MCP2515's registers. The mask's low 18 bits are cleared if
+ * any ID is standard, because for standard frames those bits of the
+ * mask apply to the first two data bytes.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "can.h"
+ * #include "filter.h"
+ */
+
+enum {
+	FILT_N = 4, // filters per mask
+	FILT_MAX_IDS = 8, // IDs that can be covered
+};
+
+typedef struct {
+	CanId mask;
+	CanId filters[FILT_N]; // unused filters repeat the first
+	U8 groups; // number of distinct filters
+} FiltCover;
+
+// Compute the tightest mask and filters that accept the given IDs.
+// The IDs are ids[sel[0]], ..., ids[sel[n-1]], where consecutive
+// elements of ids are stride bytes apart, so they can be the IDs in an
+// array of structs: pass &fmts[0].id and sizeof(fmts[0]).
+// Duplicate IDs are allowed.
+// With no IDs, only extended ID 0 is accepted.
+// Returns FAIL, and a cover that accepts everything, if there are more
+// than FILT_MAX_IDS IDs.
+Status filtCover(const CanId *ids, U8 stride, const U8 sel[], U8 n, FiltCover *cover);
+
+// Check whether the MCP2515 would accept a frame with the given ID.
+bool filtAccepts(const FiltCover *cover, const CanId *id);
@@ -0,0 +1,52 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "can.h"
+
+#include "frameq.h"
+
+void
+fqInit(FrameQ *q) {
+	q->head = 0u;
+	q->tail = 0u;
+	q->peak = 0u;
+	q->overflows = 0u;
+}
+
+U8
+fqLen(const FrameQ *q) {
+	return (U8)(q->head - q->tail);
+}
+
+Status
+fqPush(FrameQ *q, const CanFrame *frame) {
+	U8 len;
+
+	len = fqLen(q);
+	if (len >= FQ_LEN) {
+		if (q->overflows < 0xFFFF) { // saturate
+			q->overflows++;
+		}
+		return FAIL;
+	}
+
+	q->frames[q->head & (FQ_LEN-1u)] = *frame;
+	q->head++; // publish after the frame is copied
+
+	if (++len > q->peak) {
+		q->peak = len;
+	}
+	return OK;
+}
+
+Status
+fqPop(FrameQ *q, CanFrame *frame) {
+	if (fqLen(q) == 0u) {
+		return FAIL;
+	}
+
+	*frame = q->frames[q->tail & (FQ_LEN-1u)];
+	q->tail++; // release the slot after the frame is copied
+	return OK;
+}
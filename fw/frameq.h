@@ -0,0 +1,45 @@
+/* Fixed-size FIFO of CAN frames.
+ *
+ * The queue has one producer and one consumer, e.g., the ISR pushes
+ * received frames and the main loop pops them. Each side only writes
+ * its own U8 index, so no locking is needed between them.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "can.h"
+ * #include "frameq.h"
+ */
+
+enum {
+	FQ_LEN = 4, // capacity -- must be a power of 2
+};
+
+typedef struct {
+	CanFrame frames[FQ_LEN];
+	volatile U8 head; // free-running write index
+	volatile U8 tail; // free-running read index
+
+	// Statistics
+	volatile U8 peak; // maximum number of frames held at once
+	volatile U16 overflows; // frames dropped because the queue was full
+} FrameQ;
+
+// Empty the queue and clear its statistics.
+void fqInit(FrameQ *q);
+
+// Append a copy of a frame to the back of the queue.
+// Returns FAIL, and counts an overflow, if the queue is full.
+Status fqPush(FrameQ *q, const CanFrame *frame);
+
+// Remove the frame at the front of the queue.
+// Returns FAIL if the queue is empty.
+Status fqPop(FrameQ *q, CanFrame *frame);
+
+// Number of frames in the queue.
+U8 fqLen(const FrameQ *q);
@@ -0,0 +1,113 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "eeprom.h"
+#include "can.h"
+#include "table.h"
+#include "signal.h"
+#include "serial.h"
+
+#include "layout.h"
+
+#define ERASED 0xFF
+
+// Version 1
+#define V1_TAB_SIZE LAY_SCRATCH_SIZE
+#define V1_META_ADDR (LAY_NTAB*V1_TAB_SIZE) // formats, then headers
+#define META_SIZE (LAY_NTAB*SER_SIGFMT_SIZE + LAY_NTAB*TAB_HDR_SIZE)
+
+// Steps: move the formats and headers, then for each table from the
+// last: copy it to the scratch space, then spread it into its new place.
+enum {
+	STEP_META = 0,
+	NSTEPS = 1 + 2*LAY_NTAB,
+};
+
+// Copy n bytes, one page at a time.
+static Status
+copy(EepromAddr dst, EepromAddr src, U16 n) {
+	U8 buf[16u];
+	U8 k;
+
+	while (n) {
+		k = (n < sizeof(buf)) ? (U8)n : sizeof(buf);
+		if (eepromRead(src, buf, k) != OK || eepromWrite(dst, buf, k) != OK) {
+			return FAIL;
+		}
+		src += k;
+		dst += k;
+		n -= k;
+	}
+	return OK;
+}
+
+// Spread the version 1 table in the scratch space into table t.
+// A grid's values are contiguous in both layouts.
+static Status
+spread(U8 t) {
+	U8 hdr[TAB_HDR_SIZE], row[TAB_ROW_SIZE];
+	U8 k;
+
+	if (eepromRead(LAY_TAB_HDR_ADDR(t), hdr, sizeof(hdr)) != OK) {
+		return FAIL;
+	}
+	if (hdr[0u] == TAB_MODE_GRID) {
+		return copy(LAY_TAB_ADDR(t), LAY_SCRATCH_ADDR, V1_TAB_SIZE);
+	}
+	for (k = 0u; k < TAB_ROWS; k++) {
+		if (eepromRead(LAY_SCRATCH_ADDR + k*TAB_ROW_SIZE, row, sizeof(row)) != OK
+			|| eepromWrite(LAY_TAB_ADDR(t) + k*TAB_ROW_STRIDE, row, sizeof(row)) != OK) {
+			return FAIL;
+		}
+	}
+	return OK;
+}
+
+static Status
+step(U8 s) {
+	U8 t;
+
+	if (s == STEP_META) {
+		return copy(LAY_SIGFMT_ADDR(0u), V1_META_ADDR, META_SIZE);
+	}
+	t = LAY_NTAB-1u - (s-1u)/2u;
+	if ((s-1u) % 2u == 0u) {
+		return copy(LAY_SCRATCH_ADDR, t*V1_TAB_SIZE, V1_TAB_SIZE);
+	}
+	return spread(t);
+}
+
+Status
+layMigrate(void) {
+	U8 version, done, s;
+
+	if (eepromRead(LAY_VERSION_ADDR, &version, 1u) != OK) {
+		return FAIL;
+	}
+	if (version == LAY_VERSION) {
+		return OK;
+	} else if (version != ERASED) {
+		return FAIL; // unknown
+	}
+
+	// Version 1
+	if (eepromRead(LAY_PROGRESS_ADDR, &done, 1u) != OK) {
+		return FAIL;
+	}
+	for (s = (done == ERASED) ? 0u : done+1u; s < NSTEPS; s++) {
+		// Each step is written out before it is recorded
+		if (step(s) != OK || eepromFlush() != OK) {
+			return FAIL;
+		}
+		if (eepromWrite(LAY_PROGRESS_ADDR, &s, 1u) != OK || eepromFlush() != OK) {
+			return FAIL;
+		}
+	}
+
+	version = LAY_VERSION;
+	if (eepromWrite(LAY_VERSION_ADDR, &version, 1u) != OK) {
+		return FAIL;
+	}
+	return eepromFlush();
+}
@@ -0,0 +1,77 @@
+/* Layout of the EEPROM, and migration from older layouts.
+ *
+ * Version 2, in 16-byte pages:
+ *   0-1535      tables, LAY_NTAB x TAB_SIZE (rows never straddle a page)
+ *   1536-1583   signal formats, LAY_NTAB x SER_SIGFMT_SIZE
+ *   1584-1631   table headers, LAY_NTAB x TAB_HDR_SIZE
+ *   1632-1637   signals' update rates, LAY_NTAB x 1 (see sched.h)
+ *   1640-1663   signals' damping, LAY_NTAB x 4: shift, slew (see damp.h), unused
+ *   1664-1855   scratch space used while migrating
+ *   2032        layout version
+ *   2033        migration progress
+ *   2034-2036   bit timing last found on the bus, CNF1..CNF3
+ *
+ * Version 1 had no version byte (it reads as erased) and 6-byte rows
+ * packed back to back: tables at k*192, formats at 1152, headers at
+ * 1200.
+ *
+ * Migration moves the formats and headers, then each table from the
+ * last to the first, through the scratch space so that no data is
+ * overwritten before it is copied. Progress is recorded after each step,
+ * so if power is lost, the migration resumes where it left off.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "eeprom.h"
+ * #include "can.h"
+ * #include "table.h"
+ * #include "signal.h"
+ * #include "serial.h"
+ * #include "layout.h"
+ */
+
+enum {
+	LAY_VERSION = 2,
+	LAY_NTAB = 6, // tables, and signal formats
+	LAY_SIZE = 2048, // 25LC160C
+	LAY_PAGE_SIZE = 16,
+	LAY_DAMP_SIZE = 4,
+	LAY_SCRATCH_SIZE = TAB_ROWS*TAB_ROW_SIZE, // a version 1 table
+	LAY_BAUD_SIZE = 3,
+};
+
+// Round a up to a multiple of n, a power of 2
+#define LAY_ALIGN(a, n) (((a) + (n)-1u) & ~((n)-1u))
+
+// Each region starts where the one before it ends, rounded up so that
+// no entry straddles a page. The version, progress and bit timing bytes
+// are in the last page.
+#define LAY_SIGFMT_BASE (LAY_NTAB*TAB_SIZE)
+#define LAY_TAB_HDR_BASE (LAY_SIGFMT_BASE + LAY_NTAB*SER_SIGFMT_SIZE)
+#define LAY_RATE_BASE (LAY_TAB_HDR_BASE + LAY_NTAB*TAB_HDR_SIZE)
+#define LAY_DAMP_BASE LAY_ALIGN(LAY_RATE_BASE + LAY_NTAB, LAY_DAMP_SIZE)
+#define LAY_SCRATCH_BASE LAY_ALIGN(LAY_DAMP_BASE + LAY_NTAB*LAY_DAMP_SIZE, LAY_PAGE_SIZE)
+#define LAY_END (LAY_SCRATCH_BASE + LAY_SCRATCH_SIZE) // of the spaces above
+#define LAY_VERSION_BASE (LAY_SIZE - LAY_PAGE_SIZE)
+#define LAY_PROGRESS_BASE (LAY_VERSION_BASE + 1u)
+#define LAY_BAUD_BASE (LAY_PROGRESS_BASE + 1u)
+
+#define LAY_TAB_ADDR(k) ((EepromAddr)((k)*TAB_SIZE))
+#define LAY_SIGFMT_ADDR(k) ((EepromAddr)(LAY_SIGFMT_BASE + (k)*SER_SIGFMT_SIZE))
+#define LAY_TAB_HDR_ADDR(k) ((EepromAddr)(LAY_TAB_HDR_BASE + (k)*TAB_HDR_SIZE))
+#define LAY_RATE_ADDR(k) ((EepromAddr)(LAY_RATE_BASE + (k)))
+#define LAY_DAMP_ADDR(k) ((EepromAddr)(LAY_DAMP_BASE + LAY_DAMP_SIZE*(k)))
+#define LAY_SCRATCH_ADDR ((EepromAddr)LAY_SCRATCH_BASE)
+#define LAY_VERSION_ADDR ((EepromAddr)LAY_VERSION_BASE)
+#define LAY_PROGRESS_ADDR ((EepromAddr)LAY_PROGRESS_BASE)
+#define LAY_BAUD_ADDR ((EepromAddr)LAY_BAUD_BASE)
+
+// Bring the EEPROM up to the current layout.
+// Returns FAIL if its version is unknown or the EEPROM fails.
+Status layMigrate(void);
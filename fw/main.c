@@ -13,32 +13,53 @@
 #include "signal.h"
 #include "serial.h"
 #include "table.h"
+#include "frameq.h"
+#include "filter.h"
+#include "dispatch.h"
+#include "wave.h"
+#include "layout.h"
+#include "baud.h"
+#include "memo.h"
+#include "sched.h"
+#include "damp.h"
+#include "errlog.h"
+#include "telem.h"
+#include "prof.h"
+#include "trace.h"
 
 #define ERR __LINE__
 
-// TODO: auto baud detection
+// Bit timing used if none is cached in EEPROM and none is found on the bus
 #define CAN_TIMING CAN_TIMING_10K
 
+// Control frames have IDs 0x1272TXX, where T is the type of frame.
+#define CTRL_CAN_ID 0x1272000
+#define CTRL_TYPE_MASK 0xF00
 #define TAB_CTRL_CAN_ID 0x1272000 // Table Control Frame ID
 #define SIG_CTRL_CAN_ID 0x1272100 // Signal Control Frame ID
-#define ERR_CAN_ID 0x1272F00
-
-// Tachometer -- TMR1
-// (pulse/min) = 60 * (Fosc/4) / ((pre)*(post)*(2^16 - TMR1))
-//  = 60 * (48e6/4) / (8*6*(2^16 - TMR1))
-//  = 15000000 / (2^16 - TMR1)
-#define TACH_FACTOR 15000000ul
-#define TMR1_POST 6u // TMR1 postscaler -- must be multiple of 2
-#define MIN_TACH_PULSE_PER_MIN 229u // (pulse/min) >= TACH_FACTOR / (2^16)
-
-// Speedometer -- TMR2
-// (pulse/min) = 60 * (Fosc/4) / ((pre)*(post)*(PR2+1)*(period))
-// = 60 * (48e6/4) / (64*16*10*(period))
-// = 70313 / (period)
-#define SPEED_FACTOR 70313ul
-#define MIN_SPEED_PULSE_PER_MIN 2u // (pulse/min) >= SPEED_FACTOR / period_max)
-
-#define EDGE_PER_PULSE 2u // rising and falling edge
+#define GRID_CTRL_CAN_ID 0x1272200 // Grid Control Frame ID
+#define BAUD_CTRL_CAN_ID 0x1272300 // Bit Timing Control Frame ID
+#define RATE_CTRL_CAN_ID 0x1272400 // Rate Control Frame ID
+#define DAMP_CTRL_CAN_ID 0x1272500 // Damping Control Frame ID
+#define TELEM_CTRL_CAN_ID 0x1272600 // Telemetry Control Frame ID
+#define TELEM_CAN_ID 0x1272610 // Telemetry Frames: 0x127261X, X is the signal
+#define DIAG_CAN_ID 0x1272E00 // Diagnostic Frames: 0x1272EYX, Y is the kind
+#define DIAG_KIND_MASK 0x0F0
+#define PROF_DIAG_CAN_ID 0x1272E00 // Profiler Frame ID, if built with PROFILE
+#define TRACE_DIAG_CAN_ID 0x1272E10 // Latency Frame ID, if built with PROFILE
+#define MEMO_DIAG_CAN_ID 0x1272E20 // Memo Statistics Frame ID
+#define ERR_CAN_ID 0x1272F00 // Error Frames: 0x1272F0X, X is 0 or a slot+1
+
+// Grid Control Frames carry GRID_VALS_PER_FRAME values per block,
+// or the grid's header in block GRID_HDR_BLOCK.
+#define GRID_VALS_PER_FRAME 4u
+#define GRID_HDR_BLOCK 0x1F
+
+// Dampers are stepped every DAMP_TICK_DIV scheduler ticks: DAMP_TICK_HZ
+#define DAMP_TICK_DIV 4u
+
+// Tachometer -- TMR1, speedometer -- TMR2
+// See wave.h.
 
 // Signals
 typedef enum {
@@ -49,89 +70,205 @@ typedef enum {
 	SIG_AN3,
 	SIG_AN4,
 
-	NSIG,
+	NSIG, // at most SCHED_MAX_SIGS
 } Signal;
 
-// Table Control filter.
-// Used for writing/reading calibration tables.
-static const CanId tblCtrlFilter = {
-	.isExt = true,
-	.eid = TAB_CTRL_CAN_ID};
-
-// Signal Control filter.
-// Used for writing/reading the CAN ID and encoding format of  each signal.
+// Control filter.
+// Used for writing/reading calibration tables and the CAN ID and
+// encoding format of each signal.
 // See `doc/datafmt.pdf'.
-static const CanId sigCtrlFilter = {
+static const CanId ctrlFilter = {
 	.isExt = true,
-	.eid = SIG_CTRL_CAN_ID};
+	.eid = CTRL_CAN_ID};
 
 // Receive buffer 0 mask.
-// RXB0 receives Table Control and Signal Control frames.
+// RXB0 receives control frames of all types.
 static const CanId rxb0Mask = {
 	.isExt = true,
-	.eid = 0x1FFFFF00, // all but LSB
+	.eid = 0x1FFFF000, // all but type and LSB
 };
 
-// Receive buffer 1 mask.
-// RXB1 is used for receiving signals.
-// The mask is permissive: all messages are accepted and filtered in software.
-static const CanId rxb1Mask = {
-	.isExt = true,
-	.eid = 0u, // accept all messages
-};
-
-// Calibration tables in EEPROM
-static const Table tbls[NSIG] = {
-	[SIG_TACH] = {0ul*TAB_SIZE}, // tachometer
-	[SIG_SPEED] = {1ul*TAB_SIZE}, // speedometer
-	[SIG_AN1] = {2ul*TAB_SIZE}, // analog channels...
-	[SIG_AN2] = {3ul*TAB_SIZE},
-	[SIG_AN3] = {4ul*TAB_SIZE},
-	[SIG_AN4] = {5ul*TAB_SIZE},
+// Calibration tables in EEPROM. See layout.h.
+static Table tbls[NSIG] = {
+	[SIG_TACH] = {LAY_TAB_ADDR(0u), LAY_TAB_HDR_ADDR(0u)}, // tachometer
+	[SIG_SPEED] = {LAY_TAB_ADDR(1u), LAY_TAB_HDR_ADDR(1u)}, // speedometer
+	[SIG_AN1] = {LAY_TAB_ADDR(2u), LAY_TAB_HDR_ADDR(2u)}, // analog channels...
+	[SIG_AN2] = {LAY_TAB_ADDR(3u), LAY_TAB_HDR_ADDR(3u)},
+	[SIG_AN3] = {LAY_TAB_ADDR(4u), LAY_TAB_HDR_ADDR(4u)},
+	[SIG_AN4] = {LAY_TAB_ADDR(5u), LAY_TAB_HDR_ADDR(5u)},
 };
 
 // EEPROM address of encoding format structure for each signal.
 // Each of these addresses point to a SigFmt structure in the EEPROM.
 static const EepromAddr sigFmtAddrs[NSIG] = {
-	[SIG_TACH] = NSIG*TAB_SIZE + 0ul*SER_SIGFMT_SIZE, // tachometer
-	[SIG_SPEED] = NSIG*TAB_SIZE + 1ul*SER_SIGFMT_SIZE, // speedometer
-	[SIG_AN1] = NSIG*TAB_SIZE + 2ul*SER_SIGFMT_SIZE, // analog channels...
-	[SIG_AN2] = NSIG*TAB_SIZE + 3ul*SER_SIGFMT_SIZE,
-	[SIG_AN3] = NSIG*TAB_SIZE + 4ul*SER_SIGFMT_SIZE,
-	[SIG_AN4] = NSIG*TAB_SIZE + 5ul*SER_SIGFMT_SIZE,
+	[SIG_TACH] = LAY_SIGFMT_ADDR(0u), // tachometer
+	[SIG_SPEED] = LAY_SIGFMT_ADDR(1u), // speedometer
+	[SIG_AN1] = LAY_SIGFMT_ADDR(2u), // analog channels...
+	[SIG_AN2] = LAY_SIGFMT_ADDR(3u),
+	[SIG_AN3] = LAY_SIGFMT_ADDR(4u),
+	[SIG_AN4] = LAY_SIGFMT_ADDR(5u),
 };
 
 // Encoding format and CAN ID of each signal
-static volatile SigFmt sigFmts[NSIG];
+static SigFmt sigFmts[NSIG];
+
+// Extraction plan of each signal, compiled from sigFmts
+static SigPlan sigPlans[NSIG];
+
+// Signals carried by each configured CAN ID, built from sigFmts
+static Dispatch dispatch;
+
+// A signal's ID changed: RXB1's filters are to be set again
+static bool sigIdsChanged;
+
+// Last raw value and output value of each signal
+static Memo memos[NSIG];
+
+// Newest value of each signal, waiting for its turn to drive the gauge
+static Sched sched;
+
+// Damping between each signal's looked-up value and its output
+static Damp damps[NSIG];
+
+// Errors handling frames, reported in a summary now and then
+static ErrLog errLog;
+
+// Samples of the signals, off unless asked for
+static Telem telem;
+
+#ifdef PROFILE
+// Time spent in the ISR, and in the main loop
+static Prof prof;
+
+// Time taken by each signal from frame to gauge
+static Trace trace;
+#endif
+
+// Bit timing in use, and how it was found
+static BaudResult baud;
+
+// Received frames waiting to be handled by the main loop.
+// Filled by the ISR so frame handling never delays the timer interrupts.
+static FrameQ rxq;
+
+static volatile U16 tmr1Reload = 0u;
+static volatile U8 tachSegs = 1u;
+static volatile U32 speedInc = 0ul; // phase increment per TMR2 tick
+
+// Map each signal's CAN ID to the signal.
+// Signals whose format is invalid are left out.
+static void
+buildDispatch(void) {
+	Signal sig;
 
-static volatile U16 tmr1Start = 0u;
-static volatile U16 tmr2Period = 0u;
+	dispInit(&dispatch);
+	for (sig = 0u; sig < NSIG; sig++) {
+		if (sigPlans[sig].isValid) {
+			(void)dispAdd(&dispatch, &sigFmts[sig].id, sig); // NSIG <= DISP_MAX_SIGS
+		}
+	}
+}
 
 // Load signals' encoding formats and CAN IDs from EEPROM
 static Status
 loadSigFmts(void) {
-	U8 oldGie, k;
+	U8 k;
+	Status status;
+
+	for (k = 0u; k < NSIG; k++) {
+		status = serReadSigFmt(sigFmtAddrs[k], &sigFmts[k]);
+		if (status != OK) {
+			return ERR;
+		}
+		(void)sigCompile(&sigFmts[k], &sigPlans[k]); // invalid if unset
+	}
+	buildDispatch();
+
+	return OK;
+}
+
+// Load tables' headers from EEPROM
+static Status
+loadTabs(void) {
+	U8 k;
 	Status status;
 
-	// Disable interrupts so the volatile address pointers can be passed safely
-	oldGie = GIE;
-	GIE = 0;
+	for (k = 0u; k < NSIG; k++) {
+		status = tabInit(&tbls[k]);
+		if (status != OK) {
+			return ERR;
+		}
+	}
+
+	return OK;
+}
 
+// Load the signals' update rates from EEPROM.
+static Status
+loadRates(void) {
+	U8 k, rate;
+	Status status;
+
+	schedInit(&sched);
 	for (k = 0u; k < NSIG; k++) {
-		status = serReadSigFmt(sigFmtAddrs[k], (SigFmt *)&sigFmts[k]);
+		status = eepromRead(LAY_RATE_ADDR(k), &rate, 1u);
 		if (status != OK) {
-			INTCONbits.GIE = oldGie; // restore previous interrupt setting
 			return ERR;
 		}
+		schedSetRate(&sched, k, rate); // erased reads as SCHED_RATE_DEFAULT
 	}
+	return OK;
+}
 
-	// Restore previous interrupt setting
-	INTCONbits.GIE = oldGie;
+// Load the signals' damping settings from EEPROM.
+static Status
+loadDamps(void) {
+	U8 k, buf[3u];
+	Status status;
 
+	for (k = 0u; k < NSIG; k++) {
+		dampInit(&damps[k]);
+		status = eepromRead(LAY_DAMP_ADDR(k), buf, sizeof(buf));
+		if (status != OK) {
+			return ERR;
+		}
+		if (buf[0u] > DAMP_MAX_SHIFT) { // erased: off
+			continue;
+		}
+		dampConfig(&damps[k], buf[0u], deserU16Be(buf+1u));
+	}
 	return OK;
 }
 
+// Program RXB1's mask and filters to accept the signals' IDs.
+// If they can't be covered, RXB1 accepts everything; either way,
+// received frames are still matched against the signals in software.
+static void
+setSigFilters(void) {
+	U8 sel[NSIG]; // signals to cover: their IDs are read in place
+	FiltCover cover;
+	CanMode mode;
+	U8 k, n;
+
+	n = 0u;
+	for (k = 0u; k < NSIG; k++) {
+		if (sigPlans[k].isValid) {
+			sel[n++] = k;
+		}
+	}
+	(void)filtCover(&sigFmts[0u].id, sizeof(sigFmts[0u]), sel, n, &cover);
+
+	(void)canConfigBegin(&mode); // drops frames nobody acknowledges
+	canSetMask1(&cover.mask);
+	canSetFilter2(&cover.filters[0u]);
+	canSetFilter3(&cover.filters[1u]);
+	canSetFilter4(&cover.filters[2u]);
+	canSetFilter5(&cover.filters[3u]);
+	canConfigEnd(mode);
+}
+
 // Transmit an error code (typically a line number) to the CAN bus.
+// Only for errors at power-up; later ones go to errLog.
 static void
 txErrFrame(Status err) {
 	CanFrame frame;
@@ -141,7 +278,56 @@ txErrFrame(Status err) {
 	frame.dlc = 2u;
 	frame.data[0u] = (err >> 8u) & 0xFF;
 	frame.data[1u] = (err >> 0u) & 0xFF;
-	(void)canTx(&frame);
+	(void)canTx(&frame, CAN_PRIO_HIGH);
+}
+
+// Transmit a summary of errLog.
+static Status
+txErrSummary(void) {
+	CanFrame frame;
+
+	frame.id = (CanId){.isExt = true, .eid = ERR_CAN_ID};
+	frame.rtr = false;
+	frame.dlc = 6u;
+	serU16Be(frame.data, errLog.total);
+	serU16Be(frame.data+2u, errLog.lost);
+	serU16Be(frame.data+4u, errLog.last);
+	return canTx(&frame, CAN_PRIO_MEDIUM_LOW);
+}
+
+// Transmit a sample of a signal: its raw value, the value it was looked
+// up as, and the value output.
+static Status
+txTelem(Signal sig) {
+	CanFrame frame;
+
+	if (sig >= NSIG || !memos[sig].hasRaw) {
+		return OK; // nothing received yet
+	}
+	frame.id = (CanId){.isExt = true, .eid = TELEM_CAN_ID | (sig & 0xF)};
+	frame.rtr = false;
+	frame.dlc = 8u;
+	serU32Be(frame.data, *(U32 *)&memos[sig].raw);
+	serU16Be(frame.data+4u, memos[sig].val);
+	serU16Be(frame.data+6u, dampOut(&damps[sig]));
+	return canTx(&frame, CAN_PRIO_LOW);
+}
+
+// Report the bit timing in use.
+static void
+txBaudFrame(const BaudResult *baud) {
+	CanFrame frame;
+
+	frame.id = (CanId){.isExt = true, .eid = BAUD_CTRL_CAN_ID};
+	frame.rtr = false;
+	frame.dlc = 6u;
+	frame.data[0u] = baud->timing.cnf[0u];
+	frame.data[1u] = baud->timing.cnf[1u];
+	frame.data[2u] = baud->timing.cnf[2u];
+	frame.data[3u] = baud->locked;
+	frame.data[4u] = (baud->waitMs >> 8u) & 0xFF;
+	frame.data[5u] = (baud->waitMs >> 0u) & 0xFF;
+	(void)canTx(&frame, CAN_PRIO_MEDIUM_HIGH);
 }
 
 static void
@@ -150,26 +336,67 @@ reset(void) {
 	asm("RESET");
 }
 
+static void handleFrame(const CanFrame *frame);
+static Status driveGauge(Signal sig, I32 raw);
+static Status setOutput(Signal sig, U16 val);
+
 void
 main(void) {
 	Status status;
+	CanFrame frame;
+	BaudTiming cached;
+	U8 k, sig, dampDiv;
+	I32 raw;
+	U16 val;
 
 	sysInit();
 	spiInit();
 	canInit();
 	dacInit();
 	eepromInit();
+	fqInit(&rxq);
+
+	// Find the bus's bit rate, trying the last one found first
+	status = eepromRead(LAY_BAUD_ADDR, cached.cnf, sizeof(cached.cnf));
+	if (status != OK || !baudValid(&cached)) {
+		cached = (BaudTiming){{CAN_TIMING}};
+	}
+	baudDetect(&cached, &baud); // masks are still clear
 
 	// Setup MCP2515 CAN controller
-	canSetBitTiming(CAN_TIMING);
 	canSetMask0(&rxb0Mask); // RXB0 receives control messages
-	canSetFilter0(&tblCtrlFilter); // Table Control Frames
-	canSetFilter1(&sigCtrlFilter); // Signal Control Frames
-	canSetMask1(&rxb1Mask); // RXB1 receives signal values
-		// RXB1 messages are filtered in software
+	canSetFilter0(&ctrlFilter); // control frames
+	canSetFilter1(&ctrlFilter); // RXF1 is unused
 	canIE(true); // enable interrupts on MCP2515's INT pin
 	canSetMode(CAN_MODE_NORMAL);
 
+	// Convert the EEPROM from an older firmware's layout
+	status = layMigrate();
+	if (status != OK) {
+		txErrFrame(ERR);
+		reset();
+	}
+
+	// Remember the bit rate for the next power-up
+	if (baud.locked && memcmp(baud.timing.cnf, cached.cnf, sizeof(cached.cnf)) != 0) {
+		status = eepromWrite(LAY_BAUD_ADDR, baud.timing.cnf, sizeof(baud.timing.cnf));
+		if (status != OK) {
+			txErrFrame(ERR);
+		}
+	}
+	txBaudFrame(&baud);
+
+	// Nothing looked up yet
+	for (k = 0u; k < NSIG; k++) {
+		memoInit(&memos[k]);
+	}
+	errLogInit(&errLog);
+	telemInit(&telem);
+#ifdef PROFILE
+	profInit(&prof);
+	traceInit(&trace);
+#endif
+
 	// Load signals' encoding formats and CAN IDs from EEPROM
 	status = loadSigFmts();
 	if (status != OK) {
@@ -177,22 +404,114 @@ main(void) {
 		reset();
 	}
 
+	// Load tables' headers from EEPROM
+	status = loadTabs();
+	if (status != OK) {
+		txErrFrame(status);
+		reset();
+	}
+
+	// Load signals' update rates from EEPROM
+	status = loadRates();
+	if (status != OK) {
+		txErrFrame(status);
+		reset();
+	}
+
+	// Load signals' damping from EEPROM
+	status = loadDamps();
+	if (status != OK) {
+		txErrFrame(status);
+		reset();
+	}
+
+	// RXB1 receives signal values
+	setSigFilters();
+
 	// Setup TMR1 for tachometer
-	T1CON = 0x31; // source=Fosc/4, prescaler=1:8, enable=1
+	T1CON = 0x30; // source=Fosc/4, prescaler=1:8, enable=0 until driven
 
 	// Setup TMR2 for speedometer
-	T2CON = 0x7F; // postscaler=1:16, enable=1, prescaler=1:64
+	T2CON = 0x7B; // postscaler=1:16, enable=0 until driven, prescaler=1:64
 	PR2 = 10u-1u; // period = PR2+1
 
+	// Setup TMR0 to tick the gauge update scheduler, polled
+	OPTION_REG = (OPTION_REG & 0xC0) | 0x05; // source=Fosc/4, prescaler=1:64
+
 	// Enable interrupts
 	INTCON = 0x00; // clear flags
 	INTEDG = 0; // interrupt on falling edge of INT pin
 	INTE = 1; // enable INT pin
+	// The MCP2515 may have held INT low since before its edge was cleared
+	// above: frames or errors pending since canIE(true) would never
+	// interrupt. Run the ISR's drain once to service them.
+	INTF = 1;
 	PEIE = 1; // enable peripheral interrupts
 	GIE = 1; // enable global interrupts
 
+	dampDiv = 0u;
 	for (;;) {
+		PROF_IDLE(&prof);
+
+		// The SPI bus is shared with the ISR,
+		// so hold off CAN interrupts while using it.
+		// The timer interrupts stay enabled.
+		if (fqPop(&rxq, &frame) == OK) {
+			INTE = 0;
+			TRACE_POP(&trace, rxq.tail - 1u); // arrival of the frame
+			handleFrame(&frame);
+			if (sigIdsChanged) {
+				sigIdsChanged = false;
+				setSigFilters();
+			}
+			INTE = 1;
+		}
 
+		// Drive the gauges with the newest values that are due
+		if (TMR0IF) {
+			TRACE_TICK(&trace); // clears TMR0IF
+			schedTick(&sched);
+			errLogTick(&errLog);
+			telemTick(&telem);
+			PROF_TICK(&prof);
+			TRACE_COLLECT(&trace);
+
+			// Move damped outputs towards their values
+			if (++dampDiv >= DAMP_TICK_DIV) {
+				dampDiv = 0u;
+				INTE = 0;
+				for (k = 0u; k < NSIG; k++) {
+					if (dampStep(&damps[k], &val)) {
+						(void)setOutput(k, val);
+					}
+				}
+				(void)dacCommit(); // the analog gauges move together
+				INTE = 1;
+			}
+		}
+		if (schedNext(&sched, &sig, &raw)) {
+			INTE = 0;
+			(void)driveGauge(sig, raw);
+			(void)dacCommit();
+			INTE = 1;
+		}
+
+		// Report now and then
+		if (errLogDue(&errLog)) {
+			INTE = 0;
+			(void)txErrSummary();
+			INTE = 1;
+		}
+		if (telemNext(&telem, &sig)) {
+			INTE = 0;
+			(void)txTelem(sig);
+			INTE = 1;
+		}
+
+		// Write calibration data behind
+		INTE = 0;
+		eepromPoll();
+		INTE = 1;
 	}
 }
 
@@ -225,23 +544,102 @@ handleTblCtrlFrame(const CanFrame *frame) {
 		response.dlc = 6u;
 		serU32Be(response.data, key);
 		serU16Be(response.data+4u, val);
-		return canTx(&response);
+		return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
 	} else { // DATA
 		if (frame->dlc != 6u) {
 			return ERR;
 		}
 		key = deserU32Be(frame->data);
 		val = deserU16Be(frame->data+4u);
+		memoInvalidate(&memos[tab]);
 		return tabWrite(&tbls[tab], row, key, val);
 	}
 }
 
+// Transmit the response to a Grid Control REMOTE FRAME:
+// a DATA FRAME containing the requested header or block of values.
+static Status
+respondGridCtrl(U8 tab, U8 blk) {
+	CanFrame response;
+	TabGrid grid;
+	U16 vals[GRID_VALS_PER_FRAME];
+	U8 k;
+	Status status;
+
+	response.id = (CanId){
+		.isExt = true,
+		.eid = GRID_CTRL_CAN_ID | ((tab << 5u) & 0xE0) | (blk & 0x1F)};
+	response.rtr = false;
+
+	if (blk == GRID_HDR_BLOCK) {
+		status = tabReadGrid(&tbls[tab], &grid);
+		if (status != OK) {
+			return ERR;
+		}
+		response.dlc = 6u;
+		serU32Be(response.data, *(U32 *)&grid.start);
+		response.data[4u] = grid.shift;
+		response.data[5u] = grid.len;
+	} else {
+		status = tabReadVals(&tbls[tab], blk*GRID_VALS_PER_FRAME, vals, GRID_VALS_PER_FRAME);
+		if (status != OK) {
+			return ERR;
+		}
+		response.dlc = 2u*GRID_VALS_PER_FRAME;
+		for (k = 0u; k < GRID_VALS_PER_FRAME; k++) {
+			serU16Be(response.data + 2u*k, vals[k]);
+		}
+	}
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+}
+
+// Handle a Grid Control Frame.
+// See `doc/datafmt.pdf'
+static Status
+handleGridCtrlFrame(const CanFrame *frame) {
+	U8 tab, blk, k;
+	U32 ustart;
+	TabGrid grid;
+	U16 vals[GRID_VALS_PER_FRAME];
+
+	// Extract table and block indices from ID
+	tab = (frame->id.eid & 0xE0) >> 5u;
+	blk = frame->id.eid & 0x1F;
+	if (tab >= NSIG
+		|| (blk != GRID_HDR_BLOCK && blk >= TAB_GRID_LEN/GRID_VALS_PER_FRAME)) {
+		return ERR;
+	}
+
+	if (frame->rtr) { // REMOTE
+		return respondGridCtrl(tab, blk);
+	} else if (blk == GRID_HDR_BLOCK) { // DATA: header
+		if (frame->dlc != 6u) {
+			return ERR;
+		}
+		ustart = deserU32Be(frame->data);
+		grid.start = *(I32 *)&ustart;
+		grid.shift = frame->data[4u];
+		grid.len = frame->data[5u];
+		memoInvalidate(&memos[tab]);
+		return (tabWriteGrid(&tbls[tab], &grid) == OK) ? OK : ERR;
+	} else { // DATA: values
+		if (frame->dlc != 2u*GRID_VALS_PER_FRAME) {
+			return ERR;
+		}
+		for (k = 0u; k < GRID_VALS_PER_FRAME; k++) {
+			vals[k] = deserU16Be(frame->data + 2u*k);
+		}
+		memoInvalidate(&memos[tab]);
+		return tabWriteVals(&tbls[tab], blk*GRID_VALS_PER_FRAME, vals, GRID_VALS_PER_FRAME);
+	}
+}
+
 // Transmit the response to a Signal Control REMOTE FRAME.
 // The response is a Signal Control DATA FRAME containing the CAN ID
 // and encoding format of the requested signal.
 static Status
 respondSigCtrl(Signal sig) {
-	const volatile SigFmt *sigFmt;
+	const SigFmt *sigFmt;
 	CanFrame response;
 
 	if (sig >= NSIG) {
@@ -269,9 +667,10 @@ respondSigCtrl(Signal sig) {
 	response.data[4u] = sigFmt->start;
 	response.data[5u] = sigFmt->size;
 	response.data[6u] = (U8)((sigFmt->order & 0x1) << 7u)
-		| (U8)((sigFmt->isSigned) ? 0x40 : 0x00);
+		| (U8)((sigFmt->isSigned) ? 0x40 : 0x00)
+		| (U8)((sigFmt->isCode) ? 0x20 : 0x00);
 
-	return canTx(&response);
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
 }
 
 // Set the CAN ID and encoding format of a signal in response
@@ -309,6 +708,7 @@ setSigFmt(const CanFrame *frame) {
 	sigFmt.size = frame->data[5u];
 	sigFmt.order = (frame->data[6u] & 0x80) ? LITTLE_ENDIAN : BIG_ENDIAN;
 	sigFmt.isSigned = frame->data[6u] & 0x40;
+	sigFmt.isCode = frame->data[6u] & 0x20;
 
 	// Save to EEPROM
 	status = serWriteSigFmt(sigFmtAddrs[sig], &sigFmt);
@@ -317,7 +717,18 @@ setSigFmt(const CanFrame *frame) {
 	}
 
 	// Update copy in RAM
+	if (sigFmt.isCode != sigFmts[sig].isCode) {
+		memoForget(&memos[sig]); // same value, other units: output it again
+	} else {
+		memoInvalidate(&memos[sig]);
+	}
 	sigFmts[sig] = sigFmt;
+	(void)sigCompile(&sigFmts[sig], &sigPlans[sig]);
+	buildDispatch();
+
+	// Accept the new ID in hardware, from the main loop: covering the
+	// IDs is the deepest call, so it is kept off the handlers' stack
+	sigIdsChanged = true;
 
 	return OK;
 }
@@ -336,25 +747,158 @@ handleSigCtrlFrame(const CanFrame *frame) {
 	}
 }
 
+// Handle a Bit Timing Control Frame.
+// A new timing is acknowledged at the old rate before it is applied.
+static Status
+handleBaudCtrlFrame(const CanFrame *frame) {
+	BaudTiming timing;
+	Status status;
+
+	if (frame->rtr) { // REMOTE
+		txBaudFrame(&baud);
+		return OK;
+	}
+
+	// DATA
+	if (frame->dlc < 3u) {
+		return ERR;
+	}
+	timing = (BaudTiming){{frame->data[0u], frame->data[1u], frame->data[2u]}};
+	if (!baudValid(&timing)) {
+		return ERR;
+	}
+	status = eepromWrite(LAY_BAUD_ADDR, timing.cnf, sizeof(timing.cnf));
+	if (status != OK) {
+		return ERR;
+	}
+	baud = (BaudResult){.timing = timing, .locked = true};
+	txBaudFrame(&baud);
+	status = canRetime(timing.cnf[0u], timing.cnf[1u], timing.cnf[2u]);
+	if (status != OK) {
+		return ERR; // unsent frames were aborted, maybe the acknowledgement
+	}
+	return OK;
+}
+
+// Transmit the response to a Rate Control REMOTE FRAME: the signal's update rate.
+static Status
+respondRateCtrl(Signal sig) {
+	CanFrame response;
+
+	if (sig >= NSIG) {
+		return ERR;
+	}
+	response.id = (CanId){.isExt = true, .eid = RATE_CTRL_CAN_ID | (sig & 0xF)};
+	response.rtr = false;
+	response.dlc = 1u;
+	response.data[0u] = sched.boxes[sig].rate;
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+}
+
+// Handle a Rate Control Frame.
+static Status
+handleRateCtrlFrame(const CanFrame *frame) {
+	Signal sig;
+	U8 rate;
+	Status status;
+
+	sig = frame->id.eid & 0xF;
+	if (frame->rtr) { // REMOTE
+		return respondRateCtrl(sig);
+	}
+
+	// DATA
+	if (sig >= NSIG || frame->dlc < 1u) {
+		return ERR;
+	}
+	rate = frame->data[0u];
+	status = eepromWrite(LAY_RATE_ADDR(sig), &rate, 1u);
+	if (status != OK) {
+		return ERR;
+	}
+	schedSetRate(&sched, sig, rate);
+	return OK;
+}
+
+// Transmit the response to a Damping Control REMOTE FRAME: the signal's damping.
+static Status
+respondDampCtrl(Signal sig) {
+	CanFrame response;
+
+	if (sig >= NSIG) {
+		return ERR;
+	}
+	response.id = (CanId){.isExt = true, .eid = DAMP_CTRL_CAN_ID | (sig & 0xF)};
+	response.rtr = false;
+	response.dlc = 3u;
+	response.data[0u] = damps[sig].shift;
+	serU16Be(response.data+1u, damps[sig].slew);
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+}
+
+// Handle a Damping Control Frame.
+static Status
+handleDampCtrlFrame(const CanFrame *frame) {
+	Signal sig;
+	U8 buf[3u];
+	Status status;
+
+	sig = frame->id.eid & 0xF;
+	if (frame->rtr) { // REMOTE
+		return respondDampCtrl(sig);
+	}
+
+	// DATA
+	if (sig >= NSIG || frame->dlc != 3u || frame->data[0u] > DAMP_MAX_SHIFT) {
+		return ERR;
+	}
+	memcpy(buf, frame->data, sizeof(buf));
+	status = eepromWrite(LAY_DAMP_ADDR(sig), buf, sizeof(buf));
+	if (status != OK) {
+		return ERR;
+	}
+	dampConfig(&damps[sig], buf[0u], deserU16Be(buf+1u));
+	return OK;
+}
+
 // Set frequency of tachometer output signal.
 static void
 driveTach(U16 pulsePerMin) {
-	if (pulsePerMin < MIN_TACH_PULSE_PER_MIN) {
+	TachTiming t;
+
+	if (waveTach(pulsePerMin, &t) != OK) {
+		TMR1ON = 0;
 		TMR1IE = 0;
+		TRACE_OUTPUT(&trace, SIG_TACH);
 	} else {
+		TMR1IE = 0; // tmr1Reload and tachSegs are shared with the ISR
+		tmr1Reload = t.reload;
+		tachSegs = t.segs;
+		if (!TMR1ON) {
+			TMR1 = t.reload; // a whole first segment
+		}
+		TRACE_ARM(&trace, SIG_TACH); // applied at the next overflow
 		TMR1IE = 1;
-		tmr1Start = (((U32)1ul<<16u) - (U32)TACH_FACTOR / (U32)pulsePerMin) & 0xFFFF;
+		TMR1ON = 1;
 	}
 }
 
 // Set frequency of speedometer output signal.
 static void
 driveSpeed(U16 pulsePerMin) {
-	if (pulsePerMin < MIN_SPEED_PULSE_PER_MIN) {
+	U32 inc;
+
+	inc = waveSpeed(pulsePerMin);
+	if (inc == 0ul) {
+		TMR2ON = 0;
 		TMR2IE = 0;
+		TRACE_OUTPUT(&trace, SIG_SPEED);
 	} else {
+		TMR2IE = 0; // speedInc is shared with the ISR
+		speedInc = inc;
+		TRACE_ARM(&trace, SIG_SPEED); // applied at the next tick
 		TMR2IE = 1;
-		tmr2Period = ((U32)SPEED_FACTOR / pulsePerMin) & 0xFFFF;
+		TMR2ON = 1;
 	}
 }
 
@@ -369,22 +913,46 @@ driveGauge(Signal sig, I32 raw) {
 		return ERR;
 	}
 
+	// Same raw value as last time: the output already shows it
+	if (memoHit(&memos[sig], raw)) {
+		TRACE_LOOKUP(&trace, sig);
+		TRACE_END(&trace, sig);
+		return OK;
+	}
+
 	// Lookup gauge waveform value in EEPROM table
 	status = tabLookup(&tbls[sig], raw, &val);
 	if (status != OK) {
+		TRACE_END(&trace, sig);
 		return ERR;
 	}
+	TRACE_LOOKUP(&trace, sig);
 
-	// TODO: remove
-	CanFrame frame;
-	frame.id = (CanId){.isExt=false, .sid=0x123};
-	frame.rtr = false;
-	frame.dlc = 7u;
-	frame.data[0u] = sig & 0xFF; // signal
-	U32 uraw = *(U32 *)&raw;
-	serU32Be(frame.data+1, uraw); // key
-	serU16Be(frame.data+5, val); // val
-	canTx(&frame);
+	// Output value unchanged
+	if (!memoStore(&memos[sig], raw, val)) {
+		TRACE_END(&trace, sig);
+		return OK;
+	}
+
+	// Damped: the main loop moves the output towards val, and the
+	// trace ends at the first step that moves it
+	if (!dampSet(&damps[sig], val)) {
+		if (damps[sig].settled) { // already there: no step will come
+			TRACE_END(&trace, sig);
+		}
+		return OK;
+	}
+
+	return setOutput(sig, val);
+}
+
+// Set the output signal being sent to one of the gauges.
+// Analog outputs are only staged; dacCommit() writes them.
+static Status
+setOutput(Signal sig, U16 val) {
+	if (sig >= SIG_AN1 && sig <= SIG_AN4 && !sigFmts[sig].isCode) {
+		val = dacCode(val); // millivolts
+	}
 
 	switch (sig) {
 	case SIG_TACH:
@@ -394,22 +962,24 @@ driveGauge(Signal sig, I32 raw) {
 		driveSpeed(val);
 		break;
 	case SIG_AN1:
-		dacSet1a(val);
+		dacStage(DAC_1A, val);
 		break;
 	case SIG_AN2:
-		dacSet1b(val);
+		dacStage(DAC_1B, val);
 		break;
 	case SIG_AN3:
-		dacSet2a(val);
+		dacStage(DAC_2A, val);
 		break;
 	case SIG_AN4:
-		dacSet2b(val);
+		dacStage(DAC_2B, val);
 		break;
 	default:
 		return ERR; // invalid signal
 	}
+	if (sig >= SIG_AN1) {
+		TRACE_OUTPUT(&trace, sig); // the caller commits it at once
+	}
 
-	// TODO
 	return OK;
 }
 
@@ -417,19 +987,22 @@ driveGauge(Signal sig, I32 raw) {
 static Status
 handleSigFrame(const CanFrame *frame) {
 	Status status, result;
+	DispSet sigs;
 	Signal sig;
 	I32 raw;
 
 	result = OK;
 
-	// Search for signal with this ID
-	// Exhaustive because message may contain multiple signals.
-	for (sig = 0u; sig < NSIG; sig++) {
-		if (canIdEq(&frame->id, (const CanId *)&sigFmts[sig].id)) {
+	// Signals in this message, if any.
+	// A message may contain multiple signals.
+	sigs = dispLookup(&dispatch, &frame->id);
+	for (sig = 0u; sigs != 0u; sig++, sigs >>= 1u) {
+		if (sigs & 1u) {
 			// Extract raw signal value from frame
-			status = sigPluck((const SigFmt *)&sigFmts[sig], frame, &raw);
+			status = sigExtract(&sigPlans[sig], frame, &raw);
 			if (status == OK) {
-				status = driveGauge(sig, raw); // generate output signal
+				TRACE_EXTRACT(&trace, sig);
+				schedPost(&sched, sig, raw); // the main loop drives the gauge
 			}
 			result |= status;
 		}
@@ -438,52 +1011,273 @@ handleSigFrame(const CanFrame *frame) {
 	return result;
 }
 
+// Transmit the response to a Memo Statistics REMOTE FRAME:
+// the signal's memo hits and misses.
+static Status
+respondMemoDiag(Signal sig) {
+	CanFrame response;
+
+	if (sig >= NSIG) {
+		return ERR;
+	}
+	response.id = (CanId){.isExt = true, .eid = MEMO_DIAG_CAN_ID | (sig & 0xF)};
+	response.rtr = false;
+	response.dlc = 6u;
+	serU16Be(response.data, memos[sig].rawHits);
+	serU16Be(response.data+2u, memos[sig].valHits);
+	serU16Be(response.data+4u, memos[sig].misses);
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+}
+
+#ifdef PROFILE
+// Transmit the response to a Profiler REMOTE FRAME. X=0..2: one ISR
+// source's times, which are then cleared. X=3: the CPU idle count.
+static Status
+respondProfDiag(U8 x) {
+	CanFrame response;
+	ProfSrc src;
+	bool gie;
+
+	response.id = (CanId){.isExt = true, .eid = PROF_DIAG_CAN_ID | (x & 0xF)};
+	response.rtr = false;
+	if (x == PROF_NSRC) { // CPU
+		response.dlc = 2u;
+		serU16Be(response.data, prof.last);
+		return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+	} else if (x > PROF_NSRC) {
+		return ERR;
+	}
+
+	gie = GIE;
+	GIE = 0; // the ISR records into it
+	profTake(&prof, x, &src);
+	GIE = gie;
+	response.dlc = 7u;
+	response.data[0u] = src.max;
+	serU16Be(response.data+1u, src.n);
+	serU32Be(response.data+3u, src.total);
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+}
+
+// Transmit the response to a Latency REMOTE FRAME: one frame per stage
+// with the signal's times, zero if it wasn't being traced. The signal
+// is then traced from now on, with its times cleared.
+static Status
+respondTraceDiag(Signal sig) {
+	CanFrame response;
+	U8 k;
+
+	if (sig >= NSIG) {
+		return ERR;
+	}
+	if (trace.sig != sig) {
+		traceSelect(&trace, sig); // no times yet
+	}
+	response.id = (CanId){.isExt = true, .eid = TRACE_DIAG_CAN_ID | (sig & 0xF)};
+	response.rtr = false;
+	response.dlc = 7u;
+	for (k = 0u; k < TRACE_NSTAGE; k++) {
+		response.data[0u] = k;
+		serU16Be(response.data+1u, trace.stages[k].max);
+		serU16Be(response.data+3u, traceMean(&trace.stages[k]));
+		serU16Be(response.data+5u, trace.stages[k].n);
+		if (canTx(&response, CAN_PRIO_MEDIUM_HIGH) != OK) {
+			return ERR;
+		}
+	}
+	traceSelect(&trace, sig); // clears them
+	return OK;
+}
+#endif
+
+// Handle a Diagnostic Frame: a REMOTE FRAME asking for statistics.
+static Status
+handleDiagFrame(const CanFrame *frame) {
+	if (!frame->rtr) {
+		return ERR;
+	}
+	switch (frame->id.eid & DIAG_KIND_MASK) {
+	case MEMO_DIAG_CAN_ID & DIAG_KIND_MASK:
+		return respondMemoDiag(frame->id.eid & 0xF);
+#ifdef PROFILE
+	case PROF_DIAG_CAN_ID & DIAG_KIND_MASK:
+		return respondProfDiag(frame->id.eid & 0xF);
+	case TRACE_DIAG_CAN_ID & DIAG_KIND_MASK:
+		return respondTraceDiag(frame->id.eid & 0xF);
+#endif
+	default:
+		return ERR;
+	}
+}
+
+// Transmit the response to a Telemetry Control REMOTE FRAME: the signals
+// reported and the rate.
+static Status
+respondTelemCtrl(void) {
+	CanFrame response;
+
+	response.id = (CanId){.isExt = true, .eid = TELEM_CTRL_CAN_ID};
+	response.rtr = false;
+	response.dlc = 2u;
+	response.data[0u] = telem.sigs;
+	response.data[1u] = telem.rate;
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+}
+
+// Handle a Telemetry Control Frame.
+static Status
+handleTelemCtrlFrame(const CanFrame *frame) {
+	if (frame->id.eid != TELEM_CTRL_CAN_ID) {
+		return OK; // a telemetry frame, maybe from another Interface
+	}
+	if (frame->rtr) { // REMOTE
+		return respondTelemCtrl();
+	}
+
+	// DATA
+	if (frame->dlc != 2u) {
+		return ERR;
+	}
+	telemConfig(&telem, frame->data[0u] & ((1u << NSIG) - 1u), frame->data[1u]);
+	return OK;
+}
+
+// Handle an Error Frame. A REMOTE FRAME reads and clears the log:
+// X=0 the summary and everything, X=1..ERRLOG_SLOTS one slot.
+static Status
+handleErrFrame(const CanFrame *frame) {
+	CanFrame response;
+	ErrSlot slot;
+	Status status;
+	U8 x;
+
+	if (!frame->rtr) {
+		return OK; // an error report, maybe from another Interface
+	}
+	x = frame->id.eid & 0xF;
+	if (x == 0u) {
+		status = txErrSummary();
+		errLogInit(&errLog);
+		return status;
+	}
+	if (!errLogTake(&errLog, x-1u, &slot)) {
+		return ERR;
+	}
+	response.id = (CanId){.isExt = true, .eid = ERR_CAN_ID | x};
+	response.rtr = false;
+	response.dlc = 4u;
+	serU16Be(response.data, slot.code);
+	serU16Be(response.data+2u, slot.count);
+	return canTx(&response, CAN_PRIO_MEDIUM_HIGH);
+}
+
+// Check whether a frame was accepted by RXB0's control filter.
+static bool
+isCtrlFrame(const CanFrame *frame) {
+	return frame->id.isExt
+		&& ((frame->id.eid & rxb0Mask.eid) == (ctrlFilter.eid & rxb0Mask.eid));
+}
+
+// Handle a control frame.
+static Status
+handleCtrlFrame(const CanFrame *frame) {
+	switch (frame->id.eid & CTRL_TYPE_MASK) {
+	case TAB_CTRL_CAN_ID & CTRL_TYPE_MASK: // calibration table control
+		return handleTblCtrlFrame(frame);
+	case SIG_CTRL_CAN_ID & CTRL_TYPE_MASK: // signal ID control
+		return handleSigCtrlFrame(frame);
+	case GRID_CTRL_CAN_ID & CTRL_TYPE_MASK: // grid table control
+		return handleGridCtrlFrame(frame);
+	case BAUD_CTRL_CAN_ID & CTRL_TYPE_MASK: // bit timing control
+		return handleBaudCtrlFrame(frame);
+	case RATE_CTRL_CAN_ID & CTRL_TYPE_MASK: // update rate control
+		return handleRateCtrlFrame(frame);
+	case DAMP_CTRL_CAN_ID & CTRL_TYPE_MASK: // damping control
+		return handleDampCtrlFrame(frame);
+	case TELEM_CTRL_CAN_ID & CTRL_TYPE_MASK: // telemetry control
+		return handleTelemCtrlFrame(frame);
+	case DIAG_CAN_ID & CTRL_TYPE_MASK: // diagnostics
+		return handleDiagFrame(frame);
+	case ERR_CAN_ID & CTRL_TYPE_MASK: // error log
+		return handleErrFrame(frame);
+	default:
+		return OK; // not for us
+	}
+}
+
+// Handle a frame taken from the receive queue.
+static void
+handleFrame(const CanFrame *frame) {
+	Status status;
+
+	if (isCtrlFrame(frame)) {
+		status = handleCtrlFrame(frame);
+		if (status != OK) {
+			errLogRecord(&errLog, status);
+		}
+	} else { // signal frame from RXB1
+		(void)handleSigFrame(frame);
+	}
+}
+
 void
 __interrupt() isr(void) {
 	static U8 tmr1Ctr = 0u;
-	static U16 tmr2Ctr = 0u;
+	static U32 speedPhase = 0ul;
 
 	U8 rxStatus;
 	CanFrame frame;
-	Status status;
 
-	if (INTF) { // CAN interrupt
-		rxStatus = canRxStatus();
-		switch (rxStatus & 0x7) { // check filter hit
-		case 0u: // RXF0: calibration table control
-			canReadRxb0(&frame);
-			status = handleTblCtrlFrame(&frame);
-			if (status != OK) {
-				txErrFrame(status);
-			}
-			break;
-		case 1u: // RXF1: signal ID control
-			canReadRxb0(&frame);
-			status = handleSigCtrlFrame(&frame);
-			if (status != OK) {
-				txErrFrame(status);
-			}
-			break;
-		default: // message in RXB1
-			canReadRxb1(&frame);
-			(void)handleSigFrame(&frame);
-		}
-		INTF = 0; // clear flag
-	}
-	if (TMR1IF) { // tachometer
-		if (++tmr1Ctr >= (TMR1_POST/EDGE_PER_PULSE)) {
+	// A flag is set even while its interrupt is disabled, e.g. while
+	// the main loop updates what the handler reads: check both.
+	if (TMR1IE && TMR1IF) { // tachometer -- first, so its edges wait on nothing else
+		PROF_START(&prof);
+		// Add to the count rather than overwrite it: the time taken to
+		// get here is already counted.
+		TMR1ON = 0;
+		TMR1 += tmr1Reload;
+		TMR1ON = 1;
+		TMR1IF = 0;
+		TRACE_APPLY(&trace, SIG_TACH);
+		if (++tmr1Ctr >= tachSegs) {
 			tmr1Ctr = 0u;
 			TACH_PIN ^= 1; // toggle tach output
 		}
-		TMR1H = (tmr1Start>>8u)&0xFF; // reset timer
-		TMR1L = (tmr1Start>>0u)&0xFF;
-		TMR1IF = 0;
+		PROF_STOP(&prof, PROF_TMR1);
+	}
+	if (INTE && INTF) { // CAN interrupt
+		PROF_START(&prof);
+		// INT is level-sensitive but only its falling edge interrupts,
+		// so service the MCP2515 until nothing holds INT low.
+		// Only copy frames out of the MCP2515 here;
+		// they are handled later by the main loop.
+		INTF = 0; // an edge from here on interrupts again
+		do {
+			while ((rxStatus = canRxStatus()) & 0xC0) {
+				// RXB0 first: RXB1 may hold a frame that rolled over from it
+				if (rxStatus & 0x40) {
+					canReadRxb0(&frame);
+					TRACE_RX(&trace, rxq.head);
+					(void)fqPush(&rxq, &frame); // overflow is counted by the queue
+				}
+				if (rxStatus & 0x80) {
+					canReadRxb1(&frame);
+					TRACE_RX(&trace, rxq.head);
+					(void)fqPush(&rxq, &frame);
+				}
+			}
+			canTxService(); // refill transmit buffers
+		} while (canErrService()); // count overflows
+		PROF_STOP(&prof, PROF_INT);
 	}
-	if (TMR2IF) { // speedometer
-		if (++tmr2Ctr >= (tmr2Period/EDGE_PER_PULSE)) {
-			tmr2Ctr = 0u;
+	if (TMR2IE && TMR2IF) { // speedometer
+		PROF_START(&prof);
+		TRACE_APPLY(&trace, SIG_SPEED);
+		speedPhase += speedInc;
+		if (speedPhase < speedInc) { // carry: one edge per 2^32
 			SPEED_PIN ^= 1; // toggle speedometer output
 		}
 		TMR2IF = 0;
+		PROF_STOP(&prof, PROF_TMR2);
 	}
 }
@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#include "memo.h"
+
+static void
+count(U16 *n) {
+	if (*n < 0xFFFF) {
+		(*n)++;
+	}
+}
+
+void
+memoInit(Memo *m) {
+	m->hasRaw = false;
+	m->hasVal = false;
+	m->rawHits = 0u;
+	m->valHits = 0u;
+	m->misses = 0u;
+}
+
+bool
+memoHit(Memo *m, I32 raw) {
+	if (m->hasRaw && m->raw == raw) {
+		count(&m->rawHits);
+		return true;
+	}
+	count(&m->misses);
+	return false;
+}
+
+bool
+memoStore(Memo *m, I32 raw, U16 val) {
+	m->raw = raw;
+	m->hasRaw = true;
+	if (m->hasVal && m->val == val) {
+		count(&m->valHits);
+		return false;
+	}
+	m->val = val;
+	m->hasVal = true;
+	return true;
+}
+
+void
+memoInvalidate(Memo *m) {
+	m->hasRaw = false;
+}
+
+void
+memoForget(Memo *m) {
+	m->hasRaw = false;
+	m->hasVal = false;
+}
@@ -0,0 +1,52 @@
+/* Last-value memo of a signal.
+ *
+ * Signals are often broadcast faster than they change, so the same raw
+ * value arrives frame after frame. The memo keeps the last raw value
+ * and the output value it was looked up as, so that:
+ *  - a raw value equal to the last one skips the table lookup, and
+ *  - an output value equal to the one driven skips the output update.
+ *
+ * Writing the signal's table or format invalidates the raw value; the
+ * output value stays, since the gauge still shows it. A format that
+ * changes the output's units (millivolts or DAC codes) forgets both.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "memo.h"
+ */
+
+typedef struct {
+	I32 raw; // last raw value looked up
+	U16 val; // output value driven
+	bool hasRaw; // raw was looked up as val
+	bool hasVal; // val is driven
+
+	// Statistics, saturating
+	U16 rawHits; // lookups skipped
+	U16 valHits; // output updates skipped
+	U16 misses; // raw values looked up
+} Memo;
+
+// Forget everything, and clear the statistics.
+void memoInit(Memo *m);
+
+// Check whether raw is the last raw value looked up.
+// If so, the output already shows its value: nothing needs doing.
+bool memoHit(Memo *m, I32 raw);
+
+// Record that raw was looked up as val.
+// Returns true if the output must be set to val.
+bool memoStore(Memo *m, I32 raw, U16 val);
+
+// Forget the last raw value, e.g. because the table changed.
+void memoInvalidate(Memo *m);
+
+// Forget the output value too, e.g. because its units changed:
+// the next one is output even if it is the same number.
+void memoForget(Memo *m);
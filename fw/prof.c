@@ -0,0 +1,63 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#include "prof.h"
+
+#ifdef PROFILE
+
+void
+profInit(Prof *p) {
+	U8 k;
+
+	for (k = 0u; k < PROF_NSRC; k++) {
+		p->srcs[k].max = 0u;
+		p->srcs[k].n = 0u;
+		p->srcs[k].total = 0ul;
+	}
+	p->start = 0u;
+	p->passes = 0u;
+	p->ticks = 0u;
+	p->last = 0u;
+}
+
+void
+profRecord(Prof *p, U8 src, U8 t) {
+	ProfSrc *s;
+
+	if (src >= PROF_NSRC) {
+		return;
+	}
+	s = &p->srcs[src];
+	if (t > s->max) {
+		s->max = t;
+	}
+	if (s->n < 0xFFFF) {
+		s->n++;
+		s->total += t;
+	}
+}
+
+void
+profTake(Prof *p, U8 src, ProfSrc *s) {
+	if (src >= PROF_NSRC) {
+		return;
+	}
+	*s = p->srcs[src];
+	p->srcs[src].max = 0u;
+	p->srcs[src].n = 0u;
+	p->srcs[src].total = 0ul;
+}
+
+void
+profTick(Prof *p) {
+	if (++p->ticks < PROF_WINDOW) {
+		return;
+	}
+	p->last = p->passes;
+	p->passes = 0u;
+	p->ticks = 0u;
+}
+
+#endif // PROFILE
@@ -0,0 +1,83 @@
+/* Profiler: ISR time per source and a CPU idle count.
+ *
+ * Compiled in only if PROFILE is defined (make PROFILE=1); otherwise the
+ * PROF_x macros expand to nothing and the Prof type doesn't exist.
+ *
+ * Time is read from TMR0, which the scheduler already runs free at
+ * Fosc/4/64, so one count is 64 instruction cycles (5.3us). Each ISR
+ * source's handler is timed from PROF_START to PROF_STOP, leaving out
+ * the context save and restore; handlers longer than 255 counts (1.4ms)
+ * wrap. Per source, the profiler keeps the longest time, the count and
+ * the total, so the mean is total/count. The count saturates at 65535,
+ * and the total stops with it.
+ *
+ * The idle count is of passes of the main loop, which get longer and
+ * fewer the more work there is to do, in the main loop or in the ISR.
+ * PROF_IDLE counts them and every PROF_WINDOW ticks the count of the
+ * window is kept. Compared to the count on a quiet bus, it gives the
+ * CPU utilization.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <xc.h>
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "prof.h"
+ */
+
+#ifdef PROFILE
+
+enum {
+	PROF_INT = 0, // CAN interrupt
+	PROF_TMR1, // tachometer
+	PROF_TMR2, // speedometer
+	PROF_NSRC,
+
+	PROF_WINDOW = 732, // ticks of SCHED_TICK_HZ: 1s
+};
+
+typedef struct {
+	U8 max; // longest time, TMR0 counts
+	U16 n; // times counted, saturating
+	U32 total; // of the times counted
+} ProfSrc;
+
+typedef struct {
+	ProfSrc srcs[PROF_NSRC];
+	U8 start; // TMR0 at PROF_START
+
+	U16 passes; // main loop passes in this window, saturating
+	U16 ticks; // into this window
+	U16 last; // passes in the last window
+} Prof;
+
+// Clear everything.
+void profInit(Prof *p);
+
+// Count a handler that took t TMR0 counts.
+void profRecord(Prof *p, U8 src, U8 t);
+
+// Take a copy of a source's times and clear them.
+// Must not be interrupted by the ISR.
+void profTake(Prof *p, U8 src, ProfSrc *s);
+
+// Count one tick of SCHED_TICK_HZ.
+void profTick(Prof *p);
+
+#define PROF_START(p) ((p)->start = TMR0)
+#define PROF_STOP(p, src) profRecord((p), (src), (U8)(TMR0 - (p)->start))
+#define PROF_IDLE(p) do { if ((p)->passes < 0xFFFF) { (p)->passes++; } } while (0)
+#define PROF_TICK(p) profTick(p)
+
+#else
+
+#define PROF_START(p)
+#define PROF_STOP(p, src)
+#define PROF_IDLE(p)
+#define PROF_TICK(p)
+
+#endif // PROFILE
@@ -0,0 +1,91 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#include "sched.h"
+
+void
+schedInit(Sched *s) {
+	U8 k;
+
+	for (k = 0u; k < SCHED_MAX_SIGS; k++) {
+		s->boxes[k].full = false;
+		s->boxes[k].wait = 0u;
+#ifdef PROFILE
+		s->boxes[k].coalesced = 0u;
+#endif
+		schedSetRate(s, k, SCHED_RATE_DEFAULT);
+	}
+	s->next = 0u;
+}
+
+void
+schedSetRate(Sched *s, U8 sig, U8 rate) {
+	Mailbox *box;
+	U8 hz;
+
+	if (sig >= SCHED_MAX_SIGS) {
+		return;
+	}
+	box = &s->boxes[sig];
+	box->rate = rate;
+	if (rate == SCHED_RATE_ASAP) {
+		box->period = 0u;
+	} else {
+		hz = (rate == SCHED_RATE_DEFAULT) ? SCHED_DEFAULT_HZ : rate;
+		box->period = (SCHED_TICK_HZ + hz/2u) / hz; // rounded
+	}
+	if (box->wait > box->period) {
+		box->wait = box->period;
+	}
+}
+
+void
+schedPost(Sched *s, U8 sig, I32 raw) {
+	Mailbox *box;
+
+	if (sig >= SCHED_MAX_SIGS) {
+		return;
+	}
+	box = &s->boxes[sig];
+#ifdef PROFILE
+	if (box->full && box->coalesced < 0xFFFF) { // saturate
+		box->coalesced++;
+	}
+#endif
+	box->raw = raw;
+	box->full = true;
+}
+
+void
+schedTick(Sched *s) {
+	U8 k;
+
+	for (k = 0u; k < SCHED_MAX_SIGS; k++) {
+		if (s->boxes[k].wait > 0u) {
+			s->boxes[k].wait--;
+		}
+	}
+}
+
+bool
+schedNext(Sched *s, U8 *sig, I32 *raw) {
+	Mailbox *box;
+	U8 n, k;
+
+	k = s->next;
+	for (n = 0u; n < SCHED_MAX_SIGS; n++) {
+		box = &s->boxes[k];
+		if (box->full && box->wait == 0u) {
+			box->full = false;
+			box->wait = box->period;
+			*sig = k;
+			*raw = box->raw;
+			s->next = (k+1u) % SCHED_MAX_SIGS;
+			return true;
+		}
+		k = (k+1u) % SCHED_MAX_SIGS;
+	}
+	return false;
+}
@@ -0,0 +1,65 @@
+/* Gauge update scheduler.
+ *
+ * Gauges can't follow more than a few tens of updates per second, but
+ * their signals may arrive much faster. Each signal has a mailbox that
+ * holds only its newest raw value: receiving a frame just posts into
+ * it, replacing any value not yet taken. The main loop ticks the
+ * scheduler from a timer and takes values from it at most at each
+ * signal's rate, so the work done on the gauges is bounded by the rates
+ * whatever the bus load.
+ *
+ * A value arriving after a quiet spell is taken at once; only the ones
+ * that follow it wait for the signal's period.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "sched.h"
+ */
+
+enum {
+	SCHED_MAX_SIGS = 6, // the gauges: one mailbox each
+	SCHED_TICK_HZ = 732, // TMR0 overflows: 12MHz / 64 / 256
+	SCHED_RATE_ASAP = 0, // take each value as it arrives
+	SCHED_RATE_DEFAULT = 0xFF, // SCHED_DEFAULT_HZ, also if erased
+	SCHED_DEFAULT_HZ = 50,
+};
+
+typedef struct {
+	I32 raw; // newest value
+	bool full; // raw not yet taken
+	U8 rate; // Hz, or SCHED_RATE_x, as set
+	U16 period; // ticks between updates
+	U16 wait; // ticks until the next update may be taken
+
+#ifdef PROFILE
+	// Statistics, saturating
+	U16 coalesced; // values replaced before being taken
+#endif
+} Mailbox;
+
+typedef struct {
+	Mailbox boxes[SCHED_MAX_SIGS];
+	U8 next; // where schedNext resumes its round
+} Sched;
+
+// Empty the mailboxes and set every rate to SCHED_RATE_DEFAULT.
+void schedInit(Sched *s);
+
+// Set a signal's update rate: 1-254Hz, or SCHED_RATE_x.
+void schedSetRate(Sched *s, U8 sig, U8 rate);
+
+// Post a signal's newest raw value.
+void schedPost(Sched *s, U8 sig, I32 raw);
+
+// Count one tick of SCHED_TICK_HZ.
+void schedTick(Sched *s);
+
+// Take a value that is due, going round the signals in turn.
+// Returns false if none is.
+bool schedNext(Sched *s, U8 *sig, I32 *raw);
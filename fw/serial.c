@@ -89,7 +89,8 @@ serWriteSigFmt(EepromAddr addr, const SigFmt *sig) {
 	buf[0u] = sig->start;
 	buf[1u] = sig->size;
 	buf[2u] = (U8)((sig->order & 0x01) << 7u)
-		| ((sig->isSigned) ? 0x40 : 0x00);
+		| ((sig->isSigned) ? 0x40 : 0x00)
+		| ((sig->isCode) ? 0x20 : 0x00);
 	return eepromWrite(addr+SER_CANID_SIZE, buf, sizeof(buf));
 }
 
@@ -113,6 +114,7 @@ serReadSigFmt(EepromAddr addr, SigFmt *sig) {
 	sig->size = buf[1u];
 	sig->order = (buf[2u] & 0x80) ? LITTLE_ENDIAN : BIG_ENDIAN;
 	sig->isSigned = buf[2u] & 0x40;
+	sig->isCode = buf[2u] & 0x20;
 
 	return OK;
 }
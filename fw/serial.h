@@ -49,6 +49,7 @@ Status serReadCanId(EepromAddr addr, CanId *id);
 // The Byte-order and Signedness flags are bits 7 and 6 of byte 6, respectively.
 // Byte order: [6][7] = {0=>LE, 1=>BE}.
 // Signedness: [6][6] = {0=>unsigned, 1=>signed}.
+// Table units: [6][5] = {0=>millivolts, 1=>DAC codes}.
 // Byte 7 is unused -- it's for alignment.
 Status serWriteSigFmt(EepromAddr addr, const SigFmt *sig);
 
@@ -5,77 +5,108 @@
 #include "can.h"
 
 #include "signal.h"
-#include "signal_utestable.h"
 
-// Extract a little-endian value from a frame.
-// Assumes signal is within the frame's DATA FIELD.
-void
-pluckLE(const SigFmt *sig, const CanFrame *frame, U32 *raw) {
-	U8 i, end, mask, byte;
+enum {
+	DATA_BITS = 8u * sizeof(((CanFrame *)0)->data), // size of DATA FIELD
+	RAW_BITS = 8u * sizeof(U32),
+};
 
-	*raw = 0ul;
-	end = sig->start + sig->size;
+// Low n bits, for n = 1 to 32, at index n-1: a constant table, so it
+// stays in program memory, and a mask costs no shifting
+#define LOW_BITS(n) ((U32)((2ul << ((n)-1u)) - 1ul))
+static const U32 lowBits[RAW_BITS] = {
+	LOW_BITS(1u), LOW_BITS(2u), LOW_BITS(3u), LOW_BITS(4u),
+	LOW_BITS(5u), LOW_BITS(6u), LOW_BITS(7u), LOW_BITS(8u),
+	LOW_BITS(9u), LOW_BITS(10u), LOW_BITS(11u), LOW_BITS(12u),
+	LOW_BITS(13u), LOW_BITS(14u), LOW_BITS(15u), LOW_BITS(16u),
+	LOW_BITS(17u), LOW_BITS(18u), LOW_BITS(19u), LOW_BITS(20u),
+	LOW_BITS(21u), LOW_BITS(22u), LOW_BITS(23u), LOW_BITS(24u),
+	LOW_BITS(25u), LOW_BITS(26u), LOW_BITS(27u), LOW_BITS(28u),
+	LOW_BITS(29u), LOW_BITS(30u), LOW_BITS(31u), LOW_BITS(32u),
+};
 
-	// First iteration starts at arbitrary bit: namely the (i%8)'th bit.
-	// Subsequent iterations start at bit 0 of each byte.
+Status
+sigCompile(const SigFmt *sig, SigPlan *plan) {
+	U8 end;
 
-	for (i = sig->start; i < end; i += 8u-(i%8u)) {
-		mask = (U8)(0xFF << (i%8u));
-		if (i/8u == end/8u) { // if end in this byte
-			mask &= 0xFF >> (8u - (end%8u)); // ignore top bits
-		}
-		byte = (frame->data[i/8u] & mask) >> (i%8u);
-		*raw |= (U32)byte << (i - sig->start);
+	plan->isValid = false;
+	if (
+		(sig->size < 1u) // signal is empty
+		|| (sig->start >= DATA_BITS) // signal starts outside DATA FIELD
+		|| (sig->size > DATA_BITS - sig->start) // signal extends outside DATA FIELD
+		|| (sig->order != LITTLE_ENDIAN && sig->order != BIG_ENDIAN)
+	) {
+		return FAIL;
 	}
-}
-
-// Extract a big-endian value from a frame.
-// Assumes signal is within the frame's DATA FIELD.
-void
-pluckBE(const SigFmt *sig, const CanFrame *frame, U32 *raw) {
-	U8 i, end, mask;
 
-	*raw = 0ul;
 	end = sig->start + sig->size;
+	plan->order = sig->order;
+	plan->lo = sig->start >> 3u;
+	plan->hi = (end-1u) >> 3u;
+	plan->shift = sig->start & 0x7;
+	plan->endBits = ((end-1u) & 0x7) + 1u;
+	plan->minDlc = plan->hi + 1u;
 
-	// First iteration starts at arbitrary bit: namely the (i%8)'th bit.
-	// Subsequent iterations start at bit 0 of each byte.
-
-	for (i = sig->start; i < end; i += 8u-(i%8u)) {
-		mask = (U8)(0xFF << (i%8u));
-		if (i/8u == end/8u) { // if end in this byte
-			mask &= 0xFF >> (8u - (end%8u)); // ignore top bits
-			*raw <<= (end%8u) - (i%8u); // include bits between i and end
-		} else {
-			*raw <<= 8u - (i%8u); // include bits between i and end of byte
-		}
-		*raw |= (frame->data[i/8u] & mask) >> (i%8u);
+	if (sig->order == LITTLE_ENDIAN && sig->size > RAW_BITS) {
+		// Only the low 32 bits are kept: the rest need not be read
+		plan->hi = (sig->start + RAW_BITS - 1u) >> 3u;
 	}
+
+	plan->bits = (sig->size < RAW_BITS) ? sig->size : RAW_BITS;
+	plan->isSigned = sig->isSigned;
+
+	plan->isValid = true;
+	return OK;
 }
 
 Status
-sigPluck(const SigFmt *sig, const CanFrame *frame, I32 *raw) {
-	U32 uraw;
+sigExtract(const SigPlan *plan, const CanFrame *frame, I32 *raw) {
+	const U8 *data;
+	U32 uraw, top, mask;
+	U8 k, endMask;
 
-	// Preconditions
-	if (
-		(sig->start >= (8u * frame->dlc)) // signal starts outside DATA FIELD
-		|| (sig->size > (8u * frame->dlc - sig->start)) // signal extends outside DATA FIELD
-		|| (sig->size < 1u) // signal is empty
-	) {
+	if (!plan->isValid || frame->dlc < plan->minDlc) {
 		return FAIL;
 	}
+	data = frame->data;
 
-	switch (sig->order) {
-	case LITTLE_ENDIAN:
-		pluckLE(sig, frame, &uraw);
-		break;
-	case BIG_ENDIAN:
-		pluckBE(sig, frame, &uraw);
-		break;
-	default:
-		return FAIL; // invalid byte order
+	if (plan->order == LITTLE_ENDIAN) {
+		// Bits ascend through the bytes. Gather up to 4 bytes,
+		// most-significant first, and shift out the bits below the signal.
+		// A 5th byte fills in the top bits.
+		top = 0ul;
+		k = plan->hi;
+		if (k - plan->lo == 4u) {
+			top = (U32)data[k] << (RAW_BITS - plan->shift);
+			k--;
+		}
+		uraw = 0ul;
+		for (; k > plan->lo; k--) {
+			uraw = (uraw << 8u) | data[k];
+		}
+		uraw = (((uraw << 8u) | data[plan->lo]) >> plan->shift) | top;
+	} else {
+		// Bits of each byte, from the first byte to the last, are
+		// appended below those of the previous.
+		endMask = 0xFF >> (8u - plan->endBits);
+		if (plan->lo == plan->hi) {
+			uraw = (U32)(data[plan->lo] & endMask) >> plan->shift;
+		} else {
+			uraw = data[plan->lo] >> plan->shift;
+			for (k = plan->lo + 1u; k < plan->hi; k++) {
+				uraw = (uraw << 8u) | data[k];
+			}
+			uraw = (uraw << plan->endBits) | (data[plan->hi] & endMask);
+		}
 	}
+
+	// Keep the signal's bits, and sign extend
+	mask = lowBits[plan->bits - 1u];
+	uraw &= mask;
+	if (plan->isSigned && (uraw & ~(mask >> 1u))) { // sign bit set
+		uraw |= ~mask;
+	}
+
 	*raw = *(I32 *)&uraw;
 	return OK;
 }
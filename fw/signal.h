@@ -26,8 +26,31 @@ typedef struct {
 	U8 size; // size of the signal in bits
 	ByteOrder order; // big-endian/little-endian
 	bool isSigned;
+	bool isCode; // table values are DAC codes, not millivolts
 } SigFmt;
 
+// An extraction plan is a SigFmt compiled into the byte indices and
+// shifts needed to pluck the signal out of a frame, so that
+// extracting it from each frame is a short straight-line sequence.
+// Signals larger than 32 bits are truncated to their low 32 bits.
+typedef struct {
+	bool isValid;
+	ByteOrder order;
+	U8 lo, hi; // indices of first and last byte holding the signal
+	U8 shift; // position of the signal's first bit in byte lo: start%8
+	U8 endBits; // big-endian: number of bits of byte hi, from bit 0
+	U8 minDlc; // frames shorter than this don't hold the signal
+	U8 bits; // bits kept: size, up to 32
+	bool isSigned;
+} SigPlan;
+
+// Compile a SigFmt into an extraction plan.
+// Returns FAIL, and marks the plan invalid, if the signal is empty
+// or doesn't fit in a DATA FIELD.
+Status sigCompile(const SigFmt *sig, SigPlan *plan);
+
 // Extract the raw signal value out of a CAN frame's DATA FIELD.
+// Signed signals are sign-extended.
 // Assumes the frame's ID matches that of the signal.
-Status sigPluck(const SigFmt *sig, const CanFrame *frame, I32 *raw);
+// Returns FAIL if the plan is invalid or the signal is outside the frame.
+Status sigExtract(const SigPlan *plan, const CanFrame *frame, I32 *raw);
@@ -1,2 +0,0 @@
-void pluckLE(const SigFmt *sig, const CanFrame *frame, U32 *raw);
-void pluckBE(const SigFmt *sig, const CanFrame *frame, U32 *raw);
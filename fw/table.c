@@ -9,16 +9,79 @@
 
 #include "table.h"
 
+#ifdef PROFILE
+#define TAB_COUNT(n) ((n)++)
+#else
+#define TAB_COUNT(n)
+#endif
+
+// Check that a grid fits in a table and its keys fit in an I32.
+static bool
+isValidGrid(const TabGrid *grid) {
+	U32 span;
+
+	if (grid->len == 0u || grid->len > TAB_GRID_LEN || grid->shift > 31u) {
+		return false;
+	}
+	span = (U32)(grid->len - 1u) << grid->shift;
+	if ((span >> grid->shift) != (U32)(grid->len - 1u)) {
+		return false; // overflow
+	}
+	return span <= (U32)INT32_MAX - (U32)grid->start;
+}
+
+static void
+parseHdr(const U8 hdr[TAB_HDR_SIZE], TabGrid *grid) {
+	U32 ustart;
+
+	grid->shift = hdr[1u];
+	grid->len = hdr[2u];
+	ustart = deserU32Be(hdr+4u);
+	grid->start = *(I32 *)&ustart;
+}
+
 Status
-tabWrite(const Table *tab, U8 k, U32 key, U16 val) {
+tabInit(Table *tab) {
+	U8 hdr[TAB_HDR_SIZE];
+	Status status;
+
+	tab->cached = false;
+	tab->isGrid = false;
+
+	status = eepromRead(tab->hdr, hdr, sizeof(hdr));
+	if (status != OK) {
+		return FAIL;
+	}
+	if (hdr[0u] == TAB_MODE_GRID) {
+		parseHdr(hdr, &tab->grid);
+		tab->isGrid = isValidGrid(&tab->grid); // else treat as rows
+	}
+	return OK;
+}
+
+Status
+tabWrite(Table *tab, U8 k, U32 key, U16 val) {
 	U16 addr;
 	U8 row[sizeof(key) + sizeof(val)];
+	U8 mode;
+	Status status;
 
 	if (k >= TAB_ROWS) {
 		return FAIL;
 	}
 
-	addr = tab->offset + k*TAB_ROW_SIZE;
+	tab->cached = false;
+
+	if (tab->isGrid) { // switch back to rows
+		mode = TAB_MODE_ROWS;
+		status = eepromWrite(tab->hdr, &mode, sizeof(mode));
+		if (status != OK) {
+			return FAIL;
+		}
+		tab->isGrid = false;
+	}
+
+	addr = tab->offset + k*TAB_ROW_STRIDE;
 	serU32Be(row, key);
 	serU16Be(row+sizeof(key), val);
 	return eepromWrite(addr, row, sizeof(row));
@@ -34,57 +97,266 @@ tabRead(const Table *tab, U8 k, U32 *key, U16 *val) {
 		return FAIL;
 	}
 
-	addr = tab->offset + k*TAB_ROW_SIZE;
+	addr = tab->offset + k*TAB_ROW_STRIDE;
 	status = eepromRead(addr, row, sizeof(row));
 	*key = deserU32Be(row);
 	*val = deserU16Be(row+sizeof(U32));
 	return status;
 }
 
-// Linear interpolation.
-static U16
-interp(I32 x, I32 x1, U16 y1, I32 x2, U16 y2) {
-	return (U16)(y1 + ((I32)y2-y1) * (x-x1) / (x2-x1));
+Status
+tabWriteGrid(Table *tab, const TabGrid *grid) {
+	U8 hdr[TAB_HDR_SIZE];
+	Status status;
+
+	if (!isValidGrid(grid)) {
+		return FAIL;
+	}
+
+	tab->cached = false;
+
+	hdr[0u] = TAB_MODE_GRID;
+	hdr[1u] = grid->shift;
+	hdr[2u] = grid->len;
+	hdr[3u] = 0u;
+	serU32Be(hdr+4u, *(U32 *)&grid->start);
+	status = eepromWrite(tab->hdr, hdr, sizeof(hdr));
+	if (status != OK) {
+		return FAIL;
+	}
+	tab->grid = *grid;
+	tab->isGrid = true;
+	return OK;
+}
+
+Status
+tabReadGrid(const Table *tab, TabGrid *grid) {
+	U8 hdr[TAB_HDR_SIZE];
+	Status status;
+
+	status = eepromRead(tab->hdr, hdr, sizeof(hdr));
+	if (status != OK || hdr[0u] != TAB_MODE_GRID) {
+		return FAIL;
+	}
+	parseHdr(hdr, grid);
+	return OK;
+}
+
+Status
+tabWriteVals(Table *tab, U8 k, const U16 vals[], U8 n) {
+	U8 buf[4u*TAB_VAL_SIZE];
+	U8 i;
+
+	if (n > sizeof(buf)/TAB_VAL_SIZE || k >= TAB_GRID_LEN || n > TAB_GRID_LEN - k) {
+		return FAIL;
+	}
+
+	tab->cached = false;
+
+	for (i = 0u; i < n; i++) {
+		serU16Be(buf + i*TAB_VAL_SIZE, vals[i]);
+	}
+	return eepromWrite(tab->offset + k*TAB_VAL_SIZE, buf, n*TAB_VAL_SIZE);
 }
 
 Status
-tabLookup(const Table *tab, I32 key, U16 *val) {
-	U8 row;
-	U32 utkey;
-	I32 tkey1, tkey2;
-	U16 tval1, tval2;
+tabReadVals(const Table *tab, U8 k, U16 vals[], U8 n) {
+	U8 buf[4u*TAB_VAL_SIZE];
+	U8 i;
 	Status status;
 
-	// Search for key
-	for (row = 0u; row < TAB_ROWS; row++) {
-		status = tabRead(tab, row, &utkey, &tval1);
+	if (n > sizeof(buf)/TAB_VAL_SIZE || k >= TAB_GRID_LEN || n > TAB_GRID_LEN - k) {
+		return FAIL;
+	}
+
+	status = eepromRead(tab->offset + k*TAB_VAL_SIZE, buf, n*TAB_VAL_SIZE);
+	for (i = 0u; i < n; i++) {
+		vals[i] = deserU16Be(buf + i*TAB_VAL_SIZE);
+	}
+	return status;
+}
+
+// Linear interpolation across the cached segment: key1 < key < key2.
+// The span is shifted down to 16 bits so that it is a 16x16-bit
+// multiply and a 32/16-bit division. The slope isn't kept: six tables'
+// worth of it costs more RAM than it saves time, as the memo already
+// skips repeated keys. Exact if the segment spans fewer than 2^16 keys.
+static U16
+interp(const Table *tab, I32 key) {
+	U32 span;
+	U16 dx, dy, rise;
+	U8 shift;
+
+	span = (U32)tab->key2 - (U32)tab->key1; // > 0
+	for (shift = 0u; span > 0xFFFF; shift++) {
+		span >>= 1u;
+	}
+	dx = (U16)(((U32)tab->key2 - (U32)key) >> shift);
+	if (tab->val2 < tab->val1) { // falling
+		rise = tab->val1 - tab->val2;
+		dy = (U16)((U32)rise*dx / (U16)span);
+		return tab->val2 + dy;
+	}
+	rise = tab->val2 - tab->val1;
+	dy = (U16)((U32)rise*dx / (U16)span);
+	return tab->val2 - dy;
+}
+
+// Check if key falls in the cached segment.
+static bool
+isCached(const Table *tab, I32 key) {
+	if (!tab->cached) {
+		return false;
+	} else if (tab->row > 0u && key <= tab->key1) {
+		return false; // below segment
+	} else if (tab->row != TAB_END && key > tab->key2) {
+		return false; // above segment
+	}
+	return true;
+}
+
+// Read the key of row k.
+static Status
+readKey(const Table *tab, U8 k, I32 *key) {
+	U8 buf[TAB_KEY_SIZE];
+	U32 ukey;
+	Status status;
+
+	status = eepromRead(tab->offset + k*TAB_ROW_STRIDE, buf, sizeof(buf));
+	ukey = deserU32Be(buf);
+	*key = *(I32 *)&ukey;
+	return status;
+}
+
+// Load the segment of a row table that key falls in into the cache.
+static Status
+loadRowSegment(Table *tab, I32 key) {
+	U8 lo, hi, mid;
+	U8 rows[TAB_ROW_STRIDE + TAB_ROW_SIZE];
+	U8 *row;
+	U32 ukey;
+	I32 tkey;
+	Status status;
+
+	// Binary search for first row with key <= tkey.
+	// The last row is not probed: it is read below with its neighbour.
+	lo = 0u;
+	hi = TAB_ROWS-1u;
+	while (lo < hi) {
+		mid = (lo + hi) >> 1u;
+		status = readKey(tab, mid, &tkey);
 		if (status != OK) {
 			return FAIL;
 		}
-		tkey1 = *(I32 *)&utkey;
-
-		if (key == tkey1) { // found exact key
-			*val = tval1; 
-			return OK;
-		} else if (key < tkey1) {
-			if (row > 0u) { // not first row
-				// Interpolate with previous row
-				status = tabRead(tab, row-1u, &utkey, &tval2);
-				if (status != OK) {
-					return FAIL;
-				}
-				tkey2 = *(I32 *)&utkey;
-				*val = interp(key, tkey1, tval1, tkey2, tval2);
-			} else { // key < key of first row
-				*val = tval1; // use first row value
-			}
-			return OK;
-		} else { // key > tkey
-			// continue until key <= tkey
+		if (tkey < key) {
+			lo = mid + 1u;
+		} else {
+			hi = mid;
 		}
 	}
 
-	// Reached last row
-	*val = tval1; // last value in table
+	// Read the bracketing rows in one sequential read
+	if (lo == 0u) { // key <= first key
+		status = eepromRead(tab->offset, rows, TAB_ROW_SIZE);
+	} else {
+		status = eepromRead(tab->offset + (lo-1u)*TAB_ROW_STRIDE, rows, sizeof(rows));
+	}
+	if (status != OK) {
+		return FAIL;
+	}
+
+	row = rows;
+	if (lo > 0u) { // lower row of the segment
+		ukey = deserU32Be(row);
+		tab->key1 = *(I32 *)&ukey;
+		tab->val1 = deserU16Be(row+TAB_KEY_SIZE);
+		row += TAB_ROW_STRIDE;
+	}
+	// Upper row of the segment
+	ukey = deserU32Be(row);
+	tab->key2 = *(I32 *)&ukey;
+	tab->val2 = deserU16Be(row+TAB_KEY_SIZE);
+
+	if (key > tab->key2) { // key > last key
+		tab->key1 = tab->key2;
+		tab->val1 = tab->val2;
+		lo = TAB_END;
+	}
+	tab->row = lo;
+	tab->cached = true;
+	return OK;
+}
+
+// Load the segment of a grid that key falls in into the cache.
+// The index of its upper point is found with a subtraction and a shift.
+static Status
+loadGridSegment(Table *tab, I32 key) {
+	const TabGrid *grid;
+	U32 i;
+	U16 vals[2u];
+	Status status;
+
+	tab->cached = false;
+	grid = &tab->grid;
+	if (key <= grid->start) {
+		i = 0u;
+	} else {
+		i = (((U32)key - (U32)grid->start - 1u) >> grid->shift) + 1u;
+	}
+
+	if (i == 0u) { // key <= first key
+		status = tabReadVals(tab, 0u, vals, 1u);
+		tab->key2 = grid->start;
+		tab->val2 = vals[0u];
+		tab->row = 0u;
+	} else if (i >= grid->len) { // key > last key
+		status = tabReadVals(tab, grid->len-1u, vals, 1u);
+		tab->key2 = (I32)((U32)grid->start + ((U32)(grid->len-1u) << grid->shift));
+		tab->key1 = tab->key2;
+		tab->val1 = tab->val2 = vals[0u];
+		tab->row = TAB_END;
+	} else {
+		status = tabReadVals(tab, (U8)(i-1u), vals, 2u);
+		tab->key1 = (I32)((U32)grid->start + ((i-1u) << grid->shift));
+		tab->key2 = (I32)((U32)tab->key1 + (1ul << grid->shift));
+		tab->val1 = vals[0u];
+		tab->val2 = vals[1u];
+		tab->row = (U8)i;
+	}
+	if (status != OK) {
+		return FAIL;
+	}
+	tab->cached = true;
+	return OK;
+}
+
+Status
+tabLookup(Table *tab, I32 key, U16 *val) {
+	Status status;
+
+	if (isCached(tab, key)) {
+		TAB_COUNT(tab->hits);
+	} else {
+		TAB_COUNT(tab->misses);
+		if (tab->isGrid) {
+			status = loadGridSegment(tab, key);
+		} else {
+			status = loadRowSegment(tab, key);
+		}
+		if (status != OK) {
+			return FAIL;
+		}
+	}
+
+	if (tab->row == 0u) { // key <= key of first row
+		*val = tab->val2; // use first row value
+	} else if (tab->row == TAB_END) { // key > key of last row
+		*val = tab->val1; // last value in table
+	} else if (key == tab->key2) { // found exact key
+		*val = tab->val2;
+	} else {
+		// Interpolate between the two rows
+		*val = interp(tab, key);
+	}
 	return OK;
 }
@@ -2,6 +2,23 @@
  *
  * A table has a fixed number of rows that define a key/value mapping.
  * Keys are I32, values are U16. They are stored big-endian.
+ * Rows are padded to 8 bytes, so no row straddles a 16-byte EEPROM page
+ * and writing one takes a single write cycle. Rows written faster than
+ * that are merged by page, and then the padding costs up to a third
+ * more cycles than packed rows would (see layout_utests).
+ *
+ * A table whose keys are evenly spaced by a power of two can instead be
+ * stored as a grid: the start key and step are kept in the table's
+ * header, and the table's space holds only values. The row of a key is
+ * then found with a subtraction and a shift, and the table holds
+ * TAB_GRID_LEN points instead of TAB_ROWS.
+ *
+ * The header is 8 bytes:
+ * [0] mode: TAB_MODE_GRID, anything else (e.g. erased) means rows.
+ * [1] log2 of the step between keys.
+ * [2] number of points.
+ * [3] unused.
+ * [4..7] start key, big-endian.
  *
  * See also: `doc/datafmt.pdf'
  *
@@ -23,20 +40,76 @@ enum {
 	TAB_VAL_SIZE = sizeof(U16),
 	TAB_ROWS = 32,
 	TAB_ROW_SIZE = TAB_KEY_SIZE + TAB_VAL_SIZE,
-	TAB_SIZE = TAB_ROWS * TAB_ROW_SIZE,
+	TAB_ROW_STRIDE = 8, // distance between rows: a power of 2 that divides a page
+	TAB_SIZE = TAB_ROWS * TAB_ROW_STRIDE,
+	// Max points in a grid. The table's space holds TAB_SIZE/TAB_VAL_SIZE
+	// = 128, but Grid Control Frames address 31 blocks of 4 values.
+	TAB_GRID_LEN = 124,
+	TAB_HDR_SIZE = 8,
+	TAB_MODE_ROWS = 0x00,
+	TAB_MODE_GRID = 0x01,
+	TAB_END = 0xFF, // segment index of keys past the end of a table
 };
 
+// Evenly-spaced keys: start, start + 2^shift, ..., start + (len-1)*2^shift.
+typedef struct {
+	I32 start;
+	U8 shift;
+	U8 len;
+} TabGrid;
+
 typedef struct {
 	EepromAddr offset; // starting address
+	EepromAddr hdr; // address of header
+
+	bool isGrid;
+	TabGrid grid; // if isGrid
+
+	// Cached segment: the two rows bracketing the last key looked up.
+	// Keys in (key1, key2] are answered without reading the EEPROM.
+	// Row is the index of the upper row: 0 if the key was below the
+	// first row and TAB_END if it was above the last.
+	bool cached;
+	U8 row;
+	I32 key1, key2;
+	U16 val1, val2;
+
+#ifdef PROFILE
+	// Statistics
+	U16 hits, misses; // segment cache hits/misses
+#endif
 } Table;
 
+// Load the table's header from the EEPROM.
+Status tabInit(Table *tab);
+
 // Set the key and value of row k.
-Status tabWrite(const Table *tab, U8 k, U32 key, U16 val);
+// Switches a grid table back to rows.
+// Invalidates the table's cached segment.
+Status tabWrite(Table *tab, U8 k, U32 key, U16 val);
 
 // Read row k.
 Status tabRead(const Table *tab, U8 k, U32 *key, U16 *val);
 
+// Switch the table to a grid with the given keys.
+// Returns FAIL if the grid is empty, too long, or its last key overflows.
+// Invalidates the table's cached segment.
+Status tabWriteGrid(Table *tab, const TabGrid *grid);
+
+// Read the table's grid header from the EEPROM.
+// Returns FAIL if the table is not a grid.
+Status tabReadGrid(const Table *tab, TabGrid *grid);
+
+// Set the values of n grid points starting at point k.
+// Invalidates the table's cached segment.
+Status tabWriteVals(Table *tab, U8 k, const U16 vals[], U8 n);
+
+// Read the values of n grid points starting at point k.
+Status tabReadVals(const Table *tab, U8 k, U16 vals[], U8 n);
+
 // Lookup the value associated with given key.
 // If key falls between two rows, the value is interpolated
 // from the two adjacent.
-Status tabLookup(const Table *tab, I32 key, U16 *val);
+// The rows must be sorted by key: they are binary searched.
+// A grid is indexed directly.
+Status tabLookup(Table *tab, I32 key, U16 *val);
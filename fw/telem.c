@@ -0,0 +1,47 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#include "telem.h"
+
+void
+telemInit(Telem *t) {
+	telemConfig(t, 0u, 0u);
+}
+
+void
+telemConfig(Telem *t, U8 sigs, U8 rate) {
+	t->sigs = (rate == 0u) ? 0u : sigs;
+	t->rate = rate;
+	t->period = (rate == 0u) ? 0u : (TELEM_TICK_HZ + rate/2u) / rate; // rounded
+	t->wait = 0u;
+	t->next = 0u;
+}
+
+void
+telemTick(Telem *t) {
+	if (t->wait > 0u) {
+		t->wait--;
+	}
+}
+
+bool
+telemNext(Telem *t, U8 *sig) {
+	U8 n, k;
+
+	if (t->sigs == 0u || t->wait > 0u) {
+		return false;
+	}
+	k = t->next;
+	for (n = 0u; n < TELEM_MAX_SIGS; n++) {
+		if (t->sigs & (1u << k)) {
+			*sig = k;
+			t->next = (k+1u) % TELEM_MAX_SIGS;
+			t->wait = t->period;
+			return true;
+		}
+		k = (k+1u) % TELEM_MAX_SIGS;
+	}
+	return false;
+}
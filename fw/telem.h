@@ -0,0 +1,44 @@
+/* Telemetry stream.
+ *
+ * For calibrating, the Interface can report each signal's raw value and
+ * the output it drives. Telemetry is off at power-up; once turned on
+ * for a set of signals, the main loop ticks it and sends a sample when
+ * telemNext() says so: one signal at a time, in turn, at most rate
+ * samples per second in all, however fast the signals arrive.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "telem.h"
+ */
+
+enum {
+	TELEM_MAX_SIGS = 8,
+	TELEM_TICK_HZ = 732, // SCHED_TICK_HZ
+};
+
+typedef struct {
+	U8 sigs; // bit k: signal k is reported
+	U8 rate; // samples per second, all signals together
+	U16 period; // ticks between samples
+	U16 wait; // ticks until the next sample
+	U8 next; // where telemNext resumes its round
+} Telem;
+
+// Turn telemetry off.
+void telemInit(Telem *t);
+
+// Report the signals in the sigs mask at rate samples per second.
+// A mask or rate of 0 turns telemetry off.
+void telemConfig(Telem *t, U8 sigs, U8 rate);
+
+// Count one tick of TELEM_TICK_HZ.
+void telemTick(Telem *t);
+
+// Check whether a sample is due, and if so, of which signal.
+bool telemNext(Telem *t, U8 *sig);
@@ -65,27 +65,32 @@ echo(CanFrame *frame) {
 		frame->data[k]++;
 	}
 
-	canTx(frame);
+	canTx(frame, CAN_PRIO_LOW);
 }
 
 void
 __interrupt() isr(void) {
+	U8 status;
 	CanFrame frame;
 
 	if (INTCONbits.INTF) {
-		switch (canRxStatus() & 0x7) { // check filter match
-		case 0u: // RXF0
-			canReadRxb0(&frame);
-			echo(&frame);
-			break;
-		case 2u: // RXF2
-			canReadRxb1(&frame);
-			echo(&frame);
-			break;
-		default:
-			canReadRxb0(&frame); // clear interrupt flag
-			canReadRxb1(&frame);
+		status = canRxStatus();
+		if (status & 0xC0) { // frame received
+			switch (status & 0x7) { // check filter match
+			case 0u: // RXF0
+				canReadRxb0(&frame);
+				echo(&frame);
+				break;
+			case 2u: // RXF2
+				canReadRxb1(&frame);
+				echo(&frame);
+				break;
+			default:
+				canReadRxb0(&frame); // clear interrupt flag
+				canReadRxb1(&frame);
+			}
 		}
+		canTxService(); // clear TX interrupt flags
 		INTCONbits.INTF = 0;
 	}
 }
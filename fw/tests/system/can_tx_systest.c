@@ -52,7 +52,7 @@ void
 __interrupt() isr(void) {
 	if (PIR1bits.TMR1IF) {
 		if (++ctr == 114u) { // 5s period
-			(void)canTx(&frame);
+			(void)canTx(&frame, CAN_PRIO_LOW);
 			ctr = 0u;
 		}
 		PIR1bits.TMR1IF = 0;
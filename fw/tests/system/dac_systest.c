@@ -13,10 +13,11 @@ main(void) {
 	spiInit();
 	dacInit();
 
-	dacSet1a(123); // 0.123V
-	dacSet1b(345); // 0.345V
-	dacSet2a(1230); // 1.230V
-	dacSet2b(3450); // 3.450V
+	dacStage(DAC_1A, dacCode(123)); // 0.123V
+	dacStage(DAC_1B, dacCode(345)); // 0.345V
+	dacStage(DAC_2A, dacCode(1230)); // 1.230V
+	dacStage(DAC_2B, dacCode(3450)); // 3.450V
+	(void)dacCommit();
 
 	for (;;) {
 
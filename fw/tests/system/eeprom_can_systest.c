@@ -76,7 +76,7 @@ readEeprom(const CanFrame *frame) {
 		.dlc = 1u,
 		.data = {val},
 	};
-	return canTx(&out);
+	return canTx(&out, CAN_PRIO_LOW);
 }
 
 // Write a value to the EEPROM.
@@ -99,22 +99,25 @@ __interrupt() isr(void) {
 
 	if (INTCONbits.INTF) {
 		status = canRxStatus();
-		switch (status & 0x7) { // check filter match
-		case 0u: // RXF0
-			canReadRxb0(&frame);
-			if (frame.rtr) {
-				(void)readEeprom(&frame);
-			} else {
-				(void)writeEeprom(&frame);
+		if (status & 0xC0) { // frame received
+			switch (status & 0x7) { // check filter match
+			case 0u: // RXF0
+				canReadRxb0(&frame);
+				if (frame.rtr) {
+					(void)readEeprom(&frame);
+				} else {
+					(void)writeEeprom(&frame);
+				}
+				break;
+			case 1u: // RXF1
+				canReadRxb0(&frame); // clear interrupt flag
+				break;
+			default:
+				// Message in RXB1
+				canReadRxb1(&frame); // clear interrupt flag
 			}
-			break;
-		case 1u: // RXF1
-			canReadRxb0(&frame); // clear interrupt flag
-			break;
-		default:
-			// Message in RXB1
-			canReadRxb1(&frame); // clear interrupt flag
 		}
+		canTxService(); // clear TX interrupt flags
 		INTCONbits.INTF = 0;
 	}
 }
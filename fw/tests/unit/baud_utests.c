@@ -0,0 +1,188 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <baud.h>
+#include <mock.h>
+
+#include <xc.h>
+
+#define CYCLES_PER_MS 12000ul
+
+// Frames sent on the bus at one bit rate only
+static struct {
+	U32 bitRate; // bps
+	U32 period; // cycles between frames; 0: silent
+	U32 next;
+} bus;
+
+static void
+traffic(void) {
+	MockCanFrame frame = {{0x12, 0x34, 0x00, 0x00, 0x08}};
+
+	while (bus.period && (I32)(mockClock - bus.next) >= 0) {
+		(void)mockCanBus(&frame, bus.bitRate);
+		bus.next += bus.period;
+	}
+}
+
+static void
+setBus(U32 bitRate, U32 periodMs) {
+	bus.bitRate = bitRate;
+	bus.period = periodMs * CYCLES_PER_MS;
+	bus.next = mockClock + bus.period/2u; // out of phase with the search
+}
+
+void setUp(void) {
+	mockReset();
+	canInit();
+	setBus(0u, 0u);
+	mockDelayHook = traffic;
+}
+void tearDown(void) {
+	mockDelayHook = NULL;
+}
+
+static const struct {
+	BaudTiming timing;
+	U16 kbps;
+} rates[] = {
+	{{{CAN_TIMING_10K}}, 10u},
+	{{{CAN_TIMING_20K}}, 20u},
+	{{{CAN_TIMING_50K}}, 50u},
+	{{{CAN_TIMING_100K}}, 100u},
+	{{{CAN_TIMING_125K}}, 125u},
+	{{{CAN_TIMING_250K}}, 250u},
+	{{{CAN_TIMING_500K}}, 500u},
+};
+
+enum { NRATES = sizeof(rates) / sizeof(rates[0u]) };
+
+static const BaudTiming fallback = {{CAN_TIMING_10K}};
+
+// Check that the search ended in Config mode at the given timing.
+static void
+checkSet(const BaudTiming *timing) {
+	TEST_ASSERT_EQUAL_HEX8(CAN_MODE_CONFIG, mockCan.regs[0x0E] >> 5u);
+	TEST_ASSERT_EQUAL_HEX8(timing->cnf[0u], mockCan.regs[0x2A]);
+	TEST_ASSERT_EQUAL_HEX8(timing->cnf[1u], mockCan.regs[0x29]);
+	TEST_ASSERT_EQUAL_HEX8(timing->cnf[2u], mockCan.regs[0x28]);
+}
+
+static void
+testTimings(void) {
+	setUp();
+
+	BaudTiming erased = {{0xFF, 0xFF, 0xFF}};
+	BaudTiming noBtl = {{0x00, 0x1A, 0x03}};
+	BaudTiming shortPs2 = {{0xC0, 0x9A, 0x00}}; // 1 TQ
+	BaudTiming bigSjw = {{0xC0, 0x9A, 0x02}}; // SJW=4 > PS2=3
+	U8 k;
+
+	for (k = 0u; k < NRATES; k++) {
+		TEST_ASSERT_TRUE(baudValid(&rates[k].timing));
+		TEST_ASSERT_EQUAL_UINT16(rates[k].kbps, baudKbps(&rates[k].timing));
+	}
+	TEST_ASSERT_FALSE(baudValid(&erased));
+	TEST_ASSERT_FALSE(baudValid(&noBtl));
+	TEST_ASSERT_FALSE(baudValid(&shortPs2));
+	TEST_ASSERT_FALSE(baudValid(&bigSjw));
+
+	tearDown();
+}
+
+// Lock onto each rate, with and without the right timing cached.
+static void
+testDetect(void) {
+	static const U32 periods[] = {10u, 40u}; // ms between frames
+	BaudResult fresh, cached;
+	U32 t0, elapsed;
+	U8 p, k;
+
+	printf("\nTime to lock, cached timing 10k (as after a reflash) / right timing:\n");
+	printf("%6s %7s %8s %8s %8s %8s\n", "kbps", "gap ms", "tries", "wait ms", "tries", "wait ms");
+	for (p = 0u; p < sizeof(periods)/sizeof(periods[0u]); p++) {
+		for (k = 0u; k < NRATES; k++) {
+			setUp();
+			setBus(rates[k].kbps*1000ul, periods[p]);
+			t0 = mockClock;
+			baudDetect(&fallback, &fresh);
+			elapsed = (mockClock - t0) / CYCLES_PER_MS;
+			TEST_ASSERT_TRUE(fresh.locked);
+			TEST_ASSERT_EQUAL_UINT16(rates[k].kbps, baudKbps(&fresh.timing));
+			checkSet(&rates[k].timing);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(BAUD_MAX_MS, fresh.waitMs);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(elapsed, fresh.waitMs); // a lower bound
+			TEST_ASSERT_UINT32_WITHIN(elapsed/10u + 1u, elapsed, fresh.waitMs); // close in the mock
+
+			setUp();
+			setBus(rates[k].kbps*1000ul, periods[p]);
+			baudDetect(&rates[k].timing, &cached);
+			TEST_ASSERT_TRUE(cached.locked);
+			TEST_ASSERT_EQUAL_UINT8(1u, cached.tries);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(BAUD_FRAMES*periods[p], cached.waitMs);
+			checkSet(&rates[k].timing);
+
+			printf("%6u %7lu %8u %8u %8u %8u\n", rates[k].kbps, (unsigned long)periods[p],
+				fresh.tries, fresh.waitMs, cached.tries, cached.waitMs);
+		}
+	}
+
+	tearDown();
+}
+
+// The cached timing is out of date: the bus has changed rates.
+static void
+testStale(void) {
+	setUp();
+
+	BaudResult result;
+
+	setBus(125000ul, 20u);
+	baudDetect(&rates[6u].timing, &result); // 500k
+	TEST_ASSERT_TRUE(result.locked);
+	TEST_ASSERT_EQUAL_UINT16(125u, baudKbps(&result.timing));
+	TEST_ASSERT_EQUAL_UINT8(3u, result.tries); // 500k, then 250k and 125k
+	checkSet(&rates[4u].timing);
+
+	tearDown();
+}
+
+// Nothing on the bus: give up in bounded time and keep the first timing.
+static void
+testSilent(void) {
+	setUp();
+
+	BaudResult result;
+	BaudTiming cached = {{CAN_TIMING_250K}};
+	U32 elapsed;
+
+	baudDetect(&cached, &result);
+	elapsed = mockClock / CYCLES_PER_MS;
+	printf("\nSilent bus: gave up after %u tries, %ums waited (%lums measured)\n",
+		result.tries, result.waitMs, (unsigned long)elapsed);
+	TEST_ASSERT_FALSE(result.locked);
+	TEST_ASSERT_EQUAL_UINT8(BAUD_PASSES*BAUD_NPRESETS, result.tries); // 250k only once per pass
+	TEST_ASSERT_EQUAL_UINT16(result.tries*BAUD_WINDOW_MS, result.waitMs);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(BAUD_MAX_MS, result.waitMs);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(BAUD_MAX_MS + BAUD_MAX_MS/10u, elapsed);
+	checkSet(&cached);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testTimings);
+	RUN_TEST(testDetect);
+	RUN_TEST(testStale);
+	RUN_TEST(testSilent);
+
+	return UnityEnd();
+}
@@ -0,0 +1,609 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <mock.h>
+
+#include <xc.h>
+
+void setUp(void) {
+	mockReset();
+	canInit();
+}
+void tearDown(void) {}
+
+static CanFrame
+extFrame(U32 eid, U8 dlc) {
+	CanFrame frame = {.id = {.isExt = true, .eid = eid}, .dlc = dlc};
+	U8 k;
+
+	for (k = 0u; k < dlc; k++) {
+		frame.data[k] = 0xA0 + k;
+	}
+	return frame;
+}
+
+static CanFrame
+stdFrame(U16 sid, U8 dlc) {
+	CanFrame frame = extFrame(0u, dlc);
+
+	frame.id = (CanId){.isExt = false, .sid = sid};
+	return frame;
+}
+
+// Register form of a frame, as the MCP2515 holds it
+static MockCanFrame
+regsOf(const CanFrame *frame) {
+	MockCanFrame m = {{0}};
+	U8 k;
+
+	if (frame->id.isExt) {
+		m.regs[0u] = frame->id.eid >> 21u;
+		m.regs[1u] = ((frame->id.eid >> 13u) & 0xE0) | 0x08 | ((frame->id.eid >> 16u) & 0x03);
+		m.regs[2u] = frame->id.eid >> 8u;
+		m.regs[3u] = frame->id.eid;
+	} else {
+		m.regs[0u] = frame->id.sid >> 3u;
+		m.regs[1u] = frame->id.sid << 5u;
+	}
+	m.regs[4u] = frame->dlc | (frame->rtr ? 0x40 : 0x00);
+	for (k = 0u; k < frame->dlc; k++) {
+		m.regs[5u+k] = frame->data[k];
+	}
+	return m;
+}
+
+static void
+assertSent(const CanFrame *frame, U32 k) {
+	MockCanFrame want;
+
+	want = regsOf(frame);
+	TEST_ASSERT_EQUAL_MEMORY(want.regs, mockCan.tx[k % MOCK_CAN_TXLOG].regs, 5u + frame->dlc);
+}
+
+// Let the bus send everything, servicing each TX interrupt
+static void
+drain(void) {
+	while (mockCanTransmit() >= 0) {
+		TEST_ASSERT_TRUE(mockCanInt());
+		canTxService();
+		TEST_ASSERT_FALSE(mockCanInt()); // flags cleared
+	}
+}
+
+static void
+testTxFrames(void) {
+	setUp();
+
+	CanFrame frames[4u];
+	U8 k;
+
+	canIE(true);
+	frames[0u] = extFrame(0x1272F00, 2u);
+	frames[1u] = stdFrame(0x7FF, 8u);
+	frames[2u] = extFrame(0x1FFFFFFF, 0u);
+	frames[2u].rtr = true;
+	frames[3u] = stdFrame(0x123, 7u);
+	for (k = 0u; k < 4u; k++) {
+		TEST_ASSERT_EQUAL(OK, canTx(&frames[k], CAN_PRIO_LOW));
+		drain();
+		assertSent(&frames[k], k);
+	}
+	TEST_ASSERT_EQUAL_UINT32(4u, mockCan.ntx);
+
+	tearDown();
+}
+
+// Frames go out by priority, and in order within a priority,
+// whichever buffers they were loaded into.
+static void
+testTxOrder(void) {
+	setUp();
+
+	static const U8 prios[] = {
+		CAN_PRIO_LOW, CAN_PRIO_LOW, CAN_PRIO_LOW, CAN_PRIO_HIGH,
+		CAN_PRIO_LOW, CAN_PRIO_MEDIUM_HIGH, CAN_PRIO_HIGH,
+	};
+	CanFrame frame;
+	CanTxStats stats;
+	U32 k, prev;
+	U8 prio, prevPrio;
+
+	canIE(true);
+	for (k = 0u; k < sizeof(prios); k++) {
+		frame = extFrame(0x100u*prios[k] + k, 1u);
+		TEST_ASSERT_EQUAL(OK, canTx(&frame, prios[k]));
+	}
+	drain();
+	TEST_ASSERT_EQUAL_UINT32(sizeof(prios), mockCan.ntx);
+
+	// The first three were loaded at once; after them, strict order
+	prevPrio = 0xFF;
+	prev = 0u;
+	for (k = 3u; k < sizeof(prios); k++) {
+		prio = mockCan.tx[k].regs[2u] >> 0u; // eid[15:8]
+		TEST_ASSERT_LESS_OR_EQUAL(prevPrio, prio);
+		if (prio == prevPrio) {
+			TEST_ASSERT_GREATER_THAN(prev, mockCan.tx[k].regs[3u]);
+		}
+		prevPrio = prio;
+		prev = mockCan.tx[k].regs[3u];
+	}
+	// The low ones loaded first keep their order
+	TEST_ASSERT_EQUAL_UINT8(0u, mockCan.tx[0u].regs[3u] & 0x0F);
+
+	canGetTxStats(&stats);
+	TEST_ASSERT_EQUAL_UINT16(0u, stats.drops);
+
+	tearDown();
+}
+
+// Three frames fill the buffers, TXQ_LEN more the queue; the rest are dropped.
+static void
+testTxDrops(void) {
+	setUp();
+
+	CanFrame frame;
+	CanTxStats stats;
+	U8 k;
+
+	frame = extFrame(0x1234567, 8u);
+	for (k = 0u; k < 3u + 4u + 2u; k++) {
+		(void)canTx(&frame, CAN_PRIO_LOW);
+	}
+	canGetTxStats(&stats);
+	TEST_ASSERT_EQUAL_UINT16(2u, stats.drops);
+	TEST_ASSERT_EQUAL_UINT8(4u, stats.peak);
+
+	// Without interrupts, sent buffers are retired by the next canTx
+	for (k = 0u; k < 3u; k++) {
+		TEST_ASSERT_GREATER_OR_EQUAL(0, mockCanTransmit());
+	}
+	TEST_ASSERT_EQUAL(OK, canTx(&frame, CAN_PRIO_LOW));
+	for (k = 0u; k < 3u; k++) {
+		TEST_ASSERT_GREATER_OR_EQUAL(0, mockCanTransmit());
+	}
+	TEST_ASSERT_EQUAL(OK, canTx(&frame, CAN_PRIO_LOW));
+	TEST_ASSERT_EQUAL(OK, canTx(&frame, CAN_PRIO_LOW));
+	canGetTxStats(&stats);
+	TEST_ASSERT_EQUAL_UINT16(2u, stats.drops);
+
+	tearDown();
+}
+
+static void
+testIdRegisters(void) {
+	setUp();
+
+	CanId ext = {.isExt = true, .eid = 0x1ABCDEF5};
+	CanId std = {.isExt = false, .sid = 0x5A5};
+
+	canSetMask0(&ext);
+	TEST_ASSERT_EQUAL_HEX8(0xD5, mockCan.regs[0x20]); // id[28:21]
+	TEST_ASSERT_EQUAL_HEX8(0xE8, mockCan.regs[0x21]); // id[20:18], EXIDE, id[17:16]
+	TEST_ASSERT_EQUAL_HEX8(0xDE, mockCan.regs[0x22]);
+	TEST_ASSERT_EQUAL_HEX8(0xF5, mockCan.regs[0x23]);
+
+	canSetFilter5(&std);
+	TEST_ASSERT_EQUAL_HEX8(0xB4, mockCan.regs[0x18]);
+	TEST_ASSERT_EQUAL_HEX8(0xA0, mockCan.regs[0x19]);
+	TEST_ASSERT_EQUAL_HEX8(0x00, mockCan.regs[0x1A]);
+	TEST_ASSERT_EQUAL_HEX8(0x00, mockCan.regs[0x1B]);
+
+	canSetBitTiming(CAN_TIMING_250K);
+	TEST_ASSERT_EQUAL_HEX8(0xC1, mockCan.regs[0x2A]);
+	TEST_ASSERT_EQUAL_HEX8(0x9A, mockCan.regs[0x29]);
+	TEST_ASSERT_EQUAL_HEX8(0x03, mockCan.regs[0x28]);
+
+	tearDown();
+}
+
+static void
+testRx(void) {
+	setUp();
+
+	CanFrame sent, got;
+	MockCanFrame m;
+
+	canIE(true);
+	sent = extFrame(0x18FEF100, 8u);
+	m = regsOf(&sent);
+	TEST_ASSERT_EQUAL(1, mockCanReceive(&m, 2u));
+	TEST_ASSERT_TRUE(mockCanInt());
+	TEST_ASSERT_EQUAL_HEX8(0x80 | 0x10 | 2u, canRxStatus());
+	canReadRxb1(&got);
+	mockSync();
+	TEST_ASSERT_FALSE(mockCanInt()); // RX1IF cleared by READ RX BUFFER
+	TEST_ASSERT_TRUE(canIdEq(&sent.id, &got.id));
+	TEST_ASSERT_FALSE(got.rtr);
+	TEST_ASSERT_EQUAL_UINT8(8u, got.dlc);
+	TEST_ASSERT_EQUAL_MEMORY(sent.data, got.data, 8u);
+
+	tearDown();
+}
+
+// The bus acknowledges whatever is pending.
+static void
+ack(void) {
+	while (mockCanTransmit() >= 0) {}
+}
+
+// Change the bit rate while frames are waiting to be sent.
+static void
+testRetime(void) {
+	setUp();
+
+	CanFrame frame;
+	U8 k;
+
+	canSetMode(CAN_MODE_NORMAL);
+	for (k = 0u; k < 5u; k++) { // 3 in buffers, 2 queued
+		frame = extFrame(0x1272300 + k, 6u);
+		TEST_ASSERT_EQUAL(OK, canTx(&frame, CAN_PRIO_MEDIUM_HIGH));
+	}
+	mockDelayHook = ack;
+	TEST_ASSERT_EQUAL(OK, canRetime(CAN_TIMING_250K));
+	mockDelayHook = NULL;
+	TEST_ASSERT_EQUAL_UINT32(5u, mockCan.ntx); // sent at the old rate
+	TEST_ASSERT_EQUAL_UINT32(250000ul, mockCanBitRate());
+	TEST_ASSERT_EQUAL_HEX8(CAN_MODE_NORMAL, mockCan.regs[0x0E] >> 5u);
+
+	// Nobody acknowledges: the frames are given up
+	for (k = 0u; k < 4u; k++) {
+		frame = extFrame(0x1272300 + k, 6u);
+		TEST_ASSERT_EQUAL(OK, canTx(&frame, CAN_PRIO_MEDIUM_HIGH));
+	}
+	TEST_ASSERT_EQUAL(FAIL, canRetime(CAN_TIMING_500K));
+	TEST_ASSERT_EQUAL_UINT32(500000ul, mockCanBitRate());
+	TEST_ASSERT_EQUAL_HEX8(CAN_MODE_NORMAL, mockCan.regs[0x0E] >> 5u);
+	TEST_ASSERT_EQUAL_HEX8(0x00, mockCan.regs[0x0F] & 0x10); // ABAT released
+	for (k = 0u; k < 3u; k++) {
+		TEST_ASSERT_EQUAL_HEX8(0x00, mockCan.regs[0x30 + 0x10*k] & 0x08); // TXREQ
+	}
+	TEST_ASSERT_EQUAL(-1, mockCanTransmit());
+
+	// Transmission carries on at the new rate
+	frame = extFrame(0x1272300, 6u);
+	TEST_ASSERT_EQUAL(OK, canTx(&frame, CAN_PRIO_MEDIUM_HIGH));
+	TEST_ASSERT_GREATER_OR_EQUAL(0, mockCanTransmit());
+	TEST_ASSERT_EQUAL_UINT32(6u, mockCan.ntx);
+
+	tearDown();
+}
+
+// Enter Config mode to change a filter while nobody acknowledges.
+static void
+testConfig(void) {
+	setUp();
+
+	CanFrame frame;
+	CanId id;
+	CanMode mode;
+
+	canSetMode(CAN_MODE_NORMAL);
+	frame = extFrame(0x1272300, 6u);
+	TEST_ASSERT_EQUAL(OK, canTx(&frame, CAN_PRIO_MEDIUM_HIGH));
+	TEST_ASSERT_EQUAL(FAIL, canConfigBegin(&mode));
+	TEST_ASSERT_EQUAL(CAN_MODE_NORMAL, mode);
+	TEST_ASSERT_EQUAL_HEX8(CAN_MODE_CONFIG, mockCan.regs[0x0E] >> 5u);
+	id = (CanId){.isExt = true, .eid = 0x18FEF100};
+	canSetFilter5(&id);
+	canConfigEnd(mode);
+	TEST_ASSERT_EQUAL_HEX8(CAN_MODE_NORMAL, mockCan.regs[0x0E] >> 5u);
+	TEST_ASSERT_EQUAL(-1, mockCanTransmit()); // given up
+
+	// Nothing pending: straight in
+	TEST_ASSERT_EQUAL(OK, canConfigBegin(&mode));
+	canConfigEnd(mode);
+	TEST_ASSERT_EQUAL_HEX8(CAN_MODE_NORMAL, mockCan.regs[0x0E] >> 5u);
+
+	tearDown();
+}
+
+/* Receive path.
+ *
+ * isr() does what the firmware's interrupt handler does on a falling
+ * edge of INT; isrOld() is the original handler: one frame per edge,
+ * chosen by filter hit, with rollover disabled.
+ */
+typedef struct {
+	U32 next; // time of the next frame on the bus
+	U32 gap; // cycles between frames
+	U32 sent, received;
+	bool intf; // PIC's INTF latch
+	bool level; // INT asserted
+} Bus;
+
+static Bus bus;
+
+// Put frames due by now on the bus, and latch falling edges of INT.
+static void
+arrive(void) {
+	MockCanFrame m;
+	CanFrame frame;
+
+	mockSync();
+	bus.level = mockCanInt(); // as left by the firmware
+	while ((I32)(mockClock - bus.next) >= 0) {
+		frame = extFrame(bus.sent, 8u);
+		m = regsOf(&frame);
+		(void)mockCanReceive(&m, (bus.sent % 8u == 0u) ? 0u : 2u); // some control frames
+		bus.sent++;
+		bus.next += bus.gap;
+	}
+	mockSync();
+	if (mockCanInt() && !bus.level) {
+		bus.intf = true;
+	}
+	bus.level = mockCanInt();
+}
+
+static U8
+rxStatus(void) {
+	arrive();
+	return canRxStatus();
+}
+
+static void
+isr(void) {
+	CanFrame frame;
+	U8 status;
+
+	bus.intf = false;
+	do {
+		while ((status = rxStatus()) & 0xC0) {
+			if (status & 0x40) {
+				canReadRxb0(&frame);
+				bus.received++;
+			}
+			if (status & 0x80) {
+				canReadRxb1(&frame);
+				bus.received++;
+			}
+		}
+		canTxService();
+	} while (canErrService());
+	arrive();
+}
+
+static void
+isrOld(void) {
+	CanFrame frame;
+
+	switch (rxStatus() & 0x7) {
+	case 0u:
+	case 1u:
+		canReadRxb0(&frame);
+		break;
+	default:
+		canReadRxb1(&frame);
+	}
+	bus.received++; // counted even if the buffer was empty
+	bus.intf = false;
+	arrive();
+}
+
+// Frames at a fixed rate for 1s, while the main loop holds off the CAN
+// interrupt for `hold' cycles at a time to handle them.
+static void
+receive(bool old, U32 gap, U32 hold) {
+	enum { LOOP = 200u, SECOND = 12000000ul };
+	U32 t0;
+
+	setUp();
+	canIE(true);
+	if (old) {
+		mockCan.regs[0x60] = 0x00; // no rollover
+	}
+	bus = (Bus){.next = mockClock + gap, .gap = gap};
+	t0 = mockClock;
+	while (mockClock - t0 < SECOND) {
+		// Main loop: INTE masked while a frame is handled
+		_delay(hold);
+		arrive();
+		_delay(LOOP);
+		arrive();
+		if (bus.intf) {
+			old ? isrOld() : isr();
+		}
+	}
+}
+
+// Two frames arrive before the interrupt is serviced: both are read,
+// oldest first, and INT is released.
+static void
+testDrainBoth(void) {
+	setUp();
+
+	CanFrame a, b, got;
+	MockCanFrame m;
+	U8 status;
+
+	canIE(true);
+	a = extFrame(0x1272001, 6u);
+	b = extFrame(0x1272002, 6u);
+	m = regsOf(&a);
+	TEST_ASSERT_EQUAL(0, mockCanReceive(&m, 0u));
+	m = regsOf(&b);
+	TEST_ASSERT_EQUAL(1, mockCanReceive(&m, 0u)); // rolled over
+
+	status = canRxStatus();
+	TEST_ASSERT_EQUAL_HEX8(0xC0, status & 0xC0);
+	canReadRxb0(&got);
+	TEST_ASSERT_TRUE(canIdEq(&a.id, &got.id));
+	canReadRxb1(&got);
+	TEST_ASSERT_TRUE(canIdEq(&b.id, &got.id));
+	TEST_ASSERT_EQUAL_HEX8(0x00, canRxStatus() & 0xC0);
+	TEST_ASSERT_FALSE(canErrService());
+	TEST_ASSERT_FALSE(mockCanInt());
+
+	tearDown();
+}
+
+// A frame that finds both buffers full is counted, and ERRIF is cleared.
+static void
+testOverflow(void) {
+	setUp();
+
+	CanFrame frame;
+	CanRxStats stats;
+	MockCanFrame m;
+	U8 k;
+
+	canIE(true);
+	frame = extFrame(0x1272001, 1u);
+	m = regsOf(&frame);
+	for (k = 0u; k < 3u; k++) {
+		(void)mockCanReceive(&m, 0u); // third one overflows RXB1 after rollover
+	}
+	(void)mockCanReceive(&m, 3u);
+	mockCan.regs[0x60] = 0x00; // no rollover
+	(void)mockCanReceive(&m, 0u);
+	TEST_ASSERT_EQUAL_UINT32(3u, mockCan.rxOverflows);
+
+	canReadRxb0(&frame);
+	canReadRxb1(&frame);
+	TEST_ASSERT_FALSE(canErrService()); // only ERRIF was left
+	mockSync();
+	TEST_ASSERT_FALSE(mockCanInt());
+	canGetRxStats(&stats);
+	TEST_ASSERT_EQUAL_UINT16(1u, stats.rx0Overflows); // sticky: once per service
+	TEST_ASSERT_EQUAL_UINT16(1u, stats.rx1Overflows);
+	TEST_ASSERT_EQUAL_HEX8(0x00, mockCan.regs[0x2D]);
+
+	tearDown();
+}
+
+static void
+testSustained(void) {
+	static const struct {
+		const char *rate;
+		U32 gap; // 8-byte extended frames back to back: ~150 bits
+	} rates[] = {{"250k", 7200u}, {"500k", 3600u}};
+	static const U32 holds[] = {1200u, 6000u, 12000u}; // 0.1ms-1ms
+	CanRxStats stats;
+	U32 oldRx, overflows;
+	U8 r, h;
+
+	printf("\nFrames received out of 1s at full bus load:\n");
+	printf("%6s %8s %8s %8s %8s %10s\n", "rate", "hold us", "sent", "old", "new", "overflows");
+	for (r = 0u; r < sizeof(rates)/sizeof(rates[0u]); r++) {
+		for (h = 0u; h < sizeof(holds)/sizeof(holds[0u]); h++) {
+			receive(true, rates[r].gap, holds[h]);
+			oldRx = bus.received;
+			receive(false, rates[r].gap, holds[h]);
+			canGetRxStats(&stats);
+			overflows = stats.rx0Overflows + stats.rx1Overflows;
+			printf("%6s %8lu %8lu %8lu %8lu %10lu\n", rates[r].rate,
+				(unsigned long)holds[h] / 12u, (unsigned long)bus.sent,
+				(unsigned long)oldRx, (unsigned long)bus.received,
+				(unsigned long)overflows);
+
+			TEST_ASSERT_GREATER_OR_EQUAL(oldRx, bus.received);
+			TEST_ASSERT_LESS_OR_EQUAL(bus.sent, bus.received + mockCan.rxOverflows);
+			TEST_ASSERT_EQUAL(mockCan.rxOverflows > 0u, overflows > 0u); // losses are reported
+			if (holds[h] + 2000u < rates[r].gap) { // serviced between frames
+				TEST_ASSERT_EQUAL_UINT32(0u, mockCan.rxOverflows);
+			}
+		}
+	}
+
+	tearDown();
+}
+
+/* SPI traffic of each operation. */
+typedef struct {
+	U32 bytes, transactions;
+} Traffic;
+
+static Traffic
+since(void) {
+	Traffic t = {mockSpi.bytes, mockSpi.transactions};
+
+	mockSpiClear();
+	return t;
+}
+
+static void
+testSpiCounts(void) {
+	setUp();
+
+	CanFrame frame;
+	CanId id = {.isExt = true, .eid = 0x18FEF100};
+	Traffic tx8, tx2, txDone, mask, timing, rx, ie;
+
+	canIE(true);
+	mockSpiClear();
+
+	frame = extFrame(0x18FEF100, 8u);
+	(void)canTx(&frame, CAN_PRIO_LOW);
+	tx8 = since();
+
+	(void)mockCanTransmit();
+	canTxService();
+	txDone = since();
+
+	frame = stdFrame(0x123, 2u);
+	(void)canTx(&frame, CAN_PRIO_LOW);
+	tx2 = since();
+
+	canSetMask1(&id);
+	mask = since();
+
+	canSetBitTiming(CAN_TIMING_500K);
+	timing = since();
+
+	canIE(true);
+	ie = since();
+
+	frame = extFrame(0x18FEF100, 8u);
+	{
+		MockCanFrame m = regsOf(&frame);
+		(void)mockCanReceive(&m, 0u);
+	}
+	mockSpiClear();
+	canReadRxb0(&frame);
+	rx = since();
+
+	printf("\nMCP2515 SPI traffic per operation:\n");
+	printf("%-28s %6s %6s\n", "operation", "bytes", "CS");
+	printf("%-28s %6lu %6lu\n", "canTx, ext ID, 8 bytes", (unsigned long)tx8.bytes, (unsigned long)tx8.transactions);
+	printf("%-28s %6lu %6lu\n", "canTx, std ID, 2 bytes", (unsigned long)tx2.bytes, (unsigned long)tx2.transactions);
+	printf("%-28s %6lu %6lu\n", "TX-done interrupt", (unsigned long)txDone.bytes, (unsigned long)txDone.transactions);
+	printf("%-28s %6lu %6lu\n", "set mask/filter", (unsigned long)mask.bytes, (unsigned long)mask.transactions);
+	printf("%-28s %6lu %6lu\n", "set bit timing", (unsigned long)timing.bytes, (unsigned long)timing.transactions);
+	printf("%-28s %6lu %6lu\n", "enable interrupts", (unsigned long)ie.bytes, (unsigned long)ie.transactions);
+	printf("%-28s %6lu %6lu\n", "read RX buffer, 8 bytes", (unsigned long)rx.bytes, (unsigned long)rx.transactions);
+
+	// LOAD TX BUFFER and RTS
+	TEST_ASSERT_EQUAL_UINT32(1u+4u+1u+8u + 1u, tx8.bytes);
+	TEST_ASSERT_EQUAL_UINT32(2u, tx8.transactions);
+	// Sequential WRITE
+	TEST_ASSERT_EQUAL_UINT32(2u+4u, mask.bytes);
+	TEST_ASSERT_EQUAL_UINT32(2u+3u, timing.bytes);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testTxFrames);
+	RUN_TEST(testTxOrder);
+	RUN_TEST(testTxDrops);
+	RUN_TEST(testIdRegisters);
+	RUN_TEST(testRetime);
+	RUN_TEST(testConfig);
+	RUN_TEST(testRx);
+	RUN_TEST(testDrainBoth);
+	RUN_TEST(testOverflow);
+	RUN_TEST(testSustained);
+	RUN_TEST(testSpiCounts);
+
+	return UnityEnd();
+}
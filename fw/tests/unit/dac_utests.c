@@ -0,0 +1,179 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <dac.h>
+#include <mock.h>
+
+#include <xc.h>
+
+void setUp(void) {
+	mockReset();
+	dacInit();
+	mockSync();
+	mockSpiClear();
+	mockDac.writes = 0u;
+}
+void tearDown(void) {}
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+static void
+testInit(void) {
+	U8 ch;
+
+	mockReset();
+	for (ch = 0u; ch < DAC_NCHAN; ch++) {
+		mockDac.out[ch] = 0x3FF;
+	}
+	dacInit();
+	mockSync();
+	TEST_ASSERT_EQUAL_UINT32(DAC_NCHAN, mockDac.writes);
+	TEST_ASSERT_EQUAL_UINT32(DAC_NCHAN, mockSpi.transactions);
+	for (ch = 0u; ch < DAC_NCHAN; ch++) {
+		TEST_ASSERT_EQUAL_UINT16(0u, mockDac.out[ch]);
+	}
+}
+
+static void
+testCode(void) {
+	setUp();
+
+	U16 mv;
+
+	TEST_ASSERT_EQUAL_UINT16(0u, dacCode(0u));
+	TEST_ASSERT_EQUAL_UINT16(512u, dacCode(2500u));
+	TEST_ASSERT_EQUAL_UINT16(DAC_MAX_CODE, dacCode(4999u));
+	TEST_ASSERT_EQUAL_UINT16(DAC_MAX_CODE, dacCode(5000u)); // not 1024
+	TEST_ASSERT_EQUAL_UINT16(DAC_MAX_CODE, dacCode(0xFFFF));
+	for (mv = 0u; mv < 5000u; mv++) {
+		TEST_ASSERT_EQUAL_UINT16((U32)mv * 1024u / 5000u, dacCode(mv));
+	}
+
+	tearDown();
+}
+
+// Only the channels whose code changed are written.
+static void
+testCommit(void) {
+	setUp();
+
+	TEST_ASSERT_EQUAL_UINT8(0u, dacCommit());
+
+	dacStage(DAC_1B, 100u);
+	dacStage(DAC_2B, 2000u); // clamped
+	TEST_ASSERT_EQUAL_UINT8(2u, dacCommit());
+	mockSync();
+	TEST_ASSERT_EQUAL_UINT32(2u, mockSpi.transactions);
+	TEST_ASSERT_EQUAL_UINT32(4u, mockSpi.bytes);
+	TEST_ASSERT_EQUAL_UINT16(0u, mockDac.out[DAC_1A]);
+	TEST_ASSERT_EQUAL_UINT16(100u, mockDac.out[DAC_1B]);
+	TEST_ASSERT_EQUAL_UINT16(0u, mockDac.out[DAC_2A]);
+	TEST_ASSERT_EQUAL_UINT16(DAC_MAX_CODE, mockDac.out[DAC_2B]);
+
+	// Unchanged, and changed back before the commit
+	dacStage(DAC_1B, 100u);
+	dacStage(DAC_1A, 7u);
+	dacStage(DAC_1A, 0u);
+	TEST_ASSERT_EQUAL_UINT8(0u, dacCommit());
+
+	// Last staged wins
+	dacStage(DAC_2A, 1u);
+	dacStage(DAC_2A, 2u);
+	TEST_ASSERT_EQUAL_UINT8(1u, dacCommit());
+	mockSync();
+	TEST_ASSERT_EQUAL_UINT16(2u, mockDac.out[DAC_2A]);
+	TEST_ASSERT_EQUAL_UINT32(3u, mockDac.writes);
+
+	tearDown();
+}
+
+/* SPI traffic of the analog outputs.
+ *
+ * Four gauges follow slowly drifting, noisy voltages, each updated at
+ * 50Hz. Before, every new value was converted from millivolts and
+ * written on its own as the scheduler took it, spreading the channels
+ * over a scheduler round. Now the values are DAC codes, equal codes
+ * aren't written, and the channels of one update are written together.
+ */
+static void
+testTraffic(void) {
+	setUp();
+
+	enum { UPDATES = 50u*60u, NOISE_MV = 20u }; // a minute
+	static const U16 base[DAC_NCHAN] = {800u, 1900u, 3100u, 4200u};
+	U16 mv[DAC_NCHAN], last[DAC_NCHAN];
+	U32 rng, k, before, skew, maxSkew, t0, t1;
+	U8 ch;
+
+	rng = 7u;
+	before = 0u;
+	maxSkew = 0u;
+	for (ch = 0u; ch < DAC_NCHAN; ch++) {
+		last[ch] = 0xFFFF;
+	}
+	for (k = 0u; k < UPDATES; k++) {
+		for (ch = 0u; ch < DAC_NCHAN; ch++) {
+			mv[ch] = base[ch] + (k/10u) % 200u + xorshift(&rng) % NOISE_MV;
+			if (mv[ch] != last[ch]) {
+				before++; // a write per new value
+				last[ch] = mv[ch];
+			}
+			dacStage(ch, dacCode(mv[ch])); // as stored in a table of codes
+		}
+		(void)dacCommit();
+		mockSync();
+
+		// Spread of the writes of this update
+		t0 = 0xFFFFFFFF;
+		t1 = 0u;
+		for (ch = 0u; ch < DAC_NCHAN; ch++) {
+			if (mockDac.latchedAt[ch] + 1000u >= mockClock) { // written now
+				t0 = (mockDac.latchedAt[ch] < t0) ? mockDac.latchedAt[ch] : t0;
+				t1 = (mockDac.latchedAt[ch] > t1) ? mockDac.latchedAt[ch] : t1;
+			}
+		}
+		skew = (t1 > t0) ? t1 - t0 : 0u;
+		maxSkew = (skew > maxSkew) ? skew : maxSkew;
+		mockClock += 12000000ul / 50u;
+
+		for (ch = 0u; ch < DAC_NCHAN; ch++) {
+			TEST_ASSERT_EQUAL_UINT16(dacCode(mv[ch]), mockDac.out[ch]);
+		}
+	}
+
+	printf("\nSPI traffic of %u updates of %u analog outputs:\n", UPDATES, DAC_NCHAN);
+	printf("%14s %10s %10s\n", "", "before", "batched");
+	printf("%14s %10lu %10lu\n", "transactions", (unsigned long)before,
+		(unsigned long)mockSpi.transactions);
+	printf("%14s %10lu %10lu\n", "bytes", (unsigned long)2u*before,
+		(unsigned long)mockSpi.bytes);
+	printf("%14s %10lu %10lu\n", "divisions", (unsigned long)before, 0ul);
+	printf("%14s %10s %10.1f\n", "max skew us", "-", maxSkew / 12.0);
+	TEST_ASSERT_EQUAL_UINT32(mockSpi.transactions, mockDac.writes);
+	TEST_ASSERT_LESS_THAN_UINT32(before, mockSpi.transactions);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(3u*2u*32u, maxSkew); // three writes apart at most
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testInit);
+	RUN_TEST(testCode);
+	RUN_TEST(testCommit);
+	RUN_TEST(testTraffic);
+
+	return UnityEnd();
+}
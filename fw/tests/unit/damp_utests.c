@@ -0,0 +1,246 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <damp.h>
+
+static Damp damp;
+
+void setUp(void) {
+	dampInit(&damp);
+}
+void tearDown(void) {}
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+// Step until settled. Returns the number of ticks taken.
+static U32
+settle(Damp *d) {
+	U32 ticks;
+	U16 out;
+
+	for (ticks = 0u; !d->settled; ticks++) {
+		TEST_ASSERT_LESS_THAN_UINT32(1000000ul, ticks);
+		(void)dampStep(d, &out);
+	}
+	return ticks;
+}
+
+// With both stages off, the target is output at once.
+static void
+testOff(void) {
+	setUp();
+
+	U16 out;
+
+	TEST_ASSERT_TRUE(dampSet(&damp, 1234u));
+	TEST_ASSERT_EQUAL_UINT16(1234u, dampOut(&damp));
+	TEST_ASSERT_FALSE(dampStep(&damp, &out));
+
+	// Erased settings
+	dampConfig(&damp, 0xFF, DAMP_SLEW_OFF);
+	TEST_ASSERT_TRUE(dampSet(&damp, 0xFFFF));
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, dampOut(&damp));
+
+	tearDown();
+}
+
+// The IIR covers 1/2^shift of the distance per tick, without overshoot,
+// and reaches the target exactly.
+static void
+testIir(void) {
+	setUp();
+
+	U32 ticks;
+	U16 out, prev;
+
+	dampConfig(&damp, 4u, DAMP_SLEW_OFF);
+	TEST_ASSERT_FALSE(dampSet(&damp, 16000u));
+	TEST_ASSERT_TRUE(dampStep(&damp, &out));
+	TEST_ASSERT_EQUAL_UINT16(1000u, out);
+
+	// 1 - (15/16)^16 of the way after one time constant
+	for (ticks = 1u; ticks < 16u; ticks++) {
+		(void)dampStep(&damp, &out);
+	}
+	TEST_ASSERT_UINT32_WITHIN(50u, 10302u, dampOut(&damp));
+
+	prev = dampOut(&damp);
+	while (!damp.settled) {
+		if (dampStep(&damp, &out)) {
+			TEST_ASSERT_GREATER_THAN(prev, out);
+			TEST_ASSERT_LESS_OR_EQUAL(16000u, out);
+			prev = out;
+		}
+	}
+	TEST_ASSERT_EQUAL_UINT16(16000u, dampOut(&damp));
+
+	// Down again
+	TEST_ASSERT_FALSE(dampSet(&damp, 0u));
+	ticks = settle(&damp);
+	TEST_ASSERT_EQUAL_UINT16(0u, dampOut(&damp));
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(16u*32u, ticks);
+
+	tearDown();
+}
+
+// The slew limiter ramps the output at a fixed rate.
+static void
+testSlew(void) {
+	setUp();
+
+	U16 out;
+	U32 k;
+
+	dampConfig(&damp, 0u, 100u);
+	TEST_ASSERT_FALSE(dampSet(&damp, 1050u));
+	for (k = 1u; k <= 10u; k++) {
+		TEST_ASSERT_TRUE(dampStep(&damp, &out));
+		TEST_ASSERT_EQUAL_UINT16(100u*k, out);
+	}
+	TEST_ASSERT_TRUE(dampStep(&damp, &out));
+	TEST_ASSERT_EQUAL_UINT16(1050u, out);
+	TEST_ASSERT_TRUE(damp.settled);
+
+	// Both stages, over the full range
+	dampConfig(&damp, 1u, 0x4000);
+	TEST_ASSERT_FALSE(dampSet(&damp, 0xFFFF));
+	TEST_ASSERT_TRUE(dampStep(&damp, &out));
+	TEST_ASSERT_EQUAL_UINT16(1050u + 0x4000, out);
+	(void)settle(&damp);
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, dampOut(&damp));
+	TEST_ASSERT_FALSE(dampSet(&damp, 0u));
+	TEST_ASSERT_TRUE(dampStep(&damp, &out));
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF - 0x4000, out);
+	(void)settle(&damp);
+	TEST_ASSERT_EQUAL_UINT16(0u, dampOut(&damp));
+
+	// Turned off midway: the next target is output at once
+	TEST_ASSERT_FALSE(dampSet(&damp, 5000u));
+	TEST_ASSERT_TRUE(dampStep(&damp, &out));
+	dampConfig(&damp, 0u, DAMP_SLEW_OFF);
+	TEST_ASSERT_TRUE(dampSet(&damp, 6000u));
+	TEST_ASSERT_EQUAL_UINT16(6000u, dampOut(&damp));
+
+	tearDown();
+}
+
+// Noise on a steady signal is smoothed out.
+static void
+testNoise(void) {
+	setUp();
+
+	enum { MEAN = 20000u, NOISE = 2000u, TICKS = 5000u };
+	U32 rng, k;
+	U16 out, in, lo, hi;
+
+	rng = 1u;
+	dampConfig(&damp, 5u, DAMP_SLEW_OFF);
+	(void)dampSet(&damp, MEAN);
+	(void)settle(&damp);
+	lo = hi = dampOut(&damp);
+	for (k = 0u; k < TICKS; k++) {
+		in = MEAN - NOISE/2u + xorshift(&rng) % NOISE;
+		(void)dampSet(&damp, in);
+		(void)dampStep(&damp, &out);
+		if (dampOut(&damp) < lo) {
+			lo = dampOut(&damp);
+		}
+		if (dampOut(&damp) > hi) {
+			hi = dampOut(&damp);
+		}
+	}
+	printf("\nOutput swing for an input swing of %u: %u\n", NOISE, hi - lo);
+	TEST_ASSERT_LESS_THAN_UINT32(NOISE/3u, hi - lo);
+
+	tearDown();
+}
+
+/* Cycle budget.
+ *
+ * The main loop steps all six dampers each tick with the CAN interrupt
+ * masked, so the damping must leave room for it and the timers. Rough
+ * instruction cycle costs of dampStep on the PIC, as compiled by XC8: a
+ * 32-bit shift takes about 7 cycles a bit, the rest a few 16- and 32-bit
+ * compares and additions. The worst case is the largest shift with both
+ * stages on. Stepping is also timed on the host to check that the work
+ * doesn't depend on the values.
+ */
+enum {
+	NDAMP = 6u,
+	TICK_CYCLES = 12000000ul / DAMP_TICK_HZ,
+	BUDGET_CYCLES = TICK_CYCLES / 20u, // 5%
+	CYC_CALL = 40u, // call, pointer setup, settled check, return
+	CYC_IIR = 90u, // goal, compare, subtract, add, snap check
+	CYC_SHIFT_BIT = 7u,
+	CYC_ROUND = 30u,
+	CYC_SLEW = 60u,
+	CYC_SETTLED = 20u,
+};
+
+static U32
+stepCycles(U8 shift, bool slew) {
+	return CYC_CALL + CYC_IIR + shift*CYC_SHIFT_BIT + CYC_ROUND
+		+ (slew ? CYC_SLEW : 0u) + CYC_SETTLED;
+}
+
+static void
+testBudget(void) {
+	enum { TICKS = 200000u };
+	Damp ds[NDAMP];
+	U32 k, worst;
+	U8 i;
+	U16 out;
+	clock_t start;
+	double ns;
+
+	worst = NDAMP * stepCycles(DAMP_MAX_SHIFT, true);
+	printf("\nDamping %u signals at %uHz, worst case:\n", NDAMP, DAMP_TICK_HZ);
+	printf("%12s %12s %12s\n", "cycles/tick", "budget", "tick");
+	printf("%12lu %12lu %12lu\n", (unsigned long)worst,
+		(unsigned long)BUDGET_CYCLES, (unsigned long)TICK_CYCLES);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(BUDGET_CYCLES, worst);
+
+	// Host: swing between the extremes so no damper ever settles
+	for (i = 0u; i < NDAMP; i++) {
+		dampInit(&ds[i]);
+		dampConfig(&ds[i], DAMP_MAX_SHIFT, 1u);
+	}
+	start = clock();
+	for (k = 0u; k < TICKS; k++) {
+		for (i = 0u; i < NDAMP; i++) {
+			if (k % 1000u == 0u) {
+				(void)dampSet(&ds[i], (k/1000u) & 1u ? 0u : 0xFFFF);
+			}
+			(void)dampStep(&ds[i], &out);
+			TEST_ASSERT_FALSE(ds[i].settled);
+		}
+	}
+	ns = 1e9 * (clock() - start) / CLOCKS_PER_SEC / TICKS;
+	printf("Host: %.0fns per tick of %u dampers\n", ns, NDAMP);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testOff);
+	RUN_TEST(testIir);
+	RUN_TEST(testSlew);
+	RUN_TEST(testNoise);
+	RUN_TEST(testBudget);
+
+	return UnityEnd();
+}
@@ -0,0 +1,177 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <dispatch.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static CanId
+ext(U32 eid) {
+	return (CanId){.isExt = true, .eid = eid};
+}
+
+static CanId
+std(U16 sid) {
+	return (CanId){.isExt = false, .sid = sid};
+}
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+static bool
+idEq(const CanId *a, const CanId *b) {
+	if (a->isExt != b->isExt) {
+		return false;
+	}
+	return a->isExt ? a->eid == b->eid : a->sid == b->sid;
+}
+
+// The linear scan that the table replaces.
+static DispSet
+scan(const CanId ids[], U8 n, const CanId *id) {
+	DispSet sigs;
+	U8 k;
+
+	sigs = 0u;
+	for (k = 0u; k < n; k++) {
+		if (idEq(&ids[k], id)) {
+			sigs |= 1u << k;
+		}
+	}
+	return sigs;
+}
+
+static void
+testLookup(void) {
+	setUp();
+
+	// Signals 0 and 3 share a message
+	CanId ids[] = {ext(0x0CF00400), ext(0x18FEF100), std(0x123), ext(0x0CF00400), ext(0x123)};
+	Dispatch d;
+	CanId id;
+	U8 k;
+
+	dispInit(&d);
+	for (k = 0u; k < 5u; k++) {
+		TEST_ASSERT_EQUAL(OK, dispAdd(&d, &ids[k], k));
+	}
+	TEST_ASSERT_EQUAL_UINT8(0x09, dispLookup(&d, &ids[0u]));
+	TEST_ASSERT_EQUAL_UINT8(0x02, dispLookup(&d, &ids[1u]));
+	TEST_ASSERT_EQUAL_UINT8(0x04, dispLookup(&d, &ids[2u])); // standard
+	TEST_ASSERT_EQUAL_UINT8(0x10, dispLookup(&d, &ids[4u])); // extended, same number
+
+	id = ext(0x0CF00401);
+	TEST_ASSERT_EQUAL_UINT8(0u, dispLookup(&d, &id));
+	id = std(0x124);
+	TEST_ASSERT_EQUAL_UINT8(0u, dispLookup(&d, &id));
+
+	// Rebuilt empty
+	dispInit(&d);
+	TEST_ASSERT_EQUAL_UINT8(0u, dispLookup(&d, &ids[0u]));
+
+	tearDown();
+}
+
+// IDs that share a home slot, until the table is full.
+static void
+testFull(void) {
+	setUp();
+
+	CanId ids[DISP_SLOTS+1u];
+	Dispatch d;
+	CanId id;
+	U8 k;
+
+	// 0x11 * k: the nibbles cancel, so every ID hashes to slot 0
+	dispInit(&d);
+	for (k = 0u; k < DISP_SLOTS; k++) {
+		ids[k] = ext(0x11ul * k);
+		TEST_ASSERT_EQUAL(OK, dispAdd(&d, &ids[k], k % DISP_MAX_SIGS));
+	}
+	TEST_ASSERT_EQUAL_UINT8(DISP_SLOTS-1u, d.maxProbe);
+	for (k = 0u; k < DISP_SLOTS; k++) {
+		TEST_ASSERT_EQUAL_UINT8(1u << (k % DISP_MAX_SIGS), dispLookup(&d, &ids[k]));
+	}
+	id = ext(0x1100);
+	TEST_ASSERT_EQUAL_UINT8(0u, dispLookup(&d, &id)); // terminates
+	TEST_ASSERT_EQUAL(FAIL, dispAdd(&d, &id, 0u));
+	TEST_ASSERT_EQUAL(OK, dispAdd(&d, &ids[0u], 1u)); // existing ID still fits
+	TEST_ASSERT_EQUAL(FAIL, dispAdd(&d, &ids[0u], DISP_MAX_SIGS));
+
+	tearDown();
+}
+
+// Random configurations against the linear scan,
+// with probe counts for IDs on a bus.
+static void
+testRandom(void) {
+	setUp();
+
+	enum { CONFIGS = 2000u, FRAMES = 64u };
+	CanId ids[DISP_MAX_SIGS], id;
+	Dispatch d;
+	U32 rng, c, hist[DISP_SLOTS];
+	U8 n, k, f;
+
+	for (k = 0u; k < DISP_SLOTS; k++) {
+		hist[k] = 0u;
+	}
+	rng = 0xC0FFEEu;
+	for (c = 0u; c < CONFIGS; c++) {
+		n = 1u + xorshift(&rng) % DISP_MAX_SIGS;
+		dispInit(&d);
+		for (k = 0u; k < n; k++) {
+			if (k > 0u && (xorshift(&rng) & 7u) == 0u) {
+				ids[k] = ids[k-1u]; // shared message
+			} else if (xorshift(&rng) & 1u) {
+				ids[k] = ext(xorshift(&rng) & 0x1FFFFFFF);
+			} else {
+				ids[k] = std(xorshift(&rng) & 0x7FF);
+			}
+			TEST_ASSERT_EQUAL(OK, dispAdd(&d, &ids[k], k));
+		}
+		hist[d.maxProbe]++;
+
+		for (k = 0u; k < n; k++) {
+			TEST_ASSERT_EQUAL_UINT8(scan(ids, n, &ids[k]), dispLookup(&d, &ids[k]));
+		}
+		for (f = 0u; f < FRAMES; f++) {
+			id = (f & 1u) ? ext(xorshift(&rng) & 0x1FFFFFFF) : std(xorshift(&rng) & 0x7FF);
+			TEST_ASSERT_EQUAL_UINT8(scan(ids, n, &id), dispLookup(&d, &id));
+		}
+	}
+
+	printf("\nLongest probe over %u random configurations of up to %u signals:\n",
+		CONFIGS, DISP_MAX_SIGS);
+	for (k = 0u; k < DISP_SLOTS; k++) {
+		if (hist[k] > 0u) {
+			printf("  %u extra slots: %5.1f%%\n", k, 100.0 * hist[k] / CONFIGS);
+		}
+	}
+	// Bound: 19 configurations in 20 probe at most 2 extra slots
+	TEST_ASSERT_GREATER_OR_EQUAL(CONFIGS*19u/20u, hist[0u] + hist[1u] + hist[2u]);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testLookup);
+	RUN_TEST(testFull);
+	RUN_TEST(testRandom);
+
+	return UnityEnd();
+}
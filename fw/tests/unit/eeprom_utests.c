@@ -0,0 +1,351 @@
+#include <xc.h>
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <spi.h>
+#include <eeprom.h>
+#include <mock.h>
+
+void setUp(void) {
+	mockReset();
+	eepromInit();
+}
+void tearDown(void) {}
+
+// The original blocking write, kept as the reference.
+// It waits out each page's write cycle with _delay().
+static U8
+refReadStatus(void) {
+	U8 status;
+
+	EEPROM_CS = 0;
+	(void)spiTx(0x05);
+	status = spiTx(0x00);
+	EEPROM_CS = 1;
+	return status;
+}
+
+static void
+refWaitAndEnable(void) {
+	while (refReadStatus() & 0x1) {
+		_delay(60000u);
+	}
+	EEPROM_CS = 0;
+	(void)spiTx(0x06);
+	EEPROM_CS = 1;
+	(void)refReadStatus();
+}
+
+static void
+refWrite(U16 addr, const U8 *data, U8 size) {
+	refWaitAndEnable();
+	EEPROM_CS = 0;
+	(void)spiTx(0x02);
+	(void)spiTx(addr >> 8u);
+	(void)spiTx(addr & 0xFF);
+	while (size--) {
+		(void)spiTx(*data++);
+		addr++;
+		if (addr % MOCK_EEPROM_PAGE == 0u && size) {
+			EEPROM_CS = 1;
+			refWaitAndEnable();
+			EEPROM_CS = 0;
+			(void)spiTx(0x02);
+			(void)spiTx(addr >> 8u);
+			(void)spiTx(addr & 0xFF);
+		}
+	}
+	EEPROM_CS = 1;
+}
+
+// Buffered bytes are read back without touching the EEPROM.
+static void
+testReadThrough(void) {
+	setUp();
+
+	U8 data[20], got[24];
+	U8 k;
+
+	for (k = 0u; k < sizeof(data); k++) {
+		data[k] = k + 1u;
+	}
+	TEST_ASSERT_EQUAL(OK, eepromWrite(10u, data, sizeof(data))); // two pages
+	mockSync();
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.writeCycles);
+
+	TEST_ASSERT_EQUAL(OK, eepromRead(10u, got, sizeof(data)));
+	TEST_ASSERT_EQUAL_MEMORY(data, got, sizeof(data));
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.reads);
+
+	// Partly buffered: the rest comes from the EEPROM
+	TEST_ASSERT_EQUAL(OK, eepromRead(8u, got, sizeof(got)));
+	TEST_ASSERT_EQUAL_UINT32(1u, mockEeprom.reads);
+	TEST_ASSERT_EQUAL_UINT8(0xFF, got[0u]);
+	TEST_ASSERT_EQUAL_UINT8(0xFF, got[1u]);
+	TEST_ASSERT_EQUAL_MEMORY(data, got+2u, sizeof(data));
+	TEST_ASSERT_EQUAL_UINT8(0xFF, got[22u]);
+
+	// A newer write to a page that is being written
+	eepromPoll(); // starts page 0
+	mockSync();
+	TEST_ASSERT_EQUAL_UINT32(1u, mockEeprom.writeCycles);
+	data[0u] = 0xAA;
+	TEST_ASSERT_EQUAL(OK, eepromWrite(10u, data, 1u));
+	TEST_ASSERT_EQUAL(OK, eepromRead(10u, got, 1u));
+	TEST_ASSERT_EQUAL_UINT8(0xAA, got[0u]);
+
+	TEST_ASSERT_EQUAL(OK, eepromFlush());
+	mockSync();
+	TEST_ASSERT_EQUAL_MEMORY(data, &mockEeprom.mem[10u], sizeof(data));
+	TEST_ASSERT_EQUAL_UINT32(3u, mockEeprom.writeCycles);
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.busyErrors);
+
+	tearDown();
+}
+
+// Scattered bytes of a page are written in one cycle, and the bytes
+// between them are left unchanged.
+static void
+testCoalesce(void) {
+	setUp();
+
+	U8 page[MOCK_EEPROM_PAGE], b;
+	U8 k;
+
+	for (k = 0u; k < sizeof(page); k++) {
+		page[k] = 0x10 + k;
+	}
+	TEST_ASSERT_EQUAL(OK, eepromWrite(32u, page, sizeof(page)));
+	TEST_ASSERT_EQUAL(OK, eepromFlush());
+
+	mockSync();
+	mockEeprom.writeCycles = 0u;
+	b = 0xA2;
+	TEST_ASSERT_EQUAL(OK, eepromWrite(32u+2u, &b, 1u));
+	b = 0xA9;
+	TEST_ASSERT_EQUAL(OK, eepromWrite(32u+9u, &b, 1u));
+	b = 0xA5;
+	TEST_ASSERT_EQUAL(OK, eepromWrite(32u+5u, &b, 1u));
+	TEST_ASSERT_EQUAL(OK, eepromFlush());
+	mockSync();
+
+	page[2u] = 0xA2;
+	page[5u] = 0xA5;
+	page[9u] = 0xA9;
+	TEST_ASSERT_EQUAL_UINT32(1u, mockEeprom.writeCycles);
+	TEST_ASSERT_EQUAL_MEMORY(page, &mockEeprom.mem[32u], sizeof(page));
+	TEST_ASSERT_EQUAL_UINT8(0xFF, mockEeprom.mem[31u]);
+	TEST_ASSERT_EQUAL_UINT8(0xFF, mockEeprom.mem[48u]);
+
+	tearDown();
+}
+
+// With every buffer taken, a write to another page waits for one cycle.
+static void
+testFull(void) {
+	setUp();
+
+	U8 b;
+	U32 t0;
+	U16 k;
+
+	b = 0x5A;
+	for (k = 0u; k < EEPROM_WB_PAGES; k++) {
+		TEST_ASSERT_EQUAL(OK, eepromWrite(k*MOCK_EEPROM_PAGE, &b, 1u));
+	}
+	eepromPoll(); // first page writing
+	t0 = mockClock;
+	TEST_ASSERT_EQUAL(OK, eepromWrite(k*MOCK_EEPROM_PAGE, &b, 1u));
+	TEST_ASSERT_TRUE(mockClock - t0 >= MOCK_EEPROM_TWC - 1000u);
+	TEST_ASSERT_TRUE(mockClock - t0 <= 2u*MOCK_EEPROM_TWC);
+
+	TEST_ASSERT_EQUAL(OK, eepromFlush());
+	mockSync();
+	for (k = 0u; k <= EEPROM_WB_PAGES; k++) {
+		TEST_ASSERT_EQUAL_UINT8(0x5A, mockEeprom.mem[k*MOCK_EEPROM_PAGE]);
+	}
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.busyErrors);
+
+	tearDown();
+}
+
+
+// Reads only poll the status register while a write cycle may be in progress.
+static void
+testSkipStatus(void) {
+	setUp();
+
+	U8 b, v;
+	U32 polls;
+
+	// Once after a reset: a cycle may have been started before it
+	TEST_ASSERT_EQUAL(OK, eepromRead(0u, &v, 1u));
+	TEST_ASSERT_EQUAL_UINT32(1u, mockEeprom.statusReads);
+	polls = mockEeprom.statusReads;
+	TEST_ASSERT_EQUAL(OK, eepromRead(0u, &v, 1u));
+	TEST_ASSERT_EQUAL_UINT32(polls, mockEeprom.statusReads);
+
+	// During a write cycle: wait for it
+	b = 0xA5;
+	TEST_ASSERT_EQUAL(OK, eepromWrite(0u, &b, 1u));
+	eepromPoll();
+	polls = mockEeprom.statusReads;
+	TEST_ASSERT_EQUAL(OK, eepromRead(1u, &v, 1u));
+	TEST_ASSERT_GREATER_THAN(polls, mockEeprom.statusReads);
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.busyErrors);
+
+	// Seen to finish: no more polling, by reads or by the main loop
+	polls = mockEeprom.statusReads;
+	TEST_ASSERT_EQUAL(OK, eepromRead(0u, &v, 1u));
+	eepromPoll();
+	TEST_ASSERT_EQUAL_UINT8(0xA5, v);
+	TEST_ASSERT_EQUAL_UINT32(polls, mockEeprom.statusReads);
+
+	tearDown();
+}
+
+// A page isn't started while a cycle from before a reset is running:
+// no instructions but READ STATUS reach the busy EEPROM.
+// (eepromInit's WRDI does, and is ignored.)
+static void
+testBusyAtReset(void) {
+	setUp();
+
+	U8 b, v;
+
+	b = 0x11;
+	refWrite(0x40, &b, 1u);
+	mockSync();
+	eepromInit(); // reset mid-cycle
+	mockEeprom.busyErrors = 0u;
+	b = 0x22;
+	TEST_ASSERT_EQUAL(OK, eepromWrite(0x80, &b, 1u));
+	eepromPoll();
+	eepromPoll();
+	TEST_ASSERT_EQUAL_UINT32(1u, mockEeprom.writeCycles);
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.busyErrors);
+
+	_delay(MOCK_EEPROM_TWC);
+	eepromPoll();
+	mockSync();
+	TEST_ASSERT_EQUAL_UINT32(2u, mockEeprom.writeCycles);
+	TEST_ASSERT_EQUAL(OK, eepromFlush());
+	TEST_ASSERT_EQUAL(OK, eepromRead(0x80, &v, 1u));
+	TEST_ASSERT_EQUAL_UINT8(0x22, v);
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.busyErrors);
+
+	tearDown();
+}
+
+/* Calibrating a 32-row table.
+ *
+ * The calibration tool sends one 6-byte row per frame. Each is written
+ * when it arrives; in between, the main loop polls the EEPROM.
+ */
+enum {
+	ROWS = 32u,
+	ROW_SIZE = 6u,
+	LOOP_CYCLES = 300u, // one pass of the main loop
+};
+
+typedef struct {
+	U32 cycles; // write cycles
+	U32 maxStall; // longest time in eepromWrite, in instruction cycles
+	U32 stall; // total time in eepromWrite
+	U32 done; // time the last write cycle finished
+} CalResult;
+
+static void
+calibrate(bool buffered, U32 frameGap, CalResult *r) {
+	U8 row[ROW_SIZE];
+	U32 t0, next, dt;
+	U8 k, b;
+
+	setUp();
+	*r = (CalResult){0};
+	next = 0u;
+	for (k = 0u; k < ROWS; k++) {
+		// Main loop until the frame arrives
+		while ((I32)(mockClock - next) < 0) {
+			_delay(LOOP_CYCLES);
+			if (buffered) {
+				eepromPoll();
+			}
+		}
+		next = mockClock + frameGap;
+
+		for (b = 0u; b < ROW_SIZE; b++) {
+			row[b] = k*ROW_SIZE + b;
+		}
+		t0 = mockClock;
+		if (buffered) {
+			TEST_ASSERT_EQUAL(OK, eepromWrite(k*ROW_SIZE, row, ROW_SIZE));
+		} else {
+			refWrite(k*ROW_SIZE, row, ROW_SIZE);
+		}
+		dt = mockClock - t0;
+		r->stall += dt;
+		r->maxStall = (dt > r->maxStall) ? dt : r->maxStall;
+	}
+	// Main loop until the last cycle is done.
+	// Polling leaves the EEPROM idle only once nothing is buffered.
+	do {
+		_delay(LOOP_CYCLES);
+		if (buffered) {
+			eepromPoll();
+		}
+	} while (refReadStatus() & 0x1);
+	mockSync();
+	r->done = mockClock;
+	r->cycles = mockEeprom.writeCycles;
+
+	for (k = 0u; k < ROWS*ROW_SIZE; k++) {
+		TEST_ASSERT_EQUAL_UINT8(k, mockEeprom.mem[k]);
+	}
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.busyErrors);
+}
+
+static void
+testCalibration(void) {
+	static const U32 gaps[] = {3000u, 12000u, 60000u, 120000u}; // 0.25ms-10ms
+	CalResult old, new;
+	U8 k;
+
+	printf("\nWriting a %u-row table, one row per frame:\n", ROWS);
+	printf("%9s %8s %8s %10s %10s %10s %10s\n", "frame gap", "cycles", "",
+		"max stall", "", "total ms", "");
+	printf("%9s %8s %8s %10s %10s %10s %10s\n", "ms", "old", "new",
+		"old ms", "new ms", "old", "new");
+	for (k = 0u; k < sizeof(gaps)/sizeof(gaps[0u]); k++) {
+		calibrate(false, gaps[k], &old);
+		calibrate(true, gaps[k], &new);
+		printf("%9.2f %8lu %8lu %10.2f %10.2f %10.1f %10.1f\n", gaps[k] / 12000.0,
+			(unsigned long)old.cycles, (unsigned long)new.cycles,
+			old.maxStall / 12000.0, new.maxStall / 12000.0,
+			old.done / 12000.0, new.done / 12000.0);
+
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(old.cycles, new.cycles);
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(old.stall, new.stall);
+	}
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testReadThrough);
+	RUN_TEST(testCoalesce);
+	RUN_TEST(testFull);
+	RUN_TEST(testSkipStatus);
+	RUN_TEST(testBusyAtReset);
+	RUN_TEST(testCalibration);
+
+	return UnityEnd();
+}
@@ -0,0 +1,142 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <errlog.h>
+
+static ErrLog elog;
+
+void setUp(void) {
+	errLogInit(&elog);
+}
+void tearDown(void) {}
+
+static void
+testCount(void) {
+	setUp();
+
+	ErrSlot slot;
+	U32 k;
+
+	errLogRecord(&elog, 100u);
+	errLogRecord(&elog, 200u);
+	errLogRecord(&elog, 100u);
+	TEST_ASSERT_EQUAL_UINT16(3u, elog.total);
+	TEST_ASSERT_EQUAL_UINT16(100u, elog.last);
+	TEST_ASSERT_EQUAL_UINT16(100u, elog.slots[0u].code);
+	TEST_ASSERT_EQUAL_UINT16(2u, elog.slots[0u].count);
+	TEST_ASSERT_EQUAL_UINT16(200u, elog.slots[1u].code);
+	TEST_ASSERT_EQUAL_UINT16(1u, elog.slots[1u].count);
+
+	// Saturate
+	for (k = 0u; k < 70000ul; k++) {
+		errLogRecord(&elog, 200u);
+	}
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, elog.slots[1u].count);
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, elog.total);
+
+	// Take and clear
+	TEST_ASSERT_TRUE(errLogTake(&elog, 0u, &slot));
+	TEST_ASSERT_EQUAL_UINT16(100u, slot.code);
+	TEST_ASSERT_EQUAL_UINT16(2u, slot.count);
+	TEST_ASSERT_TRUE(errLogTake(&elog, 0u, &slot));
+	TEST_ASSERT_EQUAL_UINT16(ERRLOG_NONE, slot.code);
+	TEST_ASSERT_EQUAL_UINT16(0u, slot.count);
+	TEST_ASSERT_FALSE(errLogTake(&elog, ERRLOG_SLOTS, &slot));
+
+	// The freed slot is reused
+	errLogRecord(&elog, 300u);
+	TEST_ASSERT_EQUAL_UINT16(300u, elog.slots[0u].code);
+
+	tearDown();
+}
+
+// Codes beyond the slots are counted as lost.
+static void
+testLost(void) {
+	setUp();
+
+	U8 k;
+
+	for (k = 0u; k < ERRLOG_SLOTS + 3u; k++) {
+		errLogRecord(&elog, 10u + k);
+	}
+	errLogRecord(&elog, 10u); // has a slot
+	TEST_ASSERT_EQUAL_UINT16(3u, elog.lost);
+	TEST_ASSERT_EQUAL_UINT16(ERRLOG_SLOTS + 4u, elog.total);
+	TEST_ASSERT_EQUAL_UINT16(2u, elog.slots[0u].count);
+	TEST_ASSERT_EQUAL_UINT16(10u + ERRLOG_SLOTS - 1u, elog.slots[ERRLOG_SLOTS-1u].code);
+
+	tearDown();
+}
+
+// A summary is due after new errors, at most once a period.
+static void
+testDue(void) {
+	setUp();
+
+	U32 t;
+
+	TEST_ASSERT_FALSE(errLogDue(&elog)); // nothing yet
+	errLogRecord(&elog, 1u);
+	TEST_ASSERT_TRUE(errLogDue(&elog)); // the first at once
+	TEST_ASSERT_FALSE(errLogDue(&elog));
+	errLogRecord(&elog, 1u);
+	for (t = 1u; t < ERRLOG_PERIOD; t++) {
+		errLogTick(&elog);
+		TEST_ASSERT_FALSE(errLogDue(&elog));
+	}
+	errLogTick(&elog);
+	TEST_ASSERT_TRUE(errLogDue(&elog));
+
+	// Quiet: no summary
+	for (t = 0u; t < 3u*ERRLOG_PERIOD; t++) {
+		errLogTick(&elog);
+		TEST_ASSERT_FALSE(errLogDue(&elog));
+	}
+
+	tearDown();
+}
+
+// A tool sending bad control frames as fast as the bus allows.
+static void
+testStorm(void) {
+	setUp();
+
+	enum { SECONDS = 10u, BAD_HZ = 2000u };
+	U32 t, tick, frames, summaries;
+
+	frames = summaries = 0u;
+	tick = 0u;
+	for (t = 0u; t < SECONDS*1000000ul; t += 1000000ul / BAD_HZ) { // us
+		errLogRecord(&elog, 500u + frames % 3u);
+		frames++;
+		for (; tick * 1000000ull / ERRLOG_PERIOD < t; tick++) {
+			errLogTick(&elog);
+		}
+		if (errLogDue(&elog)) {
+			summaries++;
+		}
+	}
+	printf("\nError frames sent for %lu bad frames in %us: before %lu, now %lu\n",
+		(unsigned long)frames, SECONDS, (unsigned long)frames, (unsigned long)summaries);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(SECONDS + 1u, summaries);
+	TEST_ASSERT_EQUAL_UINT16(frames, elog.total);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testCount);
+	RUN_TEST(testLost);
+	RUN_TEST(testDue);
+	RUN_TEST(testStorm);
+
+	return UnityEnd();
+}
@@ -0,0 +1,346 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <filter.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static CanId
+ext(U32 eid) {
+	return (CanId){.isExt = true, .eid = eid};
+}
+
+static CanId
+std(U16 sid) {
+	return (CanId){.isExt = false, .sid = sid};
+}
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+// Cover ids[0], ..., ids[n-1].
+static Status
+coverIds(const CanId ids[], U8 n, FiltCover *cover) {
+	U8 sel[FILT_MAX_IDS+2u], k;
+
+	for (k = 0u; k < n; k++) {
+		sel[k] = k;
+	}
+	return filtCover(ids, sizeof(ids[0u]), sel, n, cover);
+}
+
+// Flip each ID bit compared by the mask and check that it's rejected.
+static void
+checkNeighbours(const FiltCover *cover, const CanId *ids, U8 n) {
+	CanId id;
+	U8 k, b;
+
+	for (k = 0u; k < n; k++) {
+		TEST_ASSERT_TRUE(filtAccepts(cover, &ids[k]));
+		for (b = 0u; b < (ids[k].isExt ? 29u : 11u); b++) {
+			id = ids[k];
+			if (id.isExt) {
+				if (!cover->mask.isExt && b < 18u) {
+					continue; // ignored when standard IDs are present
+				}
+				id.eid ^= 1ul << b;
+			} else {
+				id.sid ^= 1u << b;
+			}
+			TEST_ASSERT_FALSE(filtAccepts(cover, &id));
+		}
+	}
+}
+
+// Up to four IDs get a filter each and nothing else is accepted.
+static void
+testExact(void) {
+	setUp();
+
+	CanId extIds[] = {ext(0x0CF00400), ext(0x18FEF100), ext(0x18FEEE00), ext(0x1FFFFFFF)};
+	CanId stdIds[] = {std(0x000), std(0x123), std(0x124), std(0x7FF)};
+	CanId mixed[] = {ext(0x0CF00400), ext(0x18FEF100), std(0x123), std(0x7FF)};
+	FiltCover cover;
+	CanId id;
+
+	TEST_ASSERT_EQUAL(OK, coverIds(extIds, 4u, &cover));
+	TEST_ASSERT_EQUAL_UINT8(4u, cover.groups);
+	TEST_ASSERT_TRUE(cover.mask.isExt);
+	TEST_ASSERT_EQUAL_UINT32(0x1FFFFFFF, cover.mask.eid);
+	checkNeighbours(&cover, extIds, 4u);
+
+	TEST_ASSERT_EQUAL(OK, coverIds(stdIds, 4u, &cover));
+	TEST_ASSERT_EQUAL_UINT8(4u, cover.groups);
+	TEST_ASSERT_FALSE(cover.mask.isExt);
+	TEST_ASSERT_EQUAL_UINT16(0x7FF, cover.mask.sid);
+	checkNeighbours(&cover, stdIds, 4u);
+
+	// Standard IDs are present, so the mask must not look at the data:
+	// extended IDs are only compared in their top 11 bits.
+	TEST_ASSERT_EQUAL(OK, coverIds(mixed, 4u, &cover));
+	TEST_ASSERT_EQUAL_UINT8(4u, cover.groups);
+	TEST_ASSERT_FALSE(cover.mask.isExt);
+	TEST_ASSERT_EQUAL_UINT16(0x7FF, cover.mask.sid);
+	checkNeighbours(&cover, mixed, 4u);
+
+	// Same number, other format
+	id = ext(0x123);
+	TEST_ASSERT_FALSE(filtAccepts(&cover, &id));
+
+	tearDown();
+}
+
+// Five IDs: the two that differ in one bit share a filter.
+static void
+testMerge(void) {
+	setUp();
+
+	CanId ids[] = {ext(0x100), ext(0x200), ext(0x400), ext(0x800), ext(0x801)};
+	FiltCover cover;
+	CanId id;
+	U8 k;
+
+	TEST_ASSERT_EQUAL(OK, coverIds(ids, 5u, &cover));
+	TEST_ASSERT_TRUE(cover.mask.isExt);
+	TEST_ASSERT_EQUAL_UINT32(0x1FFFFFFE, cover.mask.eid);
+	TEST_ASSERT_EQUAL_UINT8(4u, cover.groups);
+	for (k = 0u; k < 5u; k++) {
+		TEST_ASSERT_TRUE(filtAccepts(&cover, &ids[k]));
+	}
+	id = ext(0x101); // sibling of 0x100 under the mask
+	TEST_ASSERT_TRUE(filtAccepts(&cover, &id));
+	id = ext(0x802);
+	TEST_ASSERT_FALSE(filtAccepts(&cover, &id));
+
+	tearDown();
+}
+
+// Random sets of IDs are always covered, and duplicates are ignored.
+static void
+testRandom(void) {
+	setUp();
+
+	CanId ids[FILT_MAX_IDS+2u];
+	FiltCover cover;
+	U32 rng, k;
+	U8 n, i;
+
+	rng = 12345u;
+	for (k = 0u; k < 2000u; k++) {
+		n = 1u + xorshift(&rng) % FILT_MAX_IDS;
+		for (i = 0u; i < n; i++) {
+			if (xorshift(&rng) & 1u) {
+				ids[i] = ext(xorshift(&rng) & 0x1FFFFFFF);
+			} else {
+				ids[i] = std(xorshift(&rng) & 0x7FF);
+			}
+		}
+		ids[n] = ids[0u]; // duplicate
+		TEST_ASSERT_EQUAL(OK, coverIds(ids, n+1u, &cover));
+		for (i = 0u; i < n; i++) {
+			TEST_ASSERT_TRUE(filtAccepts(&cover, &ids[i]));
+		}
+	}
+
+	tearDown();
+}
+
+// IDs are read in place from an array of structs, picked by index.
+static void
+testSelect(void) {
+	setUp();
+
+	struct {
+		U8 before;
+		CanId id;
+		U8 after;
+	} fmts[] = {
+		{0xAAu, ext(0x0CF00400), 0x55u},
+		{0xAAu, std(0x7FF), 0x55u}, // not selected
+		{0xAAu, ext(0x18FEF100), 0x55u},
+		{0xAAu, std(0x123), 0x55u},
+	};
+	const U8 sel[] = {3u, 0u, 2u, 0u};
+	FiltCover cover;
+	CanId ids[3u];
+
+	TEST_ASSERT_EQUAL(OK, filtCover(&fmts[0u].id, sizeof(fmts[0u]), sel, 4u, &cover));
+	TEST_ASSERT_EQUAL_UINT8(3u, cover.groups);
+	ids[0u] = fmts[0u].id;
+	ids[1u] = fmts[2u].id;
+	ids[2u] = fmts[3u].id;
+	checkNeighbours(&cover, ids, 3u);
+	TEST_ASSERT_FALSE(filtAccepts(&cover, &fmts[1u].id));
+
+	tearDown();
+}
+
+static void
+testLimits(void) {
+	setUp();
+
+	CanId ids[FILT_MAX_IDS+1u], id;
+	FiltCover cover;
+	U8 k;
+
+	// Nothing configured
+	TEST_ASSERT_EQUAL(OK, coverIds(ids, 0u, &cover));
+	id = ext(0x18FEF100);
+	TEST_ASSERT_FALSE(filtAccepts(&cover, &id));
+	id = std(0x100);
+	TEST_ASSERT_FALSE(filtAccepts(&cover, &id));
+
+	// Too many IDs: accept everything
+	for (k = 0u; k < FILT_MAX_IDS+1u; k++) {
+		ids[k] = ext(0x1000u*k);
+	}
+	TEST_ASSERT_EQUAL(FAIL, coverIds(ids, FILT_MAX_IDS+1u, &cover));
+	id = ext(0x0ABCDEF);
+	TEST_ASSERT_TRUE(filtAccepts(&cover, &id));
+	id = std(0x555);
+	TEST_ASSERT_TRUE(filtAccepts(&cover, &id));
+
+	tearDown();
+}
+
+/* Bus trace.
+ *
+ * Messages seen on a J1939 truck bus at 500kbps, with their periods.
+ * The gauges display engine speed (EEC1), vehicle speed (CCVS), coolant
+ * temperature (ET1), oil pressure (EFL/P1), fuel level (DD), and battery
+ * voltage (VEP1).
+ */
+typedef struct {
+	const char *name;
+	CanId id;
+	U16 periodMs;
+} TraceMsg;
+
+static const TraceMsg trace[] = {
+	{"EEC1", {true, {.eid = 0x0CF00400}}, 10u},
+	{"EEC2", {true, {.eid = 0x0CF00300}}, 50u},
+	{"EEC3", {true, {.eid = 0x18FEDF00}}, 250u},
+	{"ETC1", {true, {.eid = 0x0CF00203}}, 10u},
+	{"ETC2", {true, {.eid = 0x18F00503}}, 100u},
+	{"ETC7", {true, {.eid = 0x18FE4A03}}, 100u},
+	{"TSC1", {true, {.eid = 0x0C000003}}, 10u},
+	{"TSC1", {true, {.eid = 0x0C00000B}}, 10u},
+	{"EBC1", {true, {.eid = 0x18F0010B}}, 100u},
+	{"EBC2", {true, {.eid = 0x18FEBF0B}}, 100u},
+	{"ERC1", {true, {.eid = 0x18F00010}}, 100u},
+	{"CCVS", {true, {.eid = 0x18FEF100}}, 100u},
+	{"LFE", {true, {.eid = 0x18FEF200}}, 100u},
+	{"ET1", {true, {.eid = 0x18FEEE00}}, 1000u},
+	{"EFL/P1", {true, {.eid = 0x18FEEF00}}, 500u},
+	{"AMB", {true, {.eid = 0x18FEF500}}, 1000u},
+	{"IC1", {true, {.eid = 0x18FEF600}}, 500u},
+	{"VEP1", {true, {.eid = 0x18FEF700}}, 1000u},
+	{"DD", {true, {.eid = 0x18FEFC17}}, 1000u},
+	{"TCO1", {true, {.eid = 0x0CFE6CEE}}, 50u},
+	{"VDHR", {true, {.eid = 0x18FEC1EE}}, 1000u},
+	{"TD", {true, {.eid = 0x18FEE6EE}}, 1000u},
+	{"CVW", {true, {.eid = 0x18FE7000}}, 1000u},
+	{"PROP", {true, {.eid = 0x18FF0000}}, 50u},
+	{"PROP", {true, {.eid = 0x18FF0100}}, 50u},
+	{"PROP", {true, {.eid = 0x18FF2117}}, 100u},
+	{"PROP", {true, {.eid = 0x18FF4027}}, 20u},
+	{"ACC", {true, {.eid = 0x18FE6F2A}}, 100u},
+	{"AIR1", {true, {.eid = 0x18FEAE30}}, 1000u},
+};
+
+enum { NTRACE = sizeof(trace) / sizeof(trace[0u]) };
+
+// Frames in 10s of the trace, and how many a cover accepts
+static void
+replay(const FiltCover *cover, U32 *frames, U32 *accepted) {
+	U32 t;
+	U8 k;
+
+	*frames = *accepted = 0u;
+	for (t = 0u; t < 10000u; t++) { // ms
+		for (k = 0u; k < NTRACE; k++) {
+			if (t % trace[k].periodMs == 0u) {
+				(*frames)++;
+				if (filtAccepts(cover, &trace[k].id)) {
+					(*accepted)++;
+				}
+			}
+		}
+	}
+}
+
+static void
+testTrace(void) {
+	setUp();
+
+	static const char *const configs[][6] = {
+		{"EEC1", "CCVS", "ET1", "EFL/P1", "DD", "VEP1"},
+		{"EEC1", "CCVS", "ET1", "EFL/P1"},
+		{"EEC1", "CCVS"},
+	};
+	static const U8 nsigs[] = {6u, 4u, 2u};
+	CanId ids[FILT_MAX_IDS+1u];
+	FiltCover cover;
+	U8 c, i, k;
+	U32 frames, accepted, wanted;
+
+	// Old configuration: accept all
+	for (i = 0u; i < FILT_MAX_IDS+1u; i++) {
+		ids[i] = ext(0x1000u*i);
+	}
+	TEST_ASSERT_EQUAL(FAIL, coverIds(ids, FILT_MAX_IDS+1u, &cover));
+	replay(&cover, &frames, &accepted);
+	printf("\nAccepted frames over 10s of a J1939 trace (%lu frames/s):\n",
+		(unsigned long)frames / 10u);
+	printf("%8s %8s %10s %8s %8s\n", "signals", "groups", "accepted/s", "wanted/s", "ratio");
+	printf("%8s %8s %10lu %8s %7.1f%%\n", "all", "-",
+		(unsigned long)accepted / 10u, "-", 100.0 * accepted / frames);
+	TEST_ASSERT_EQUAL_UINT32(frames, accepted);
+
+	for (c = 0u; c < sizeof(nsigs); c++) {
+		wanted = 0u;
+		for (i = 0u; i < nsigs[c]; i++) {
+			for (k = 0u; k < NTRACE; k++) {
+				if (strcmp(trace[k].name, configs[c][i]) == 0) {
+					ids[i] = trace[k].id;
+					wanted += 10000u / trace[k].periodMs;
+				}
+			}
+		}
+		TEST_ASSERT_EQUAL(OK, coverIds(ids, nsigs[c], &cover));
+		replay(&cover, &frames, &accepted);
+		printf("%8u %8u %10lu %8lu %7.1f%%\n", nsigs[c], cover.groups,
+			(unsigned long)accepted / 10u, (unsigned long)wanted / 10u,
+			100.0 * accepted / frames);
+		TEST_ASSERT_GREATER_OR_EQUAL(wanted, accepted);
+		TEST_ASSERT_LESS_THAN_UINT32(frames / 2u, accepted);
+	}
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testExact);
+	RUN_TEST(testMerge);
+	RUN_TEST(testRandom);
+	RUN_TEST(testSelect);
+	RUN_TEST(testLimits);
+	RUN_TEST(testTrace);
+
+	return UnityEnd();
+}
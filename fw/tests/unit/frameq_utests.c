@@ -0,0 +1,139 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <frameq.h>
+
+static FrameQ q;
+
+void setUp(void) {
+	fqInit(&q);
+}
+void tearDown(void) {}
+
+static CanFrame
+mkFrame(U32 eid) {
+	CanFrame frame = {
+		.id = {.isExt = true, .eid = eid},
+		.dlc = 1u,
+		.data = {eid & 0xFF},
+	};
+	return frame;
+}
+
+static void
+testFifoOrder(void) {
+	setUp();
+
+	CanFrame frame;
+	U32 k;
+
+	// Several laps around the ring
+	for (k = 0u; k < 5u*FQ_LEN; k++) {
+		frame = mkFrame(k);
+		TEST_ASSERT_EQUAL(OK, fqPush(&q, &frame));
+		frame = mkFrame(k+1000u);
+		TEST_ASSERT_EQUAL(OK, fqPush(&q, &frame));
+		TEST_ASSERT_EQUAL_UINT8(2u, fqLen(&q));
+
+		TEST_ASSERT_EQUAL(OK, fqPop(&q, &frame));
+		TEST_ASSERT_EQUAL_UINT32(k, frame.id.eid);
+		TEST_ASSERT_EQUAL(OK, fqPop(&q, &frame));
+		TEST_ASSERT_EQUAL_UINT32(k+1000u, frame.id.eid);
+	}
+	TEST_ASSERT_EQUAL(FAIL, fqPop(&q, &frame));
+	TEST_ASSERT_EQUAL_UINT16(0u, q.overflows);
+	TEST_ASSERT_EQUAL_UINT8(2u, q.peak);
+
+	tearDown();
+}
+
+static void
+testOverflow(void) {
+	setUp();
+
+	CanFrame frame;
+	U32 k;
+
+	for (k = 0u; k < FQ_LEN+3u; k++) {
+		frame = mkFrame(k);
+		(void)fqPush(&q, &frame);
+	}
+	TEST_ASSERT_EQUAL_UINT8(FQ_LEN, fqLen(&q));
+	TEST_ASSERT_EQUAL_UINT8(FQ_LEN, q.peak);
+	TEST_ASSERT_EQUAL_UINT16(3u, q.overflows);
+
+	// Oldest frames are kept; the late ones were dropped
+	for (k = 0u; k < FQ_LEN; k++) {
+		TEST_ASSERT_EQUAL(OK, fqPop(&q, &frame));
+		TEST_ASSERT_EQUAL_UINT32(k, frame.id.eid);
+	}
+	TEST_ASSERT_EQUAL(FAIL, fqPop(&q, &frame));
+
+	tearDown();
+}
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+// The ISR pushes bursts of frames between the main loop's pops, at
+// random. Every frame comes out once, in order, unless the queue was
+// full when it arrived; each of those is counted as an overflow.
+static void
+testInterleaved(void) {
+	setUp();
+
+	CanFrame frame;
+	U32 rng, sent, got, next, dropped, k, n;
+
+	rng = 0x1234567ul;
+	sent = got = next = dropped = 0u;
+	for (k = 0u; k < 20000u; k++) {
+		// ISR: a burst of up to 3 frames, in order of arrival
+		for (n = xorshift(&rng) % 4u; n > 0u; n--) {
+			frame = mkFrame(sent++);
+			if (fqPush(&q, &frame) != OK) {
+				dropped++;
+			}
+		}
+		TEST_ASSERT_LESS_OR_EQUAL(FQ_LEN, fqLen(&q));
+
+		// Main loop: up to 2 frames per pass
+		for (n = xorshift(&rng) % 3u; n > 0u && fqPop(&q, &frame) == OK; n--) {
+			TEST_ASSERT_GREATER_OR_EQUAL(next, frame.id.eid); // none repeated
+			next = frame.id.eid + 1u;
+			got++;
+		}
+	}
+	while (fqPop(&q, &frame) == OK) {
+		TEST_ASSERT_GREATER_OR_EQUAL(next, frame.id.eid);
+		next = frame.id.eid + 1u;
+		got++;
+	}
+
+	TEST_ASSERT_GREATER_THAN(0u, dropped);
+	TEST_ASSERT_EQUAL_UINT32(sent, got + dropped); // none lost
+	TEST_ASSERT_EQUAL_UINT16(dropped, q.overflows);
+	TEST_ASSERT_EQUAL_UINT8(FQ_LEN, q.peak);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testFifoOrder);
+	RUN_TEST(testOverflow);
+	RUN_TEST(testInterleaved);
+
+	return UnityEnd();
+}
@@ -0,0 +1,305 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <eeprom.h>
+#include <can.h>
+#include <table.h>
+#include <signal.h>
+#include <serial.h>
+#include <layout.h>
+#include <mock.h>
+
+#include <xc.h>
+
+#define V1_TAB_SIZE (TAB_ROWS*TAB_ROW_SIZE)
+#define V1_GRID_LEN (V1_TAB_SIZE/TAB_VAL_SIZE)
+#define V1_SIGFMT_ADDR(k) (LAY_NTAB*V1_TAB_SIZE + (k)*SER_SIGFMT_SIZE)
+#define V1_TAB_HDR_ADDR(k) (LAY_NTAB*V1_TAB_SIZE + LAY_NTAB*SER_SIGFMT_SIZE + (k)*TAB_HDR_SIZE)
+#define V1_END V1_TAB_HDR_ADDR(LAY_NTAB)
+
+enum { GRID_TAB = 3u }; // the one table stored as a grid
+
+void setUp(void) {
+	mockReset();
+	eepromInit();
+}
+void tearDown(void) {}
+
+static U32
+key(U8 t, U8 k) {
+	return 0x01000000ul*t + 1000ul*k;
+}
+
+static U16
+val(U8 t, U8 k) {
+	return 0x100u*t + 3u*k;
+}
+
+static void
+put(EepromAddr addr, const U8 *data, U8 n) {
+	U8 k;
+
+	for (k = 0u; k < n; k++) {
+		mockEeprom.mem[addr+k] = data[k];
+	}
+}
+
+// Write a calibration in the version 1 layout straight into the EEPROM.
+static void
+writeV1(void) {
+	U8 t, k, b, buf[TAB_HDR_SIZE];
+
+	for (t = 0u; t < LAY_NTAB; t++) {
+		for (b = 0u; b < SER_SIGFMT_SIZE; b++) {
+			buf[b] = 0x10u*t + b;
+		}
+		put(V1_SIGFMT_ADDR(t), buf, SER_SIGFMT_SIZE);
+
+		if (t == GRID_TAB) {
+			put(V1_TAB_HDR_ADDR(t), (U8[TAB_HDR_SIZE]){TAB_MODE_GRID, 2u, V1_GRID_LEN, 0xFF, 0x00, 0x00, 0x00, 0x10}, TAB_HDR_SIZE);
+			for (k = 0u; k < V1_GRID_LEN; k++) {
+				put(t*V1_TAB_SIZE + 2u*k, (U8[2u]){val(t, k) >> 8u, val(t, k) & 0xFF}, 2u);
+			}
+			continue;
+		}
+		put(V1_TAB_HDR_ADDR(t), (U8[TAB_HDR_SIZE]){TAB_MODE_ROWS, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF}, TAB_HDR_SIZE);
+		for (k = 0u; k < TAB_ROWS; k++) {
+			put(t*V1_TAB_SIZE + k*TAB_ROW_SIZE, (U8[TAB_ROW_SIZE]){
+				key(t, k) >> 24u, (key(t, k) >> 16u) & 0xFF, (key(t, k) >> 8u) & 0xFF, key(t, k) & 0xFF,
+				val(t, k) >> 8u, val(t, k) & 0xFF}, TAB_ROW_SIZE);
+		}
+	}
+}
+
+// Check that the calibration written by writeV1 reads back in the current layout.
+static void
+checkV2(void) {
+	Table tab;
+	TabGrid grid;
+	U8 t, k, b, fmt[SER_SIGFMT_SIZE];
+	U32 rkey;
+	U16 rval, vals[4u];
+
+	mockEeprom.failAfter = 0u;
+	TEST_ASSERT_EQUAL_UINT8(LAY_VERSION, mockEeprom.mem[LAY_VERSION_ADDR]);
+	for (t = 0u; t < LAY_NTAB; t++) {
+		TEST_ASSERT_EQUAL(OK, eepromRead(LAY_SIGFMT_ADDR(t), fmt, sizeof(fmt)));
+		for (b = 0u; b < SER_SIGFMT_SIZE; b++) {
+			TEST_ASSERT_EQUAL_UINT8(0x10u*t + b, fmt[b]);
+		}
+
+		tab = (Table){.offset = LAY_TAB_ADDR(t), .hdr = LAY_TAB_HDR_ADDR(t)};
+		TEST_ASSERT_EQUAL(OK, tabInit(&tab));
+		TEST_ASSERT_EQUAL(t == GRID_TAB, tab.isGrid);
+		if (t == GRID_TAB) {
+			TEST_ASSERT_EQUAL(OK, tabReadGrid(&tab, &grid));
+			TEST_ASSERT_EQUAL_UINT8(V1_GRID_LEN, grid.len);
+			for (k = 0u; k < V1_GRID_LEN; k += 4u) {
+				TEST_ASSERT_EQUAL(OK, tabReadVals(&tab, k, vals, 4u));
+				for (b = 0u; b < 4u; b++) {
+					TEST_ASSERT_EQUAL_UINT16(val(t, k+b), vals[b]);
+				}
+			}
+			continue;
+		}
+		for (k = 0u; k < TAB_ROWS; k++) {
+			TEST_ASSERT_EQUAL(OK, tabRead(&tab, k, &rkey, &rval));
+			TEST_ASSERT_EQUAL_UINT32(key(t, k), rkey);
+			TEST_ASSERT_EQUAL_UINT16(val(t, k), rval);
+		}
+	}
+}
+
+// Whether no entry of size n from addr straddles a page.
+static bool
+inPage(U16 addr, U16 n) {
+	return addr/LAY_PAGE_SIZE == (addr + n-1u)/LAY_PAGE_SIZE;
+}
+
+static void
+testRegions(void) {
+	setUp();
+
+	U8 k;
+
+	// Calibrated EEPROMs have these addresses
+	TEST_ASSERT_EQUAL_UINT16(1536u, LAY_SIGFMT_ADDR(0u));
+	TEST_ASSERT_EQUAL_UINT16(1584u, LAY_TAB_HDR_ADDR(0u));
+	TEST_ASSERT_EQUAL_UINT16(1632u, LAY_RATE_ADDR(0u));
+	TEST_ASSERT_EQUAL_UINT16(1640u, LAY_DAMP_ADDR(0u));
+	TEST_ASSERT_EQUAL_UINT16(1664u, LAY_SCRATCH_ADDR);
+	TEST_ASSERT_EQUAL_UINT16(2032u, LAY_VERSION_ADDR);
+	TEST_ASSERT_EQUAL_UINT16(2033u, LAY_PROGRESS_ADDR);
+	TEST_ASSERT_EQUAL_UINT16(2034u, LAY_BAUD_ADDR);
+
+	// In order, without overlapping
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_SIGFMT_ADDR(0u), LAY_TAB_ADDR(LAY_NTAB));
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_TAB_HDR_ADDR(0u), LAY_SIGFMT_ADDR(LAY_NTAB));
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_RATE_ADDR(0u), LAY_TAB_HDR_ADDR(LAY_NTAB));
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_DAMP_ADDR(0u), LAY_RATE_ADDR(LAY_NTAB));
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_SCRATCH_ADDR, LAY_DAMP_ADDR(LAY_NTAB));
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_VERSION_ADDR, LAY_END);
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_SIZE, LAY_BAUD_ADDR + LAY_BAUD_SIZE);
+
+	// The scratch space is clear of the version 1 data it is filled from
+	TEST_ASSERT_LESS_OR_EQUAL_UINT32(LAY_SCRATCH_ADDR, V1_END);
+
+	// Pages
+	TEST_ASSERT_EQUAL_UINT16(0u, LAY_TAB_ADDR(1u) % LAY_PAGE_SIZE);
+	TEST_ASSERT_EQUAL_UINT16(0u, LAY_SCRATCH_ADDR % LAY_PAGE_SIZE);
+	TEST_ASSERT_EQUAL_UINT16(0u, LAY_VERSION_ADDR % LAY_PAGE_SIZE);
+	TEST_ASSERT_TRUE(inPage(LAY_BAUD_ADDR, LAY_BAUD_SIZE));
+	for (k = 0u; k < LAY_NTAB; k++) {
+		TEST_ASSERT_TRUE(inPage(LAY_SIGFMT_ADDR(k), SER_SIGFMT_SIZE));
+		TEST_ASSERT_TRUE(inPage(LAY_TAB_HDR_ADDR(k), TAB_HDR_SIZE));
+		TEST_ASSERT_TRUE(inPage(LAY_DAMP_ADDR(k), LAY_DAMP_SIZE));
+	}
+
+	tearDown();
+}
+
+static void
+testMigrate(void) {
+	setUp();
+
+	U32 cycles;
+
+	writeV1();
+	TEST_ASSERT_EQUAL(OK, layMigrate());
+	checkV2();
+
+	// Already migrated: nothing to do
+	cycles = mockEeprom.writeCycles;
+	TEST_ASSERT_EQUAL(OK, layMigrate());
+	TEST_ASSERT_EQUAL_UINT32(cycles, mockEeprom.writeCycles);
+
+	// Unknown version
+	mockEeprom.mem[LAY_VERSION_ADDR] = LAY_VERSION+1u;
+	TEST_ASSERT_EQUAL(FAIL, layMigrate());
+
+	tearDown();
+}
+
+// Lose power after each write cycle of the migration in turn,
+// then power up again and let it finish.
+static void
+testResume(void) {
+	setUp();
+
+	U32 total, n;
+
+	writeV1();
+	TEST_ASSERT_EQUAL(OK, layMigrate());
+	total = mockEeprom.writeCycles;
+
+	for (n = 1u; n < total; n++) {
+		setUp();
+		writeV1();
+		mockEeprom.failAfter = n;
+		TEST_ASSERT_EQUAL(FAIL, layMigrate());
+
+		mockEeprom.failAfter = 0u;
+		eepromInit(); // reset: anything buffered is lost
+		TEST_ASSERT_EQUAL(OK, layMigrate());
+		checkV2();
+	}
+
+	tearDown();
+}
+
+/* Write cycles taken by a calibration.
+ *
+ * The calibration tool sends six tables, one row per frame, and waits
+ * for each row to be read back before sending the next. A row that
+ * straddles a page takes two write cycles if it can't be merged with its
+ * neighbours.
+ */
+enum { LOOP_CYCLES = 300u }; // one pass of the main loop
+
+typedef struct {
+	U32 cycles; // write cycles
+	U32 done; // time the last write cycle finished
+} CalResult;
+
+static void
+calibrate(U8 version, U32 frameGap, CalResult *r) {
+	U8 row[TAB_ROW_SIZE];
+	EepromAddr addr;
+	U32 next;
+	U8 t, k, b;
+
+	setUp();
+	next = 0u;
+	for (t = 0u; t < LAY_NTAB; t++) {
+		for (k = 0u; k < TAB_ROWS; k++) {
+			// Main loop until the frame arrives
+			while ((I32)(mockClock - next) < 0) {
+				_delay(LOOP_CYCLES);
+				eepromPoll();
+			}
+			next = mockClock + frameGap;
+
+			for (b = 0u; b < TAB_ROW_SIZE; b++) {
+				row[b] = t + k + b;
+			}
+			addr = (version == 1u)
+				? t*V1_TAB_SIZE + k*TAB_ROW_SIZE
+				: LAY_TAB_ADDR(t) + k*TAB_ROW_STRIDE;
+			TEST_ASSERT_EQUAL(OK, eepromWrite(addr, row, TAB_ROW_SIZE));
+			TEST_ASSERT_EQUAL(OK, eepromRead(addr, row, TAB_ROW_SIZE)); // read back
+		}
+	}
+	TEST_ASSERT_EQUAL(OK, eepromFlush());
+	r->cycles = mockEeprom.writeCycles;
+	r->done = mockClock;
+}
+
+static void
+testCalibration(void) {
+	static const U32 gaps[] = {12000u, 24000u, 72000u, 120000u}; // 1ms-10ms
+	CalResult v1, v2;
+	U8 k;
+
+	printf("\nWriting a calibration of %u tables of %u rows, one row per frame:\n",
+		LAY_NTAB, TAB_ROWS);
+	printf("%9s %8s %8s %10s %10s\n", "frame gap", "cycles", "", "total ms", "");
+	printf("%9s %8s %8s %10s %10s\n", "ms", "v1", "v2", "v1", "v2");
+	for (k = 0u; k < sizeof(gaps)/sizeof(gaps[0u]); k++) {
+		calibrate(1u, gaps[k], &v1);
+		calibrate(2u, gaps[k], &v2);
+		printf("%9.2f %8lu %8lu %10.1f %10.1f\n", gaps[k] / 12000.0,
+			(unsigned long)v1.cycles, (unsigned long)v2.cycles,
+			v1.done / 12000.0, v2.done / 12000.0);
+
+		// The trade-off of padding rows to TAB_ROW_STRIDE:
+		// rows arriving slower than a write cycle are written one by one,
+		// and none takes two cycles. Rows arriving faster are merged by
+		// page, so there the cost is the padding: at most 8/6 as many
+		// cycles as packed rows (97 vs 73), and at most 20ms per table.
+		if (gaps[k] >= MOCK_EEPROM_TWC) {
+			TEST_ASSERT_EQUAL_UINT32(LAY_NTAB*TAB_ROWS, v2.cycles);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(v1.cycles, v2.cycles);
+		} else {
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(v1.cycles*TAB_ROW_STRIDE, v2.cycles*TAB_ROW_SIZE);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(v1.done + LAY_NTAB*240000u, v2.done);
+		}
+	}
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testRegions);
+	RUN_TEST(testMigrate);
+	RUN_TEST(testResume);
+	RUN_TEST(testCalibration);
+
+	return UnityEnd();
+}
@@ -0,0 +1,197 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <eeprom.h>
+#include <table.h>
+#include <memo.h>
+#include <mock.h>
+
+static Memo memo;
+
+void setUp(void) {
+	memoInit(&memo);
+}
+void tearDown(void) {}
+
+static void
+testHit(void) {
+	setUp();
+
+	TEST_ASSERT_FALSE(memoHit(&memo, 100)); // nothing yet
+	TEST_ASSERT_TRUE(memoStore(&memo, 100, 7u));
+	TEST_ASSERT_TRUE(memoHit(&memo, 100));
+	TEST_ASSERT_TRUE(memoHit(&memo, 100));
+	TEST_ASSERT_FALSE(memoHit(&memo, 101));
+	TEST_ASSERT_FALSE(memoStore(&memo, 101, 7u)); // same output
+	TEST_ASSERT_TRUE(memoHit(&memo, 101));
+	TEST_ASSERT_FALSE(memoHit(&memo, -1));
+	TEST_ASSERT_TRUE(memoStore(&memo, -1, 0u));
+
+	TEST_ASSERT_EQUAL_UINT16(3u, memo.rawHits);
+	TEST_ASSERT_EQUAL_UINT16(1u, memo.valHits);
+	TEST_ASSERT_EQUAL_UINT16(3u, memo.misses);
+
+	tearDown();
+}
+
+// A new table or format: the raw value is looked up again, but the
+// output is only updated if its value changed.
+static void
+testInvalidate(void) {
+	setUp();
+
+	TEST_ASSERT_FALSE(memoHit(&memo, 100));
+	TEST_ASSERT_TRUE(memoStore(&memo, 100, 7u));
+	memoInvalidate(&memo);
+	TEST_ASSERT_FALSE(memoHit(&memo, 100));
+	TEST_ASSERT_FALSE(memoStore(&memo, 100, 7u));
+	memoInvalidate(&memo);
+	TEST_ASSERT_FALSE(memoHit(&memo, 100));
+	TEST_ASSERT_TRUE(memoStore(&memo, 100, 8u));
+	TEST_ASSERT_TRUE(memoHit(&memo, 100));
+
+	// Other units: the same value is output again
+	memoForget(&memo);
+	TEST_ASSERT_FALSE(memoHit(&memo, 100));
+	TEST_ASSERT_TRUE(memoStore(&memo, 100, 8u));
+
+	tearDown();
+}
+
+static void
+testSaturate(void) {
+	setUp();
+
+	U32 k;
+
+	(void)memoStore(&memo, 0, 0u);
+	for (k = 0u; k < 0x10010ul; k++) {
+		(void)memoHit(&memo, 0);
+		(void)memoStore(&memo, 0, 0u);
+	}
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, memo.rawHits);
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, memo.valHits);
+
+	tearDown();
+}
+
+/* Engine speed traces.
+ *
+ * EEC1 carries engine speed at 0.125rpm/bit, every 10ms. The tach table
+ * maps it to pulses per minute at 1rpm resolution, so only one raw
+ * value in eight can move the needle.
+ */
+typedef enum {
+	IDLE, // ECU-filtered: changes every few frames, by a count or two
+	CRUISE, // steady, 1 frame in 10 differs
+	RAMP, // accelerating 800 to 3000rpm
+	NTRACES,
+} Trace;
+
+static const char *const traceNames[NTRACES] = {"idle", "cruise", "ramp"};
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+static I32
+engineSpeed(Trace t, U32 k, U32 n, U32 *rng, I32 last) {
+	switch (t) {
+	case IDLE:
+		return (xorshift(rng) % 4u == 0u) ? 800*8 + (I32)(xorshift(rng) % 5u) - 2 : last;
+	case CRUISE:
+		return (xorshift(rng) % 10u == 0u) ? 1800*8 + (I32)(xorshift(rng) % 3u) - 1 : 1800*8;
+	default:
+		return 800*8 + (I32)((2200ul*8ul*k) / n);
+	}
+}
+
+// Handle one sample the way driveGauge does.
+// Returns true if the output was updated.
+static bool
+drive(Table *tab, Memo *m, I32 raw, U16 *out) {
+	U16 val;
+
+	if (m != NULL && memoHit(m, raw)) {
+		return false;
+	}
+	TEST_ASSERT_EQUAL(OK, tabLookup(tab, raw, &val));
+	if (m != NULL && !memoStore(m, raw, val)) {
+		return false;
+	}
+	*out = val;
+	return true;
+}
+
+static void
+testTrace(void) {
+	enum { NSAMPLES = 1000u }; // 10s at 100Hz
+	Table tab;
+	U32 k, rng, lookups[2u], updates[2u], bytes[2u];
+	U16 outs[2u];
+	I32 raw;
+	U8 t, withMemo;
+
+	printf("\nEngine speed at 100Hz for 10s:\n");
+	printf("%8s %9s %9s %9s %9s %10s %10s\n", "trace", "lookups", "", "updates", "", "SPI bytes", "");
+	printf("%8s %9s %9s %9s %9s %10s %10s\n", "", "before", "memo", "before", "memo", "before", "memo");
+	for (t = 0u; t < NTRACES; t++) {
+		for (withMemo = 0u; withMemo < 2u; withMemo++) {
+			mockReset();
+			eepromInit();
+			tab = (Table){.offset = 0u, .hdr = 6u*TAB_SIZE + 48u};
+			TEST_ASSERT_EQUAL(OK, tabInit(&tab));
+			for (k = 0u; k < TAB_ROWS; k++) { // 0..8000rpm, 250rpm per row
+				TEST_ASSERT_EQUAL(OK, tabWrite(&tab, k, 250ul*8ul*k, 250u*k + (k > 4u ? 3u*k : 0u)));
+			}
+			TEST_ASSERT_EQUAL(OK, eepromFlush());
+			memoInit(&memo);
+			mockSpiClear();
+
+			rng = 2463534242ul;
+			raw = 800*8;
+			lookups[withMemo] = updates[withMemo] = 0u;
+			for (k = 0u; k < NSAMPLES; k++) {
+				raw = engineSpeed(t, k, NSAMPLES, &rng, raw);
+				if (withMemo) {
+					TEST_ASSERT_EQUAL_UINT32(k, memo.misses + memo.rawHits);
+				}
+				if (drive(&tab, withMemo ? &memo : NULL, raw, &outs[withMemo])) {
+					updates[withMemo]++;
+				}
+			}
+			lookups[withMemo] = withMemo ? memo.misses : NSAMPLES;
+			bytes[withMemo] = mockSpi.bytes;
+		}
+		printf("%8s %9lu %9lu %9lu %9lu %10lu %10lu\n", traceNames[t],
+			(unsigned long)lookups[0u], (unsigned long)lookups[1u],
+			(unsigned long)updates[0u], (unsigned long)updates[1u],
+			(unsigned long)bytes[0u], (unsigned long)bytes[1u]);
+
+		TEST_ASSERT_EQUAL_UINT16(outs[0u], outs[1u]); // same reading
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(lookups[0u], lookups[1u]);
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(updates[0u], updates[1u]);
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(bytes[0u], bytes[1u]);
+	}
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testHit);
+	RUN_TEST(testInvalidate);
+	RUN_TEST(testSaturate);
+	RUN_TEST(testTrace);
+
+	return UnityEnd();
+}
@@ -0,0 +1,107 @@
+/* Simulated SPI bus and peripherals for the unit tests.
+ *
+ * spiTx() routes each byte to whichever device's chip-select is low and
+ * keeps count of the traffic. The devices are modelled closely enough for
+ * the firmware's drivers to run against them unmodified.
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "mock.h"
+ */
+
+// Bus traffic
+typedef struct {
+	U32 bytes; // bytes clocked over the bus
+	U32 transactions; // chip-select cycles
+} MockSpiStats;
+
+extern MockSpiStats mockSpi;
+
+// Microchip 25LC160C EEPROM
+enum {
+	MOCK_EEPROM_SIZE = 2048u,
+	MOCK_EEPROM_PAGE = 16u,
+	MOCK_EEPROM_TWC = 60000u, // write cycle time: 5ms
+};
+
+typedef struct {
+	U8 mem[MOCK_EEPROM_SIZE];
+	U32 reads; // READ instructions
+	U32 writeCycles; // page writes started
+	U32 statusReads; // READ STATUS instructions
+	U32 busyErrors; // instructions other than READ STATUS sent during a write cycle
+	U32 failAfter; // write cycles after which power is lost; 0: never
+} MockEeprom;
+
+extern MockEeprom mockEeprom;
+
+// Microchip MCP2515 CAN controller.
+// Frames are in register form: SIDH, SIDL, EID8, EID0, DLC, D0..D7.
+enum {
+	MOCK_CAN_TXLOG = 16u, // transmitted frames kept
+};
+
+typedef struct {
+	U8 regs[13u];
+} MockCanFrame;
+
+typedef struct {
+	U8 regs[128u]; // register file
+	MockCanFrame tx[MOCK_CAN_TXLOG]; // transmitted frames, oldest first
+	U32 ntx; // frames transmitted
+	U32 rxOverflows; // frames lost because their buffer was full
+} MockCan;
+
+extern MockCan mockCan;
+
+// Microchip MCP4912 DACs, ~LDAC tied low: an output changes at the end of
+// its write. Channels are numbered as DacChan.
+enum {
+	MOCK_DAC_NCHAN = 4u,
+};
+
+typedef struct {
+	U16 out[MOCK_DAC_NCHAN]; // codes output
+	U32 latchedAt[MOCK_DAC_NCHAN]; // time each output last changed
+	U32 writes; // 16-bit writes
+} MockDac;
+
+extern MockDac mockDac;
+
+// Transmit the frame that would win arbitration: the pending transmit
+// buffer with the highest TXP bits, and of those the highest numbered.
+// Returns the buffer's number, or -1 if none is pending.
+int mockCanTransmit(void);
+
+// Receive a frame that passed acceptance filter n (0--5).
+// Filters 0 and 1 load RXB0, unless it is full and rollover (BUKT) is
+// enabled; the others load RXB1. Returns the buffer loaded, or -1 if it
+// was full: then RXnOVR and ERRIF are set.
+int mockCanReceive(const MockCanFrame *frame, U8 filter);
+
+// Nominal bit rate in bps set by CNF1..CNF3.
+U32 mockCanBitRate(void);
+
+// A frame sent on a bus running at bitRate bps. In Normal or Listen-only
+// mode, it is received through filter 0 if the bit timing gives that
+// rate; otherwise MERRF is set. Returns the buffer loaded, or -1.
+int mockCanBus(const MockCanFrame *frame, U32 bitRate);
+
+// Level of the INT pin: true (low, asserted) if an enabled interrupt
+// flag is set.
+bool mockCanInt(void);
+
+// Reset the bus, the devices and the clock.
+// The EEPROM is erased to 0xFF.
+void mockReset(void);
+
+// Reset the traffic counters.
+void mockSpiClear(void);
+
+// Finish the last transaction if its chip-select has been released.
+// The devices otherwise only see the end of a transaction
+// when the next one starts.
+void mockSync(void);
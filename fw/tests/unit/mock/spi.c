@@ -0,0 +1,516 @@
+/* Simulated SPI bus. See mock.h. */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "xc.h"
+#include "types.h"
+#include "spi.h"
+
+#include "mock.h"
+
+// Instruction cycles to clock one byte at 3MHz
+#define BYTE_CYCLES 32u
+
+typedef enum {
+	DEV_NONE,
+	DEV_EEPROM,
+	DEV_CAN,
+	DEV_DAC1,
+	DEV_DAC2,
+} Device;
+
+extern volatile uint8_t mockPinTouched;
+
+MockSpiStats mockSpi;
+MockEeprom mockEeprom;
+MockCan mockCan;
+MockDac mockDac;
+
+static Device dev = DEV_NONE; // device in current transaction
+static U16 pos; // bytes into current transaction
+
+// 25LC160C state
+static struct {
+	bool wel; // write enable latch
+	bool pendingWel; // WREN received, latches at end of transaction
+	U32 busyUntil; // end of current write cycle
+	U8 cmd;
+	U16 addr;
+	U8 page[MOCK_EEPROM_PAGE]; // bytes latched by WRITE
+	U16 pageMask; // which bytes of page were written
+} ee;
+
+static bool
+eeBusy(void) {
+	return (I32)(mockClock - ee.busyUntil) < 0;
+}
+
+// Chip-select of the EEPROM went high
+static void
+eeEnd(void) {
+	U8 k;
+
+	if (ee.pendingWel) {
+		ee.wel = true;
+		ee.pendingWel = false;
+	}
+	if (ee.cmd == 0x02 && ee.pageMask != 0u) { // WRITE
+		// Start write cycle
+		for (k = 0u; k < MOCK_EEPROM_PAGE; k++) {
+			if (ee.pageMask & (1u << k)) {
+				mockEeprom.mem[(ee.addr & ~(MOCK_EEPROM_PAGE-1u)) + k] = ee.page[k];
+			}
+		}
+		mockEeprom.writeCycles++;
+		ee.busyUntil = mockClock + MOCK_EEPROM_TWC;
+		ee.wel = false;
+	}
+	ee.pageMask = 0u;
+}
+
+static U8
+eeTx(U8 c) {
+	U8 out;
+
+	out = 0xFF;
+	if (mockEeprom.failAfter != 0u && mockEeprom.writeCycles >= mockEeprom.failAfter) {
+		ee.cmd = 0x00; // no power: the bus reads high, so WIP looks set
+		return out;
+	}
+	if (pos == 0u) {
+		ee.cmd = c;
+		if (c == 0x05) { // READ STATUS
+			mockEeprom.statusReads++;
+		} else if (eeBusy()) {
+			mockEeprom.busyErrors++;
+			ee.cmd = 0x00; // ignored
+		} else if (c == 0x03) { // READ
+			mockEeprom.reads++;
+		} else if (c == 0x06) { // WRITE ENABLE
+			ee.pendingWel = true;
+		} else if (c == 0x04) { // WRITE DISABLE
+			ee.wel = false;
+		} else if (c == 0x02 && !ee.wel) {
+			ee.cmd = 0x00; // WRITE without latch is ignored
+		}
+		return out;
+	}
+
+	switch (ee.cmd) {
+	case 0x05: // READ STATUS
+		out = (eeBusy() ? 0x01 : 0x00) | (ee.wel ? 0x02 : 0x00);
+		break;
+	case 0x03: // READ
+	case 0x02: // WRITE
+		if (pos == 1u) {
+			ee.addr = (U16)c << 8u;
+		} else if (pos == 2u) {
+			ee.addr = (ee.addr | c) & (MOCK_EEPROM_SIZE-1u);
+		} else if (ee.cmd == 0x03) {
+			out = mockEeprom.mem[ee.addr];
+			ee.addr = (ee.addr + 1u) & (MOCK_EEPROM_SIZE-1u); // wraps at end of memory
+		} else {
+			ee.page[ee.addr % MOCK_EEPROM_PAGE] = c;
+			ee.pageMask |= 1u << (ee.addr % MOCK_EEPROM_PAGE);
+			// Wraps within the page
+			ee.addr = (ee.addr & ~(MOCK_EEPROM_PAGE-1u)) | ((ee.addr + 1u) % MOCK_EEPROM_PAGE);
+		}
+		break;
+	default:
+		break;
+	}
+	return out;
+}
+
+// MCP2515 registers and bits
+enum {
+	CAN_CANSTAT = 0x0E,
+	CAN_CANCTRL = 0x0F,
+	CAN_EFLG = 0x2D,
+	CAN_CNF3 = 0x28,
+	CAN_CNF2 = 0x29,
+	CAN_CNF1 = 0x2A,
+	CAN_CANINTE = 0x2B,
+	CAN_CANINTF = 0x2C,
+	CAN_TXB0CTRL = 0x30,
+	CAN_RXB0CTRL = 0x60,
+	CAN_RXB1CTRL = 0x70,
+	CAN_TXREQ = 0x08,
+	CAN_ABTF = 0x40,
+	CAN_ABAT = 0x10,
+	CAN_BUKT = 0x04,
+	CAN_RX0OVR = 0x40,
+	CAN_RX1OVR = 0x80,
+	CAN_MERRF = 0x80,
+};
+
+// MCP2515 state
+static struct {
+	U8 cmd;
+	U8 addr; // next register of READ/WRITE/READ RX/LOAD TX
+	U8 mask; // BIT MODIFY
+	U8 filhit[2u]; // filter that accepted each receive buffer's frame
+} mcp;
+
+// Write a register the way the SPI interface does:
+// read-only bits are left alone.
+static void
+mcpWriteReg(U8 addr, U8 val) {
+	U8 n;
+
+	addr &= 0x7F;
+	if ((addr & 0x0F) == CAN_CANSTAT) {
+		return; // read-only
+	} else if ((addr & 0x0F) == CAN_CANCTRL) {
+		mockCan.regs[CAN_CANCTRL] = val;
+		if (val & CAN_ABAT) { // abort pending transmissions
+			for (n = 0u; n < 3u; n++) {
+				if (mockCan.regs[CAN_TXB0CTRL + 0x10*n] & CAN_TXREQ) {
+					mockCan.regs[CAN_TXB0CTRL + 0x10*n] &= ~CAN_TXREQ;
+					mockCan.regs[CAN_TXB0CTRL + 0x10*n] |= CAN_ABTF;
+				}
+			}
+		}
+		// Mode changes at once, but not while frames are pending
+		for (n = 0u; n < 3u; n++) {
+			if (mockCan.regs[CAN_TXB0CTRL + 0x10*n] & CAN_TXREQ) {
+				return;
+			}
+		}
+		mockCan.regs[CAN_CANSTAT] = (mockCan.regs[CAN_CANSTAT] & 0x1F) | (val & 0xE0);
+		return;
+	} else if ((addr & 0x8F) == 0x00 && addr >= CAN_TXB0CTRL && addr < 0x60) { // TXBnCTRL
+		val = (mockCan.regs[addr] & ~0x0B) | (val & 0x0B);
+	}
+	mockCan.regs[addr] = val;
+}
+
+static U8
+mcpReadReg(U8 addr) {
+	addr &= 0x7F;
+	if ((addr & 0x0F) == CAN_CANSTAT || (addr & 0x0F) == CAN_CANCTRL) {
+		return mockCan.regs[addr & 0x0F];
+	}
+	return mockCan.regs[addr];
+}
+
+static void
+mcpReset(void) {
+	memset(mockCan.regs, 0, sizeof(mockCan.regs));
+	mockCan.regs[CAN_CANSTAT] = 0x80; // Config mode
+	mockCan.regs[CAN_CANCTRL] = 0x87;
+}
+
+static U8
+mcpReadStatus(void) {
+	U8 intf, n, status;
+
+	intf = mockCan.regs[CAN_CANINTF];
+	status = intf & 0x03; // RXnIF
+	for (n = 0u; n < 3u; n++) {
+		if (mockCan.regs[CAN_TXB0CTRL + 0x10*n] & CAN_TXREQ) {
+			status |= 0x04 << 2u*n;
+		}
+		if (intf & (0x04 << n)) {
+			status |= 0x08 << 2u*n;
+		}
+	}
+	return status;
+}
+
+static U8
+mcpRxStatus(void) {
+	U8 intf, buf, status;
+
+	intf = mockCan.regs[CAN_CANINTF];
+	status = (intf & 0x03) << 6u;
+	if (status == 0u) {
+		return status;
+	}
+	buf = (intf & 0x01) ? 0u : 1u;
+	if (mockCan.regs[0x62 + 0x10*buf] & 0x08) { // IDE
+		status |= 0x10;
+		if (mockCan.regs[0x65 + 0x10*buf] & 0x40) {
+			status |= 0x08; // remote
+		}
+	} else if (mockCan.regs[0x62 + 0x10*buf] & 0x10) { // SRR
+		status |= 0x08;
+	}
+	return status | mcp.filhit[buf];
+}
+
+// Start addresses of READ RX BUFFER and LOAD TX BUFFER
+static const U8 readRxAddr[4u] = {0x61, 0x66, 0x71, 0x76};
+static const U8 loadTxAddr[6u] = {0x31, 0x36, 0x41, 0x46, 0x51, 0x56};
+
+static U8
+mcpTx(U8 c) {
+	U8 out, n;
+
+	out = 0xFF;
+	if (pos == 0u) {
+		mcp.cmd = c;
+		if (c == 0xC0) { // RESET
+			mcpReset();
+		} else if ((c & 0xF9) == 0x90) { // READ RX BUFFER
+			mcp.addr = readRxAddr[(c >> 1u) & 0x3];
+		} else if ((c & 0xF8) == 0x40 && (c & 0x7) < 6u) { // LOAD TX BUFFER
+			mcp.addr = loadTxAddr[c & 0x7];
+		} else if ((c & 0xF8) == 0x80) { // RTS
+			for (n = 0u; n < 3u; n++) {
+				if (c & (1u << n)) {
+					mockCan.regs[CAN_TXB0CTRL + 0x10*n] |= CAN_TXREQ;
+				}
+			}
+		}
+		return out;
+	}
+
+	if ((mcp.cmd & 0xF9) == 0x90) { // READ RX BUFFER
+		out = mockCan.regs[mcp.addr++ & 0x7F];
+	} else if ((mcp.cmd & 0xF8) == 0x40) { // LOAD TX BUFFER
+		mockCan.regs[mcp.addr++ & 0x7F] = c;
+	} else {
+		switch (mcp.cmd) {
+		case 0x03: // READ
+			if (pos == 1u) {
+				mcp.addr = c;
+			} else {
+				out = mcpReadReg(mcp.addr++);
+			}
+			break;
+		case 0x02: // WRITE
+			if (pos == 1u) {
+				mcp.addr = c;
+			} else {
+				mcpWriteReg(mcp.addr++, c);
+			}
+			break;
+		case 0x05: // BIT MODIFY
+			if (pos == 1u) {
+				mcp.addr = c;
+			} else if (pos == 2u) {
+				mcp.mask = c;
+			} else if (pos == 3u) {
+				mcpWriteReg(mcp.addr, (mcpReadReg(mcp.addr) & ~mcp.mask) | (c & mcp.mask));
+			}
+			break;
+		case 0xA0: // READ STATUS
+			out = mcpReadStatus();
+			break;
+		case 0xB0: // RX STATUS
+			out = mcpRxStatus();
+			break;
+		default:
+			break;
+		}
+	}
+	return out;
+}
+
+// Chip-select of the MCP2515 went high
+static void
+mcpEnd(void) {
+	if ((mcp.cmd & 0xF9) == 0x90) { // READ RX BUFFER clears RXnIF
+		mockCan.regs[CAN_CANINTF] &= ~(1u << ((mcp.cmd >> 2u) & 0x1));
+	}
+	mcp.cmd = 0x00;
+}
+
+int
+mockCanTransmit(void) {
+	U8 *ctrl;
+	int n, best;
+
+	best = -1;
+	for (n = 0; n < 3; n++) {
+		ctrl = &mockCan.regs[CAN_TXB0CTRL + 0x10*n];
+		if ((*ctrl & CAN_TXREQ) && (best < 0
+			|| (*ctrl & 0x03) >= (mockCan.regs[CAN_TXB0CTRL + 0x10*best] & 0x03))) {
+			best = n;
+		}
+	}
+	if (best < 0) {
+		return best;
+	}
+	memcpy(mockCan.tx[mockCan.ntx % MOCK_CAN_TXLOG].regs,
+		&mockCan.regs[CAN_TXB0CTRL + 0x10*best + 1], sizeof(MockCanFrame));
+	mockCan.ntx++;
+	mockCan.regs[CAN_TXB0CTRL + 0x10*best] &= ~CAN_TXREQ;
+	mockCan.regs[CAN_CANINTF] |= 0x04 << best; // TXnIF
+	return best;
+}
+
+int
+mockCanReceive(const MockCanFrame *frame, U8 filter) {
+	U8 buf;
+
+	buf = (filter < 2u) ? 0u : 1u;
+	if (buf == 0u && (mockCan.regs[CAN_CANINTF] & 0x01)
+		&& (mockCan.regs[CAN_RXB0CTRL] & CAN_BUKT)) {
+		buf = 1u; // rollover
+	}
+	if (mockCan.regs[CAN_CANINTF] & (1u << buf)) {
+		mockCan.regs[CAN_EFLG] |= buf ? CAN_RX1OVR : CAN_RX0OVR;
+		mockCan.regs[CAN_CANINTF] |= 0x20; // ERRIF
+		mockCan.rxOverflows++;
+		return -1;
+	}
+	memcpy(&mockCan.regs[0x61 + 0x10*buf], frame->regs, sizeof(frame->regs));
+	mcp.filhit[buf] = (buf == 1u && filter < 2u) ? 6u + filter : filter;
+	mockCan.regs[CAN_CANINTF] |= 1u << buf;
+	return buf;
+}
+
+U32
+mockCanBitRate(void) {
+	U8 cnf1, cnf2, cnf3;
+	U32 tq;
+
+	cnf1 = mockCan.regs[CAN_CNF1];
+	cnf2 = mockCan.regs[CAN_CNF2];
+	cnf3 = mockCan.regs[CAN_CNF3];
+	tq = 1u + (cnf2 & 0x07) + 1u + ((cnf2 >> 3u) & 0x07) + 1u + (cnf3 & 0x07) + 1u;
+	return 12000000ul / (2u * ((cnf1 & 0x3F) + 1u) * tq);
+}
+
+int
+mockCanBus(const MockCanFrame *frame, U32 bitRate) {
+	U8 mode;
+
+	mode = mockCan.regs[CAN_CANSTAT] >> 5u;
+	if (mode != 0x0 && mode != 0x3) { // neither Normal nor Listen-only
+		return -1;
+	}
+	if (mockCanBitRate() != bitRate) {
+		mockCan.regs[CAN_CANINTF] |= CAN_MERRF;
+		return -1;
+	}
+	return mockCanReceive(frame, 0u);
+}
+
+bool
+mockCanInt(void) {
+	return (mockCan.regs[CAN_CANINTE] & mockCan.regs[CAN_CANINTF]) != 0u;
+}
+
+// MCP4912 state
+static U16 dacCmd; // bytes of the write in progress
+
+// Chip-select of a DAC went high: latch a complete write.
+// Bit 15 selects VOUTB, bit 12 is ~SHDN; D9..D0 are bits 11..2.
+static void
+dacEnd(U8 dac) {
+	U8 ch;
+
+	if (pos != 2u || !(dacCmd & 0x1000)) {
+		return;
+	}
+	ch = 2u*dac + ((dacCmd >> 15u) & 0x1);
+	mockDac.out[ch] = (dacCmd >> 2u) & 0x3FF;
+	mockDac.latchedAt[ch] = mockClock;
+	mockDac.writes++;
+}
+
+// End the current transaction
+static void
+end(void) {
+	if (dev == DEV_EEPROM) {
+		eeEnd();
+	} else if (dev == DEV_CAN) {
+		mcpEnd();
+	} else if (dev == DEV_DAC1) {
+		dacEnd(0u);
+	} else if (dev == DEV_DAC2) {
+		dacEnd(1u);
+	}
+	dev = DEV_NONE;
+}
+
+// Device whose chip-select is low
+static Device
+selected(void) {
+	if (mockRC5 == 0u) {
+		return DEV_EEPROM;
+	} else if (mockRA5 == 0u) {
+		return DEV_CAN;
+	} else if (mockRB7 == 0u) {
+		return DEV_DAC1;
+	} else if (mockRB5 == 0u) {
+		return DEV_DAC2;
+	}
+	return DEV_NONE;
+}
+
+void
+mockSync(void) {
+	if (mockPinTouched && selected() == DEV_NONE) {
+		end();
+	}
+}
+
+void
+mockSpiClear(void) {
+	memset(&mockSpi, 0, sizeof(mockSpi));
+}
+
+void
+mockReset(void) {
+	end();
+	memset(&ee, 0, sizeof(ee));
+	memset(&mockEeprom, 0, sizeof(mockEeprom));
+	memset(mockEeprom.mem, 0xFF, sizeof(mockEeprom.mem));
+	memset(&mcp, 0, sizeof(mcp));
+	memset(&mockCan, 0, sizeof(mockCan));
+	mcpReset();
+	memset(&mockDac, 0, sizeof(mockDac));
+	dacCmd = 0u;
+	mockSpiClear();
+	mockClock = 0u;
+	mockPinTouched = 0u;
+	mockDelayHook = NULL;
+}
+
+void
+spiInit(void) {}
+
+U8
+spiTx(U8 c) {
+	Device d;
+	U8 out;
+
+	// A chip-select access since the last byte ends the transaction
+	d = selected();
+	if (mockPinTouched || d != dev) {
+		end();
+		mockPinTouched = 0u;
+		dev = d;
+		pos = 0u;
+		if (dev != DEV_NONE) {
+			mockSpi.transactions++;
+		}
+	}
+
+	mockSpi.bytes++;
+	mockClock += BYTE_CYCLES;
+
+	switch (dev) {
+	case DEV_EEPROM:
+		out = eeTx(c);
+		break;
+	case DEV_CAN:
+		out = mcpTx(c);
+		break;
+	case DEV_DAC1:
+	case DEV_DAC2:
+		dacCmd = (dacCmd << 8u) | c;
+		out = 0xFF;
+		break;
+	default:
+		out = 0xFF;
+	}
+	pos++;
+	return out;
+}
@@ -0,0 +1,28 @@
+#include <stdint.h>
+
+#include "xc.h"
+
+volatile uint32_t mockClock = 0u;
+
+void (*mockDelayHook)(void) = 0;
+
+volatile uint8_t mockRA5 = 1u, mockRC5 = 1u, mockRB5 = 1u, mockRB7 = 1u;
+volatile uint8_t TRISA5, TRISC5, TRISB7, TRISB5;
+
+// Set whenever a chip-select pin is accessed.
+// Cleared by the SPI mock when it starts a transaction.
+volatile uint8_t mockPinTouched = 0u;
+
+void
+_delay(uint32_t n) {
+	mockClock += n;
+	if (mockDelayHook) {
+		mockDelayHook();
+	}
+}
+
+volatile uint8_t *
+mockPin(volatile uint8_t *pin) {
+	mockPinTouched = 1u;
+	return pin;
+}
@@ -0,0 +1,38 @@
+/* Host stand-in for XC8's <xc.h>, used by the unit tests.
+ *
+ * Special function registers and pins are plain variables. Chip-select
+ * pins are accessed through mockPin() so that the SPI mock can tell
+ * where one transaction ends and the next one begins.
+ *
+ * Time is counted in instruction cycles (Fosc/4 = 12MHz) by mockClock.
+ * It is advanced by _delay() and by each byte sent over the SPI bus.
+ */
+
+#ifndef MOCK_XC_H
+#define MOCK_XC_H
+
+#include <stdint.h>
+
+#define __interrupt()
+
+extern volatile uint32_t mockClock;
+
+// Busy-wait n instruction cycles.
+void _delay(uint32_t n);
+
+// Called by _delay() after the clock is advanced, if set,
+// e.g., to deliver frames due by then. Cleared by mockReset().
+extern void (*mockDelayHook)(void);
+
+// Note an access to a chip-select pin and return it.
+volatile uint8_t *mockPin(volatile uint8_t *pin);
+
+// Chip selects
+extern volatile uint8_t mockRA5, mockRC5, mockRB5, mockRB7;
+#define RA5 (*mockPin(&mockRA5)) // MCP2515
+#define RC5 (*mockPin(&mockRC5)) // EEPROM
+#define RB7 (*mockPin(&mockRB7)) // DAC1
+#define RB5 (*mockPin(&mockRB5)) // DAC2
+extern volatile uint8_t TRISA5, TRISC5, TRISB7, TRISB5;
+
+#endif // MOCK_XC_H
@@ -0,0 +1,115 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <prof.h>
+
+static Prof prof;
+
+void setUp(void) {
+	profInit(&prof);
+}
+void tearDown(void) {}
+
+static void
+testRecord(void) {
+	setUp();
+
+	static const U8 times[] = {0u, 1u, 3u, 4u, 15u, 16u, 200u, 1u};
+	ProfSrc src;
+	U8 k;
+
+	for (k = 0u; k < sizeof(times); k++) {
+		profRecord(&prof, PROF_INT, times[k]);
+	}
+	profRecord(&prof, PROF_NSRC, 50u); // no such source
+
+	src = prof.srcs[PROF_INT];
+	TEST_ASSERT_EQUAL_UINT8(200u, src.max);
+	TEST_ASSERT_EQUAL_UINT16(sizeof(times), src.n);
+	TEST_ASSERT_EQUAL_UINT32(240u, src.total);
+	TEST_ASSERT_EQUAL_UINT32(0u, prof.srcs[PROF_TMR1].total);
+
+	// Taking clears
+	profTake(&prof, PROF_INT, &src);
+	TEST_ASSERT_EQUAL_UINT32(240u, src.total);
+	TEST_ASSERT_EQUAL_UINT32(0u, prof.srcs[PROF_INT].total);
+	TEST_ASSERT_EQUAL_UINT16(0u, prof.srcs[PROF_INT].n);
+	TEST_ASSERT_EQUAL_UINT8(0u, prof.srcs[PROF_INT].max);
+
+	tearDown();
+}
+
+// The total doesn't stop at 16 bits, but stops with the count, so
+// that total/count stays the mean.
+static void
+testTotal(void) {
+	setUp();
+
+	U32 k;
+
+	for (k = 0u; k < 0xFFFEul; k++) {
+		profRecord(&prof, PROF_TMR2, 2u);
+	}
+	profRecord(&prof, PROF_TMR2, 250u);
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, prof.srcs[PROF_TMR2].n);
+	TEST_ASSERT_EQUAL_UINT32(2ul*0xFFFE + 250u, prof.srcs[PROF_TMR2].total);
+	TEST_ASSERT_EQUAL_UINT8(250u, prof.srcs[PROF_TMR2].max);
+
+	// Saturated: only the longest time is still kept
+	profRecord(&prof, PROF_TMR2, 3u);
+	profRecord(&prof, PROF_TMR2, 251u);
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, prof.srcs[PROF_TMR2].n);
+	TEST_ASSERT_EQUAL_UINT32(2ul*0xFFFE + 250u, prof.srcs[PROF_TMR2].total);
+	TEST_ASSERT_EQUAL_UINT8(251u, prof.srcs[PROF_TMR2].max);
+
+	tearDown();
+}
+
+// The passes of the main loop are counted per window.
+static void
+testIdle(void) {
+	setUp();
+
+	static const U16 passes[] = {20000u, 30000u, 15000u, 3000u, 0xFFFF};
+	U32 t, k;
+	U8 w;
+
+	for (w = 0u; w < sizeof(passes)/sizeof(passes[0u]); w++) {
+		for (t = 0u; t < PROF_WINDOW; t++) {
+			for (k = 0u; k < passes[w] / PROF_WINDOW; k++) {
+				PROF_IDLE(&prof);
+			}
+			if (t < passes[w] % PROF_WINDOW) {
+				PROF_IDLE(&prof);
+			}
+			TEST_ASSERT_EQUAL_UINT16(w ? passes[w-1u] : 0u, prof.last);
+			PROF_TICK(&prof);
+		}
+		TEST_ASSERT_EQUAL_UINT16(passes[w], prof.last);
+	}
+
+	// Saturates
+	for (t = 0u; t < PROF_WINDOW; t++) {
+		for (k = 0u; k < 100u; k++) {
+			PROF_IDLE(&prof);
+		}
+		PROF_TICK(&prof);
+	}
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, prof.last);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testRecord);
+	RUN_TEST(testTotal);
+	RUN_TEST(testIdle);
+
+	return UnityEnd();
+}
@@ -0,0 +1,173 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <sched.h>
+
+static Sched sched;
+
+void setUp(void) {
+	schedInit(&sched);
+}
+void tearDown(void) {}
+
+// Values are taken at most once per period, and the newest one is taken.
+static void
+testRate(void) {
+	setUp();
+
+	U32 t, taken;
+	U8 sig;
+	I32 raw, last;
+
+	schedSetRate(&sched, 2u, 50u);
+	taken = 0u;
+	last = -1;
+	for (t = 0u; t < SCHED_TICK_HZ; t++) { // 1s, a value every tick
+		schedPost(&sched, 2u, (I32)t);
+		if (schedNext(&sched, &sig, &raw)) {
+			TEST_ASSERT_EQUAL_UINT8(2u, sig);
+			TEST_ASSERT_EQUAL_INT32((I32)t, raw); // newest
+			TEST_ASSERT_GREATER_THAN(last, raw);
+			last = raw;
+			taken++;
+		}
+		TEST_ASSERT_FALSE(schedNext(&sched, &sig, &raw));
+		schedTick(&sched);
+	}
+	TEST_ASSERT_UINT32_WITHIN(1u, 50u, taken);
+	// Every value posted was taken, replaced, or is still waiting
+	TEST_ASSERT_EQUAL_UINT16(SCHED_TICK_HZ - taken - sched.boxes[2u].full, sched.boxes[2u].coalesced);
+
+	tearDown();
+}
+
+// Taken at once: after a quiet spell, and at SCHED_RATE_ASAP.
+static void
+testImmediate(void) {
+	setUp();
+
+	U8 sig, k;
+	I32 raw;
+
+	TEST_ASSERT_FALSE(schedNext(&sched, &sig, &raw)); // nothing posted
+	schedPost(&sched, 0u, 10);
+	TEST_ASSERT_TRUE(schedNext(&sched, &sig, &raw));
+	TEST_ASSERT_EQUAL_INT32(10, raw);
+	schedPost(&sched, 0u, 11);
+	TEST_ASSERT_FALSE(schedNext(&sched, &sig, &raw)); // within the period
+	for (k = 0u; k < (SCHED_TICK_HZ + SCHED_DEFAULT_HZ/2u) / SCHED_DEFAULT_HZ; k++) {
+		schedTick(&sched);
+	}
+	TEST_ASSERT_TRUE(schedNext(&sched, &sig, &raw));
+	TEST_ASSERT_EQUAL_INT32(11, raw);
+
+	schedSetRate(&sched, 1u, SCHED_RATE_ASAP);
+	for (k = 0u; k < 10u; k++) {
+		schedPost(&sched, 1u, k);
+		TEST_ASSERT_TRUE(schedNext(&sched, &sig, &raw));
+		TEST_ASSERT_EQUAL_UINT8(1u, sig);
+		TEST_ASSERT_EQUAL_INT32(k, raw);
+	}
+
+	// Slowing down shortens the wait to the new period
+	schedSetRate(&sched, 0u, 1u);
+	schedSetRate(&sched, 0u, SCHED_RATE_ASAP);
+	schedPost(&sched, 0u, 12);
+	TEST_ASSERT_TRUE(schedNext(&sched, &sig, &raw));
+
+	tearDown();
+}
+
+// Signals due together are taken in turn.
+static void
+testRoundRobin(void) {
+	setUp();
+
+	U8 sig, k, n;
+	I32 raw;
+	U8 seen;
+
+	for (n = 0u; n < 3u; n++) {
+		for (k = 0u; k < SCHED_MAX_SIGS; k++) {
+			schedSetRate(&sched, k, SCHED_RATE_ASAP);
+			schedPost(&sched, k, 100*k + n);
+		}
+		seen = 0u;
+		for (k = 0u; k < SCHED_MAX_SIGS; k++) {
+			TEST_ASSERT_TRUE(schedNext(&sched, &sig, &raw));
+			TEST_ASSERT_EQUAL_INT32(100*sig + n, raw);
+			seen |= 1u << sig;
+		}
+		TEST_ASSERT_EQUAL_HEX8((1u << SCHED_MAX_SIGS) - 1u, seen);
+		TEST_ASSERT_FALSE(schedNext(&sched, &sig, &raw));
+	}
+
+	tearDown();
+}
+
+// Six signals on the bus at rising frame rates: the gauge updates stay
+// at the configured rates.
+static void
+testBoundedLoad(void) {
+	enum { NSIGS = 6u, SECONDS = 4u, STEP_US = 50u };
+	static const U32 frameHz[] = {10u, 50u, 100u, 500u, 2000u};
+	static const U8 rates[NSIGS] = {50u, 50u, 20u, 20u, 20u, SCHED_RATE_DEFAULT};
+	U32 t, nextFrame, nextTick, frames, updates, bound;
+	U8 f, k, sig;
+	I32 raw;
+
+	bound = 0u;
+	for (k = 0u; k < NSIGS; k++) {
+		bound += (rates[k] == SCHED_RATE_DEFAULT) ? SCHED_DEFAULT_HZ : rates[k];
+	}
+
+	printf("\nGauge updates/s for %u signals at rates summing to %luHz:\n",
+		NSIGS, (unsigned long)bound);
+	printf("%10s %10s %10s\n", "frames/s", "before", "scheduled");
+	for (f = 0u; f < sizeof(frameHz)/sizeof(frameHz[0u]); f++) {
+		setUp();
+		for (k = 0u; k < NSIGS; k++) {
+			schedSetRate(&sched, k, rates[k]);
+		}
+		frames = updates = 0u;
+		nextFrame = nextTick = 0u;
+		for (t = 0u; t < SECONDS*1000000ul; t += STEP_US) {
+			if (t >= nextFrame) { // one frame per signal
+				for (k = 0u; k < NSIGS; k++) {
+					schedPost(&sched, k, (I32)t);
+					frames++;
+				}
+				nextFrame += 1000000ul / frameHz[f];
+			}
+			if (t >= nextTick) {
+				schedTick(&sched);
+				nextTick += 1000000ul / SCHED_TICK_HZ;
+			}
+			while (schedNext(&sched, &sig, &raw)) {
+				updates++;
+			}
+		}
+		printf("%10lu %10lu %10lu\n", (unsigned long)frames / SECONDS,
+			(unsigned long)frames / SECONDS, (unsigned long)updates / SECONDS);
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(frames, updates);
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(bound*SECONDS + NSIGS, updates);
+
+		tearDown();
+	}
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testRate);
+	RUN_TEST(testImmediate);
+	RUN_TEST(testRoundRobin);
+	RUN_TEST(testBoundedLoad);
+
+	return UnityEnd();
+}
@@ -1,31 +1,147 @@
 #include <stdbool.h>
 #include <stdint.h>
+#include <stdio.h>
+#include <time.h>
 
 #include <unity.h>
 
 #include <types.h>
 #include <can.h>
 #include <signal.h>
-#include <signal_utestable.h>
 
 void setUp(void) {}
 void tearDown(void) {}
 
+// Work done by the bit-loop routines, in the classes that are loops on
+// the PIC16: loop iterations, divisions and remainders (by 8, but of
+// U8s that XC8 doesn't turn into shifts), and the bits moved by shifts
+// of a variable distance, one step per bit.
+static U32 refIters, refDivs, refBits;
+
+// The original bit-loop extraction, kept as the reference.
+// Extract a little-endian value from a frame.
+// Assumes signal is within the frame's DATA FIELD.
+static void
+pluckLE(const SigFmt *sig, const CanFrame *frame, U32 *raw) {
+	U8 i, end, mask, byte;
+
+	*raw = 0ul;
+	end = sig->start + sig->size;
+
+	// First iteration starts at arbitrary bit: namely the (i%8)'th bit.
+	// Subsequent iterations start at bit 0 of each byte.
+
+	for (i = sig->start; i < end; i += 8u-(i%8u)) {
+		mask = (U8)(0xFF << (i%8u));
+		if (i/8u == end/8u) { // if end in this byte
+			mask &= 0xFF >> (8u - (end%8u)); // ignore top bits
+			refDivs += 1u;
+			refBits += 8u - (end%8u);
+		}
+		byte = (frame->data[i/8u] & mask) >> (i%8u);
+		*raw |= (U32)byte << (i - sig->start);
+		refIters++;
+		refDivs += 6u;
+		refBits += 2u*(i%8u) + (i - sig->start);
+	}
+}
+
+// Extract a big-endian value from a frame.
+// Assumes signal is within the frame's DATA FIELD.
+static void
+pluckBE(const SigFmt *sig, const CanFrame *frame, U32 *raw) {
+	U8 i, end, mask;
+
+	*raw = 0ul;
+	end = sig->start + sig->size;
+
+	// First iteration starts at arbitrary bit: namely the (i%8)'th bit.
+	// Subsequent iterations start at bit 0 of each byte.
+
+	for (i = sig->start; i < end; i += 8u-(i%8u)) {
+		mask = (U8)(0xFF << (i%8u));
+		if (i/8u == end/8u) { // if end in this byte
+			mask &= 0xFF >> (8u - (end%8u)); // ignore top bits
+			*raw <<= (end%8u) - (i%8u); // include bits between i and end
+			refDivs += 3u;
+			refBits += 8u - (end%8u) + (end%8u) - (i%8u);
+		} else {
+			*raw <<= 8u - (i%8u); // include bits between i and end of byte
+			refDivs += 1u;
+			refBits += 8u - (i%8u);
+		}
+		*raw |= (frame->data[i/8u] & mask) >> (i%8u);
+		refIters++;
+		refDivs += 6u;
+		refBits += 2u*(i%8u);
+	}
+}
+
+// The original sigPluck, plus sign extension.
+// Signals larger than 32 bits keep their low 32 bits.
+static Status
+refPluck(const SigFmt *sig, const CanFrame *frame, I32 *raw) {
+	SigFmt trunc;
+	U32 uraw, mask;
+
+	if (
+		(sig->start >= (8u * frame->dlc))
+		|| (sig->size > (8u * frame->dlc - sig->start))
+		|| (sig->size < 1u)
+	) {
+		return FAIL;
+	}
+
+	if (sig->order == LITTLE_ENDIAN) {
+		trunc = *sig;
+		if (trunc.size > 32u) {
+			trunc.size = 32u;
+		}
+		pluckLE(&trunc, frame, &uraw);
+	} else {
+		pluckBE(sig, frame, &uraw);
+	}
+
+	if (sig->isSigned && sig->size < 32u) {
+		mask = (1ul << sig->size) - 1ul;
+		if (uraw & (1ul << (sig->size-1u))) {
+			uraw |= ~mask;
+		}
+	}
+	*raw = (I32)uraw;
+	return OK;
+}
+
+static Status
+extract(const SigFmt *sig, const CanFrame *frame, I32 *raw) {
+	SigPlan plan;
+
+	(void)sigCompile(sig, &plan);
+	return sigExtract(&plan, frame, raw);
+}
+
 static void
 testPluckLE(void) {
 	setUp();
 
 	// 1111 1111  (1110 11)10  (1111 0010)  1111 1(101)
 	// 7       0  15        8  23      16  31       24
-	CanFrame frame = {.data = {0xFF, 0xEE, 0xF2, 0xFD}};
+	CanFrame frame = {.dlc = 4u, .data = {0xFF, 0xEE, 0xF2, 0xFD}};
 	SigFmt sig = {
 		.start = 10u,
 		.size = 17u,
+		.order = LITTLE_ENDIAN,
 	};
-	U32 want = 0x17CBB;
-	U32 got;
-	pluckLE(&sig, &frame, &got);
-	TEST_ASSERT_EQUAL_UINT32(want, got);
+	I32 want = 0x17CBB;
+	I32 got;
+	TEST_ASSERT_EQUAL(OK, extract(&sig, &frame, &got));
+	TEST_ASSERT_EQUAL_INT32(want, got);
+
+	// Signed: bit 16 is set
+	sig.isSigned = true;
+	want = 0x17CBB - 0x20000;
+	TEST_ASSERT_EQUAL(OK, extract(&sig, &frame, &got));
+	TEST_ASSERT_EQUAL_INT32(want, got);
 
 	tearDown();
 }
@@ -36,15 +152,208 @@ testPluckBE(void) {
 
 	// 1111 1111  (1110 11)10  (1111 0010)  1111 1(101)
 	// 7       0  15        8  23      16  31       24
-	CanFrame frame = {.data = {0xFF, 0xEE, 0xF2, 0xFD}};
+	CanFrame frame = {.dlc = 4u, .data = {0xFF, 0xEE, 0xF2, 0xFD}};
 	SigFmt sig = {
 		.start = 10u,
 		.size = 17u,
+		.order = BIG_ENDIAN,
 	};
-	U32 want = 0x1DF95;
-	U32 got;
-	pluckBE(&sig, &frame, &got);
-	TEST_ASSERT_EQUAL_UINT32(want, got);
+	I32 want = 0x1DF95;
+	I32 got;
+	TEST_ASSERT_EQUAL(OK, extract(&sig, &frame, &got));
+	TEST_ASSERT_EQUAL_INT32(want, got);
+
+	// Signed: bit 16 is set
+	sig.isSigned = true;
+	want = 0x1DF95 - 0x20000;
+	TEST_ASSERT_EQUAL(OK, extract(&sig, &frame, &got));
+	TEST_ASSERT_EQUAL_INT32(want, got);
+
+	tearDown();
+}
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+enum { NFRAMES = 12u };
+
+// Frames to extract from: all zeros, all ones, alternating bits,
+// and random data.
+static void
+mkFrames(CanFrame frames[NFRAMES]) {
+	U32 rng;
+	U8 f, k;
+
+	rng = 0x9E3779B9u;
+	for (f = 0u; f < NFRAMES; f++) {
+		frames[f].dlc = 8u;
+		for (k = 0u; k < 8u; k++) {
+			switch (f) {
+			case 0u: frames[f].data[k] = 0x00; break;
+			case 1u: frames[f].data[k] = 0xFF; break;
+			case 2u: frames[f].data[k] = 0x55; break;
+			case 3u: frames[f].data[k] = 0xAA; break;
+			default: frames[f].data[k] = (U8)xorshift(&rng);
+			}
+		}
+	}
+}
+
+// Every start, size, byte order, and signedness that fits in a frame,
+// against the original routines, with every DLC.
+static void
+testDifferential(void) {
+	setUp();
+
+	static const ByteOrder orders[] = {LITTLE_ENDIAN, BIG_ENDIAN};
+	CanFrame frames[NFRAMES], frame;
+	SigFmt sig;
+	SigPlan plan;
+	U8 o, start, size, f, dlc, sign;
+	I32 want, got;
+	Status wantStatus;
+	U32 n;
+
+	mkFrames(frames);
+	n = 0u;
+	for (o = 0u; o < 2u; o++) {
+		for (start = 0u; start < 64u; start++) {
+			for (size = 1u; size <= 64u - start; size++) {
+				for (sign = 0u; sign < 2u; sign++) {
+					sig = (SigFmt){.start = start, .size = size,
+						.order = orders[o], .isSigned = sign};
+					TEST_ASSERT_EQUAL(OK, sigCompile(&sig, &plan));
+					for (f = 0u; f < NFRAMES; f++) {
+						for (dlc = 0u; dlc <= 8u; dlc++) {
+							frame = frames[f];
+							frame.dlc = dlc;
+							wantStatus = refPluck(&sig, &frame, &want);
+							TEST_ASSERT_EQUAL(wantStatus, sigExtract(&plan, &frame, &got));
+							if (wantStatus == OK) {
+								TEST_ASSERT_EQUAL_INT32(want, got);
+							}
+							n++;
+						}
+					}
+				}
+			}
+		}
+	}
+	printf("\n%lu extractions match\n", (unsigned long)n);
+
+	// Formats that don't fit in a frame
+	sig = (SigFmt){.start = 0u, .size = 0u, .order = LITTLE_ENDIAN};
+	TEST_ASSERT_EQUAL(FAIL, sigCompile(&sig, &plan));
+	TEST_ASSERT_EQUAL(FAIL, sigExtract(&plan, &frames[0u], &got));
+	sig = (SigFmt){.start = 60u, .size = 5u, .order = BIG_ENDIAN};
+	TEST_ASSERT_EQUAL(FAIL, sigCompile(&sig, &plan));
+	sig = (SigFmt){.start = 0xFF, .size = 0xFF, .order = BIG_ENDIAN}; // erased EEPROM
+	TEST_ASSERT_EQUAL(FAIL, sigCompile(&sig, &plan));
+	TEST_ASSERT_EQUAL(FAIL, sigExtract(&plan, &frames[0u], &got));
+
+	tearDown();
+}
+
+// Work done by sigExtract, in the same classes as the bit-loop routines,
+// read off the plan: it has no divisions or remainders, its loops shift
+// by a constant 8 bits, and its variable shifts are fixed by its shape.
+// Little-endian shifts down by shift, and up by 32-shift for a 5th
+// byte; big-endian builds the end mask with a shift by 8-endBits, then
+// shifts by shift, and by endBits if there is more than one byte.
+static void
+planWork(const SigPlan *plan, U32 *iters, U32 *bits) {
+	if (plan->order == LITTLE_ENDIAN) {
+		*iters = plan->hi - plan->lo;
+		*bits = plan->shift;
+		if (plan->hi - plan->lo == 4u) {
+			*iters -= 1u;
+			*bits += 32u - plan->shift; // RAW_BITS
+		}
+	} else if (plan->lo == plan->hi) {
+		*iters = 0u;
+		*bits = 8u - plan->endBits + plan->shift;
+	} else {
+		*iters = plan->hi - plan->lo - 1u;
+		*bits = 8u - plan->endBits + plan->shift + plan->endBits;
+	}
+}
+
+// Host time is measured over the same formats.
+static void
+testBenchmark(void) {
+	setUp();
+
+	enum { REPS = 20u };
+	CanFrame frames[NFRAMES];
+	SigFmt sig;
+	SigPlan plan;
+	U8 o, start, size, f, r;
+	U32 n, iters, divs, bits, pIters, pBits, it, bt;
+	I32 raw;
+	volatile I32 sink;
+	clock_t t0, refClk, planClk;
+
+	mkFrames(frames);
+	printf("\nPer extraction, all formats of up to 32 bits, mean:\n");
+	printf("%6s %21s %21s %17s\n", "", "bit loops", "plan", "host ns");
+	printf("%6s %6s %6s %7s %6s %6s %7s %8s %8s\n", "order",
+		"iters", "divs", "shifted", "iters", "divs", "shifted", "loops", "plan");
+	for (o = 0u; o < 2u; o++) {
+		n = iters = divs = bits = pIters = pBits = 0u;
+		refClk = planClk = 0;
+		for (start = 0u; start < 64u; start++) {
+			for (size = 1u; size <= 32u && size <= 64u - start; size++) {
+				sig = (SigFmt){.start = start, .size = size,
+					.order = (o == 0u) ? LITTLE_ENDIAN : BIG_ENDIAN};
+				(void)sigCompile(&sig, &plan);
+				n++;
+
+				// Count
+				refIters = refDivs = refBits = 0u;
+				(void)refPluck(&sig, &frames[4u], &raw);
+				planWork(&plan, &it, &bt);
+				iters += refIters;
+				divs += refDivs;
+				bits += refBits;
+				pIters += it;
+				pBits += bt;
+
+				// No more work than the bit loops, class by class
+				TEST_ASSERT_LESS_OR_EQUAL_UINT32(refIters, it);
+				TEST_ASSERT_LESS_OR_EQUAL_UINT32(refBits, bt);
+
+				// Time
+				t0 = clock();
+				for (r = 0u; r < REPS; r++) {
+					for (f = 0u; f < NFRAMES; f++) {
+						(void)refPluck(&sig, &frames[f], &raw);
+						sink = raw;
+					}
+				}
+				refClk += clock() - t0;
+				t0 = clock();
+				for (r = 0u; r < REPS; r++) {
+					for (f = 0u; f < NFRAMES; f++) {
+						(void)sigExtract(&plan, &frames[f], &raw);
+						sink = raw;
+					}
+				}
+				planClk += clock() - t0;
+			}
+		}
+		printf("%6s %6.2f %6.2f %7.2f %6.2f %6.2f %7.2f %8.1f %8.1f\n",
+			(o == 0u) ? "LE" : "BE",
+			(double)iters / n, (double)divs / n, (double)bits / n,
+			(double)pIters / n, 0.0, (double)pBits / n,
+			1e9 * refClk / CLOCKS_PER_SEC / ((double)n * REPS * NFRAMES),
+			1e9 * planClk / CLOCKS_PER_SEC / ((double)n * REPS * NFRAMES));
+	}
+	(void)sink;
 
 	tearDown();
 }
@@ -55,6 +364,8 @@ main(void) {
 
 	RUN_TEST(testPluckLE);
 	RUN_TEST(testPluckBE);
+	RUN_TEST(testDifferential);
+	RUN_TEST(testBenchmark);
 
 	return UnityEnd();
 }
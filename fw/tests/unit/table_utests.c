@@ -0,0 +1,561 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <eeprom.h>
+#include <table.h>
+#include <mock.h>
+
+// Example calibrations from sw/cal/example
+typedef struct {
+	const char *name;
+	U8 n;
+	I32 keys[TAB_ROWS];
+	U16 vals[TAB_ROWS];
+} Example;
+
+static const Example examples[] = {
+	{"ect", 21u,
+		{20, 30, 40, 50, 60, 70, 80, 90, 100, 110, 120, 130, 140, 150, 160, 170, 180, 190, 200, 220, 240},
+		{4932, 4890, 4828, 4740, 4619, 4461, 4261, 4019, 3740, 3430, 3101, 2767, 2441, 2131, 1847, 1592, 1369, 1174, 1006, 745, 556}},
+	{"speed", 3u, {0, 25600, 64000}, {0, 550, 1375}},
+	{"tach", 2u, {0, 64255}, {0, 8032}},
+};
+
+enum { NEXAMPLES = sizeof(examples) / sizeof(examples[0u]) };
+
+static Table tab;
+
+void setUp(void) {
+	mockReset();
+	eepromInit();
+	tab = (Table){.offset = 2u*TAB_SIZE, .hdr = 6u*TAB_SIZE + 48u + 2u*TAB_HDR_SIZE};
+	TEST_ASSERT_EQUAL(OK, tabInit(&tab));
+}
+void tearDown(void) {}
+
+// Write a table the way the calibration tool does:
+// unused rows are filled with the last row.
+static void
+writeExample(Table *tab, const Example *ex) {
+	U8 row, k;
+
+	for (row = 0u; row < TAB_ROWS; row++) {
+		k = (row < ex->n) ? row : ex->n-1u;
+		TEST_ASSERT_EQUAL(OK, tabWrite(tab, row, (U32)ex->keys[k], ex->vals[k]));
+	}
+	TEST_ASSERT_EQUAL(OK, eepromFlush()); // nothing left buffered
+}
+
+// The original lookup: linear search, reading one row per transaction.
+static U16
+refLookup(const Table *tab, I32 key) {
+	U8 row;
+	U32 utkey;
+	I32 tkey1, tkey2;
+	U16 tval1, tval2;
+
+	for (row = 0u; row < TAB_ROWS; row++) {
+		TEST_ASSERT_EQUAL(OK, tabRead(tab, row, &utkey, &tval1));
+		tkey1 = (I32)utkey;
+		if (key == tkey1) {
+			return tval1;
+		} else if (key < tkey1) {
+			if (row == 0u) {
+				return tval1;
+			}
+			TEST_ASSERT_EQUAL(OK, tabRead(tab, row-1u, &utkey, &tval2));
+			tkey2 = (I32)utkey;
+			return (U16)(tval1 + ((I32)tval2-tval1) * (key-tkey1) / (tkey2-tkey1));
+		}
+	}
+	return tval1;
+}
+
+// Slowly-varying signal sampled at the bus rate:
+// a ramp through the table's range with each value repeated.
+static I32
+trace(const Example *ex, U32 k, U32 n) {
+	I32 lo, hi;
+
+	lo = ex->keys[0u] - 10;
+	hi = ex->keys[ex->n-1u] + 10;
+	return lo + (I32)(((int64_t)(hi - lo) * k) / n);
+}
+
+static void
+testMatchesReference(void) {
+	U8 e;
+	I32 key;
+	U16 val;
+
+	for (e = 0u; e < NEXAMPLES; e++) {
+		setUp();
+		writeExample(&tab, &examples[e]);
+
+		// Every key in and around the table, in both directions
+		for (key = examples[e].keys[0u]-3; key <= examples[e].keys[examples[e].n-1u]+3; key++) {
+			TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &val));
+			TEST_ASSERT_EQUAL_UINT16(refLookup(&tab, key), val);
+		}
+		for (; key >= examples[e].keys[0u]-3; key -= 7) {
+			TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &val));
+			TEST_ASSERT_EQUAL_UINT16(refLookup(&tab, key), val);
+		}
+
+		// Extremes
+		TEST_ASSERT_EQUAL(OK, tabLookup(&tab, INT32_MIN, &val));
+		TEST_ASSERT_EQUAL_UINT16(examples[e].vals[0u], val);
+		TEST_ASSERT_EQUAL(OK, tabLookup(&tab, INT32_MAX, &val));
+		TEST_ASSERT_EQUAL_UINT16(examples[e].vals[examples[e].n-1u], val);
+
+		tearDown();
+	}
+}
+
+static void
+testWriteInvalidates(void) {
+	setUp();
+
+	U16 val;
+
+	writeExample(&tab, &examples[0u]); // ect
+	TEST_ASSERT_EQUAL(OK, tabLookup(&tab, 25, &val));
+	TEST_ASSERT_EQUAL_UINT16(4911u, val);
+	TEST_ASSERT_EQUAL(OK, tabLookup(&tab, 25, &val));
+	TEST_ASSERT_EQUAL_UINT16(1u, tab.hits);
+
+	// Change the upper row of the cached segment
+	TEST_ASSERT_EQUAL(OK, tabWrite(&tab, 1u, 30u, 5000u));
+	TEST_ASSERT_EQUAL(OK, tabLookup(&tab, 25, &val));
+	TEST_ASSERT_EQUAL_UINT16(4966u, val);
+	TEST_ASSERT_EQUAL_UINT16(2u, tab.misses);
+	TEST_ASSERT_EQUAL_UINT32(0u, mockEeprom.busyErrors);
+
+	tearDown();
+}
+
+// Pseudo-random keys spread over the whole I32 range
+static I32
+randKey(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return (I32)*state;
+}
+
+// Compare a cache-miss lookup against the linear search and count
+// the EEPROM READ transactions each one makes.
+static void
+checkMiss(I32 key, U32 *maxReads, U32 *maxRefReads) {
+	U16 val, want;
+	U32 reads;
+
+	reads = mockEeprom.reads;
+	want = refLookup(&tab, key);
+	if (mockEeprom.reads - reads > *maxRefReads) {
+		*maxRefReads = mockEeprom.reads - reads;
+	}
+
+	tab.cached = false;
+	reads = mockEeprom.reads;
+	TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &val));
+	if (mockEeprom.reads - reads > *maxReads) {
+		*maxReads = mockEeprom.reads - reads;
+	}
+
+	TEST_ASSERT_EQUAL_UINT16(want, val);
+}
+
+// Binary search against the linear search over the full I32 key range:
+// every key around each row, the extremes, a regular sweep of the range,
+// and random keys.
+static void
+testBinarySearch(void) {
+	U8 e, row;
+	U32 k, rng, maxReads, maxRefReads;
+	I32 key, d;
+
+	printf("\nEEPROM reads per cache miss, worst case:\n");
+	printf("%8s %8s %8s\n", "table", "linear", "binary");
+	for (e = 0u; e < NEXAMPLES; e++) {
+		setUp();
+		writeExample(&tab, &examples[e]);
+		maxReads = maxRefReads = 0u;
+
+		for (row = 0u; row < examples[e].n; row++) {
+			for (d = -3; d <= 3; d++) {
+				checkMiss(examples[e].keys[row] + d, &maxReads, &maxRefReads);
+			}
+		}
+		checkMiss(INT32_MIN, &maxReads, &maxRefReads);
+		checkMiss(INT32_MAX, &maxReads, &maxRefReads);
+		for (key = INT32_MIN; key < INT32_MAX - (1l<<20); key += 1l<<20) {
+			checkMiss(key, &maxReads, &maxRefReads);
+		}
+		rng = 0x12345678u;
+		for (k = 0u; k < 20000u; k++) {
+			checkMiss(randKey(&rng), &maxReads, &maxRefReads);
+		}
+
+		printf("%8s %8lu %8lu\n", examples[e].name,
+			(unsigned long)maxRefReads, (unsigned long)maxReads);
+		TEST_ASSERT_LESS_OR_EQUAL(6u, maxReads); // log2(TAB_ROWS) probes + 1 read
+
+		tearDown();
+	}
+}
+
+// SPI bytes per lookup with and without the segment cache.
+static void
+testSpiBytesPerLookup(void) {
+	enum { NSAMPLES = 4000u };
+	U8 e;
+	U32 k, uncached, cached, noSpi;
+	U16 val;
+	I32 key;
+
+	printf("\nSPI bytes per lookup, %u samples of a slow ramp:\n", NSAMPLES);
+	printf("%8s %10s %10s %8s\n", "table", "uncached", "cached", "hits");
+	for (e = 0u; e < NEXAMPLES; e++) {
+		setUp();
+		writeExample(&tab, &examples[e]);
+
+		// Uncached: every lookup scans the table
+		mockSpiClear();
+		for (k = 0u; k < NSAMPLES; k++) {
+			tab.cached = false;
+			(void)tabLookup(&tab, trace(&examples[e], k, NSAMPLES), &val);
+		}
+		uncached = mockSpi.bytes;
+
+		// Cached
+		tab.cached = false;
+		tab.hits = tab.misses = 0u;
+		noSpi = 0u;
+		mockSpiClear();
+		for (k = 0u; k < NSAMPLES; k++) {
+			key = trace(&examples[e], k, NSAMPLES);
+			cached = mockSpi.bytes;
+			TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &val));
+			if (mockSpi.bytes == cached) {
+				noSpi++;
+			}
+		}
+		cached = mockSpi.bytes;
+
+		printf("%8s %10.1f %10.1f %7.1f%%\n", examples[e].name,
+			(double)uncached / NSAMPLES, (double)cached / NSAMPLES,
+			100.0 * tab.hits / NSAMPLES);
+
+		TEST_ASSERT_EQUAL_UINT32(NSAMPLES, tab.hits + tab.misses);
+		TEST_ASSERT_EQUAL_UINT32(tab.hits, noSpi); // hits cost no SPI traffic
+		TEST_ASSERT_LESS_THAN_UINT32(uncached / 10u, cached);
+
+		tearDown();
+	}
+}
+
+// SPI traffic of cache misses. With no write cycle in progress, reads
+// skip the status register: before, each READ was preceded by a 2-byte
+// READ STATUS transaction.
+static void
+testNoStatusPolls(void) {
+	enum { NSAMPLES = 4000u, STATUS_BYTES = 2u };
+	U8 e;
+	U32 k, reads, polls;
+	U16 val;
+
+	printf("\nSPI traffic per cache miss, %u samples of a slow ramp:\n", NSAMPLES);
+	printf("%8s %10s %10s %10s %10s\n", "table", "bytes", "", "CS cycles", "");
+	printf("%8s %10s %10s %10s %10s\n", "", "polled", "now", "polled", "now");
+	for (e = 0u; e < NEXAMPLES; e++) {
+		setUp();
+		writeExample(&tab, &examples[e]);
+
+		mockSpiClear();
+		reads = mockEeprom.reads;
+		polls = mockEeprom.statusReads;
+		for (k = 0u; k < NSAMPLES; k++) {
+			tab.cached = false;
+			TEST_ASSERT_EQUAL(OK, tabLookup(&tab, trace(&examples[e], k, NSAMPLES), &val));
+		}
+		reads = mockEeprom.reads - reads;
+
+		printf("%8s %10.1f %10.1f %10.1f %10.1f\n", examples[e].name,
+			(double)(mockSpi.bytes + STATUS_BYTES*reads) / NSAMPLES,
+			(double)mockSpi.bytes / NSAMPLES,
+			(double)(mockSpi.transactions + reads) / NSAMPLES,
+			(double)mockSpi.transactions / NSAMPLES);
+
+		TEST_ASSERT_EQUAL_UINT32(polls, mockEeprom.statusReads);
+		TEST_ASSERT_EQUAL_UINT32(reads, mockSpi.transactions);
+
+		tearDown();
+	}
+}
+
+// Interpolation between rows (key1, val1) and (key2, val2) in 64 bits,
+// rounded like the original integer math: toward val2.
+static U16
+exactInterp(I32 key, I32 key1, U16 val1, I32 key2, U16 val2) {
+	int64_t dy, dx;
+
+	dy = (int64_t)val1 - val2;
+	dx = (int64_t)key1 - key2;
+	return (U16)(val2 + dy * ((int64_t)key - key2) / dx);
+}
+
+// Maximum error of the shifted interpolation against the original
+// 32-bit integer math and against exact 64-bit math, for segments of
+// increasing span. The original overflows when |val2-val1| * (key-key2)
+// exceeds 2^31, so it is only compared where it doesn't.
+static void
+testInterpAccuracy(void) {
+	enum { NSEGMENTS = 300u, NKEYS = 100u };
+	static const U8 spanBits[] = {4u, 8u, 12u, 16u, 20u, 24u, 28u, 32u};
+	U8 b, j;
+	U32 rng, span, k, errOrig, errExact, overflows, err;
+	I32 key1, key2, key;
+	U16 val1, val2, val, want;
+	int64_t prod;
+
+	printf("\nInterpolation error (LSB), %u segments x %u keys per span:\n",
+		NSEGMENTS, NKEYS);
+	printf("%6s %10s %10s %10s\n", "span", "vs orig", "vs exact", "orig ovf");
+	rng = 0xC0FFEEu;
+	for (b = 0u; b < sizeof(spanBits); b++) {
+		errOrig = errExact = overflows = 0u;
+		for (k = 0u; k < NSEGMENTS; k++) {
+			setUp();
+
+			// Random segment of up to 2^spanBits keys
+			span = (U32)randKey(&rng);
+			if (spanBits[b] < 32u) {
+				span &= (1ul << spanBits[b]) - 1ul;
+			}
+			span |= 2u;
+			key1 = (I32)((U32)randKey(&rng) & 0x3FFFFFFF) - 0x7FFFFFFF;
+			if ((U32)INT32_MAX - (U32)key1 < span) {
+				span = (U32)INT32_MAX - (U32)key1;
+			}
+			key2 = (I32)((U32)key1 + span);
+			val1 = (U16)randKey(&rng);
+			val2 = (U16)randKey(&rng);
+			for (j = 0u; j < TAB_ROWS; j++) {
+				TEST_ASSERT_EQUAL(OK, tabWrite(&tab, j,
+					(U32)((j == 0u) ? key1 : key2), (j == 0u) ? val1 : val2));
+			}
+
+			for (j = 0u; j < NKEYS; j++) {
+				key = (I32)((U32)key1 + 1u + (U32)randKey(&rng) % (span-1u));
+				TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &val));
+				want = exactInterp(key, key1, val1, key2, val2);
+				err = (val > want) ? val - want : want - val;
+				if (err > errExact) {
+					errExact = err;
+				}
+
+				prod = ((int64_t)val1 - val2) * ((int64_t)key - key2);
+				if (prod > INT32_MAX || prod < INT32_MIN) {
+					overflows++;
+				} else if (err > errOrig) {
+					errOrig = err; // no overflow: original == exact
+				}
+			}
+
+			tearDown();
+		}
+		printf("%4s2^%-2u %10lu %10lu %9.1f%%\n", "", spanBits[b],
+			(unsigned long)errOrig, (unsigned long)errExact,
+			100.0 * overflows / (NSEGMENTS*NKEYS));
+
+		if (spanBits[b] <= 16u) {
+			TEST_ASSERT_EQUAL_UINT32(0u, errExact); // span fits in 16 bits
+		} else {
+			TEST_ASSERT_LESS_OR_EQUAL(4u, errExact); // |dy| * 2^-14
+		}
+	}
+}
+
+// Write a grid table with random values.
+static void
+writeGrid(const TabGrid *grid, U16 vals[TAB_GRID_LEN], U32 *rng) {
+	U8 k;
+
+	for (k = 0u; k < grid->len; k++) {
+		vals[k] = (U16)randKey(rng);
+	}
+	for (k = 0u; k+4u <= TAB_GRID_LEN; k += 4u) {
+		TEST_ASSERT_EQUAL(OK, tabWriteVals(&tab, k, vals+k, 4u));
+	}
+	TEST_ASSERT_EQUAL(OK, tabWriteGrid(&tab, grid));
+	TEST_ASSERT_EQUAL(OK, eepromFlush()); // nothing left buffered
+}
+
+// Lookup in a grid: at, around, and between every point, past both ends,
+// and at random keys. Each cache miss is a single EEPROM read.
+static void
+testGrid(void) {
+	static const TabGrid grids[] = {
+		{0, 4u, TAB_GRID_LEN}, // step 16
+		{-40, 0u, 50u}, // step 1
+		{-1000000, 15u, 61u},
+		{INT32_MIN, 26u, 64u}, // covers the I32 range
+		{123, 3u, 1u}, // single point
+	};
+	U16 vals[TAB_GRID_LEN];
+	U8 g, k;
+	U32 rng, i, j, reads;
+	I32 d, key, key1, step;
+	U16 val, want;
+
+	rng = 0xBADC0DEu;
+	for (g = 0u; g < sizeof(grids)/sizeof(grids[0u]); g++) {
+		setUp();
+		writeGrid(&grids[g], vals, &rng);
+		step = (I32)(1ul << grids[g].shift);
+
+		for (k = 0u; k < grids[g].len; k++) {
+			key1 = (I32)((U32)grids[g].start + ((U32)k << grids[g].shift));
+			for (d = -2; d <= 2; d++) {
+				key = (I32)((U32)key1 + (U32)d);
+				if ((k == 0u && d < 0 && key > key1) || (d > 0 && key < key1)) {
+					continue; // wrapped around the I32 range
+				} else if (d >= step || -d >= step) {
+					continue; // another segment
+				}
+				tab.cached = false;
+				reads = mockEeprom.reads;
+				TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &val));
+				TEST_ASSERT_EQUAL_UINT32(1u, mockEeprom.reads - reads);
+				if (d == 0) {
+					TEST_ASSERT_EQUAL_UINT16(vals[k], val);
+				} else if (d < 0) {
+					want = (k == 0u) ? vals[0u] :
+						exactInterp(key, key1-step, vals[k-1u], key1, vals[k]);
+					TEST_ASSERT_UINT16_WITHIN(2u, want, val);
+				} else {
+					want = (k+1u >= grids[g].len) ? vals[k] :
+						exactInterp(key, key1, vals[k], key1+step, vals[k+1u]);
+					TEST_ASSERT_UINT16_WITHIN(2u, want, val);
+				}
+			}
+		}
+		TEST_ASSERT_EQUAL(OK, tabLookup(&tab, INT32_MIN, &val));
+		TEST_ASSERT_EQUAL_UINT16(vals[0u], val);
+		TEST_ASSERT_EQUAL(OK, tabLookup(&tab, INT32_MAX, &val));
+		TEST_ASSERT_EQUAL_UINT16(vals[grids[g].len-1u], val);
+
+		for (i = 0u; i < 5000u; i++) {
+			key = randKey(&rng);
+			TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &val));
+			if (key <= grids[g].start) {
+				want = vals[0u];
+			} else {
+				j = ((U32)key - (U32)grids[g].start - 1u) >> grids[g].shift;
+				if (j+1u >= grids[g].len) {
+					want = vals[grids[g].len-1u];
+				} else {
+					key1 = (I32)((U32)grids[g].start + (j << grids[g].shift));
+					want = exactInterp(key, key1, vals[j], key1+step, vals[j+1u]);
+				}
+			}
+			TEST_ASSERT_UINT16_WITHIN(2u, want, val);
+		}
+
+		tearDown();
+	}
+}
+
+// A grid gives the same results as the equivalent row table.
+static void
+testGridMatchesRows(void) {
+	setUp();
+
+	TabGrid grid = {-96, 3u, TAB_ROWS};
+	U16 vals[TAB_GRID_LEN], gridVal, rowVal;
+	U32 rng;
+	U8 k;
+	I32 key;
+
+	rng = 0x5EED;
+	writeGrid(&grid, vals, &rng);
+
+	// Same points as rows in a second table
+	Table rows = {.offset = 3u*TAB_SIZE, .hdr = tab.hdr + TAB_HDR_SIZE};
+	TEST_ASSERT_EQUAL(OK, tabInit(&rows));
+	for (k = 0u; k < TAB_ROWS; k++) {
+		TEST_ASSERT_EQUAL(OK, tabWrite(&rows, k, (U32)(-96 + 8*k), vals[k]));
+	}
+	for (key = -100; key <= -96 + 8*TAB_ROWS; key++) {
+		TEST_ASSERT_EQUAL(OK, tabLookup(&tab, key, &gridVal));
+		TEST_ASSERT_EQUAL(OK, tabLookup(&rows, key, &rowVal));
+		TEST_ASSERT_EQUAL_UINT16(rowVal, gridVal);
+	}
+
+	tearDown();
+}
+
+// The mode survives a reset, and writing a row switches back to rows.
+static void
+testGridMode(void) {
+	setUp();
+
+	TabGrid grid = {0, 1u, 10u}, readBack;
+	U16 vals[TAB_GRID_LEN];
+	U32 rng;
+
+	TEST_ASSERT_FALSE(tab.isGrid); // erased EEPROM: rows
+	TEST_ASSERT_EQUAL(FAIL, tabReadGrid(&tab, &readBack));
+
+	rng = 1u;
+	writeGrid(&grid, vals, &rng);
+	TEST_ASSERT_TRUE(tab.isGrid);
+	tab.isGrid = false; // reset
+	TEST_ASSERT_EQUAL(OK, tabInit(&tab));
+	TEST_ASSERT_TRUE(tab.isGrid);
+	TEST_ASSERT_EQUAL(OK, tabReadGrid(&tab, &readBack));
+	TEST_ASSERT_EQUAL_INT32(grid.start, readBack.start);
+	TEST_ASSERT_EQUAL_UINT8(grid.shift, readBack.shift);
+	TEST_ASSERT_EQUAL_UINT8(grid.len, readBack.len);
+
+	writeExample(&tab, &examples[2u]); // tach
+	TEST_ASSERT_FALSE(tab.isGrid);
+	TEST_ASSERT_EQUAL(OK, tabInit(&tab));
+	TEST_ASSERT_FALSE(tab.isGrid);
+
+	// Invalid grids
+	grid = (TabGrid){0, 4u, 0u}; // empty
+	TEST_ASSERT_EQUAL(FAIL, tabWriteGrid(&tab, &grid));
+	grid = (TabGrid){0, 4u, TAB_GRID_LEN+1u}; // too long
+	TEST_ASSERT_EQUAL(FAIL, tabWriteGrid(&tab, &grid));
+	grid = (TabGrid){INT32_MAX-15, 4u, 2u}; // last key overflows
+	TEST_ASSERT_EQUAL(FAIL, tabWriteGrid(&tab, &grid));
+	grid = (TabGrid){INT32_MIN, 31u, 3u}; // span overflows
+	TEST_ASSERT_EQUAL(FAIL, tabWriteGrid(&tab, &grid));
+	TEST_ASSERT_FALSE(tab.isGrid);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testMatchesReference);
+	RUN_TEST(testWriteInvalidates);
+	RUN_TEST(testBinarySearch);
+	RUN_TEST(testSpiBytesPerLookup);
+	RUN_TEST(testNoStatusPolls);
+	RUN_TEST(testInterpAccuracy);
+	RUN_TEST(testGrid);
+	RUN_TEST(testGridMatchesRows);
+	RUN_TEST(testGridMode);
+
+	return UnityEnd();
+}
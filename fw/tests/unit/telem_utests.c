@@ -0,0 +1,69 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <telem.h>
+
+static Telem telem;
+
+void setUp(void) {
+	telemInit(&telem);
+}
+void tearDown(void) {}
+
+static void
+testOff(void) {
+	setUp();
+
+	U8 sig;
+	U32 t;
+
+	for (t = 0u; t < TELEM_TICK_HZ; t++) {
+		TEST_ASSERT_FALSE(telemNext(&telem, &sig));
+		telemTick(&telem);
+	}
+	telemConfig(&telem, 0x3F, 0u);
+	TEST_ASSERT_FALSE(telemNext(&telem, &sig));
+
+	tearDown();
+}
+
+// Samples go round the signals at the rate, whatever the load.
+static void
+testRate(void) {
+	setUp();
+
+	U8 sig, want;
+	U32 t, n;
+
+	telemConfig(&telem, 0x25, 10u); // signals 0, 2, 5
+	n = 0u;
+	want = 0u;
+	for (t = 0u; t < 10u*TELEM_TICK_HZ; t++) {
+		while (telemNext(&telem, &sig)) { // the main loop asks every pass
+			TEST_ASSERT_EQUAL_UINT8(want, sig);
+			want = (want == 0u) ? 2u : (want == 2u) ? 5u : 0u;
+			n++;
+		}
+		telemTick(&telem);
+	}
+	TEST_ASSERT_UINT32_WITHIN(1u, 100u, n);
+
+	// Off again
+	telemConfig(&telem, 0u, 10u);
+	TEST_ASSERT_FALSE(telemNext(&telem, &sig));
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testOff);
+	RUN_TEST(testRate);
+
+	return UnityEnd();
+}
@@ -0,0 +1,375 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <frameq.h>
+#include <sched.h>
+#include <wave.h>
+#include <eeprom.h>
+#include <table.h>
+#include <damp.h>
+#include <trace.h>
+#include <mock.h>
+
+#include <xc.h>
+
+static Trace trace;
+
+void setUp(void) {
+	traceInit(&trace);
+}
+void tearDown(void) {}
+
+// Each stage is timed from arrival, and only in order.
+static void
+testStages(void) {
+	setUp();
+
+	traceSelect(&trace, 2u);
+	traceExtract(&trace, 2u, 1000u, 1010u);
+	traceLookup(&trace, 2u, 1100u);
+	traceOutput(&trace, 2u, 1103u);
+	traceOutput(&trace, 2u, 1200u); // already output
+	traceLookup(&trace, 2u, 1300u);
+
+	traceExtract(&trace, 0u, 0u, 50u); // not traced
+	traceLookup(&trace, 0u, 60u);
+	traceOutput(&trace, 0u, 70u);
+
+	TEST_ASSERT_EQUAL_UINT16(1u, trace.stages[TRACE_STAGE_EXTRACT].n);
+	TEST_ASSERT_EQUAL_UINT16(10u, trace.stages[TRACE_STAGE_EXTRACT].max);
+	TEST_ASSERT_EQUAL_UINT16(1u, trace.stages[TRACE_STAGE_LOOKUP].n);
+	TEST_ASSERT_EQUAL_UINT16(100u, trace.stages[TRACE_STAGE_LOOKUP].max);
+	TEST_ASSERT_EQUAL_UINT16(1u, trace.stages[TRACE_STAGE_OUTPUT].n);
+	TEST_ASSERT_EQUAL_UINT16(103u, trace.stages[TRACE_STAGE_OUTPUT].max);
+
+	// Selecting clears, but keeps a value on its way
+	traceExtract(&trace, 2u, 2000u, 2001u);
+	traceSelect(&trace, 2u);
+	TEST_ASSERT_EQUAL_UINT16(0u, trace.stages[TRACE_STAGE_EXTRACT].n);
+	TEST_ASSERT_EQUAL_UINT16(0u, trace.stages[TRACE_STAGE_OUTPUT].max);
+	TEST_ASSERT_EQUAL_UINT16(0u, traceMean(&trace.stages[TRACE_STAGE_OUTPUT]));
+	traceLookup(&trace, 2u, 2005u);
+	TEST_ASSERT_EQUAL_UINT16(5u, trace.stages[TRACE_STAGE_LOOKUP].max);
+
+	// Another signal starts afresh
+	traceSelect(&trace, 0u);
+	traceOutput(&trace, 0u, 2010u);
+	TEST_ASSERT_EQUAL_UINT16(0u, trace.stages[TRACE_STAGE_OUTPUT].n);
+
+	tearDown();
+}
+
+// A newer value restarts the trace; one that goes no further ends it.
+static void
+testRestart(void) {
+	setUp();
+
+	traceSelect(&trace, 1u);
+	traceExtract(&trace, 1u, 0u, 5u);
+	traceExtract(&trace, 1u, 40u, 45u); // replaces it in the mailbox
+	traceLookup(&trace, 1u, 50u);
+	traceOutput(&trace, 1u, 60u);
+
+	traceExtract(&trace, 1u, 100u, 101u);
+	traceLookup(&trace, 1u, 110u);
+	traceEnd(&trace, 1u); // memo hit
+	traceOutput(&trace, 1u, 500u);
+
+	TEST_ASSERT_EQUAL_UINT16(3u, trace.stages[TRACE_STAGE_EXTRACT].n);
+	TEST_ASSERT_EQUAL_UINT16(2u, trace.stages[TRACE_STAGE_LOOKUP].n);
+	TEST_ASSERT_EQUAL_UINT16(10u, trace.stages[TRACE_STAGE_LOOKUP].max);
+	TEST_ASSERT_EQUAL_UINT16(10u, traceMean(&trace.stages[TRACE_STAGE_LOOKUP]));
+	TEST_ASSERT_EQUAL_UINT16(1u, trace.stages[TRACE_STAGE_OUTPUT].n);
+	TEST_ASSERT_EQUAL_UINT16(20u, trace.stages[TRACE_STAGE_OUTPUT].max);
+
+	tearDown();
+}
+
+// Times across the clock's wrap, and the mean.
+static void
+testTimes(void) {
+	setUp();
+
+	U32 k;
+
+	traceSelect(&trace, 0u);
+	traceExtract(&trace, 0u, 0xFFF0u, 0x10u);
+	TEST_ASSERT_EQUAL_UINT16(0x20u, trace.stages[TRACE_STAGE_EXTRACT].max);
+
+	traceSelect(&trace, 0u);
+	traceExtract(&trace, 0u, 0u, 1u);
+	traceExtract(&trace, 0u, 0u, 2u);
+	TEST_ASSERT_EQUAL_UINT16(2u, traceMean(&trace.stages[TRACE_STAGE_EXTRACT])); // 1.5, rounded
+
+	// The mean holds once the count saturates
+	traceSelect(&trace, 0u);
+	for (k = 0u; k < 0x10010ul; k++) {
+		traceExtract(&trace, 0u, (U16)k, (U16)(k + 7u));
+	}
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, trace.stages[TRACE_STAGE_EXTRACT].n);
+	TEST_ASSERT_EQUAL_UINT16(7u, traceMean(&trace.stages[TRACE_STAGE_EXTRACT]));
+
+	tearDown();
+}
+
+// Timer outputs are stamped by the ISR and recorded by traceCollect.
+static void
+testTimer(void) {
+	setUp();
+
+	traceSelect(&trace, 0u);
+	traceExtract(&trace, 0u, 0u, 2u);
+	traceLookup(&trace, 0u, 30u);
+	TRACE_ARM(&trace, 1u); // not traced
+	TEST_ASSERT_FALSE(trace.armed);
+	TRACE_ARM(&trace, 0u);
+	TEST_ASSERT_TRUE(trace.armed);
+	traceCollect(&trace); // not applied yet
+	TEST_ASSERT_EQUAL_UINT16(0u, trace.stages[TRACE_STAGE_OUTPUT].n);
+
+	trace.armed = false; // what TRACE_APPLY does
+	trace.at = 900u;
+	trace.applied = true;
+	traceCollect(&trace);
+	TEST_ASSERT_FALSE(trace.applied);
+	TEST_ASSERT_EQUAL_UINT16(1u, trace.stages[TRACE_STAGE_OUTPUT].n);
+	TEST_ASSERT_EQUAL_UINT16(900u, trace.stages[TRACE_STAGE_OUTPUT].max);
+
+	// Switching signals drops an output armed for the old one
+	TRACE_ARM(&trace, 0u);
+	traceSelect(&trace, 1u);
+	TEST_ASSERT_FALSE(trace.armed);
+
+	tearDown();
+}
+
+/* Host simulation of the path from frame to gauge.
+ *
+ * Engine speed arrives every 10ms and drives the tachometer; an analog
+ * signal arrives every 100ms, and is run again damped. The ISR, main loop, scheduler, table
+ * lookups and the tachometer's timer are played out on the mock clock,
+ * with the real receive queue, scheduler, table and EEPROM driver. The
+ * tracer's times are checked against latency budgets.
+ *
+ * A tachometer's new timing takes effect at the end of the edge in
+ * progress, which at 800rpm is 37.5ms away.
+ */
+enum {
+	SIG_TACH = 0u,
+	SIG_AN = 2u,
+
+	TICK_CYCLES = 16384u, // TMR0 overflow
+	COUNT_CYCLES = 64u, // TMR0 count
+	LOOP_CYCLES = 300u, // one pass of the main loop
+	ISR_CYCLES = 400u, // reading a frame out of the MCP2515
+	TMR1_ISR_CYCLES = 40u,
+	EXTRACT_CYCLES = 200u,
+	DAC_CYCLES = 60u, // staging and committing a channel
+	DAMP_DIV = 4u, // scheduler ticks per damper step
+	DAMP_SHIFT = 3u,
+	SECONDS = 2u,
+
+	// Budgets, TMR0 counts
+	BUDGET_EXTRACT = 188u, // 1ms
+	BUDGET_LOOKUP_ASAP = 375u, // 2ms
+	BUDGET_LOOKUP_50HZ = 4125u, // a 20ms period + 2ms
+	BUDGET_OUTPUT_DAC = 188u, // after the lookup
+	BUDGET_OUTPUT_TACH = 7219u, // after the lookup: a 37.5ms edge + 1ms
+	BUDGET_OUTPUT_DAMP = 1212u, // after the lookup: a damper step + 1ms
+};
+
+typedef struct {
+	U32 period; // cycles between frames
+	U32 due; // next frame
+	I32 lo, hi; // raw values ramped between
+} SimSig;
+
+static U16
+now(void) {
+	return (U16)(mockClock / COUNT_CYCLES); // ticks<<8 | TMR0
+}
+
+// Post a frame from the ISR if one is due.
+static void
+deliver(FrameQ *q, SimSig *ss, U8 sig) {
+	CanFrame frame;
+	I32 raw;
+	U32 span;
+
+	if ((I32)(mockClock - ss->due) < 0) {
+		return;
+	}
+	span = SECONDS * 12000000ul;
+	raw = ss->lo + (I32)((U32)(ss->hi - ss->lo) * (mockClock % span / 1000u) / (span / 1000u));
+	frame = (CanFrame){.id = {.isExt = true, .eid = sig}, .rtr = false, .dlc = 4u,
+		.data = {raw >> 24u, raw >> 16u, raw >> 8u, raw}};
+	trace.rx[q->head & (TRACE_RX_LEN-1u)] = now();
+	(void)fqPush(q, &frame);
+	_delay(ISR_CYCLES);
+	ss->due += ss->period;
+}
+
+// Simulate, tracing signal traced, and copy its times to out.
+// The analog signal is damped by shift, 0 for off.
+static void
+simulate(U8 rate, U8 traced, U8 shift, TraceStage out[TRACE_NSTAGE]) {
+	static FrameQ q;
+	static Sched sched;
+	static Damp damp;
+	SimSig tach, an;
+	CanFrame frame;
+	TachTiming tt;
+	Table tab;
+	U32 end, tick, tmr1Next, tmr1Pending;
+	bool tmr1On;
+	U16 val;
+	I32 raw;
+	U8 sig, k, dampDiv;
+
+	mockReset();
+	eepromInit();
+	tab = (Table){.offset = 0u, .hdr = 6u*TAB_SIZE + 48u};
+	TEST_ASSERT_EQUAL(OK, tabInit(&tab));
+	for (k = 0u; k < TAB_ROWS; k++) { // 0..8000rpm, 250rpm per row
+		TEST_ASSERT_EQUAL(OK, tabWrite(&tab, k, 250ul*8ul*k, 250u*k));
+	}
+	TEST_ASSERT_EQUAL(OK, eepromFlush());
+
+	fqInit(&q);
+	schedInit(&sched);
+	schedSetRate(&sched, SIG_TACH, rate);
+	schedSetRate(&sched, SIG_AN, rate);
+	dampInit(&damp);
+	dampConfig(&damp, shift, DAMP_SLEW_OFF);
+	dampDiv = 0u;
+	traceInit(&trace);
+	traceSelect(&trace, traced);
+
+	tach = (SimSig){120000ul, mockClock, 800*8, 3000*8};
+	an = (SimSig){1200000ul, mockClock + 5000ul, 0, 4000*8};
+	end = mockClock + SECONDS * 12000000ul;
+	tick = mockClock + TICK_CYCLES;
+	tmr1On = false;
+	tmr1Next = tmr1Pending = 0u;
+	while ((I32)(mockClock - end) < 0) {
+		// ISR
+		deliver(&q, &tach, SIG_TACH);
+		deliver(&q, &an, SIG_AN);
+		if (tmr1On && (I32)(mockClock - tmr1Next) >= 0) {
+			if (trace.armed && trace.sig == SIG_TACH) { // TRACE_APPLY
+				trace.armed = false;
+				trace.at = now();
+				trace.applied = true;
+			}
+			tmr1Next += tmr1Pending; // TMR1 += tmr1Reload
+			_delay(TMR1_ISR_CYCLES);
+		}
+
+		// Main loop
+		if (fqPop(&q, &frame) == OK) {
+			trace.cur = trace.rx[(q.tail - 1u) & (TRACE_RX_LEN-1u)];
+			_delay(EXTRACT_CYCLES);
+			raw = (I32)((U32)frame.data[0u] << 24u | (U32)frame.data[1u] << 16u
+				| (U32)frame.data[2u] << 8u | frame.data[3u]);
+			traceExtract(&trace, frame.id.eid, trace.cur, now());
+			schedPost(&sched, frame.id.eid, raw);
+		}
+		if ((I32)(mockClock - tick) >= 0) {
+			tick += TICK_CYCLES;
+			schedTick(&sched);
+			traceCollect(&trace);
+			if (++dampDiv >= DAMP_DIV) {
+				dampDiv = 0u;
+				if (dampStep(&damp, &val)) {
+					_delay(DAC_CYCLES);
+					traceOutput(&trace, SIG_AN, now());
+				}
+			}
+		}
+		if (schedNext(&sched, &sig, &raw)) {
+			TEST_ASSERT_EQUAL(OK, tabLookup(&tab, raw, &val));
+			traceLookup(&trace, sig, now());
+			if (sig == SIG_TACH) {
+				TEST_ASSERT_EQUAL(OK, waveTach(val, &tt));
+				tmr1Pending = (U32)(U16)(WAVE_TMR1_COMP - tt.reload) * 8ul;
+				TRACE_ARM(&trace, SIG_TACH);
+				if (!tmr1On) {
+					tmr1On = true;
+					tmr1Next = mockClock + tmr1Pending;
+				}
+			} else if (dampSet(&damp, val)) {
+				_delay(DAC_CYCLES);
+				traceOutput(&trace, sig, now());
+			} else if (damp.settled) {
+				traceEnd(&trace, sig);
+			}
+		}
+		_delay(LOOP_CYCLES);
+	}
+	for (k = 0u; k < TRACE_NSTAGE; k++) {
+		out[k] = trace.stages[k];
+	}
+}
+
+static double
+us(U16 counts) {
+	return counts * (double)COUNT_CYCLES / 12.0;
+}
+
+static void
+testPipeline(void) {
+	setUp();
+
+	static const U8 rates[] = {SCHED_RATE_ASAP, SCHED_RATE_DEFAULT};
+	static const char *const stageNames[TRACE_NSTAGE] = {"extract", "lookup", "output"};
+	static const U8 sigs[3u] = {SIG_TACH, SIG_AN, SIG_AN};
+	static const U8 shifts[3u] = {0u, 0u, DAMP_SHIFT};
+	static const U16 budgets[3u] = {BUDGET_OUTPUT_TACH, BUDGET_OUTPUT_DAC, BUDGET_OUTPUT_DAMP};
+	static const char *const sigNames[3u] = {"tach", "analog", "damped"};
+	TraceStage st[TRACE_NSTAGE];
+	U8 r, k, g;
+
+	printf("\nLatency from arrival, tach at 100Hz and an analog signal at 10Hz, undamped and damped:\n");
+	printf("%6s %7s %8s %7s %10s %10s\n", "rate", "signal", "stage", "n", "max us", "mean us");
+	for (r = 0u; r < sizeof(rates); r++) {
+		for (g = 0u; g < 3u; g++) {
+			simulate(rates[r], sigs[g], shifts[g], st);
+			for (k = 0u; k < TRACE_NSTAGE; k++) {
+				printf("%6s %7s %8s %7u %10.0f %10.0f\n",
+					(rates[r] == SCHED_RATE_ASAP) ? "asap" : "50Hz", sigNames[g],
+					stageNames[k], st[k].n, us(st[k].max), us(traceMean(&st[k])));
+				TEST_ASSERT_GREATER_THAN(0u, st[k].n);
+			}
+
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(BUDGET_EXTRACT, st[TRACE_STAGE_EXTRACT].max);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(
+				(rates[r] == SCHED_RATE_ASAP) ? BUDGET_LOOKUP_ASAP : BUDGET_LOOKUP_50HZ,
+				st[TRACE_STAGE_LOOKUP].max);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(
+				st[TRACE_STAGE_LOOKUP].max + budgets[g],
+				st[TRACE_STAGE_OUTPUT].max);
+			TEST_ASSERT_LESS_OR_EQUAL_UINT32(traceMean(&st[TRACE_STAGE_OUTPUT]),
+				traceMean(&st[TRACE_STAGE_LOOKUP]));
+		}
+	}
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testStages);
+	RUN_TEST(testRestart);
+	RUN_TEST(testTimes);
+	RUN_TEST(testTimer);
+	RUN_TEST(testPipeline);
+
+	return UnityEnd();
+}
@@ -0,0 +1,128 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <can.h>
+#include <txq.h>
+
+static TxQ q;
+
+void setUp(void) {
+	txqInit(&q);
+}
+void tearDown(void) {}
+
+static CanFrame
+mkFrame(U32 eid) {
+	CanFrame frame = {
+		.id = {.isExt = true, .eid = eid},
+		.dlc = 1u,
+		.data = {eid & 0xFF},
+	};
+	return frame;
+}
+
+static U32
+popEid(void) {
+	const TxqEntry *e;
+	U32 eid;
+
+	e = txqFront(&q);
+	TEST_ASSERT_NOT_NULL(e);
+	eid = e->frame.id.eid;
+	txqPop(&q);
+	return eid;
+}
+
+static void
+testFifoWithinPriority(void) {
+	setUp();
+
+	CanFrame frame;
+	U32 k, lap;
+
+	for (lap = 0u; lap < 3u; lap++) {
+		for (k = 0u; k < TXQ_LEN; k++) {
+			frame = mkFrame(100u*lap + k);
+			TEST_ASSERT_EQUAL(OK, txqPush(&q, &frame, CAN_PRIO_MEDIUM_LOW));
+		}
+		for (k = 0u; k < TXQ_LEN; k++) {
+			TEST_ASSERT_EQUAL_UINT32(100u*lap + k, popEid());
+		}
+		TEST_ASSERT_NULL(txqFront(&q));
+	}
+	TEST_ASSERT_EQUAL_UINT16(0u, q.drops);
+	TEST_ASSERT_EQUAL_UINT8(TXQ_LEN, q.peak);
+
+	tearDown();
+}
+
+// Higher priorities overtake; equal ones keep their order.
+static void
+testPriority(void) {
+	setUp();
+
+	static const U8 prios[] = {CAN_PRIO_LOW, CAN_PRIO_HIGH, CAN_PRIO_LOW, CAN_PRIO_HIGH};
+	static const U32 order[] = {1u, 3u, 0u, 2u};
+	CanFrame frame;
+	U8 k;
+
+	for (k = 0u; k < sizeof(prios); k++) {
+		frame = mkFrame(k);
+		TEST_ASSERT_EQUAL(OK, txqPush(&q, &frame, prios[k]));
+	}
+	TEST_ASSERT_EQUAL_UINT8(CAN_PRIO_HIGH, txqFront(&q)->prio);
+	for (k = 0u; k < sizeof(prios); k++) {
+		TEST_ASSERT_EQUAL_UINT32(order[k], popEid());
+	}
+
+	// Pop on empty is harmless
+	txqPop(&q);
+	TEST_ASSERT_NULL(txqFront(&q));
+
+	tearDown();
+}
+
+// A full queue drops the new frame, whatever its priority.
+static void
+testDrops(void) {
+	setUp();
+
+	CanFrame frame;
+	U32 k;
+
+	for (k = 0u; k < TXQ_LEN; k++) {
+		frame = mkFrame(k);
+		TEST_ASSERT_EQUAL(OK, txqPush(&q, &frame, CAN_PRIO_LOW));
+	}
+	frame = mkFrame(99u);
+	TEST_ASSERT_EQUAL(FAIL, txqPush(&q, &frame, CAN_PRIO_HIGH));
+	TEST_ASSERT_EQUAL(FAIL, txqPush(&q, &frame, CAN_PRIO_LOW));
+	TEST_ASSERT_EQUAL_UINT16(2u, q.drops);
+
+	for (k = 0u; k < TXQ_LEN; k++) {
+		TEST_ASSERT_EQUAL_UINT32(k, popEid());
+	}
+
+	q.drops = 0xFFFF;
+	for (k = 0u; k <= TXQ_LEN; k++) {
+		(void)txqPush(&q, &frame, CAN_PRIO_LOW);
+	}
+	TEST_ASSERT_EQUAL_UINT16(0xFFFF, q.drops); // saturated
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testFifoWithinPriority);
+	RUN_TEST(testPriority);
+	RUN_TEST(testDrops);
+
+	return UnityEnd();
+}
@@ -0,0 +1,330 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <unity.h>
+
+#include <types.h>
+#include <wave.h>
+
+void setUp(void) {}
+void tearDown(void) {}
+
+static void
+testTachTiming(void) {
+	setUp();
+
+	TachTiming t;
+	U32 ppm, ticks, edge;
+
+	TEST_ASSERT_EQUAL(FAIL, waveTach(0u, &t));
+	TEST_ASSERT_EQUAL(FAIL, waveTach(WAVE_TACH_MIN_PULSE_PER_MIN-1u, &t));
+
+	for (ppm = WAVE_TACH_MIN_PULSE_PER_MIN; ppm <= 0xFFFF; ppm++) {
+		TEST_ASSERT_EQUAL(OK, waveTach((U16)ppm, &t));
+		TEST_ASSERT_TRUE(t.segs >= 1u && t.segs <= WAVE_TACH_MAX_SEGS);
+
+		// Fewest segments
+		TEST_ASSERT_EQUAL_UINT8((ppm >= 687u) ? 1u : (ppm >= 344u) ? 2u : 3u, t.segs);
+
+		// Edge length within a segment's rounding of 45e6/ppm ticks
+		ticks = (U16)(WAVE_TMR1_COMP - t.reload);
+		TEST_ASSERT_NOT_EQUAL(0u, ticks);
+		edge = 45000000ul / ppm;
+		TEST_ASSERT_UINT32_WITHIN(t.segs, edge, ticks*t.segs);
+	}
+
+	tearDown();
+}
+
+/* Host model of the tachometer output.
+ *
+ * Time is in instruction cycles at 12MHz; TMR1 ticks every 8 cycles.
+ * CAN frames arrive at random and keep the ISR busy while they are read
+ * from the MCP2515, delaying TMR1's interrupt.
+ *
+ * Old scheme: TMR1 was serviced after the CAN interrupt, overwritten with
+ * a fixed start value, and counted 3 overflows per edge.
+ * New scheme: TMR1 is serviced first and the reload is added to the count.
+ */
+enum {
+	ISR_ENTRY = 20u, // context save
+	ISR_RX = 600u, // read a frame from the MCP2515 and queue it
+	FRAME_PERIOD = 6000u, // mean: 2000 frames/s
+	OLD_WRITE = 12u, // cycles into the ISR before TMR1 was written
+	OLD_POST = 3u, // overflows per edge
+	NEW_STOP = 2u, // cycles into the ISR before TMR1ON is cleared
+	NEW_STOPPED = 6u, // cycles TMR1 is stopped
+	TOGGLE = 10u, // cycles into the ISR before the pin toggles
+	EDGES = 60u,
+};
+
+typedef struct {
+	U32 rng;
+	U32 arrival; // next frame
+	U32 start, end; // ISR busy reading a frame
+} Bus;
+
+static U32
+xorshift(U32 *state) {
+	*state ^= *state << 13u;
+	*state ^= *state >> 17u;
+	*state ^= *state << 5u;
+	return *state;
+}
+
+// Cycles from a TMR1 overflow at t until the ISR starts servicing it.
+// Calls must be in order of t.
+static U32
+latency(Bus *bus, U32 t, bool tmr1First) {
+	// Frames read before t
+	while (bus->arrival <= t) {
+		bus->start = (bus->arrival > bus->end) ? bus->arrival : bus->end;
+		bus->end = bus->start + ISR_ENTRY + ISR_RX;
+		bus->arrival += 1u + xorshift(&bus->rng) % (2u*FRAME_PERIOD);
+	}
+	if (t >= bus->start && t < bus->end) {
+		if (tmr1First) {
+			// Serviced after the ISR returns and re-enters,
+			// unless it was already pending on entry
+			return (t == bus->start) ? ISR_ENTRY : bus->end - t + ISR_ENTRY;
+		}
+		return bus->end - t; // next check in the same pass
+	}
+	return ISR_ENTRY;
+}
+
+typedef struct {
+	double errPct; // mean frequency error
+	double jitterUs; // largest deviation of an edge interval from the mean
+	double intsPerSec;
+	double intsPerEdge;
+} TachResult;
+
+// Edges are the times the pin toggled; ovfs are the times of the
+// overflows that caused them, which measure the frequency without the
+// ISR's latency.
+static void
+summarize(const U32 edges[EDGES], const U32 ovfs[EDGES], U32 ints, U32 ppm, TachResult *r) {
+	double ideal, mean, dev, maxDev;
+	U8 k;
+
+	ideal = 8.0 * 45e6 / ppm; // cycles per edge
+	mean = (double)(ovfs[EDGES-1u] - ovfs[0u]) / (EDGES-1u);
+	r->errPct = 100.0 * (ideal / mean - 1.0);
+
+	mean = (double)(edges[EDGES-1u] - edges[0u]) / (EDGES-1u);
+	maxDev = 0.0;
+	for (k = 1u; k < EDGES; k++) {
+		dev = (double)(edges[k] - edges[k-1u]) - mean;
+		dev = (dev < 0.0) ? -dev : dev;
+		maxDev = (dev > maxDev) ? dev : maxDev;
+	}
+	r->jitterUs = maxDev / 12.0;
+	r->intsPerSec = ints * 12e6 / (double)edges[EDGES-1u];
+	r->intsPerEdge = (double)ints / EDGES;
+}
+
+static void
+simOld(U32 ppm, TachResult *r) {
+	Bus bus = {.rng = 0x1234567u, .arrival = 100u};
+	U32 edges[EDGES], ovfs[EDGES], ovf, entry, ints;
+	U16 period;
+	U8 n, ctr;
+
+	period = (U16)(15000000ul / ppm);
+	ovf = 1000u;
+	n = ctr = 0u;
+	ints = 0u;
+	while (n < EDGES) {
+		entry = ovf + latency(&bus, ovf, false);
+		ints++;
+		if (++ctr >= OLD_POST) {
+			ctr = 0u;
+			ovfs[n] = ovf;
+			edges[n++] = entry + TOGGLE;
+		}
+		ovf = entry + OLD_WRITE + 8ul*period; // prescaler cleared
+	}
+	summarize(edges, ovfs, ints, ppm, r);
+}
+
+static void
+simNew(U32 ppm, TachResult *r) {
+	Bus bus = {.rng = 0x1234567u, .arrival = 100u};
+	U32 edges[EDGES], ovfs[EDGES], ovf, stop, ints;
+	TachTiming t;
+	U16 count;
+	U8 n, ctr;
+
+	(void)waveTach((U16)ppm, &t);
+	ovf = 1000u;
+	n = ctr = 0u;
+	ints = 0u;
+	while (n < EDGES) {
+		stop = ovf + latency(&bus, ovf, true) + NEW_STOP;
+		ints++;
+		count = (U16)((stop - ovf) / 8u) + t.reload; // partial tick lost
+		if (++ctr >= t.segs) {
+			ctr = 0u;
+			ovfs[n] = ovf;
+			edges[n++] = stop - NEW_STOP + TOGGLE;
+		}
+		ovf = stop + NEW_STOPPED + 8ul*(U16)(0u - count);
+	}
+	summarize(edges, ovfs, ints, ppm, r);
+}
+
+static void
+testTachModel(void) {
+	setUp();
+
+	static const U16 ppms[] = {229u, 300u, 500u, 687u, 1000u, 2000u, 5000u, 10000u, 20000u};
+	TachResult old, new;
+	U8 k;
+
+	printf("\nTachometer output, host model with 2000 CAN frames/s:\n");
+	printf("%7s %10s %10s %10s %10s %8s %8s\n", "pulse/", "error %", "", "jitter us", "", "ints/s", "");
+	printf("%7s %10s %10s %10s %10s %8s %8s\n", "min", "old", "new", "old", "new", "old", "new");
+	for (k = 0u; k < sizeof(ppms)/sizeof(ppms[0u]); k++) {
+		simOld(ppms[k], &old);
+		simNew(ppms[k], &new);
+		printf("%7u %10.4f %10.4f %10.1f %10.1f %8.0f %8.0f\n", ppms[k],
+			old.errPct, new.errPct, old.jitterUs, new.jitterUs,
+			old.intsPerSec, new.intsPerSec);
+
+		// Less than a tick per overflow, whatever the latency
+		TEST_ASSERT_TRUE(new.errPct < 0.05 && new.errPct > -0.05);
+		TEST_ASSERT_TRUE(-old.errPct > -10.0*new.errPct);
+		if (ppms[k] >= 687u) {
+			TEST_ASSERT_TRUE(3.0*new.intsPerEdge <= old.intsPerEdge);
+		}
+	}
+
+	tearDown();
+}
+
+/* Speedometer: frequency error of the old and new schemes.
+ *
+ * TMR2 ticks at 12MHz / (64*16*10) = 1171.875Hz.
+ * Old scheme: period = 70313/(pulse/min) ticks, halved to count ticks
+ * per edge. New scheme: phase accumulator, simulated tick by tick.
+ */
+#define SPEED_TICK_HZ 1171.875
+
+static double
+oldSpeed(U16 ppm) {
+	U16 period, perEdge;
+
+	if (ppm < 2u) {
+		return 0.0; // stopped
+	}
+	period = (U16)(70313ul / ppm);
+	perEdge = period / 2u;
+	if (perEdge == 0u) {
+		perEdge = 1u; // counter reaches 0 after one tick
+	}
+	return 60.0 * SPEED_TICK_HZ / (2.0 * perEdge);
+}
+
+// Run the accumulator for a number of ticks, as the ISR does.
+// Returns the measured pulse/min and the longest and shortest edge
+// intervals in ticks.
+static double
+newSpeed(U16 ppm, U32 ticks, U32 *maxGap, U32 *minGap) {
+	U32 inc, phase, t, last, edges, first;
+
+	inc = waveSpeed(ppm);
+	phase = 0ul;
+	edges = 0u;
+	first = last = 0u;
+	*maxGap = 0u;
+	*minGap = 0xFFFFFFFF;
+	for (t = 1u; t <= ticks; t++) {
+		phase += inc;
+		if (phase < inc) { // carry
+			if (edges == 0u) {
+				first = t;
+			} else {
+				*maxGap = (t - last > *maxGap) ? t - last : *maxGap;
+				*minGap = (t - last < *minGap) ? t - last : *minGap;
+			}
+			last = t;
+			edges++;
+		}
+	}
+	if (edges < 2u) {
+		return 0.0;
+	}
+	return 60.0 * SPEED_TICK_HZ * (edges - 1u) / (2.0 * (last - first));
+}
+
+static double
+errPct(double got, double want) {
+	double e;
+
+	e = 100.0 * (got - want) / want;
+	return (e < 0.0) ? -e : e;
+}
+
+static void
+testSpeedSweep(void) {
+	setUp();
+
+	static const U16 ppms[] = {2u, 10u, 100u, 500u, 1000u, 2000u, 4000u,
+		8000u, 12000u, 16000u, 20000u, 30000u, 35156u};
+	U32 ticks, maxGap, minGap, ppm;
+	double old, new, oldErr, newErr, oldMax, newMax, ideal;
+	U8 k;
+
+	TEST_ASSERT_EQUAL_UINT32(0ul, waveSpeed(0u));
+	TEST_ASSERT_EQUAL_UINT32(waveSpeed(WAVE_SPEED_MAX_PULSE_PER_MIN), waveSpeed(0xFFFF));
+	TEST_ASSERT_TRUE(waveSpeed(WAVE_SPEED_MAX_PULSE_PER_MIN) > waveSpeed(WAVE_SPEED_MAX_PULSE_PER_MIN-1u)); // no overflow
+	TEST_ASSERT_TRUE(waveSpeed(1u) > 0ul);
+
+	printf("\nSpeedometer frequency error, 1171.875Hz ticks:\n");
+	printf("%7s %10s %10s %10s %10s %10s\n",
+		"pulse/", "old", "old", "new", "new", "new edge");
+	printf("%7s %10s %10s %10s %10s %10s\n",
+		"min", "pulse/min", "error %", "pulse/min", "error %", "ticks");
+	for (k = 0u; k < sizeof(ppms)/sizeof(ppms[0u]); k++) {
+		// Long enough for 200 edges
+		ticks = (U32)(200.0 * 60.0 * SPEED_TICK_HZ / (2.0 * ppms[k])) + 2u;
+		old = oldSpeed(ppms[k]);
+		new = newSpeed(ppms[k], ticks, &maxGap, &minGap);
+		printf("%7u %10.1f %10.3f %10.1f %10.4f %5lu-%-4lu\n", ppms[k],
+			old, errPct(old, ppms[k]), new, errPct(new, ppms[k]),
+			(unsigned long)minGap, (unsigned long)maxGap);
+
+		// Edges land on the nearest tick: at most one tick apart
+		TEST_ASSERT_LESS_OR_EQUAL_UINT32(minGap + 1u, maxGap);
+		TEST_ASSERT_TRUE(errPct(new, ppms[k]) < 0.5);
+	}
+
+	// Whole range: the accumulator's long-run frequency, against the
+	// old scheme's
+	oldMax = newMax = 0.0;
+	for (ppm = 2u; ppm <= WAVE_SPEED_MAX_PULSE_PER_MIN; ppm++) {
+		ideal = (double)ppm;
+		oldErr = errPct(oldSpeed((U16)ppm), ideal);
+		newErr = errPct(60.0 * SPEED_TICK_HZ * waveSpeed((U16)ppm) / 8589934592.0, ideal);
+		oldMax = (oldErr > oldMax) ? oldErr : oldMax;
+		newMax = (newErr > newMax) ? newErr : newMax;
+	}
+	printf("Worst error over 2-%u pulse/min: old %.1f%%, new %.5f%%\n",
+		WAVE_SPEED_MAX_PULSE_PER_MIN, oldMax, newMax);
+	TEST_ASSERT_TRUE(newMax < 0.0001);
+
+	tearDown();
+}
+
+int
+main(void) {
+	UnityBegin(__FILE__);
+
+	RUN_TEST(testTachTiming);
+	RUN_TEST(testTachModel);
+	RUN_TEST(testSpeedSweep);
+
+	return UnityEnd();
+}
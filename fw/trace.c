@@ -0,0 +1,123 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "can.h"
+#include "frameq.h"
+
+#include "trace.h"
+
+#ifdef PROFILE
+
+static void
+clearStages(Trace *t) {
+	U8 k;
+
+	for (k = 0u; k < TRACE_NSTAGE; k++) {
+		t->stages[k].max = 0u;
+		t->stages[k].n = 0u;
+		t->stages[k].sum = 0ul;
+	}
+}
+
+// Count the traced value reaching a stage at now.
+static void
+record(Trace *t, U8 stage, U16 now) {
+	TraceStage *st;
+	U16 d;
+
+	st = &t->stages[stage];
+	d = now - t->start; // wraps with the time
+	if (d > st->max) {
+		st->max = d;
+	}
+	if (st->n < 0xFFFF) { // the mean stops with the count
+		st->n++;
+		st->sum += d;
+	}
+}
+
+void
+traceInit(Trace *t) {
+	U8 k;
+
+	t->ticks = 0u;
+	for (k = 0u; k < TRACE_RX_LEN; k++) {
+		t->rx[k] = 0u;
+	}
+	t->cur = 0u;
+	t->sig = TRACE_NONE;
+	t->start = 0u;
+	t->next = TRACE_NSTAGE;
+	t->armed = false;
+	t->applied = false;
+	t->at = 0u;
+	clearStages(t);
+}
+
+void
+traceExtract(Trace *t, U8 sig, U16 rx, U16 now) {
+	if (sig != t->sig) {
+		return;
+	}
+	t->start = rx; // replaces any value not yet looked up
+	record(t, TRACE_STAGE_EXTRACT, now);
+	t->next = TRACE_STAGE_LOOKUP;
+}
+
+void
+traceLookup(Trace *t, U8 sig, U16 now) {
+	if (sig != t->sig || t->next != TRACE_STAGE_LOOKUP) {
+		return;
+	}
+	record(t, TRACE_STAGE_LOOKUP, now);
+	t->next = TRACE_STAGE_OUTPUT;
+}
+
+void
+traceOutput(Trace *t, U8 sig, U16 now) {
+	if (sig != t->sig || t->next != TRACE_STAGE_OUTPUT) {
+		return;
+	}
+	record(t, TRACE_STAGE_OUTPUT, now);
+	t->next = TRACE_NSTAGE;
+}
+
+void
+traceEnd(Trace *t, U8 sig) {
+	if (sig == t->sig) {
+		t->next = TRACE_NSTAGE;
+	}
+}
+
+void
+traceCollect(Trace *t) {
+	if (t->applied) {
+		// The ISR doesn't touch at again until it is re-armed
+		t->applied = false;
+		traceOutput(t, t->sig, t->at);
+	}
+}
+
+void
+traceSelect(Trace *t, U8 sig) {
+	if (sig != t->sig) {
+		// Disarm before switching, so the ISR can't stamp the old
+		// signal's output as the new one's
+		t->armed = false;
+		t->applied = false;
+		t->sig = sig;
+		t->next = TRACE_NSTAGE;
+	}
+	clearStages(t);
+}
+
+U16
+traceMean(const TraceStage *s) {
+	if (s->n == 0u) {
+		return 0u;
+	}
+	return (U16)((s->sum + s->n/2u) / s->n);
+}
+
+#endif // PROFILE
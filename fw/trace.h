@@ -0,0 +1,156 @@
+/* Latency tracer: time from a signal's frame arriving to its gauge moving.
+ *
+ * Compiled in only if PROFILE is defined (make PROFILE=1), like the
+ * profiler; otherwise the TRACE_x macros expand to nothing and the Trace
+ * type doesn't exist.
+ *
+ * Each value is timed from when the ISR reads its frame out of the
+ * MCP2515 through three stages:
+ *
+ *	extract -- the main loop took the frame and extracted the value;
+ *	lookup -- the scheduler let it through and it was looked up;
+ *	output -- the gauge was given it: the DAC written, or the timer's
+ *		next overflow run with the new timing.
+ *
+ * One signal is traced at a time, chosen by traceSelect(). Per stage,
+ * the tracer keeps the longest and the mean time since arrival. Only
+ * the newest value is traced: one that replaces another in the
+ * scheduler's mailbox restarts the trace, and one that doesn't change
+ * the output (a memo hit, a repeated value) ends it at the lookup. A
+ * damped output is traced to the first step that moves it.
+ *
+ * Time is counted in TMR0 counts of 64 instruction cycles (5.3us), in
+ * 16 bits. The low 8 bits are TMR0 itself; the high 8 count its
+ * overflows, in step with the scheduler's tick. That is only exact if
+ * the main loop sees every overflow: a pass longer than 1.4ms loses 256
+ * counts per overflow missed. Times wrap at 0x10000 counts (349ms).
+ *
+ * Arrival times are kept by receive queue slot, since which signals a
+ * frame carries isn't known until the main loop dispatches it:
+ * TRACE_RX before fqPush(), TRACE_POP after fqPop().
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <xc.h>
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "can.h"
+ * #include "frameq.h"
+ * #include "trace.h"
+ */
+
+#ifdef PROFILE
+
+enum {
+	TRACE_STAGE_EXTRACT = 0,
+	TRACE_STAGE_LOOKUP,
+	TRACE_STAGE_OUTPUT,
+	TRACE_NSTAGE,
+
+	TRACE_NONE = 0xFF, // no signal traced
+	TRACE_RX_LEN = FQ_LEN,
+};
+
+typedef struct {
+	U16 max; // longest time since arrival, TMR0 counts
+	U16 n; // values timed, saturating
+	U32 sum; // of the n times
+} TraceStage;
+
+typedef struct {
+	volatile U8 ticks; // TMR0 overflows: bits 8-15 of the time
+	volatile U16 rx[TRACE_RX_LEN]; // arrival of the frame in each receive queue slot
+	U16 cur; // arrival of the frame being handled
+
+	volatile U8 sig; // signal traced, or TRACE_NONE
+	U16 start; // arrival of its value being traced
+	U8 next; // stage that value reaches next; TRACE_NSTAGE if none
+
+	// If the signal is output by a timer, its new timing takes effect at
+	// the next overflow: armed by the main loop, stamped by the ISR,
+	// collected by the main loop.
+	volatile bool armed;
+	volatile bool applied;
+	volatile U16 at; // when applied
+
+	TraceStage stages[TRACE_NSTAGE];
+} Trace;
+
+// Clear everything; trace no signal.
+void traceInit(Trace *t);
+
+// A value of a signal that arrived at rx was extracted at now.
+void traceExtract(Trace *t, U8 sig, U16 rx, U16 now);
+
+// The signal's value was looked up at now.
+void traceLookup(Trace *t, U8 sig, U16 now);
+
+// The signal's output was set at now.
+void traceOutput(Trace *t, U8 sig, U16 now);
+
+// The signal's value won't reach the output: stop tracing it.
+void traceEnd(Trace *t, U8 sig);
+
+// Record a timer output applied since the last call.
+void traceCollect(Trace *t);
+
+// Trace a signal from now on, with its times cleared. A value of it
+// already on its way stays traced.
+void traceSelect(Trace *t, U8 sig);
+
+// Mean of a stage's times in TMR0 counts, rounded.
+U16 traceMean(const TraceStage *s);
+
+// Read the time into U16 lvalue v. If TMR0 overflowed since the main
+// loop last ticked, it is read again after the overflow.
+#define TRACE_NOW(tr, v) do { \
+		(v) = TMR0; \
+		if (TMR0IF) { \
+			(v) = 0x100u | TMR0; \
+		} \
+		(v) += (U16)(tr)->ticks << 8u; \
+	} while (0)
+
+// Clear TMR0IF and count the overflow, together.
+#define TRACE_TICK(tr) do { GIE = 0; TMR0IF = 0; (tr)->ticks++; GIE = 1; } while (0)
+#define TRACE_RX(tr, slot) TRACE_NOW((tr), (tr)->rx[(slot) & (TRACE_RX_LEN-1u)])
+#define TRACE_POP(tr, slot) ((tr)->cur = (tr)->rx[(slot) & (TRACE_RX_LEN-1u)])
+#define TRACE_EXTRACT(tr, sig) do { U16 now_; TRACE_NOW((tr), now_); traceExtract((tr), (sig), (tr)->cur, now_); } while (0)
+#define TRACE_LOOKUP(tr, sig) do { U16 now_; TRACE_NOW((tr), now_); traceLookup((tr), (sig), now_); } while (0)
+#define TRACE_OUTPUT(tr, sig) do { U16 now_; TRACE_NOW((tr), now_); traceOutput((tr), (sig), now_); } while (0)
+#define TRACE_END(tr, sig) traceEnd((tr), (sig))
+// With the timer's interrupt disabled. An older output applied but not
+// yet collected is dropped: the value armed replaced it.
+#define TRACE_ARM(tr, k) do { \
+		if ((tr)->sig == (k)) { \
+			(tr)->applied = false; \
+			(tr)->armed = true; \
+		} \
+	} while (0)
+#define TRACE_APPLY(tr, k) do { \
+		if ((tr)->armed && (tr)->sig == (k)) { \
+			(tr)->armed = false; \
+			TRACE_NOW((tr), (tr)->at); \
+			(tr)->applied = true; \
+		} \
+	} while (0)
+#define TRACE_COLLECT(tr) traceCollect(tr)
+
+#else
+
+#define TRACE_TICK(tr) (TMR0IF = 0)
+#define TRACE_RX(tr, slot)
+#define TRACE_POP(tr, slot)
+#define TRACE_EXTRACT(tr, sig)
+#define TRACE_LOOKUP(tr, sig)
+#define TRACE_OUTPUT(tr, sig)
+#define TRACE_END(tr, sig)
+#define TRACE_ARM(tr, k)
+#define TRACE_APPLY(tr, k)
+#define TRACE_COLLECT(tr)
+
+#endif // PROFILE
@@ -0,0 +1,56 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+#include "can.h"
+
+#include "txq.h"
+
+void
+txqInit(TxQ *q) {
+	q->len = 0u;
+	q->peak = 0u;
+	q->drops = 0u;
+}
+
+Status
+txqPush(TxQ *q, const CanFrame *frame, U8 prio) {
+	U8 k;
+
+	if (q->len >= TXQ_LEN) {
+		if (q->drops < 0xFFFF) { // saturate
+			q->drops++;
+		}
+		return FAIL;
+	}
+
+	// Make room behind the last entry of the same or higher priority
+	for (k = q->len; k > 0u && q->entries[k-1u].prio < prio; k--) {
+		q->entries[k] = q->entries[k-1u];
+	}
+	q->entries[k].frame = *frame;
+	q->entries[k].prio = prio;
+
+	if (++q->len > q->peak) {
+		q->peak = q->len;
+	}
+	return OK;
+}
+
+const TxqEntry *
+txqFront(const TxQ *q) {
+	return (q->len > 0u) ? &q->entries[0u] : 0;
+}
+
+void
+txqPop(TxQ *q) {
+	U8 k;
+
+	if (q->len == 0u) {
+		return;
+	}
+	q->len--;
+	for (k = 0u; k < q->len; k++) {
+		q->entries[k] = q->entries[k+1u];
+	}
+}
@@ -0,0 +1,47 @@
+/* Priority queue of CAN frames waiting for a transmit buffer.
+ *
+ * Frames are kept in the order they will be sent: highest priority
+ * first, and in order of arrival within a priority.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "can.h"
+ * #include "txq.h"
+ */
+
+enum {
+	TXQ_LEN = 4, // capacity
+};
+
+typedef struct {
+	CanFrame frame;
+	U8 prio; // 0 (lowest) to 3
+} TxqEntry;
+
+typedef struct {
+	TxqEntry entries[TXQ_LEN]; // in order of transmission
+	U8 len;
+
+	// Statistics
+	U8 peak; // maximum number of frames held at once
+	U16 drops; // frames dropped because the queue was full
+} TxQ;
+
+// Empty the queue and clear its statistics.
+void txqInit(TxQ *q);
+
+// Insert a copy of a frame behind those of the same or higher priority.
+// Returns FAIL, and counts a drop, if the queue is full.
+Status txqPush(TxQ *q, const CanFrame *frame, U8 prio);
+
+// The entry to send next, or 0 if the queue is empty.
+const TxqEntry *txqFront(const TxQ *q);
+
+// Remove the entry returned by txqFront().
+void txqPop(TxQ *q);
@@ -0,0 +1,37 @@
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "types.h"
+
+#include "wave.h"
+
+Status
+waveTach(U16 pulsePerMin, TachTiming *t) {
+	U16 d, ticks;
+	U8 segs;
+
+	if (pulsePerMin < WAVE_TACH_MIN_PULSE_PER_MIN) {
+		return FAIL;
+	}
+
+	// Fewest segments that each fit in 16 bits
+	for (segs = 1u; segs < WAVE_TACH_MAX_SEGS; segs++) {
+		if (((U32)pulsePerMin*segs << 16u) > WAVE_TACH_FACTOR) {
+			break;
+		}
+	}
+	d = pulsePerMin * segs; // segs > 1 only below 687 pulse/min
+	ticks = (U16)(WAVE_TACH_FACTOR / d); // d changes every call: divide directly
+
+	t->reload = (U16)(0u - ticks) + WAVE_TMR1_COMP;
+	t->segs = segs;
+	return OK;
+}
+
+U32
+waveSpeed(U16 pulsePerMin) {
+	if (pulsePerMin > WAVE_SPEED_MAX_PULSE_PER_MIN) {
+		pulsePerMin = WAVE_SPEED_MAX_PULSE_PER_MIN;
+	}
+	return WAVE_SPEED_FACTOR * pulsePerMin;
+}
@@ -0,0 +1,63 @@
+/* Timing of the pulse trains sent to the tachometer and speedometer.
+ *
+ * Tachometer -- TMR1, Fosc/4 with a 1:8 prescaler: 1.5MHz ticks.
+ * Each edge of the output (half a pulse) is split into the fewest
+ * equal segments that each fit in TMR1's 16 bits: one segment at
+ * 687 pulse/min and above, at most three down to 229 pulse/min.
+ * TMR1 interrupts once per segment.
+ *
+ * The ISR adds the reload value to TMR1 rather than overwriting it, so
+ * the time spent reaching the ISR does not stretch the period. Only the
+ * ticks lost while TMR1 is stopped for the update are compensated.
+ * TMR1 is stopped when the output is.
+ *
+ * Speedometer -- TMR2, 12MHz / (64*16*10): 1171.875Hz ticks.
+ * A 32-bit phase accumulator advances by a fixed increment each tick and
+ * the output toggles when it carries, so each edge falls on the tick
+ * nearest its ideal time and the average frequency is exact to about
+ * 3e-7. The increment is 2^32 * (edges/tick). TMR2 is stopped when the
+ * output is.
+ *
+ * Device: PIC16F1459
+ * Compiler: XC8 v3.00
+ *
+ * Usage:
+ *
+ * #include <stdbool.h>
+ * #include <stdint.h>
+ * #include "types.h"
+ * #include "wave.h"
+ */
+
+// (ticks/edge) = 60 * (Fosc/4) / (pre) / (edges/pulse) / (pulse/min)
+//  = 60 * (48e6/4) / 8 / 2 / (pulse/min)
+//  = 45000000 / (pulse/min)
+#define WAVE_TACH_FACTOR 45000000ul
+
+// (increment) = 2^32 * (edges/pulse) * (pulse/min) / 60 / (ticks/s)
+//  = 2^32 * 2 / 60 / 1171.875 * (pulse/min)
+//  = 122167.96 * (pulse/min)
+#define WAVE_SPEED_FACTOR 122168ul
+
+#define WAVE_TACH_MIN_PULSE_PER_MIN 229u // 3 segments of 2^16 ticks per edge
+#define WAVE_TACH_MAX_SEGS 3u
+
+// TMR1 ticks lost per update: the ISR stops TMR1 for a few cycles, and
+// writing TMR1 clears the prescaler.
+#define WAVE_TMR1_COMP 1u
+
+typedef struct {
+	U16 reload; // added to TMR1 at each overflow
+	U8 segs; // TMR1 overflows per edge
+} TachTiming;
+
+// Compute TMR1's timing for a tachometer frequency.
+// Returns FAIL below WAVE_TACH_MIN_PULSE_PER_MIN.
+Status waveTach(U16 pulsePerMin, TachTiming *t);
+
+// Speedometer frequencies above this are clamped to it: one edge per tick.
+#define WAVE_SPEED_MAX_PULSE_PER_MIN 35156u
+
+// Compute TMR2's phase increment for a speedometer frequency.
+// Returns 0, meaning stopped, if the frequency is 0.
+U32 waveSpeed(U16 pulsePerMin);
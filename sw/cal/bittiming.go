@@ -0,0 +1,177 @@
+package main
+
+import (
+	"context"
+	"fmt"
+	"math"
+
+	"go.einride.tech/can"
+
+	"git.samanthony.xyz/can_gauge_interface/sw/cal/canbus"
+)
+
+// MCP2515 bit timing, as calculated by sw/bittiming/bittiming.py.
+const (
+	bitTimingCtrlId uint32 = 0x1272300
+
+	fosc = 12_000_000 // MCP2515 clock (Hz)
+
+	maxBrp = 1 << 6
+
+	minTqPerBit = 8
+	maxTqPerBit = 25
+
+	minPropSeg = 1
+	maxPropSeg = 8
+
+	minPs1 = 1
+	maxPs1 = 8
+
+	minPs2 = 2
+	maxPs2 = 8
+
+	maxSjw = 4
+
+	cnf2Btlmode = 1 << 7
+
+	sync = 1 // Tq
+)
+
+type BitTiming struct {
+	bitrate        int // bps
+	brp            int // prescaler
+	prop, ps1, ps2 int // Tq
+}
+
+// Find the bit timing for a bitrate whose sample point is closest to
+// the given one (%), using as many time quanta per bit as possible.
+func NewBitTiming(bitrate int, samplePoint float64) (BitTiming, error) {
+	var best BitTiming
+	found := false
+	for tqPerBit := maxTqPerBit; tqPerBit >= minTqPerBit; tqPerBit-- {
+		if fosc%(2*bitrate*tqPerBit) != 0 {
+			continue // no integer prescaler
+		}
+		brp := fosc / (2 * bitrate * tqPerBit)
+		if brp > maxBrp {
+			continue
+		}
+
+		propPlusPs1 := samplePoint/100.0*float64(tqPerBit) - sync
+		prop := int(math.Floor(propPlusPs1 / 2))
+		ps1 := int(math.Ceil(propPlusPs1 / 2))
+		bt := BitTiming{bitrate, brp, prop, ps1, tqPerBit - sync - prop - ps1}
+		if !bt.isValid() {
+			continue
+		}
+		if !found || math.Abs(bt.SamplePoint()-samplePoint) < math.Abs(best.SamplePoint()-samplePoint) {
+			best = bt
+			found = true
+		}
+	}
+	if !found {
+		return BitTiming{}, fmt.Errorf("no bit timing for %d bps with a %.1f%% sample point", bitrate, samplePoint)
+	}
+	return best, nil
+}
+
+func (bt BitTiming) isValid() bool {
+	return bt.prop >= minPropSeg && bt.prop <= maxPropSeg &&
+		bt.ps1 >= minPs1 && bt.ps1 <= maxPs1 &&
+		bt.ps2 >= minPs2 && bt.ps2 <= maxPs2 &&
+		bt.prop+bt.ps1 >= bt.ps2
+}
+
+func (bt BitTiming) TqPerBit() int {
+	return sync + bt.prop + bt.ps1 + bt.ps2
+}
+
+// Sample point (%)
+func (bt BitTiming) SamplePoint() float64 {
+	return float64(sync+bt.prop+bt.ps1) / float64(bt.TqPerBit()) * 100.0
+}
+
+func (bt BitTiming) maxSjw() int {
+	return min(maxSjw, bt.ps1, bt.ps2)
+}
+
+func (bt BitTiming) Cnf() [3]uint8 {
+	return [3]uint8{
+		uint8(((bt.maxSjw()-1)&0x3)<<6 | (bt.brp-1)&0x3F),
+		uint8(cnf2Btlmode | ((bt.ps1-1)&0x7)<<3 | (bt.prop-1)&0x7),
+		uint8((bt.ps2 - 1) & 0x7),
+	}
+}
+
+func (bt BitTiming) String() string {
+	cnf := bt.Cnf()
+	return fmt.Sprintf("bitrate=%dbps, Tq/bit=%d, BRP=%d, prop=%d, PS1=%d, PS2=%d, SP=%.1f%%, SJW=%d, (CNF1, CNF2, CNF3)=(0x%02X, 0x%02X, 0x%02X)",
+		bt.bitrate, bt.TqPerBit(), bt.brp, bt.prop, bt.ps1, bt.ps2, bt.SamplePoint(), bt.maxSjw(), cnf[0], cnf[1], cnf[2])
+}
+
+// Transmit the bit timing in a Bit Timing Control frame.
+// The Interface stores it in its EEPROM, and acknowledges it at the old
+// bitrate before switching to the new one, so there is no reading back.
+func (bt BitTiming) Send(bus canbus.Bus) error {
+	frame, err := bt.MarshalFrame()
+	if err != nil {
+		return err
+	}
+	ctx, cancel := context.WithTimeout(context.Background(), timeout)
+	defer cancel()
+	if err := bus.Send(ctx, frame); err != nil {
+		return err
+	}
+
+	// One deadline for the reply, however many other frames come first
+	replyCtx, replyCancel := context.WithTimeout(context.Background(), timeout)
+	defer replyCancel()
+	for {
+		replyFrame, err := bus.Receive(replyCtx)
+		if err != nil {
+			return err
+		}
+		var reply BitTimingReply
+		if err := reply.UnmarshalFrame(replyFrame); err == errWrongId {
+			continue
+		} else if err != nil {
+			return err
+		}
+		if reply.cnf != bt.Cnf() {
+			return errVerifyFail
+		}
+		return nil
+	}
+}
+
+func (bt BitTiming) MarshalFrame() (can.Frame, error) {
+	var data [8]byte
+	cnf := bt.Cnf()
+	copy(data[:], cnf[:])
+	return can.Frame{
+		ID:         bitTimingCtrlId,
+		Length:     3,
+		Data:       data,
+		IsExtended: true,
+	}, nil
+}
+
+// BitTimingReply is a Bit Timing Control DATA frame from the Interface.
+type BitTimingReply struct {
+	cnf    [3]uint8
+	found  bool
+	waitMs uint16 // time waited between polls: less than the time taken
+}
+
+func (r *BitTimingReply) UnmarshalFrame(frame can.Frame) error {
+	if !frame.IsExtended || frame.IsRemote || frame.ID != bitTimingCtrlId {
+		return errWrongId
+	}
+	if frame.Length != 6 {
+		return fmt.Errorf("wrong DLC for Bit Timing Control frame: %d", frame.Length)
+	}
+	copy(r.cnf[:], frame.Data[0:3])
+	r.found = frame.Data[3] != 0
+	r.waitMs = uint16(frame.Data[4])<<8 | uint16(frame.Data[5])
+	return nil
+}
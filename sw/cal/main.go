@@ -24,6 +24,13 @@ var (
 	// SocketCAN device
 	canDev = flag.String("can", "can0", "SocketCAN device")
 
+	// Bit timing
+	bitrate     = flag.Int("bitrate", 0, "set the Interface's bitrate (bps)")
+	samplePoint = flag.Float64("samplepoint", 75, "sample point of -bitrate (%)")
+
+	// Analog table units
+	dacCodes = flag.Bool("daccodes", false, "store analog tables as DAC codes instead of millivolts")
+
 	// Signal names
 	tachSig  = flag.String("tachsig", "", "tachometer signal name")
 	speedSig = flag.String("speedsig", "", "speedometer signal name")
@@ -45,12 +52,24 @@ var (
 	an2Tbl       = flag.String(an2TblFlag, "", "analog channel 2 calibration CSV file")
 	an3Tbl       = flag.String(an3TblFlag, "", "analog channel 3 calibration CSV file")
 	an4Tbl       = flag.String(an4TblFlag, "", "analog channel 4 calibration CSV file")
+
+	// Update rates
+	tachRate  = flag.Int("tachrate", -1, "tachometer updates per second (1-254, 0=every value, 255=default)")
+	speedRate = flag.Int("speedrate", -1, "speedometer updates per second")
+	an1Rate   = flag.Int("an1rate", -1, "analog channel 1 updates per second")
+	an2Rate   = flag.Int("an2rate", -1, "analog channel 2 updates per second")
+	an3Rate   = flag.Int("an3rate", -1, "analog channel 3 updates per second")
+	an4Rate   = flag.Int("an4rate", -1, "analog channel 4 updates per second")
 )
 
 func main() {
 	// Parse command line args
 	flag.Parse()
-	if *dbcFilename == "" {
+	rates, err := parseRates(*tachRate, *speedRate, *an1Rate, *an2Rate, *an3Rate, *an4Rate)
+	if err != nil {
+		eprintf("%v\n", err)
+	}
+	if *dbcFilename == "" && *bitrate == 0 && len(rates) == 0 {
 		weprintf("Missing flag: -%s\n", dbcFilenameFlag)
 		flag.Usage()
 		os.Exit(1)
@@ -60,6 +79,15 @@ func main() {
 	}
 	sigNames := nonEmpty(*tachSig, *speedSig, *an1Sig, *an2Sig, *an3Sig, *an4Sig)
 	tblFilenames := nonEmpty(*tachTbl, *speedTbl, *an1Tbl, *an2Tbl, *an3Tbl, *an4Tbl)
+	var bt BitTiming
+	if *bitrate < 0 {
+		eprintf("Invalid bitrate: %d\n", *bitrate)
+	} else if *bitrate > 0 {
+		var err error
+		if bt, err = NewBitTiming(*bitrate, *samplePoint); err != nil {
+			eprintf("%v\n", err)
+		}
+	}
 
 	// Open CAN connection
 	fmt.Println("Opening connection to", *canDev)
@@ -69,14 +97,34 @@ func main() {
 	}
 	defer bus.Close()
 
-	// Parse DBC file and transmit encoding of each signal
-	if err := sendEncodings(*dbcFilename, sigNames, bus); err != nil {
-		eprintf("%v\n", err)
+	if *dbcFilename != "" {
+		// Parse DBC file and transmit encoding of each signal
+		if err := sendEncodings(*dbcFilename, sigNames, bus); err != nil {
+			eprintf("%v\n", err)
+		}
+
+		// Parse tables and transmit them
+		if err := sendTables(tblFilenames, bus); err != nil {
+			eprintf("%v\n", err)
+		}
 	}
 
-	// Parse tables and transmit them
-	if err := sendTables(tblFilenames, bus); err != nil {
-		eprintf("%v\n", err)
+	// Transmit update rates
+	for _, rate := range rates {
+		fmt.Println("Sending update rate", rate)
+		if err := rate.Send(bus); err != nil {
+			eprintf("%v\n", err)
+		}
+		fmt.Printf("Update rate %d OK\n", rate.sigIndex)
+	}
+
+	// Last: the Interface stops listening at the current bitrate
+	if *bitrate > 0 {
+		fmt.Println("Sending bit timing", bt)
+		if err := bt.Send(bus); err != nil {
+			eprintf("%v\n", err)
+		}
+		fmt.Printf("Bit timing OK: the Interface is now at %d bps\n", *bitrate)
 	}
 }
 
@@ -95,6 +143,26 @@ func nonEmpty(ss ...string) map[uint8]string {
 	return m
 }
 
+// Return the update rates given, indexed by signal, skipping the negative ones.
+func parseRates(rates ...int) ([]Rate, error) {
+	var rs []Rate
+	for i, rate := range rates {
+		if rate < 0 {
+			continue // not given
+		}
+		if rate > math.MaxUint8 {
+			return nil, fmt.Errorf("Invalid update rate: %d", rate)
+		}
+		rs = append(rs, Rate{uint8(i), uint8(rate)})
+	}
+	return rs, nil
+}
+
+// Report whether a signal drives one of the analog channels.
+func isAnalog(sigIndex uint8) bool {
+	return sigIndex >= an1Index
+}
+
 // Check that the user provided a corresponding table for each signal they gave.
 func checkTablesProvided() error {
 	signals := []string{*tachSig, *speedSig, *an1Sig, *an2Sig, *an3Sig, *an4Sig}
@@ -120,6 +188,7 @@ func sendEncodings(dbcFilename string, sigNames map[uint8]string, bus canbus.Bus
 
 	// Transmit Signal Control frames
 	for _, sig := range sigs {
+		sig.isDacCode = *dacCodes && isAnalog(sig.index)
 		fmt.Println("Sending signal encoding", sig)
 		if err := sig.SendEncoding(bus); err != nil {
 			return err
@@ -138,6 +207,9 @@ func sendTables(tblFilenames map[uint8]string, bus canbus.Bus) error {
 		if err != nil {
 			return err
 		}
+		if *dacCodes && isAnalog(k) {
+			tbl.ToDacCodes()
+		}
 
 		fmt.Printf("Sending table %d\n", k)
 		if err := tbl.Send(bus); err != nil {
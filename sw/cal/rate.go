@@ -0,0 +1,84 @@
+package main
+
+import (
+	"fmt"
+
+	"go.einride.tech/can"
+
+	"git.samanthony.xyz/can_gauge_interface/sw/cal/canbus"
+)
+
+const (
+	rateCtrlId uint32 = 0x1272400
+
+	RateAsap    = 0   // update with every value
+	RateDefault = 255 // 50Hz
+)
+
+// Rate is the most updates per second of one signal's gauge.
+type Rate struct {
+	sigIndex uint8
+	rate     uint8
+}
+
+// Transmit a signal's update rate in a Rate Control frame
+// so the Interface can store it in its EEPROM.
+func (r Rate) Send(bus canbus.Bus) error {
+	req := RateControlRequest{r.sigIndex}
+	reply := &Rate{}
+	isReply := func(reply *Rate) bool { return reply.sigIndex == r.sigIndex }
+	return sendCtrlFrame(r, req, reply, bus, isReply, verifyRateCtrlReply)
+}
+
+// Verify that the response to a Rate Control REMOTE REQUEST
+// is the same as what was commanded to be written.
+func verifyRateCtrlReply(cmd Rate, reply *Rate) bool {
+	return *reply == cmd
+}
+
+func (r Rate) MarshalFrame() (can.Frame, error) {
+	var data [8]byte
+	data[0] = r.rate
+	return can.Frame{
+		ID:         rateCtrlId | uint32(r.sigIndex&0xF),
+		Length:     1,
+		Data:       data,
+		IsExtended: true,
+	}, nil
+}
+
+func (r *Rate) UnmarshalFrame(frame can.Frame) error {
+	if !frame.IsExtended || frame.IsRemote || frame.ID&^0xF != rateCtrlId {
+		return errWrongId
+	}
+	if frame.Length != 1 {
+		return fmt.Errorf("wrong DLC for Rate Control frame: %d", frame.Length)
+	}
+	r.sigIndex = uint8(frame.ID & 0xF)
+	r.rate = frame.Data[0]
+	return nil
+}
+
+func (r Rate) String() string {
+	switch r.rate {
+	case RateAsap:
+		return fmt.Sprintf("signal %d: every value", r.sigIndex)
+	case RateDefault:
+		return fmt.Sprintf("signal %d: default", r.sigIndex)
+	default:
+		return fmt.Sprintf("signal %d: %dHz", r.sigIndex, r.rate)
+	}
+}
+
+// RateControlRequest is a Rate Control REMOTE REQUEST frame.
+type RateControlRequest struct {
+	sigIndex uint8
+}
+
+func (r RateControlRequest) MarshalFrame() (can.Frame, error) {
+	return can.Frame{
+		ID:         rateCtrlId | uint32(r.sigIndex&0xF),
+		IsRemote:   true,
+		IsExtended: true,
+	}, nil
+}
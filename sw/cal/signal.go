@@ -26,6 +26,7 @@ type SignalDef struct {
 	start, size uint8
 	isBigEndian bool
 	isSigned    bool
+	isDacCode   bool // table values are DAC codes, not millivolts
 }
 
 func NewSignalDef(index uint8, msg *dbc.MessageDef, sig dbc.SignalDef) (SignalDef, error) {
@@ -81,6 +82,9 @@ func (sig SignalDef) MarshalFrame() (can.Frame, error) {
 	if sig.isSigned {
 		data[6] |= 0x40
 	}
+	if sig.isDacCode {
+		data[6] |= 0x20
+	}
 	return can.Frame{
 		ID:         sigCtrlId | uint32(sig.index&0xF),
 		Length:     7,
@@ -107,6 +111,7 @@ func (sig *SignalDef) UnmarshalFrame(frame can.Frame) error {
 	sig.size = frame.Data[5]
 	sig.isBigEndian = frame.Data[6]&0x80 == 0
 	sig.isSigned = frame.Data[6]&0x40 != 0
+	sig.isDacCode = frame.Data[6]&0x20 != 0
 	return nil
 }
 
@@ -6,6 +6,8 @@ import (
 	"encoding/csv"
 	"fmt"
 	"io"
+	"math"
+	"math/bits"
 	"os"
 	"slices"
 	"strconv"
@@ -19,7 +21,21 @@ const (
 	tblCtrlId   uint32 = 0x1272000
 	tblCtrlMask uint32 = 0x1FFFF00
 
+	gridCtrlId   uint32 = 0x1272200
+	gridCtrlMask uint32 = 0x1FFFF00
+
 	maxTabRows = 32
+
+	// A table with evenly spaced keys is sent as a grid of values.
+	maxGridLen       = 124 // 31 blocks: block 0x1F is the header
+	gridValsPerFrame = 4
+	gridHdrBlock     = 0x1F
+
+	// MCP4912 DAC
+	vrefMv     = 5000
+	maxDacCode = 1<<10 - 1
+
+	an1Index = 2 // signals from here on are analog channels
 )
 
 type Table struct {
@@ -45,6 +61,10 @@ func parseTable(filename string, sigIndex uint8) (Table, error) {
 	for {
 		err := parseRow(rdr, &tbl)
 		if err == io.EOF {
+			if _, ok := tbl.Grid(); !ok && len(tbl.rows) > maxTabRows {
+				return Table{}, fmt.Errorf("%s: too many rows for uneven keys: %d > %d",
+					filename, len(tbl.rows), maxTabRows)
+			}
 			return tbl, nil
 		} else if err != nil {
 			return Table{}, fmt.Errorf("%s:%v", filename, err)
@@ -52,6 +72,19 @@ func parseTable(filename string, sigIndex uint8) (Table, error) {
 	}
 }
 
+// Convert the table's values from millivolts to the codes output by the
+// Interface's DACs, so it doesn't have to.
+func (tbl *Table) ToDacCodes() {
+	for i := range tbl.rows {
+		tbl.rows[i].val = dacCode(tbl.rows[i].val)
+	}
+}
+
+// Same conversion as the Interface's firmware.
+func dacCode(mv uint16) uint16 {
+	return uint16(min(uint32(mv)<<10/vrefMv, maxDacCode))
+}
+
 func parseRow(rdr *csv.Reader, tbl *Table) error {
 	row, err := rdr.Read()
 	if err != nil {
@@ -79,7 +112,7 @@ func parseRow(rdr *csv.Reader, tbl *Table) error {
 }
 
 func (tbl *Table) Insert(key int32, val uint16) error {
-	if len(tbl.rows) >= maxTabRows {
+	if len(tbl.rows) >= maxGridLen {
 		return fmt.Errorf("too many rows")
 	}
 
@@ -96,8 +129,35 @@ func cmpRowKey(row Row, key int32) int {
 	return cmp.Compare(row.key, key)
 }
 
-// Transmit a table in Table Control frames so the Interface can store it in its EEPROM.
+// Grid returns the table as a grid if its keys are evenly spaced
+// by a power of two.
+func (tbl Table) Grid() (Grid, bool) {
+	if len(tbl.rows) < 2 {
+		return Grid{}, false
+	}
+	step := int64(tbl.rows[1].key) - int64(tbl.rows[0].key)
+	if step <= 0 || step > math.MaxUint32 || step&(step-1) != 0 {
+		return Grid{}, false
+	}
+	vals := make([]uint16, len(tbl.rows))
+	for i, row := range tbl.rows {
+		if i > 0 && int64(row.key)-int64(tbl.rows[i-1].key) != step {
+			return Grid{}, false
+		}
+		vals[i] = row.val
+	}
+	shift := uint8(bits.TrailingZeros64(uint64(step)))
+	return Grid{tbl.sigIndex, tbl.rows[0].key, shift, vals}, true
+}
+
+// Transmit a table so the Interface can store it in its EEPROM.
+// Tables with evenly spaced keys are sent in Grid Control frames,
+// others in Table Control frames.
 func (tbl Table) Send(bus canbus.Bus) error {
+	if grid, ok := tbl.Grid(); ok {
+		return grid.Send(bus)
+	}
+
 	// Send populated rows
 	var i int
 	for i = 0; i < len(tbl.rows); i++ {
@@ -180,3 +240,134 @@ func (r TableControlRequest) MarshalFrame() (can.Frame, error) {
 		IsExtended: true,
 	}, nil
 }
+
+// Grid is a table whose keys are start, start + 2^shift, ...
+type Grid struct {
+	sigIndex uint8
+	start    int32
+	shift    uint8
+	vals     []uint16
+}
+
+// GridHeader is the Grid Control frame that describes a grid's keys.
+type GridHeader struct {
+	sigIndex uint8
+	start    int32
+	shift    uint8
+	len      uint8
+}
+
+// GridBlock is a Grid Control frame containing consecutive values of a grid.
+type GridBlock struct {
+	sigIndex, blockIndex uint8
+	vals                 [gridValsPerFrame]uint16
+}
+
+// Transmit a grid in Grid Control frames so the Interface can store it in its EEPROM.
+// The values are sent first; the header switches the table to the grid.
+func (grid Grid) Send(bus canbus.Bus) error {
+	for i := 0; i < len(grid.vals); i += gridValsPerFrame {
+		blk := GridBlock{sigIndex: grid.sigIndex, blockIndex: uint8(i / gridValsPerFrame)}
+		for j := range blk.vals {
+			// Fill rest of last block with last value
+			blk.vals[j] = grid.vals[min(i+j, len(grid.vals)-1)]
+		}
+		if err := blk.Send(bus); err != nil {
+			return err
+		}
+	}
+	hdr := GridHeader{grid.sigIndex, grid.start, grid.shift, uint8(len(grid.vals))}
+	return hdr.Send(bus)
+}
+
+// Transmit a Grid Control frame containing a grid's header.
+func (hdr GridHeader) Send(bus canbus.Bus) error {
+	req := GridControlRequest{hdr.sigIndex, gridHdrBlock}
+	reply := &GridHeader{}
+	isReply := func(reply *GridHeader) bool { return reply.sigIndex == hdr.sigIndex }
+	verify := func(cmd GridHeader, reply *GridHeader) bool { return *reply == cmd }
+	return sendCtrlFrame(hdr, req, reply, bus, isReply, verify)
+}
+
+func (hdr GridHeader) MarshalFrame() (can.Frame, error) {
+	var data [8]byte
+	if _, err := bin.Encode(data[0:4], bin.BigEndian, hdr.start); err != nil {
+		return can.Frame{}, err
+	}
+	data[4] = hdr.shift
+	data[5] = hdr.len
+	return can.Frame{
+		ID:         gridCtrlId | uint32((hdr.sigIndex<<5)&0xE0) | gridHdrBlock,
+		Length:     6,
+		Data:       data,
+		IsExtended: true,
+	}, nil
+}
+
+func (hdr *GridHeader) UnmarshalFrame(frame can.Frame) error {
+	if !frame.IsExtended || frame.ID&gridCtrlMask != gridCtrlId || frame.ID&0x1F != gridHdrBlock {
+		return errWrongId
+	}
+	if frame.Length != 6 {
+		return fmt.Errorf("wrong DLC for Grid Control header: %d", frame.Length)
+	}
+	hdr.sigIndex = uint8((frame.ID & 0xE0) >> 5)
+	if _, err := bin.Decode(frame.Data[0:4], bin.BigEndian, &hdr.start); err != nil {
+		return err
+	}
+	hdr.shift = frame.Data[4]
+	hdr.len = frame.Data[5]
+	return nil
+}
+
+// Transmit a Grid Control frame containing a block of a grid's values.
+func (blk GridBlock) Send(bus canbus.Bus) error {
+	req := GridControlRequest{blk.sigIndex, blk.blockIndex}
+	reply := &GridBlock{}
+	isReply := func(reply *GridBlock) bool {
+		return reply.sigIndex == blk.sigIndex && reply.blockIndex == blk.blockIndex
+	}
+	verify := func(cmd GridBlock, reply *GridBlock) bool { return *reply == cmd }
+	return sendCtrlFrame(blk, req, reply, bus, isReply, verify)
+}
+
+func (blk GridBlock) MarshalFrame() (can.Frame, error) {
+	var data [8]byte
+	for i, val := range blk.vals {
+		bin.BigEndian.PutUint16(data[2*i:], val)
+	}
+	return can.Frame{
+		ID:         gridCtrlId | uint32((blk.sigIndex<<5)&0xE0) | uint32(blk.blockIndex&0x1F),
+		Length:     2 * gridValsPerFrame,
+		Data:       data,
+		IsExtended: true,
+	}, nil
+}
+
+func (blk *GridBlock) UnmarshalFrame(frame can.Frame) error {
+	if !frame.IsExtended || frame.ID&gridCtrlMask != gridCtrlId || frame.ID&0x1F == gridHdrBlock {
+		return errWrongId
+	}
+	if frame.Length != 2*gridValsPerFrame {
+		return fmt.Errorf("wrong DLC for Grid Control frame: %d", frame.Length)
+	}
+	blk.sigIndex = uint8((frame.ID & 0xE0) >> 5)
+	blk.blockIndex = uint8(frame.ID & 0x1F)
+	for i := range blk.vals {
+		blk.vals[i] = bin.BigEndian.Uint16(frame.Data[2*i:])
+	}
+	return nil
+}
+
+// GridControlRequest is a Grid Control REMOTE REQUEST frame.
+type GridControlRequest struct {
+	sigIndex, blockIndex uint8
+}
+
+func (r GridControlRequest) MarshalFrame() (can.Frame, error) {
+	return can.Frame{
+		ID:         gridCtrlId | uint32((r.sigIndex<<5)&0xE0) | uint32(r.blockIndex&0x1F),
+		IsRemote:   true,
+		IsExtended: true,
+	}, nil
+}